@@ -4,7 +4,10 @@
 #include <cstdlib>
 #include <fstream>
 #include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
 #include <argos3/core/utility/logging/argos_log.h>
+#include <argos3/core/utility/string_utilities.h>
 
 /****************************************/
 /****************************************/
@@ -23,12 +26,22 @@ public:
    }
 } __cBuzzControllerMutexInitializer;
 
+/*
+ * Names of the outgoing message types, and of the groups they belong to.
+ */
+static const char* MSG_TYPE_NAMES[BUZZMSG_TYPE_COUNT] = {
+   "broadcast", "swarm_list", "vstig_put", "vstig_query", "swarm_join", "swarm_leave"
+};
+static const char* MSG_GROUP_NAMES[BUZZMSG_TYPE_COUNT] = {
+   "broadcast", "swarm",      "vstig",     "vstig",       "swarm",      "swarm"
+};
+
 /****************************************/
 /****************************************/
 
 int BuzzLOG (buzzvm_t vm) {
    LOG << "BUZZ: ";
-   for(UInt32 i = 1; i < buzzdarray_size(vm->lsyms->syms); ++i) {
+   for(UInt32 i = 1; i <= buzzvm_lnum(vm); ++i) {
       buzzvm_lload(vm, i);
       buzzobj_t o = buzzvm_stack_at(vm, 1);
       buzzvm_pop(vm);
@@ -43,11 +56,11 @@ int BuzzLOG (buzzvm_t vm) {
             LOG << o->f.value;
             break;
          case BUZZTYPE_TABLE:
-            LOG << "[table with " << (buzzdict_size(o->t.value)) << " elems]";
+            LOG << "[table with " << (buzztable_size(o)) << " elems]";
             break;
          case BUZZTYPE_CLOSURE:
             if(o->c.value.isnative)
-               LOG << "[n-closure @" << o->c.value.ref << "]";
+               LOG << "[n-closure @" << buzzvm_pc2offset(vm, o->c.value.ref) << "]";
             else
                LOG << "[c-closure @" << o->c.value.ref << "]";
             break;
@@ -100,7 +113,7 @@ int BuzzDebugPrint(buzzvm_t vm) {
    CBuzzController& cContr = *reinterpret_cast<CBuzzController*>(buzzvm_stack_at(vm, 1)->u.value);
    /* Fill message */
    std::ostringstream oss;
-   for(UInt32 i = 1; i < buzzdarray_size(vm->lsyms->syms); ++i) {
+   for(UInt32 i = 1; i <= buzzvm_lnum(vm); ++i) {
       buzzvm_lload(vm, i);
       buzzobj_t o = buzzvm_stack_at(vm, 1);
       buzzvm_pop(vm);
@@ -115,11 +128,11 @@ int BuzzDebugPrint(buzzvm_t vm) {
             oss << o->f.value;
             break;
          case BUZZTYPE_TABLE:
-            oss << "[table with " << (buzzdict_size(o->t.value)) << " elems]";
+            oss << "[table with " << (buzztable_size(o)) << " elems]";
             break;
          case BUZZTYPE_CLOSURE:
             if(o->c.value.isnative)
-               oss << "[n-closure @" << o->c.value.ref << "]";
+               oss << "[n-closure @" << buzzvm_pc2offset(vm, o->c.value.ref) << "]";
             else
                oss << "[c-closure @" << o->c.value.ref << "]";
             break;
@@ -428,6 +441,12 @@ CBuzzController::CBuzzController() :
    m_pcPos(NULL),
    m_pcBattery(NULL),
    m_tBuzzVM(NULL),
+   m_unMemLimit(0),
+   m_unMsgEnc(BUZZMSG_ENC_COMPACT),
+   m_bInMsgFair(false),
+   m_unInMsgLimit(0),
+   m_unInMsgMax(0),
+   m_unMsgMaxAge(0),
    m_tBuzzDbgInfo(NULL) {}
 
 /****************************************/
@@ -458,6 +477,48 @@ void CBuzzController::Init(TConfigurationNode& t_node) {
       /* Get the script name */
       std::string strDbgFName;
       GetNodeAttributeOrDefault(t_node, "debug_file", strDbgFName, strDbgFName);
+      /* Get the memory limit */
+      GetNodeAttributeOrDefault(t_node, "memory_limit", m_unMemLimit, m_unMemLimit);
+      /* Get the message encoding */
+      std::string strMsgEnc = "compact";
+      GetNodeAttributeOrDefault(t_node, "msg_encoding", strMsgEnc, strMsgEnc);
+      std::vector<std::string> vecMsgEnc;
+      Tokenize(strMsgEnc, vecMsgEnc, ", ");
+      m_unMsgEnc = BUZZMSG_ENC_LEGACY;
+      for(size_t i = 0; i < vecMsgEnc.size(); ++i) {
+         if(vecMsgEnc[i] == "compact")     m_unMsgEnc |= BUZZMSG_ENC_COMPACT;
+         else if(vecMsgEnc[i] == "half")   m_unMsgEnc |= BUZZMSG_ENC_COMPACT | BUZZMSG_ENC_HALF;
+         else if(vecMsgEnc[i] == "strref") m_unMsgEnc |= BUZZMSG_ENC_COMPACT | BUZZMSG_ENC_STRREF;
+         else if(vecMsgEnc[i] != "legacy")
+            THROW_ARGOSEXCEPTION("Unknown message encoding \"" << vecMsgEnc[i] << "\"");
+      }
+      /* Get the processing of the incoming messages */
+      GetNodeAttributeOrDefault(t_node, "inmsg_fair", m_bInMsgFair, m_bInMsgFair);
+      GetNodeAttributeOrDefault(t_node, "inmsg_limit", m_unInMsgLimit, m_unInMsgLimit);
+      GetNodeAttributeOrDefault(t_node, "inmsg_max", m_unInMsgMax, m_unInMsgMax);
+      /* Get the scheduling of the outgoing messages */
+      GetNodeAttributeOrDefault(t_node, "msg_max_age", m_unMsgMaxAge, m_unMsgMaxAge);
+      TConfigurationNodeIterator itMsgClass("msg_class");
+      for(itMsgClass = itMsgClass.begin(&t_node);
+          itMsgClass != itMsgClass.end();
+          ++itMsgClass) {
+         std::string strName;
+         GetNodeAttribute(*itMsgClass, "name", strName);
+         SMsgClass sMsgClass;
+         GetNodeAttributeOrDefault(*itMsgClass, "weight", sMsgClass.Weight, sMsgClass.Weight);
+         GetNodeAttributeOrDefault(*itMsgClass, "rate", sMsgClass.Rate, sMsgClass.Rate);
+         GetNodeAttributeOrDefault(*itMsgClass, "burst", sMsgClass.Burst, sMsgClass.Burst);
+         /* A name is either a message type or a group of types */
+         bool bFound = false;
+         for(UInt32 i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+            if(strName == MSG_TYPE_NAMES[i] || strName == MSG_GROUP_NAMES[i]) {
+               m_sMsgClasses[i] = sMsgClass;
+               bFound = true;
+            }
+         }
+         if(!bFound)
+            THROW_ARGOSEXCEPTION("Unknown message class \"" << strName << "\"");
+      }
       /* Initialize the rest */
       bool bIDSuccess = false;
       m_unRobotId = 0;
@@ -484,6 +545,15 @@ void CBuzzController::Init(TConfigurationNode& t_node) {
          SetBytecode(strBCFName, strDbgFName);
       else {
          m_tBuzzVM = buzzvm_new(m_unRobotId);
+         buzzvm_mem_limit_set(m_tBuzzVM, m_unMemLimit);
+         buzzvm_msgenc_set(m_tBuzzVM, m_unMsgEnc);
+         buzzinmsg_queue_fair_set(m_tBuzzVM->inmsgs, m_bInMsgFair);
+         buzzinmsg_queue_limit_set(m_tBuzzVM->inmsgs, m_unInMsgLimit);
+         buzzinmsg_queue_max_set(m_tBuzzVM->inmsgs, m_unInMsgMax);
+         for(UInt32 i = 0; i < BUZZMSG_TYPE_COUNT; ++i)
+            buzzoutmsg_class_set(m_tBuzzVM, i, m_sMsgClasses[i].Weight, m_sMsgClasses[i].Rate, m_sMsgClasses[i].Burst);
+         buzzoutmsg_maxage_set(m_tBuzzVM, m_unMsgMaxAge);
+         m_mapGlobalSlots.clear();
          UpdateSensors();
       }
       /* Set initial robot message (id and then all zeros) */
@@ -506,7 +576,7 @@ void CBuzzController::Reset() {
               m_tBuzzVM->robot,
               m_strBytecodeFName.c_str(),
               ErrorInfo().c_str());
-      for(UInt32 i = 1; i <= buzzdarray_size(m_tBuzzVM->stacks); ++i) {
+      for(UInt32 i = 1; i <= buzzvm_stack_depth(m_tBuzzVM); ++i) {
          buzzdebug_stack_dump(m_tBuzzVM, i, stdout);
       }
       return;
@@ -549,7 +619,7 @@ void CBuzzController::ControlStep() {
                  m_tBuzzVM->robot,
                  m_strBytecodeFName.c_str(),
                  ErrorInfo().c_str());
-         for(UInt32 i = 1; i <= buzzdarray_size(m_tBuzzVM->stacks); ++i) {
+         for(UInt32 i = 1; i <= buzzvm_stack_depth(m_tBuzzVM); ++i) {
             buzzdebug_stack_dump(m_tBuzzVM, i, stdout);
          }
          return;
@@ -572,6 +642,7 @@ void CBuzzController::Destroy() {
    if(m_tBuzzVM) {
       buzzvm_function_call(m_tBuzzVM, "destroy", 0);
       buzzvm_destroy(&m_tBuzzVM);
+      m_mapGlobalSlots.clear();
       if(m_tBuzzDbgInfo) buzzdebug_destroy(&m_tBuzzDbgInfo);
    }
 }
@@ -584,6 +655,15 @@ void CBuzzController::SetBytecode(const std::string& str_bc_fname,
    /* Reset the BuzzVM */
    if(m_tBuzzVM) buzzvm_destroy(&m_tBuzzVM);
    m_tBuzzVM = buzzvm_new(m_unRobotId);
+   buzzvm_mem_limit_set(m_tBuzzVM, m_unMemLimit);
+   buzzvm_msgenc_set(m_tBuzzVM, m_unMsgEnc);
+   buzzinmsg_queue_fair_set(m_tBuzzVM->inmsgs, m_bInMsgFair);
+   buzzinmsg_queue_limit_set(m_tBuzzVM->inmsgs, m_unInMsgLimit);
+   buzzinmsg_queue_max_set(m_tBuzzVM->inmsgs, m_unInMsgMax);
+   for(UInt32 i = 0; i < BUZZMSG_TYPE_COUNT; ++i)
+      buzzoutmsg_class_set(m_tBuzzVM, i, m_sMsgClasses[i].Weight, m_sMsgClasses[i].Rate, m_sMsgClasses[i].Burst);
+   buzzoutmsg_maxage_set(m_tBuzzVM, m_unMsgMaxAge);
+   m_mapGlobalSlots.clear();
    /* Get rid of debug info */
    if(m_tBuzzDbgInfo) buzzdebug_destroy(&m_tBuzzDbgInfo);
    m_tBuzzDbgInfo = buzzdebug_new();
@@ -623,7 +703,7 @@ void CBuzzController::SetBytecode(const std::string& str_bc_fname,
               m_tBuzzVM->robot,
               m_strBytecodeFName.c_str(),
               ErrorInfo().c_str());
-      for(UInt32 i = 1; i <= buzzdarray_size(m_tBuzzVM->stacks); ++i) {
+      for(UInt32 i = 1; i <= buzzvm_stack_depth(m_tBuzzVM); ++i) {
          buzzdebug_stack_dump(m_tBuzzVM, i, stdout);
       }
       return;
@@ -637,7 +717,8 @@ void CBuzzController::SetBytecode(const std::string& str_bc_fname,
 
 std::string CBuzzController::ErrorInfo() {
    if(m_tBuzzDbgInfo) {
-      const buzzdebug_entry_t* ptInfo = buzzdebug_info_get_fromoffset(m_tBuzzDbgInfo, &m_tBuzzVM->oldpc);
+      SInt32 nOffset = buzzvm_pc2offset(m_tBuzzVM, m_tBuzzVM->oldpc);
+      const buzzdebug_entry_t* ptInfo = buzzdebug_info_get_fromoffset(m_tBuzzDbgInfo, &nOffset);
       std::ostringstream ossErrMsg;
       if(ptInfo) {
          ossErrMsg << (*ptInfo)->fname
@@ -648,7 +729,7 @@ std::string CBuzzController::ErrorInfo() {
       }
       else {
          ossErrMsg << "At bytecode offset "
-                   << m_tBuzzVM->oldpc;
+                   << nOffset;
       }
       if(m_tBuzzVM->errormsg)
          ossErrMsg << ": "
@@ -742,36 +823,44 @@ buzzvm_state CBuzzController::RegisterFunctions() {
 /****************************************/
 /****************************************/
 
+/*
+ * Reads a 16-bit unsigned integer stored by CByteArray, in network byte order.
+ */
+static UInt16 ReadUInt16(const UInt8* pun_data) {
+   UInt16 unValue;
+   ::memcpy(&unValue, pun_data, sizeof(UInt16));
+   return ntohs(unValue);
+}
+
 void CBuzzController::ProcessInMsgs() {
    /* Reset neighbor information */
    buzzneighbors_reset(m_tBuzzVM);
    /* Go through RAB messages and add them to the FIFO */
    const CCI_RangeAndBearingSensor::TReadings& tPackets = m_pcRABS->GetReadings();
    for(size_t i = 0; i < tPackets.size(); ++i) {
-      /* Copy packet into temporary buffer */
-      CByteArray cData = tPackets[i].Data;
+      /* Read the packet in place; the readings last for the whole step */
+      const UInt8* punData = tPackets[i].Data.ToCArray();
+      size_t unSize = tPackets[i].Data.Size();
+      if(unSize < sizeof(UInt16)) continue;
       /* Get robot id and update neighbor information */
-      UInt16 unRobotId = cData.PopFront<UInt16>();
+      UInt16 unRobotId = ReadUInt16(punData);
+      size_t unPos = sizeof(UInt16);
       buzzneighbors_add(m_tBuzzVM,
                         unRobotId,
                         tPackets[i].Range,
                         tPackets[i].HorizontalBearing.GetValue(),
                         tPackets[i].VerticalBearing.GetValue());
       /* Go through the messages until there's nothing else to read */
-      UInt16 unMsgSize;
-      do {
+      while(unPos + sizeof(UInt16) <= unSize) {
          /* Get payload size */
-         unMsgSize = cData.PopFront<UInt16>();
-         /* Append message to the Buzz input message queue */
-         if(unMsgSize > 0 && cData.Size() >= unMsgSize) {
-            buzzinmsg_queue_append(m_tBuzzVM,
-                                   unRobotId,
-                                   buzzmsg_payload_frombuffer(cData.ToCArray(), unMsgSize));
-            /* Get rid of the data read */
-            for(size_t i = 0; i < unMsgSize; ++i) cData.PopFront<UInt8>();
-         }
+         UInt16 unMsgSize = ReadUInt16(punData + unPos);
+         unPos += sizeof(UInt16);
+         if(unMsgSize == 0 || unPos + unMsgSize > unSize) break;
+         /* Append a view of the message to the Buzz input message queue */
+         buzzmsg_view_t tMsg = { punData + unPos, unMsgSize };
+         buzzinmsg_queue_append(m_tBuzzVM, unRobotId, tMsg);
+         unPos += unMsgSize;
       }
-      while(cData.Size() > sizeof(UInt16) && unMsgSize > 0);
    }
    /* Process messages */
    buzzvm_process_inmsgs(m_tBuzzVM);
@@ -783,52 +872,31 @@ void CBuzzController::ProcessInMsgs() {
 void CBuzzController::ProcessOutMsgs() {
    /* Process outgoing messages */
    buzzvm_process_outmsgs(m_tBuzzVM);
+   /* Make a zeroed packet, the zeroes past the messages mark their end */
+   CByteArray cData(m_pcRABA->GetSize(), 0);
    /* Send robot id */
-   CByteArray cData;
-   cData << m_tBuzzVM->robot;
-   /* Send messages from FIFO */
-   do {
-      /* Are there more messages? */
-      if(buzzoutmsg_queue_isempty(m_tBuzzVM)) break;
-      /* Get first message */
-      buzzmsg_payload_t m = buzzoutmsg_queue_first(m_tBuzzVM);
-      /* Make sure the message is smaller than the data buffer
-       * Without this check, large messages would clog the queue forever
-       */
-      size_t unMsgSize = buzzmsg_payload_size(m) + sizeof(UInt16);
-      if(unMsgSize < m_pcRABA->GetSize() - sizeof(UInt16)) {
-         /* Make sure the next message fits the data buffer */
-         if(cData.Size() + unMsgSize > m_pcRABA->GetSize()) {
-            buzzmsg_payload_destroy(&m);
-            break;
-         }
-         /* Add message length to data buffer */
-         cData << static_cast<UInt16>(buzzmsg_payload_size(m));
-         /* Add payload to data buffer */
-         cData.AddBuffer(reinterpret_cast<UInt8*>(m->data), buzzmsg_payload_size(m));
-      }
-      else {
-         RLOGERR << "Discarded oversize message ("
-                 << unMsgSize
-                 << " bytes). Max size is "
-                 << m_pcRABA->GetSize() - sizeof(UInt16)
-                 << " bytes."
-                 << std::endl;
-      }
-      /* Get rid of message */
-      buzzoutmsg_queue_next(m_tBuzzVM);
-      buzzmsg_payload_destroy(&m);
-   } while(1);
-   /* Pad the rest of the data with zeroes */
-   while(cData.Size() < m_pcRABA->GetSize()) cData << static_cast<UInt8>(0);
+   UInt16 unRobotId = htons(m_tBuzzVM->robot);
+   ::memcpy(cData.ToCArray(), &unRobotId, sizeof(UInt16));
+   /* Send as many messages as fit */
+   UInt32 unDiscarded = buzzoutmsg_queue_discarded(m_tBuzzVM);
+   buzzoutmsg_pack(m_tBuzzVM,
+                   cData.ToCArray() + sizeof(UInt16),
+                   cData.Size() - sizeof(UInt16));
+   if(buzzoutmsg_queue_discarded(m_tBuzzVM) > unDiscarded) {
+      RLOGERR << "Discarded "
+              << buzzoutmsg_queue_discarded(m_tBuzzVM) - unDiscarded
+              << " oversize message(s). Max size is "
+              << m_pcRABA->GetSize() - 2 * sizeof(UInt16)
+              << " bytes."
+              << std::endl;
+   }
    /* Send message */
    m_pcRABA->SetData(cData);
    /*
     * Update debug.msgqueue information
     */
    /* Get debug table */
-   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "debug", 1));
-   buzzvm_gload(m_tBuzzVM);
+   buzzvm_gload_slot(m_tBuzzVM, GlobalSlot("debug"));
    /* Create new debug.msgqueue table */
    buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "msgqueue", 1));
    buzzobj_t tMsgQueue = buzzheap_newobj(m_tBuzzVM, BUZZTYPE_TABLE);
@@ -839,18 +907,47 @@ void CBuzzController::ProcessOutMsgs() {
    /* Set debug.msgqueue.broadcast */
    TablePut(tMsgQueue,
             "broadcast",
-            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_BROADCAST])));
+            static_cast<SInt32>(buzzoutmsg_queue_count(m_tBuzzVM, BUZZMSG_BROADCAST)));
    /* Set debug.msgqueue.vstig */
    TablePut(tMsgQueue,
             "vstig",
-            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_PUT])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_QUERY])));
+            static_cast<SInt32>(buzzoutmsg_queue_count(m_tBuzzVM, BUZZMSG_VSTIG_PUT) + buzzoutmsg_queue_count(m_tBuzzVM, BUZZMSG_VSTIG_QUERY)));
    /* Set debug.msgqueue.swarm */
    TablePut(tMsgQueue,
             "swarm",
-            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_JOIN])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_LEAVE])));
+            static_cast<SInt32>(buzzoutmsg_queue_count(m_tBuzzVM, BUZZMSG_SWARM_JOIN) + buzzoutmsg_queue_count(m_tBuzzVM, BUZZMSG_SWARM_LEAVE)));
+   /* Set the bytes sent in this step, e.g., debug.msgqueue.sent.vstig_put */
+   buzzobj_t tSent = buzzheap_newobj(m_tBuzzVM, BUZZTYPE_TABLE);
+   for(UInt32 i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      TablePut(tSent,
+               MSG_TYPE_NAMES[i],
+               static_cast<SInt32>(buzzoutmsg_queue_sent(m_tBuzzVM, i)));
+   }
+   TablePut(tMsgQueue, "sent", tSent);
    /* Save table */
    buzzvm_push(m_tBuzzVM, tMsgQueue);
    buzzvm_tput(m_tBuzzVM);
+   /*
+    * Update debug.memory information
+    */
+   /* Get debug table */
+   buzzvm_gload_slot(m_tBuzzVM, GlobalSlot("debug"));
+   /* Create new debug.memory table */
+   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "memory", 1));
+   buzzobj_t tMemory = buzzheap_newobj(m_tBuzzVM, BUZZTYPE_TABLE);
+   /* Set debug.memory.total, debug.memory.peak and debug.memory.limit */
+   TablePut(tMemory, "total", static_cast<SInt32>(GetMemoryTotal()));
+   TablePut(tMemory, "peak",  static_cast<SInt32>(GetMemoryPeak()));
+   TablePut(tMemory, "limit", static_cast<SInt32>(buzzvm_mem_limit(m_tBuzzVM)));
+   /* Set the usage of each subsystem, e.g., debug.memory.heap */
+   for(UInt32 i = 0; i < BUZZMEM_COUNT; ++i) {
+      TablePut(tMemory,
+               buzzmem_sys_desc[i],
+               static_cast<SInt32>(GetMemoryUsed(static_cast<buzzmem_sys>(i))));
+   }
+   /* Save table */
+   buzzvm_push(m_tBuzzVM, tMemory);
+   buzzvm_tput(m_tBuzzVM);
 }
 
 /****************************************/
@@ -892,11 +989,31 @@ void CBuzzController::UpdateSensors() {
 /****************************************/
 /****************************************/
 
+UInt32 CBuzzController::GlobalSlot(const std::string& str_key) {
+   std::map<std::string, UInt32>::iterator it = m_mapGlobalSlots.find(str_key);
+   if(it != m_mapGlobalSlots.end()) return it->second;
+   UInt32 unSlot = buzzvm_global_slot(m_tBuzzVM, str_key.c_str());
+   m_mapGlobalSlots[str_key] = unSlot;
+   return unSlot;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t CBuzzController::RegisterTable(const std::string& str_key) {
+   buzzvm_pusht(m_tBuzzVM);
+   buzzobj_t tTable = buzzvm_stack_at(m_tBuzzVM, 1);
+   buzzvm_gstore_slot(m_tBuzzVM, GlobalSlot(str_key));
+   return tTable;
+}
+
+/****************************************/
+/****************************************/
+
 buzzvm_state CBuzzController::Register(const std::string& str_key,
                                        buzzobj_t t_obj) {
-   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1));
    buzzvm_push(m_tBuzzVM, t_obj);
-   buzzvm_gstore(m_tBuzzVM);
+   buzzvm_gstore_slot(m_tBuzzVM, GlobalSlot(str_key));
    return m_tBuzzVM->state;
 }
 
@@ -905,9 +1022,8 @@ buzzvm_state CBuzzController::Register(const std::string& str_key,
 
 buzzvm_state CBuzzController::Register(const std::string& str_key,
                                        SInt32 n_value) {
-   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1));
    buzzvm_pushi(m_tBuzzVM, n_value);
-   buzzvm_gstore(m_tBuzzVM);
+   buzzvm_gstore_slot(m_tBuzzVM, GlobalSlot(str_key));
    return m_tBuzzVM->state;
 }
 
@@ -916,9 +1032,8 @@ buzzvm_state CBuzzController::Register(const std::string& str_key,
 
 buzzvm_state CBuzzController::Register(const std::string& str_key,
                                        Real f_value) {
-   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1));
    buzzvm_pushf(m_tBuzzVM, f_value);
-   buzzvm_gstore(m_tBuzzVM);
+   buzzvm_gstore_slot(m_tBuzzVM, GlobalSlot(str_key));
    return m_tBuzzVM->state;
 }
 
@@ -935,10 +1050,7 @@ buzzvm_state CBuzzController::Register(const std::string& str_key,
 
 buzzvm_state CBuzzController::Register(const std::string& str_key,
                                        const CVector3& c_vec) {
-   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1));
-   buzzvm_pusht(m_tBuzzVM);
-   buzzobj_t tVecTable = buzzvm_stack_at(m_tBuzzVM, 1);
-   buzzvm_gstore(m_tBuzzVM);
+   buzzobj_t tVecTable = RegisterTable(str_key);
    TablePut(tVecTable, "x", c_vec.GetX());
    TablePut(tVecTable, "y", c_vec.GetY());
    TablePut(tVecTable, "z", c_vec.GetZ());
@@ -950,10 +1062,7 @@ buzzvm_state CBuzzController::Register(const std::string& str_key,
 
 buzzvm_state CBuzzController::Register(const std::string& str_key,
                                        const CQuaternion& c_quat) {
-   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1));
-   buzzvm_pusht(m_tBuzzVM);
-   buzzobj_t tQuatTable = buzzvm_stack_at(m_tBuzzVM, 1);
-   buzzvm_gstore(m_tBuzzVM);
+   buzzobj_t tQuatTable = RegisterTable(str_key);
    CRadians cYaw, cPitch, cRoll;
    c_quat.ToEulerAngles(cYaw, cPitch, cRoll);
    TablePut(tQuatTable, "yaw", cYaw);
@@ -967,10 +1076,7 @@ buzzvm_state CBuzzController::Register(const std::string& str_key,
 
 buzzvm_state CBuzzController::Register(const std::string& str_key,
                                        const CColor& c_color) {
-   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1));
-   buzzvm_pusht(m_tBuzzVM);
-   buzzobj_t tColorTable = buzzvm_stack_at(m_tBuzzVM, 1);
-   buzzvm_gstore(m_tBuzzVM);
+   buzzobj_t tColorTable = RegisterTable(str_key);
    TablePut(tColorTable, "red", c_color.GetRed());
    TablePut(tColorTable, "green", c_color.GetGreen());
    TablePut(tColorTable, "blue", c_color.GetBlue());
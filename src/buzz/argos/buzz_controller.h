@@ -16,6 +16,7 @@
 #include <buzz/buzzdebug.h>
 #include <string>
 #include <list>
+#include <map>
 
 using namespace argos;
 
@@ -23,6 +24,17 @@ class CBuzzController : public CCI_Controller {
 
 public:
 
+   /* Scheduling of a class of outgoing messages */
+   struct SMsgClass {
+      /* Share of the bandwidth, 0 for strict priority */
+      UInt32 Weight;
+      /* Bytes per step, 0 for no limit */
+      UInt32 Rate;
+      /* Max bytes in the token bucket, 0 for the rate */
+      UInt32 Burst;
+      SMsgClass() : Weight(0), Rate(0), Burst(0) {}
+   };
+
    struct SDebug {
       /* A ray and its color */
       struct SRay {
@@ -115,6 +127,27 @@ public:
       return m_tBuzzDbgInfo;
    }
 
+   /*
+    * Returns the bytes used by a subsystem of the Buzz VM.
+    */
+   inline SInt64 GetMemoryUsed(buzzmem_sys e_sys) const {
+      return buzzvm_mem_used(m_tBuzzVM, e_sys);
+   }
+
+   /*
+    * Returns the bytes used by the Buzz VM.
+    */
+   inline SInt64 GetMemoryTotal() const {
+      return buzzvm_mem_total(m_tBuzzVM);
+   }
+
+   /*
+    * Returns the highest number of bytes used by the Buzz VM so far.
+    */
+   inline SInt64 GetMemoryPeak() const {
+      return buzzvm_mem_peak(m_tBuzzVM);
+   }
+
    std::string ErrorInfo();
 
    typedef std::map<size_t, bool> TBuzzRobots;
@@ -144,6 +177,8 @@ public:
    buzzvm_state Register(const std::string& str_key,
                          const CColor& c_color);
 
+   buzzobj_t RegisterTable(const std::string& str_key);
+
    buzzvm_state TablePut(buzzobj_t t_table,
                          const std::string& str_key,
                          buzzobj_t t_obj);
@@ -209,6 +244,13 @@ protected:
 
    virtual void UpdateSensors();
 
+   /*
+    * Returns the slot of the global variable with the given name.
+    * The slots are cached, so that updating a variable every step is
+    * an array store.
+    */
+   UInt32 GlobalSlot(const std::string& str_key);
+
 protected:
 
    /* Pointer to the range and bearing actuator */
@@ -224,6 +266,22 @@ protected:
    UInt16 m_unRobotId;
    /* Buzz VM state */
    buzzvm_t m_tBuzzVM;
+   /* Memory limit of the Buzz VM in bytes, 0 for none */
+   UInt64 m_unMemLimit;
+   /* Encoding of the outgoing messages (buzzmsg_enc_e flags) */
+   UInt32 m_unMsgEnc;
+   /* Whether the senders of incoming messages take turns */
+   bool m_bInMsgFair;
+   /* Max incoming messages processed per step, 0 for none */
+   UInt32 m_unInMsgLimit;
+   /* Max incoming messages kept waiting, 0 for none */
+   UInt32 m_unInMsgMax;
+   /* Scheduling of each type of outgoing message */
+   SMsgClass m_sMsgClasses[BUZZMSG_TYPE_COUNT];
+   /* Steps after which a waiting outgoing message goes first, 0 for never */
+   UInt32 m_unMsgMaxAge;
+   /* Slots of the global variables set by the controller */
+   std::map<std::string, UInt32> m_mapGlobalSlots;
    /* Buzz debug info */
    buzzdebug_t m_tBuzzDbgInfo;
    /* Name of the bytecode file */
@@ -224,10 +224,7 @@ void CBuzzControllerEyeBot::UpdateSensors() {
     * Camera
     */
    if(m_pcCamera) {
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "blobs", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tBlobs = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
+      buzzobj_t tBlobs = RegisterTable("blobs");
       const CCI_ColoredBlobPerspectiveCameraSensor::SReadings& sBlobs = m_pcCamera->GetReadings();
       for(size_t i = 0; i < sBlobs.BlobList.size(); ++i) {
          buzzvm_pusht(m_tBuzzVM);
@@ -381,10 +381,7 @@ void CBuzzControllerFootBot::UpdateSensors() {
     */
    if(m_pcProximity != NULL) {
       /* Create empty proximity table */
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "proximity", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tProxTable = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
+      buzzobj_t tProxTable = RegisterTable("proximity");
       /* Get proximity readings */
       const CCI_FootBotProximitySensor::TReadings& tProxReads = m_pcProximity->GetReadings();
       /* Fill into the proximity table */
@@ -406,10 +403,7 @@ void CBuzzControllerFootBot::UpdateSensors() {
     */
    if(m_pcLight) {
       /* Create empty light table */
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "light", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tLightTable = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
+      buzzobj_t tLightTable = RegisterTable("light");
       /* Get light readings */
       const CCI_FootBotLightSensor::TReadings& tLightReads = m_pcLight->GetReadings();
       /* Fill into the light table */
@@ -432,10 +426,7 @@ void CBuzzControllerFootBot::UpdateSensors() {
    */
    if(m_pcDistanceScannerS) {
       /* Create empty distance scanner table */
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "distance_scanner", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tDistanceScannerTable = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
+      buzzobj_t tDistanceScannerTable = RegisterTable("distance_scanner");
       /* Get distance readings */
       const CCI_FootBotDistanceScannerSensor::TReadingsMap& tDistanceScannerReads = m_pcDistanceScannerS->GetReadingsMap();
       /* Fill into the distance table */
@@ -458,10 +449,7 @@ void CBuzzControllerFootBot::UpdateSensors() {
     * Camera
     */
    if(m_pcCamera) {
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "blobs", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tBlobs = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
+      buzzobj_t tBlobs = RegisterTable("blobs");
       const CCI_ColoredBlobOmnidirectionalCameraSensor::SReadings& sBlobs = m_pcCamera->GetReadings();
       for(size_t i = 0; i < sBlobs.BlobList.size(); ++i) {
          buzzvm_pusht(m_tBuzzVM);
@@ -479,10 +467,7 @@ void CBuzzControllerFootBot::UpdateSensors() {
    if(m_pcWheelsS) {
       /* Make "wheels" table */
       const CCI_DifferentialSteeringSensor::SReading& sWheels = m_pcWheelsS->GetReading();
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "wheels", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tWheels = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
+      buzzobj_t tWheels = RegisterTable("wheels");
       /* Make "velocity" table */
       buzzvm_pusht(m_tBuzzVM);
       buzzobj_t tVelocity = buzzvm_stack_at(m_tBuzzVM, 1);
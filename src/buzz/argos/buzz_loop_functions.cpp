@@ -6,8 +6,7 @@
 
 buzzobj_t BuzzGet(buzzvm_t t_vm,
                   const std::string& str_var) {
-   buzzvm_pushs(t_vm, buzzvm_string_register(t_vm, str_var.c_str(), 0));
-   buzzvm_gload(t_vm);
+   buzzvm_gload_slot(t_vm, buzzvm_global_slot(t_vm, str_var.c_str()));
    buzzobj_t tRetval = buzzvm_stack_at(t_vm, 1);
    buzzvm_pop(t_vm);
    return tRetval;
@@ -19,9 +18,8 @@ buzzobj_t BuzzGet(buzzvm_t t_vm,
 void BuzzPut(buzzvm_t t_vm,
              const std::string& str_var,
              int n_val) {
-   buzzvm_pushs(t_vm, buzzvm_string_register(t_vm, str_var.c_str(), 0));
    buzzvm_pushi(t_vm, n_val);
-   buzzvm_gstore(t_vm);
+   buzzvm_gstore_slot(t_vm, buzzvm_global_slot(t_vm, str_var.c_str()));
 }
    
 /****************************************/
@@ -30,9 +28,8 @@ void BuzzPut(buzzvm_t t_vm,
 void BuzzPut(buzzvm_t t_vm,
              const std::string& str_var,
              float f_val) {
-   buzzvm_pushs(t_vm, buzzvm_string_register(t_vm, str_var.c_str(), 0));
    buzzvm_pushf(t_vm, f_val);
-   buzzvm_gstore(t_vm);
+   buzzvm_gstore_slot(t_vm, buzzvm_global_slot(t_vm, str_var.c_str()));
 }
    
 /****************************************/
@@ -41,9 +38,8 @@ void BuzzPut(buzzvm_t t_vm,
 void BuzzPut(buzzvm_t t_vm,
              const std::string& str_var,
              const std::string& str_val) {
-   buzzvm_pushs(t_vm, buzzvm_string_register(t_vm, str_var.c_str(), 0));
    buzzvm_pushs(t_vm, buzzvm_string_register(t_vm, str_val.c_str(), 0));
-   buzzvm_gstore(t_vm);
+   buzzvm_gstore_slot(t_vm, buzzvm_global_slot(t_vm, str_var.c_str()));
 }
 
 /****************************************/
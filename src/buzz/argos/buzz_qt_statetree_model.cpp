@@ -205,7 +205,7 @@ void ProcessBuzzObjectsInTable(const void* pt_key,
          .Item = pcChild,
          .NoEmptyTables = psParams->NoEmptyTables
       };
-      buzzdict_foreach(tData->t.value, ProcessBuzzObjectsInTable, &sParams2);
+      buzztable_foreach(psParams->VM, tData, ProcessBuzzObjectsInTable, &sParams2);
       /* If no elements were added, remove the child */
       if(psParams->NoEmptyTables) {
          if(pcChild->GetNumChildren() == 0) {
@@ -220,10 +220,12 @@ void ProcessBuzzObjects(const void* pt_key,
                         void* pt_params) {
    /* Get the key as a string */
    uint16_t unKeyId = *reinterpret_cast<const uint16_t*>(pt_key);
-   /* Get the data */
-   buzzobj_t tData = *reinterpret_cast<buzzobj_t*>(pt_data);
    /* Get the parameters */
    SBuzzProcessStateData* psParams = reinterpret_cast<SBuzzProcessStateData*>(pt_params);
+   /* Get the data from the global variable slot */
+   buzzobj_t tData = buzzdarray_get(psParams->VM->gslots,
+                                    *reinterpret_cast<uint32_t*>(pt_data),
+                                    buzzobj_t);
    /* Buffer for element */
    QList<QVariant> cData;
    /* Insert key data */
@@ -261,7 +263,7 @@ void ProcessBuzzObjects(const void* pt_key,
          .Item = pcChild,
          .NoEmptyTables = psParams->NoEmptyTables
       };
-      buzzdict_foreach(tData->t.value, ProcessBuzzObjectsInTable, &sParams2);
+      buzztable_foreach(psParams->VM, tData, ProcessBuzzObjectsInTable, &sParams2);
       /* If no elements were added, remove the child */
       if(psParams->NoEmptyTables) {
          if(pcChild->GetNumChildren() == 0) {
@@ -348,7 +350,7 @@ void ProcessBuzzFunctionsInTable(const void* pt_key,
          .Item = pcChild,
          .NoEmptyTables = psParams->NoEmptyTables
       };
-      buzzdict_foreach(tData->t.value, ProcessBuzzFunctionsInTable, &sParams2);
+      buzztable_foreach(psParams->VM, tData, ProcessBuzzFunctionsInTable, &sParams2);
       /* If no elements were added, remove the child */
       if(psParams->NoEmptyTables) {
          if(pcChild->GetNumChildren() == 0)
@@ -362,10 +364,12 @@ void ProcessBuzzFunctions(const void* pt_key,
                           void* pt_params) {
    /* Get the key */
    uint16_t unKeyId = *reinterpret_cast<const uint16_t*>(pt_key);
-   /* Get the data */
-   buzzobj_t tData = *reinterpret_cast<buzzobj_t*>(pt_data);
    /* Get the parameters */
    SBuzzProcessStateData* psParams = reinterpret_cast<SBuzzProcessStateData*>(pt_params);
+   /* Get the data from the global variable slot */
+   buzzobj_t tData = buzzdarray_get(psParams->VM->gslots,
+                                    *reinterpret_cast<uint32_t*>(pt_data),
+                                    buzzobj_t);
    /* Buffer for element */
    QList<QVariant> cData;
    /* Insert key data */
@@ -389,7 +393,7 @@ void ProcessBuzzFunctions(const void* pt_key,
          .Item = pcChild,
          .NoEmptyTables = psParams->NoEmptyTables
       };
-      buzzdict_foreach(tData->t.value, ProcessBuzzFunctionsInTable, &sParams2);
+      buzztable_foreach(psParams->VM, tData, ProcessBuzzFunctionsInTable, &sParams2);
       /* If no elements were added, remove the child */
       if(psParams->NoEmptyTables) {
          if(pcChild->GetNumChildren() == 0)
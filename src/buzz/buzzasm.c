@@ -23,6 +23,7 @@
  * Adds an instruction to the bytecode buffer
  */
 #define bcode_add_instr(OPCODE)                 \
+   lastinstr = *size;                           \
    bcode_resize(1);                             \
    (*buf)[*size] = (OPCODE);                    \
    ++(*size);
@@ -110,6 +111,46 @@ struct buzz_asm_info_s {
    int retval;
 };
 
+/*
+ * Superinstructions: when an instruction with an argument is followed
+ * by the first instruction of one of these pairs, the two are replaced
+ * by the superinstruction, which takes the same argument.
+ */
+static const uint8_t buzz_asm_fusions[][3] = {
+   /* First,           second,            superinstruction */
+   { BUZZVM_INSTR_PUSHS, BUZZVM_INSTR_GLOAD, BUZZVM_INSTR_GLOADS },
+   { BUZZVM_INSTR_PUSHS, BUZZVM_INSTR_TGET,  BUZZVM_INSTR_TGETS  },
+   { BUZZVM_INSTR_PUSHI, BUZZVM_INSTR_ADD,   BUZZVM_INSTR_ADDI   },
+   { BUZZVM_INSTR_PUSHI, BUZZVM_INSTR_CALLC, BUZZVM_INSTR_CALLCI }
+};
+
+/*
+ * Fuses an instruction with the previous one, if possible.
+ * The superinstruction has the same size as the previous instruction,
+ * so the offsets of the code that follows are not affected.
+ * @param buf The bytecode buffer.
+ * @param last The offset of the previous instruction, or -1 if it can't be fused (e.g., a label is in between).
+ * @param instr The name of the instruction to fuse.
+ * @return 1 if the instruction was fused, 0 otherwise.
+ */
+static int buzz_asm_fuse(uint8_t* buf,
+                         int64_t last,
+                         const char* instr) {
+   if(last < 0) return 0;
+   size_t i;
+   for(i = 0; i < sizeof(buzz_asm_fusions) / sizeof(buzz_asm_fusions[0]); ++i) {
+      if(buf[last] == buzz_asm_fusions[i][0] &&
+         strcmp(instr, buzzvm_instr_desc[buzz_asm_fusions[i][1]]) == 0) {
+         buf[last] = buzz_asm_fusions[i][2];
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
 void buzz_asm_labsub(const void* key, void* data, void* params) {
    /* Get compilation state */
    struct buzz_asm_info_s* state = (struct buzz_asm_info_s*)params;
@@ -174,6 +215,7 @@ int buzz_asm(const char* fname,
     */
    /* Read each line */
    ssize_t read;
+   int64_t lastinstr = -1;
    char* rawline = 0;
    char* trimline = 0;
    size_t len = 0;
@@ -235,6 +277,8 @@ int buzz_asm(const char* fname,
          /* Copy label information for storage */
          char* label = strdup(labelinfo);
          buzzdict_set(labpos, &label, size);
+         /* Jumps can land here, don't fuse across */
+         lastinstr = -1;
          continue;
       }
       /* Fetch the instruction */
@@ -242,6 +286,12 @@ int buzz_asm(const char* fname,
       char* debuginfo = strsep(&trimline, "|\n");
       char* instr = strsep(&instrinfo, " \n\t");
       char* argstr = strsep(&instrinfo, " \n\t");
+      /* Fuse with the previous instruction, if possible */
+      if(buzz_asm_fuse(*buf, lastinstr, instr)) {
+         assert_noarg();
+         lastinstr = -1;
+         continue;
+      }
       /* Add debug information, if any */
       if(debuginfo && *debuginfo) {
          /* Parse line and column data */
@@ -301,6 +351,11 @@ int buzz_asm(const char* fname,
       i_arg_instr(BUZZVM_INSTR_LLOAD);
       i_arg_instr(BUZZVM_INSTR_LSTORE);
       i_arg_instr(BUZZVM_INSTR_LREMOVE);
+      i_arg_instr(BUZZVM_INSTR_ULOAD);
+      i_arg_instr(BUZZVM_INSTR_USTORE);
+      i_arg_instr(BUZZVM_INSTR_UCAPL);
+      i_arg_instr(BUZZVM_INSTR_UCAPU);
+      i_arg_instr(BUZZVM_INSTR_GSTORES);
       l_arg_instr(BUZZVM_INSTR_JUMP);
       l_arg_instr(BUZZVM_INSTR_JUMPZ);
       l_arg_instr(BUZZVM_INSTR_JUMPNZ);
@@ -326,7 +381,17 @@ int buzz_asm(const char* fname,
    free(rawline);
    buzzdict_destroy(&labpos);
    buzzdict_destroy(&labsubs);
-   return state.retval;
+   if(state.retval != 0) return state.retval;
+   /*
+    * Verify the result
+    */
+   uint32_t off;
+   buzzvm_error err = buzzvm_bcode_verify(*buf, *size, &off);
+   if(err != BUZZVM_ERROR_NONE) {
+      fprintf(stderr, "ERROR: %s: invalid bytecode at %" PRIu32 ": %s\n", fname, off, buzzvm_error_desc[err]);
+      return 2;
+   }
+   return 0;
 }
 
 /****************************************/
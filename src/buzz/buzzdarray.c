@@ -8,8 +8,28 @@
 
 #define buzzdarray_rawget(da, pos) ((uint8_t*)(da)->data + (pos) * (da)->elem_size)
 
+/*
+ * Returns the number of bytes allocated for the dynamic array.
+ */
+#define buzzdarray_bytes(da) ((int64_t)sizeof(struct buzzdarray_s) + (int64_t)(da)->capacity * (da)->elem_size)
+
 void buzzdarray_elem_destroy(uint32_t pos, void* data, void* params) {}
 
+/*
+ * Sets the capacity of the array and reallocates the data.
+ */
+static void buzzdarray_realloc(buzzdarray_t da,
+                               uint32_t cap) {
+   void* nd = realloc(da->data, (size_t)cap * da->elem_size);
+   if(!nd) {
+      fprintf(stderr, "[FATAL] Can't reallocate dynamic array.\n");
+      abort();
+   }
+   buzzmem_charge(da->mem, da->memsys, ((int64_t)cap - da->capacity) * da->elem_size);
+   da->data = nd;
+   da->capacity = cap;
+}
+
 /****************************************/
 /****************************************/
 
@@ -46,6 +66,10 @@ buzzdarray_t buzzdarray_clone(const buzzdarray_t da) {
    /* Create data buffer */
    clone->data = malloc(clone->capacity * clone->elem_size);
    memcpy(clone->data, da->data, clone->size * clone->elem_size);
+   /* The clone is charged to the same subsystem */
+   clone->mem = da->mem;
+   clone->memsys = da->memsys;
+   buzzmem_charge(clone->mem, clone->memsys, buzzdarray_bytes(clone));
    /* Done */
    return clone;
 }
@@ -76,8 +100,9 @@ buzzdarray_t buzzdarray_frombuffer(const void* buf,
 
 void buzzdarray_destroy(buzzdarray_t* da) {
    /* Get rid of every element */
-   buzzdarray_foreach(*da, (*da)->elem_destroy, NULL);
+   buzzdarray_foreach(*da, (*da)->elem_destroy, *da);
    /* Get rid of the rest */
+   buzzmem_charge((*da)->mem, (*da)->memsys, -buzzdarray_bytes(*da));
    free((*da)->data);
    free(*da);
    /* Set da to NULL */
@@ -98,13 +123,9 @@ void* buzzdarray_makeslot(buzzdarray_t da,
          fprintf(stderr, "[BUG] Array capacity is zero.\n");
          abort();
       }
-      do { da->capacity *= 2; } while(buzzdarray_size(da)+1 >= da->capacity);
-      void* nd = realloc(da->data, da->capacity * da->elem_size);
-      if(!nd) {
-         fprintf(stderr, "[FATAL] Can't reallocate dynamic array.\n");
-         abort();
-      }
-      da->data = nd;
+      uint32_t cap = da->capacity;
+      do { cap *= 2; } while(buzzdarray_size(da)+1 >= cap);
+      buzzdarray_realloc(da, cap);
    }
    /* Move elements from i onwards one step to the right */
    if(!buzzdarray_isempty(da) && i < buzzdarray_size(da)) {
@@ -139,7 +160,7 @@ void buzzdarray_remove(buzzdarray_t da,
    /* Can't remove elements past the size */
    if(pos >= buzzdarray_size(da)) return;
    /* Destroy element */
-   da->elem_destroy(pos, buzzdarray_rawget(da, pos), NULL);
+   da->elem_destroy(pos, buzzdarray_rawget(da, pos), da);
    /* Move the elements from pos onwards one spot to the left */
    memmove(
       buzzdarray_rawget(da, pos),
@@ -147,16 +168,54 @@ void buzzdarray_remove(buzzdarray_t da,
       (buzzdarray_size(da) - pos - 1) * da->elem_size);
    /* Update the size */
    --(da->size);
-   /* Shrink the capacity if necessary */
+   /* Shrink the capacity if necessary, leaving room to grow back
+      without reallocating right away */
    if((da->size > 0) &&
-      (da->size <= da->capacity / 2)) {
-      da->capacity /= 2;
-      void* nd = realloc(da->data, da->capacity * da->elem_size);
-      if(!nd) {
-         fprintf(stderr, "[FATAL] Can't reallocate dynamic array.\n");
-         abort();
+      (da->size <= da->capacity / 4)) {
+      buzzdarray_realloc(da, da->capacity / 2);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzzdarray_filter(buzzdarray_t da,
+                       buzzdarray_elem_predp keep,
+                       void* params) {
+   /* Move each kept element to the next free spot on the left */
+   uint32_t i, j = 0;
+   for(i = 0; i < buzzdarray_size(da); ++i) {
+      if(keep(i, buzzdarray_rawget(da, i), params)) {
+         if(i != j)
+            memcpy(buzzdarray_rawget(da, j),
+                   buzzdarray_rawget(da, i),
+                   da->elem_size);
+         ++j;
+      }
+      else {
+         da->elem_destroy(i, buzzdarray_rawget(da, i), da);
       }
-      da->data = nd;
+   }
+   /* Update the size */
+   da->size = j;
+   /* Shrink the capacity if necessary */
+   if(da->size > 0 &&
+      da->size <= da->capacity / 2) {
+      uint32_t cap = da->capacity;
+      while(da->size <= cap / 2) cap /= 2;
+      buzzdarray_realloc(da, cap);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzzdarray_truncate(buzzdarray_t da,
+                         uint32_t size) {
+   /* Destroy the elements past the new size */
+   while(buzzdarray_size(da) > size) {
+      --(da->size);
+      da->elem_destroy(da->size, buzzdarray_rawget(da, da->size), da);
    }
 }
 
@@ -166,15 +225,9 @@ void buzzdarray_remove(buzzdarray_t da,
 void buzzdarray_clear(buzzdarray_t da,
                       uint32_t cap) {
    /* Get rid of every element */
-   buzzdarray_foreach(da, da->elem_destroy, NULL);
+   buzzdarray_foreach(da, da->elem_destroy, da);
    /* Resize the array */
-   da->capacity = cap;
-   void* nd = realloc(da->data, da->capacity * da->elem_size);
-   if(!nd) {
-      fprintf(stderr, "[FATAL] Can't reallocate dynamic array.\n");
-      abort();
-   }
-   da->data = nd;
+   buzzdarray_realloc(da, cap);
    /* Zero the size */
    da->size = 0;
 }
@@ -182,6 +235,18 @@ void buzzdarray_clear(buzzdarray_t da,
 /****************************************/
 /****************************************/
 
+void buzzdarray_account(buzzdarray_t da,
+                        buzzmem_t mem,
+                        uint32_t sys) {
+   buzzmem_charge(da->mem, da->memsys, -buzzdarray_bytes(da));
+   da->mem = mem;
+   da->memsys = sys;
+   buzzmem_charge(da->mem, da->memsys, buzzdarray_bytes(da));
+}
+
+/****************************************/
+/****************************************/
+
 void buzzdarray_set(buzzdarray_t da,
                     uint32_t pos,
                     const void* value) {
@@ -2,6 +2,7 @@
 #define BUZZDARRAY
 
 #include <stdint.h>
+#include <buzz/buzzmem.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,7 +15,8 @@ extern "C" {
     *
     * This function pointer is used to destroy elements by
     * buzzdarray_destroy() and in methods such as
-    * buzzdarray_foreach().
+    * buzzdarray_foreach(). When destroying elements, params is the
+    * dynamic array.
     */
    typedef void (*buzzdarray_elem_funp)(uint32_t pos, void* data, void* params);
 
@@ -30,6 +32,16 @@ extern "C" {
     */
    typedef int (*buzzdarray_elem_cmpp)(const void* a, const void* b);
 
+   /*
+    * Function pointer for an element-wise predicate:
+    *
+    * int f(uint32_t pos, void* data, void* params)
+    *
+    * This function pointer is used by buzzdarray_filter(). It must
+    * return non-zero if the element must be kept, 0 otherwise.
+    */
+   typedef int (*buzzdarray_elem_predp)(uint32_t pos, void* data, void* params);
+
    /*
     * Buzz dynamic array data.
     */
@@ -39,6 +51,8 @@ extern "C" {
       uint32_t elem_size;
       uint32_t capacity;
       buzzdarray_elem_funp elem_destroy;
+      buzzmem_t mem;
+      uint32_t memsys;
    };
    typedef struct buzzdarray_s* buzzdarray_t;
 
@@ -113,6 +127,31 @@ extern "C" {
    extern void buzzdarray_remove(buzzdarray_t da,
                                  uint32_t pos);
 
+   /*
+    * Removes all the elements for which the given predicate returns 0.
+    * Internally calls da.elem_destroy() on each removed element.
+    * The kept elements retain their relative order. Differently from
+    * calling buzzdarray_remove() in a loop, this function compacts
+    * the array in a single pass, in linear time.
+    * @param da The dynamic array.
+    * @param keep The predicate.
+    * @param params A data structure to pass along.
+    */
+   extern void buzzdarray_filter(buzzdarray_t da,
+                                 buzzdarray_elem_predp keep,
+                                 void* params);
+
+   /*
+    * Removes the elements past the given size.
+    * Internally calls da.elem_destroy() on each removed element.
+    * Differently from buzzdarray_remove(), the capacity is never
+    * shrunk, so the array can grow back without reallocation.
+    * @param da The dynamic array.
+    * @param size The new size. If larger than the current size, nothing happens.
+    */
+   extern void buzzdarray_truncate(buzzdarray_t da,
+                                   uint32_t size);
+
    /*
     * Erases all the elements of the dynamic array.
     * @param da The dynamic array.
@@ -121,6 +160,18 @@ extern "C" {
    extern void buzzdarray_clear(buzzdarray_t da,
                                 uint32_t cap);
 
+   /*
+    * Charges the memory of the dynamic array to the given subsystem.
+    * The memory already charged elsewhere is moved over, and
+    * reallocations are charged from now on.
+    * @param da The dynamic array.
+    * @param mem The memory accounting, or NULL to stop accounting.
+    * @param sys The subsystem (a buzzmem_sys value).
+    */
+   extern void buzzdarray_account(buzzdarray_t da,
+                                  buzzmem_t mem,
+                                  uint32_t sys);
+
    /*
     * Sets a new value for the element at the given position.
     * If the position is out of bounds, the passed value is not
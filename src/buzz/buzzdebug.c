@@ -19,15 +19,11 @@ buzzdebug_entry_t buzzdebug_entry_new(uint64_t l,
 }
 
 void buzzdebug_off2script_destroyf(const void* key, void* data, void* params) {
-   free((void*)key);
    free(*(buzzdebug_entry_t*)data);
-   free(data);
 }
 
 void buzzdebug_script2off_destroyf(const void* key, void* data, void* params) {
    free(*(buzzdebug_entry_t*)key);
-   free((void*)key);
-   free(data);
 }
 
 uint32_t buzzdebug_entryhash(const void* key) {
@@ -287,10 +283,13 @@ buzzvm_state buzzdebug_continue(buzzvm_t vm,
          vm->state = BUZZVM_STATE_READY;
       else return vm->state;
    }
+   /* Without breakpoints, just run */
+   if(buzzdebug_breakpoint_count(dbg) == 0)
+      return buzzvm_run(vm, 0);
    /* Go on until the end, an error, or a breakpoint */
-   while(!buzzdebug_breakpoint_exists(dbg, vm->pc) &&
+   while(!buzzdebug_breakpoint_exists(dbg, buzzvm_pc2offset(vm, vm->pc)) &&
          buzzvm_step(vm) == BUZZVM_STATE_READY);
-   if(buzzdebug_breakpoint_exists(dbg, vm->pc))
+   if(buzzdebug_breakpoint_exists(dbg, buzzvm_pc2offset(vm, vm->pc)))
       vm->state = BUZZVM_STATE_STOPPED;
    return vm->state;
 }
@@ -308,21 +307,29 @@ buzzvm_state buzzdebug_closure_call(buzzvm_t vm,
       else return vm->state;
    }
    /* Insert the self table */
-   buzzdarray_insert(vm->stack, buzzdarray_size(vm->stack) - argc - 1, buzzobj_new(BUZZTYPE_NIL));
+   buzzobj_t o = buzzheap_newnil(vm);
+   buzzdarray_insert(vm->stack, buzzdarray_size(vm->stack) - argc - 1, &o);
    /* Push the argument count */
    buzzvm_pushi(vm, argc);
    /* Save the current stack depth */
-   uint32_t stacks = buzzdarray_size(vm->stacks);
+   uint32_t depth = buzzvm_stack_depth(vm);
    /* Call the closure and keep stepping until
-    * the stack count is back to the saved value */
+    * the stack depth is back to the saved value */
    buzzvm_callc(vm);
+   /* Without breakpoints, just run */
+   if(buzzdebug_breakpoint_count(dbg) == 0) {
+      if(vm->state == BUZZVM_STATE_READY &&
+         depth < buzzvm_stack_depth(vm))
+         buzzvm_run_to_depth(vm, depth);
+      return vm->state;
+   }
    do {
-      if(buzzdebug_breakpoint_exists(dbg, vm->pc))
+      if(buzzdebug_breakpoint_exists(dbg, buzzvm_pc2offset(vm, vm->pc)))
          vm->state = BUZZVM_STATE_STOPPED;
       if(buzzvm_step(vm) != BUZZVM_STATE_READY)
          return vm->state;
    }
-   while(stacks < buzzdarray_size(vm->stacks));
+   while(depth < buzzvm_stack_depth(vm));
    return vm->state;
 }
 
@@ -382,14 +389,14 @@ static void buzzdebug_print_table_elem(const void* key,
 }
 
 static void buzzdebug_print_table(FILE* stream,
-                                  buzzdict_t t,
+                                  buzzobj_t t,
                                   buzzvm_t vm) {
-   fprintf(stream, "[table] %" PRIu32 " elements\n", buzzdict_size(t));
+   fprintf(stream, "[table] %" PRIu32 " elements\n", buzztable_size(t));
    struct buzzdebug_print_table_params_s params = {
       .stream = stream,
       .vm = vm
    };
-   buzzdict_foreach(t, buzzdebug_print_table_elem, &params);
+   buzztable_foreach(vm, t, buzzdebug_print_table_elem, &params);
 }
 
 void buzzdebug_print_obj(FILE* stream,
@@ -406,16 +413,16 @@ void buzzdebug_print_obj(FILE* stream,
          fprintf(stream, "[float] %f", o->f.value);
          break;
       case BUZZTYPE_TABLE:
-         buzzdebug_print_table(stream, o->t.value, vm);
+         buzzdebug_print_table(stream, o, vm);
          break;
       case BUZZTYPE_CLOSURE:
          if(o->c.value.isnative)
-            fprintf(stream, "[n-closure] %d", o->c.value.ref);
+            fprintf(stream, "[n-closure] %d", buzzvm_pc2offset(vm, o->c.value.ref));
          else
             fprintf(stream, "[c-closure] %d", o->c.value.ref);
          break;
       case BUZZTYPE_STRING:
-         fprintf(stream, "[string] %d:'%s'", o->s.value.sid, o->s.value.str);
+         fprintf(stream, "[string] %" PRIu32 ":'%s'", o->s.value.sid, o->s.value.str);
          break;
       default:
          fprintf(stream, "[TODO] type = %d", o->o.type);
@@ -426,20 +433,27 @@ void buzzdebug_stack_dump(buzzvm_t vm,
                           uint32_t idx,
                           FILE* stream) {
    int64_t i;
-   buzzdarray_t s = buzzdarray_get(vm->stacks, vm->stacks->size - idx, buzzdarray_t);
+   /* The stack of a frame goes from its base to the base of the frame above */
+   int64_t f = buzzvm_stack_depth(vm) - idx;
+   int64_t base = f > 0 ? buzzdarray_get(vm->frames, f-1, buzzvm_frame_t).stackbase : 0;
+   int64_t end = idx > 1 ? buzzdarray_get(vm->frames, f, buzzvm_frame_t).stackbase : buzzdarray_size(vm->stack);
+   int32_t oldoff = buzzvm_pc2offset(vm, vm->oldpc);
+   int32_t off = buzzvm_pc2offset(vm, vm->pc);
    char* curinstr = NULL;
-   if(!buzz_instruction_deasm(vm->bcode, vm->oldpc, &curinstr)) curinstr = "deasm error";
+   if(oldoff < 0 || oldoff >= vm->bcode_size ||
+      !buzz_instruction_deasm(vm->bcode, oldoff, &curinstr)) curinstr = "deasm error";
    char* nextinstr = NULL;
-   if(!buzz_instruction_deasm(vm->bcode, vm->pc, &nextinstr)) nextinstr = "deasm error";
+   if(off < 0 || off >= vm->bcode_size ||
+      !buzz_instruction_deasm(vm->bcode, off, &nextinstr)) nextinstr = "deasm error";
    fprintf(stream, "============================================================\n");
    fprintf(stream, "state: %s\terror: %d\n", buzzvm_state_desc[vm->state], vm->error);
-   fprintf(stream, "code size: %u\toldpc: %d\tpc: %d\n", vm->bcode_size, vm->oldpc, vm->pc);
-   fprintf(stream, "stacks: %" PRIu64 "\tcur: %u\n", buzzdarray_size(vm->stacks), idx);
+   fprintf(stream, "code size: %u\toldpc: %d\tpc: %d\n", vm->bcode_size, oldoff, off);
+   fprintf(stream, "stacks: %" PRIu64 "\tcur: %u\n", buzzvm_stack_depth(vm), idx);
    fprintf(stream, "cur instr: %s\n", curinstr);
    fprintf(stream, "next instr: %s\n", nextinstr);
-   for(i = buzzdarray_size(s)-1; i >= 0; --i) {
+   for(i = end - base - 1; i >= 0; --i) {
       fprintf(stream, "\t%" PRIu64 "\t", i);
-      buzzobj_t o = buzzdarray_get(s, i, buzzobj_t);
+      buzzobj_t o = buzzdarray_get(vm->stack, base + i, buzzobj_t);
       buzzdebug_print_obj(stream, o, vm);
       fprintf(stream, "\n");
    }
@@ -496,26 +510,20 @@ void buzzdebug_backtrace_entry(uint32_t idx,
 void buzzdebug_backtrace(buzzvm_t vm,
                          buzzdebug_t dbg,
                          FILE* stream) {
-   /* Make sure there's at least one stack present */
-   if(buzzdarray_isempty(vm->stacks)) {
-      fprintf(stream, "<no backtrace>\n");
-      return;
-   }
-   /* If we're here, it's because there's at least one stack active */
    /* The top stack corresponds to the current pc */
-   buzzdebug_backtrace_entry(1, dbg, vm->pc, stream);
-   /* Go through the stacks beneath */
-   /* For the stacks beneath, the return pc is at the stack top */
+   buzzdebug_backtrace_entry(1, dbg, buzzvm_pc2offset(vm, vm->pc), stream);
+   /* Go through the frames beneath */
+   /* Each frame stores the return pc of its caller */
    /* The effective pc is that of the call instruction */
-   for(int64_t i = buzzdarray_size(vm->stacks) - 2; i >=0; --i) {
-      /* Get the return value */
-      int32_t pc = buzzvm_stack_at(vm, 1)->i.value;
+   for(int64_t i = buzzdarray_size(vm->frames) - 1; i >= 0; --i) {
+      /* Get the return address */
+      int32_t pc = buzzdarray_get(vm->frames, i, buzzvm_frame_t).retpc;
       /* Calculate the actual pc */
       pc -= 1;
       /* Handle the backtrace entry */
-      buzzdebug_backtrace_entry(buzzdarray_size(vm->stacks) - i,
+      buzzdebug_backtrace_entry(buzzdarray_size(vm->frames) - i + 1,
                                 dbg,
-                                pc,
+                                buzzvm_pc2offset(vm, pc),
                                 stream);
    }
 }
@@ -176,7 +176,7 @@ extern "C" {
 
    /**
     * Dumps the current state of a stack.
-    * The index goes from 1 to (vm->stacks->size).
+    * The index goes from 1 to buzzvm_stack_depth(vm).
     * The currently active stack is at index 1.
     * @param vm The VM data.
     * @param idx The index of the stack to dump.
@@ -1,25 +1,166 @@
 #include "buzzdict.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 /****************************************/
 /****************************************/
 
-struct buzzdict_entry_s {
-   void* key;
-   void* data;
-};
+/*
+ * Smallest number of slots in a table.
+ */
+#define BUZZDICT_MIN_BUCKETS 4
 
-#define buzzdict_entry_new(dt, e, k, d)         \
-   struct buzzdict_entry_s e;                   \
-   e.key = malloc(dt->key_size);                \
-   memcpy(e.key, k, dt->key_size);              \
-   e.data = malloc(dt->data_size);              \
-   memcpy(e.data, d, dt->data_size);
+/*
+ * Size of the slot header (probe distance and hash).
+ */
+#define BUZZDICT_SLOT_HEADER 8
 
-void buzzdict_entry_destroy(const void* key, void* data, void* params) {
-   free((void*)key);
-   free(data);
+/*
+ * Size of the buffer on the stack for the snapshot of buzzdict_foreach().
+ * Larger snapshots are allocated on the heap.
+ */
+#define BUZZDICT_FOREACH_LOCAL 512
+
+/*
+ * Rounds the given size up to a multiple of 8 bytes.
+ */
+#define BUZZDICT_ALIGN(sz) (((sz) + 7) & ~7u)
+
+/*
+ * Accessors to the slot fields.
+ */
+#define buzzdict_slot(dt, i) ((dt)->slots + (size_t)(i) * (dt)->slot_size)
+#define buzzdict_slot_dist(s) (((uint32_t*)(s))[0])
+#define buzzdict_slot_hash(s) (((uint32_t*)(s))[1])
+#define buzzdict_slot_key(s) ((s) + BUZZDICT_SLOT_HEADER)
+#define buzzdict_slot_data(dt, s) ((s) + (dt)->data_off)
+
+/*
+ * Spreads the given hash over the full 32 bits. The integer hash
+ * functions return the key itself, so the high bits must be mixed
+ * in before the table takes the top bits as slot index (Fibonacci
+ * hashing).
+ */
+#define buzzdict_spread(h) ((uint32_t)(h) * 2654435769u)
+
+/*
+ * Returns the home slot of the given spread hash.
+ */
+#define buzzdict_home(dt, h) ((dt)->shift < 32 ? (h) >> (dt)->shift : 0)
+
+/*
+ * Returns the number of bytes allocated for the slots.
+ */
+#define buzzdict_slot_bytes(dt) ((dt)->slots ? ((int64_t)(dt)->num_buckets + 2) * (dt)->slot_size : 0)
+
+/*
+ * Returns the number of bytes allocated for the dictionary.
+ */
+#define buzzdict_bytes(dt) ((int64_t)sizeof(struct buzzdict_s) + buzzdict_slot_bytes(dt))
+
+/****************************************/
+/****************************************/
+
+static void buzzdict_slots_alloc(buzzdict_t dt,
+                                 uint32_t num_buckets) {
+   /* Calculate the shift */
+   dt->num_buckets = num_buckets;
+   dt->shift = 32;
+   while(num_buckets > 1) { --dt->shift; num_buckets >>= 1; }
+   /*
+    * Allocate the slots, plus two scratch slots to build the new
+    * element and to swap displaced elements during insertion.
+    * calloc() marks all the slots as empty.
+    */
+   dt->slots = (uint8_t*)calloc((size_t)dt->num_buckets + 2, dt->slot_size);
+   if(!dt->slots) {
+      fprintf(stderr, "[FATAL] Can't allocate dictionary slots.\n");
+      abort();
+   }
+   buzzmem_charge(dt->mem, dt->memsys, buzzdict_slot_bytes(dt));
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Places the element stored in the given slot buffer, whose key is
+ * known not to be in the table. The buffer is overwritten.
+ */
+static void buzzdict_place(buzzdict_t dt,
+                           uint8_t* e) {
+   uint32_t mask = dt->num_buckets - 1;
+   uint32_t i = buzzdict_home(dt, buzzdict_slot_hash(e));
+   uint8_t* tmp = buzzdict_slot(dt, dt->num_buckets + 1);
+   buzzdict_slot_dist(e) = 1;
+   while(1) {
+      uint8_t* s = buzzdict_slot(dt, i);
+      /* Empty slot? Then we're done */
+      if(buzzdict_slot_dist(s) == 0) {
+         memcpy(s, e, dt->slot_size);
+         return;
+      }
+      /* Take the place of the element closer to its home and carry it along */
+      if(buzzdict_slot_dist(s) < buzzdict_slot_dist(e)) {
+         memcpy(tmp, s, dt->slot_size);
+         memcpy(s, e, dt->slot_size);
+         memcpy(e, tmp, dt->slot_size);
+      }
+      ++buzzdict_slot_dist(e);
+      i = (i + 1) & mask;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzdict_resize(buzzdict_t dt,
+                            uint32_t num_buckets) {
+   /* Keep the old slots */
+   uint8_t* old = dt->slots;
+   uint32_t oldnum = dt->num_buckets;
+   uint32_t oldsz = dt->slot_size;
+   /* Make new slots */
+   buzzdict_slots_alloc(dt, num_buckets);
+   /* Move the elements over, reusing the stored hashes */
+   uint32_t i;
+   for(i = 0; i < oldnum; ++i) {
+      uint8_t* s = old + (size_t)i * oldsz;
+      if(buzzdict_slot_dist(s) != 0)
+         buzzdict_place(dt, s);
+   }
+   free(old);
+   buzzmem_charge(dt->mem, dt->memsys, -((int64_t)oldnum + 2) * oldsz);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Looks for the slot holding the given key.
+ * Returns the slot index, or -1 if the key is not found.
+ */
+static int64_t buzzdict_find(buzzdict_t dt,
+                             const void* key,
+                             uint32_t h) {
+   if(!dt->slots) return -1;
+   uint32_t mask = dt->num_buckets - 1;
+   uint32_t i = buzzdict_home(dt, h);
+   uint32_t d = 1;
+   while(1) {
+      const uint8_t* s = buzzdict_slot(dt, i);
+      /*
+       * An empty slot, or an element closer to its home than we
+       * are to ours, means the key is not in the table
+       */
+      if(buzzdict_slot_dist(s) < d) return -1;
+      if(buzzdict_slot_hash(s) == h &&
+         dt->keycmpf(key, buzzdict_slot_key(s)) == 0)
+         return i;
+      ++d;
+      i = (i + 1) & mask;
+   }
 }
 
 /****************************************/
@@ -34,15 +175,18 @@ buzzdict_t buzzdict_new(uint32_t buckets,
    /* Create new dict. calloc() zeroes everything */
    buzzdict_t dt = (buzzdict_t)calloc(1, sizeof(struct buzzdict_s));
    /* Fill in the info */
-   dt->num_buckets = buckets;
    dt->hashf = hashf;
    dt->keycmpf = keycmpf;
-   dt->dstryf = dstryf ? dstryf : buzzdict_entry_destroy;
+   dt->dstryf = dstryf;
    dt->key_size = key_size;
    dt->data_size = data_size;
-   /* Create buckets. Unused buckets are NULL by default. */
-   dt->buckets = (buzzdarray_t*)calloc(dt->num_buckets, sizeof(buzzdarray_t*));
-   /* All done */
+   dt->data_off = BUZZDICT_SLOT_HEADER + BUZZDICT_ALIGN(key_size);
+   dt->slot_size = dt->data_off + BUZZDICT_ALIGN(data_size);
+   /* Round the initial number of slots to a power of two */
+   dt->min_buckets = BUZZDICT_MIN_BUCKETS;
+   while(dt->min_buckets < buckets) dt->min_buckets <<= 1;
+   dt->num_buckets = dt->min_buckets;
+   /* The slots are allocated on first insertion */
    return dt;
 }
 
@@ -50,22 +194,18 @@ buzzdict_t buzzdict_new(uint32_t buckets,
 /****************************************/
 
 void buzzdict_destroy(buzzdict_t* dt) {
-   /* Destroy buckets */
-   uint32_t i, j;
-   for(i = 0; i < (*dt)->num_buckets; ++i) {
-      /* Is the bucket used? */
-      if((*dt)->buckets[i] != NULL) {
-         /* Destroy elements in the bucket */
-         for(j = 0; j < buzzdarray_size((*dt)->buckets[i]); ++j) {
-            const struct buzzdict_entry_s* e = &buzzdarray_get((*dt)->buckets[i], j, struct buzzdict_entry_s);
-            (*dt)->dstryf(e->key, e->data, *dt);
-         }
-         /* Destroy bucket */
-         buzzdarray_destroy(&((*dt)->buckets[i]));
+   /* Destroy elements */
+   if((*dt)->dstryf) {
+      uint32_t i;
+      for(i = 0; (*dt)->slots && i < (*dt)->num_buckets; ++i) {
+         uint8_t* s = buzzdict_slot(*dt, i);
+         if(buzzdict_slot_dist(s) != 0)
+            (*dt)->dstryf(buzzdict_slot_key(s), buzzdict_slot_data(*dt, s), *dt);
       }
    }
-   free((*dt)->buckets);
    /* Destroy the rest */
+   buzzmem_charge((*dt)->mem, (*dt)->memsys, -buzzdict_bytes(*dt));
+   free((*dt)->slots);
    free(*dt);
    *dt = NULL;
 }
@@ -75,18 +215,9 @@ void buzzdict_destroy(buzzdict_t* dt) {
 
 void* buzzdict_rawget(buzzdict_t dt,
                       const void* key) {
-   /* Hash the key */
-   uint32_t h = dt->hashf(key) % dt->num_buckets, i;
-   /* Is the bucket empty? */
-   if(!dt->buckets[h]) return NULL;
-   /* Bucket not empty - is the entry present? */
-   for(i = 0; i < buzzdarray_size(dt->buckets[h]); ++i) {
-      const struct buzzdict_entry_s* e = &buzzdarray_get(dt->buckets[h], i, struct buzzdict_entry_s);
-      if(dt->keycmpf(key, e->key) == 0)
-         return e->data;
-   }
-   /* Entry not found */
-   return NULL;
+   int64_t i = buzzdict_find(dt, key, buzzdict_spread(dt->hashf(key)));
+   if(i < 0) return NULL;
+   return buzzdict_slot_data(dt, buzzdict_slot(dt, i));
 }
 
 /****************************************/
@@ -96,36 +227,30 @@ void buzzdict_set(buzzdict_t dt,
                   const void* key,
                   const void* data) {
    /* Hash the key */
-   uint32_t h = dt->hashf(key) % dt->num_buckets;
-   /* Is the bucket empty? */
-   if(!dt->buckets[h]) {
-      /* Create new entry list */
-      dt->buckets[h] = buzzdarray_new(1, sizeof(struct buzzdict_entry_s), NULL);
-      /* Add entry */
-      buzzdict_entry_new(dt, e, key, data);
-      buzzdarray_push(dt->buckets[h], &e);
-      /* Increase size */
-      ++(dt->size);
-   }
-   else {
-      /* Bucket not empty - is the entry present? */
-      uint32_t i;
-      for(i = 0; i < buzzdarray_size(dt->buckets[h]); ++i) {
-         const struct buzzdict_entry_s* e = &buzzdarray_get(dt->buckets[h], i, struct buzzdict_entry_s);
-         if(dt->keycmpf(key, e->key) == 0) {
-            /* Yes, destroy the entry */
-            dt->dstryf(e->key, e->data, dt);
-            buzzdarray_remove(dt->buckets[h], i);
-            --(dt->size);
-            break;
-         }
-      }
-      /* Add new entry */
-      buzzdict_entry_new(dt, e, key, data);
-      buzzdarray_push(dt->buckets[h], &e);
-      /* Increase size */
-      ++(dt->size);
+   uint32_t h = buzzdict_spread(dt->hashf(key));
+   /* Is the entry present? */
+   int64_t i = buzzdict_find(dt, key, h);
+   if(i >= 0) {
+      /* Yes, destroy the old entry and overwrite it */
+      uint8_t* s = buzzdict_slot(dt, i);
+      if(dt->dstryf)
+         dt->dstryf(buzzdict_slot_key(s), buzzdict_slot_data(dt, s), dt);
+      memcpy(buzzdict_slot_key(s), key, dt->key_size);
+      memcpy(buzzdict_slot_data(dt, s), data, dt->data_size);
+      return;
    }
+   /* Make room for the new entry, keeping the load factor below 3/4 */
+   if(!dt->slots)
+      buzzdict_slots_alloc(dt, dt->num_buckets);
+   else if((dt->size + 1) * 4 > dt->num_buckets * 3)
+      buzzdict_resize(dt, dt->num_buckets * 2);
+   /* Build the new entry in the scratch slot and place it */
+   uint8_t* e = buzzdict_slot(dt, dt->num_buckets);
+   buzzdict_slot_hash(e) = h;
+   memcpy(buzzdict_slot_key(e), key, dt->key_size);
+   memcpy(buzzdict_slot_data(dt, e), data, dt->data_size);
+   buzzdict_place(dt, e);
+   ++(dt->size);
 }
 
 /****************************************/
@@ -133,28 +258,48 @@ void buzzdict_set(buzzdict_t dt,
 
 int buzzdict_remove(buzzdict_t dt,
                     const void* key) {
-   /* Hash the key */
-   uint32_t h = dt->hashf(key) % dt->num_buckets, i;
-   /* Is the bucket empty? */
-   if(!dt->buckets[h]) return 0;
-   /* Bucket not empty - is the entry present? */
-   for(i = 0; i < buzzdarray_size(dt->buckets[h]); ++i) {
-      const struct buzzdict_entry_s* e = &buzzdarray_get(dt->buckets[h], i, struct buzzdict_entry_s);
-      if(dt->keycmpf(key, e->key) == 0) {
-         /* Entry found - remove it */
-         dt->dstryf(e->key, e->data, dt);
-         buzzdarray_remove(dt->buckets[h], i);
-         /* Is the entry list empty? If so, free the memory */
-         if(buzzdarray_isempty(dt->buckets[h]))
-            buzzdarray_destroy(&(dt->buckets[h]));
-         /* Increase size */
-         --(dt->size);
-         /* Done */
-         return 1;
-      }
+   /* Is the entry present? */
+   int64_t i = buzzdict_find(dt, key, buzzdict_spread(dt->hashf(key)));
+   if(i < 0) return 0;
+   /* Entry found - destroy it */
+   uint8_t* s = buzzdict_slot(dt, i);
+   if(dt->dstryf)
+      dt->dstryf(buzzdict_slot_key(s), buzzdict_slot_data(dt, s), dt);
+   /*
+    * Shift the following elements back by one slot until an empty
+    * slot or an element at its home is found. This keeps the probe
+    * sequences intact without tombstones.
+    */
+   uint32_t mask = dt->num_buckets - 1;
+   uint32_t j = (i + 1) & mask;
+   uint8_t* n = buzzdict_slot(dt, j);
+   while(buzzdict_slot_dist(n) > 1) {
+      memcpy(s, n, dt->slot_size);
+      --buzzdict_slot_dist(s);
+      s = n;
+      j = (j + 1) & mask;
+      n = buzzdict_slot(dt, j);
    }
-   /* Entry not found, nothing to do */
-   return 0;
+   buzzdict_slot_dist(s) = 0;
+   --(dt->size);
+   /* Shrink the table when it is mostly empty */
+   if(dt->num_buckets > dt->min_buckets &&
+      dt->size * 8 < dt->num_buckets)
+      buzzdict_resize(dt, dt->num_buckets / 2);
+   /* Done */
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzdict_account(buzzdict_t dt,
+                      buzzmem_t mem,
+                      uint32_t sys) {
+   buzzmem_charge(dt->mem, dt->memsys, -buzzdict_bytes(dt));
+   dt->mem = mem;
+   dt->memsys = sys;
+   buzzmem_charge(dt->mem, dt->memsys, buzzdict_bytes(dt));
 }
 
 /****************************************/
@@ -163,18 +308,52 @@ int buzzdict_remove(buzzdict_t dt,
 void buzzdict_foreach(buzzdict_t dt,
                       buzzdict_elem_funp fun,
                       void* params) {
-   /* Go through buckets */
-   uint32_t i, j;
+   if(!dt->slots || dt->size == 0) return;
+   /*
+    * The function might add or remove elements, which moves the others
+    * around the slots. Take a snapshot of the hashes and the keys, and
+    * look each key up again before applying the function.
+    */
+   uint8_t local[BUZZDICT_FOREACH_LOCAL];
+   size_t n = 0, sz = (size_t)dt->size * dt->data_off;
+   uint8_t* keys = sz <= sizeof(local) ? local : (uint8_t*)malloc(sz);
+   if(!keys) {
+      fprintf(stderr, "[FATAL] Can't allocate dictionary iteration snapshot.\n");
+      abort();
+   }
+   uint32_t i;
    for(i = 0; i < dt->num_buckets; ++i) {
-      /* Is the bucket used? */
-      if(dt->buckets[i] != NULL) {
-         /* Go through elements in the bucket */
-         for(j = 0; j < buzzdarray_size(dt->buckets[i]); ++j) {
-            const struct buzzdict_entry_s* e = &buzzdarray_get(dt->buckets[i], j, struct buzzdict_entry_s);
-            fun(e->key, e->data, params);
-         }
+      uint8_t* s = buzzdict_slot(dt, i);
+      if(buzzdict_slot_dist(s) != 0) {
+         memcpy(keys + n * dt->data_off, s, dt->data_off);
+         ++n;
+      }
+   }
+   /* Go through the keys still in the dictionary */
+   size_t j;
+   for(j = 0; j < n; ++j) {
+      uint8_t* k = keys + j * dt->data_off;
+      int64_t f = buzzdict_find(dt, buzzdict_slot_key(k), buzzdict_slot_hash(k));
+      if(f >= 0) {
+         uint8_t* s = buzzdict_slot(dt, f);
+         fun(buzzdict_slot_key(s), buzzdict_slot_data(dt, s), params);
       }
    }
+   if(keys != local) free(keys);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzdict_scan(buzzdict_t dt,
+                   buzzdict_elem_funp fun,
+                   void* params) {
+   uint32_t i;
+   for(i = 0; dt->slots && i < dt->num_buckets; ++i) {
+      uint8_t* s = buzzdict_slot(dt, i);
+      if(buzzdict_slot_dist(s) != 0)
+         fun(buzzdict_slot_key(s), buzzdict_slot_data(dt, s), params);
+   }
 }
 
 /****************************************/
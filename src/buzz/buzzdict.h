@@ -7,10 +7,6 @@
 extern "C" {
 #endif
 
-   // TODO
-   // CONSIDER USING BRENT'S VARIATION ON HASH COLLISION SOLVING
-   // TODO
-
    /*
     * Function pointer for an element-wise function:
     *
@@ -18,7 +14,9 @@ extern "C" {
     *
     * This function pointer is used to destroy elements by
     * buzzdict_destroy() and in methods such as
-    * buzzdict_foreach().
+    * buzzdict_foreach(). Since keys and data are stored in the
+    * dictionary, a destroy function must release only what they
+    * refer to, never the key and data pointers themselves.
     */
    typedef void (*buzzdict_elem_funp)(const void* key, void* data, void* params);
 
@@ -43,22 +41,42 @@ extern "C" {
 
    /*
     * The Buzz dictionary.
+    *
+    * The dictionary is an open-addressing hash table with Robin Hood
+    * probing. Keys and data are stored inline in the slots, so the
+    * pointers passed to the element functions and returned by
+    * buzzdict_rawget() point into the table. They are valid until the
+    * next call to buzzdict_set() or buzzdict_remove().
+    *
+    * Each slot is laid out as follows:
+    * - uint32_t: probe distance + 1, or 0 if the slot is empty
+    * - uint32_t: the spread hash of the key
+    * - the key, padded to a multiple of 8 bytes
+    * - the data, padded to a multiple of 8 bytes
     */
    struct buzzdict_s {
-      buzzdarray_t* buckets;     // Bucket data
+      uint8_t* slots;            // Slot data, allocated on first insertion
       uint32_t size;             // Number of inserted elements
-      uint32_t num_buckets;      // Number of buckets
+      uint32_t num_buckets;      // Number of slots, a power of two
+      uint32_t min_buckets;      // Number of slots the table never shrinks below
+      uint32_t shift;            // Shift that maps a spread hash to a slot
       buzzdict_hashfunp hashf;   // Key hashing function
       buzzdict_key_cmpp keycmpf; // Key comparison function
       buzzdict_elem_funp dstryf; // Element destroy function
       uint32_t key_size;         // Key size in bytes
       uint32_t data_size;        // Data size in bytes
+      uint32_t data_off;         // Offset of the data in a slot
+      uint32_t slot_size;        // Slot size in bytes
+      buzzmem_t mem;             // Memory accounting, or NULL
+      uint32_t memsys;           // Subsystem charged for the memory
    };
    typedef struct buzzdict_s* buzzdict_t;
 
    /*
     * Create a new dictionary.
-    * @param buckets The number of buckets.
+    * The table grows and shrinks automatically as elements are
+    * added and removed.
+    * @param buckets The initial number of slots, rounded up to a power of two.
     * @param key_size The size of a key.
     * @param data_size The size of a data element.
     * @param hashf The function to hash the keys.
@@ -91,6 +109,8 @@ extern "C" {
 
    /*
     * Sets a (key, data) pair.
+    * If the key is already present, the old element is destroyed
+    * and replaced.
     * @param dt The dictionary.
     * @param key The key.
     * @param data The data.
@@ -109,16 +129,47 @@ extern "C" {
    extern int buzzdict_remove(buzzdict_t dt,
                               const void* key);
 
+   /*
+    * Charges the memory of the dictionary to the given subsystem.
+    * The memory already charged elsewhere is moved over, and
+    * resizes are charged from now on.
+    * @param dt The dictionary.
+    * @param mem The memory accounting, or NULL to stop accounting.
+    * @param sys The subsystem (a buzzmem_sys value).
+    */
+   extern void buzzdict_account(buzzdict_t dt,
+                                buzzmem_t mem,
+                                uint32_t sys);
+
    /*
     * Applies the given function to each element in the dictionary.
+    * The function may add and remove elements: the walk goes through
+    * the keys present when it started, each once, and skips those
+    * removed in the meantime. The keys added during the walk are not
+    * visited. Since the keys are compared again, the keys removed by
+    * the function must stay valid until the walk is over.
     * @param dt The dictionary.
     * @param fun The function.
     * @param params A buffer to pass along.
+    * @see buzzdict_scan
     */
    extern void buzzdict_foreach(buzzdict_t dt,
                                 buzzdict_elem_funp fun,
                                 void* params);
 
+   /*
+    * Applies the given function to each element in the dictionary, in
+    * slot order.
+    * This is faster than buzzdict_foreach(), but the function must not
+    * add or remove elements.
+    * @param dt The dictionary.
+    * @param fun The function.
+    * @param params A buffer to pass along.
+    */
+   extern void buzzdict_scan(buzzdict_t dt,
+                             buzzdict_elem_funp fun,
+                             void* params);
+
    /*
     * Hash functions for strings.
     * This is the djb2() hash function presented in
@@ -2,28 +2,106 @@
 #include "buzzvm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
 
 /****************************************/
 /****************************************/
 
-#define BUZZHEAP_GC_INIT_MAXOBJS 1
+#define BUZZHEAP_GC_NURSERY        1000
+#define BUZZHEAP_GC_INIT_THRESHOLD 1000
+#define BUZZHEAP_GC_GROWTH         2.0f
+#define BUZZHEAP_GC_MAX_PAUSE      0
+#define BUZZHEAP_GC_DEADLINE       0
+
+/* Number of allocations between two slices of an incremental collection */
+#define BUZZHEAP_GC_SLICE_ALLOCS 256
+
+/* Number of objects and references processed between two checks of the time budget */
+#define BUZZHEAP_GC_CHECK_EVERY 256
+
+/* Total number of objects in the heap */
+#define buzzheap_count(h) (buzzdarray_size((h)->objs) + buzzdarray_size((h)->young) + buzzdarray_size((h)->sweeping))
+
+/* Number of objects per slab chunk */
+#define BUZZHEAP_SLAB_CHUNK 256
+
+/****************************************/
+/****************************************/
+
+/*
+ * Shared immutable objects: nil, followed by the small integers.
+ * These objects live outside the heap, so the collector never
+ * touches them and pushing them costs no allocation. They are marked
+ * as old so that storing them never triggers the write barrier.
+ */
+#define BUZZHEAP_INT1(n)   { .i = { BUZZTYPE_INT, BUZZHEAP_OLD, (n) } }
+#define BUZZHEAP_INT4(n)   BUZZHEAP_INT1(n),   BUZZHEAP_INT1((n)+1),   BUZZHEAP_INT1((n)+2),   BUZZHEAP_INT1((n)+3)
+#define BUZZHEAP_INT16(n)  BUZZHEAP_INT4(n),   BUZZHEAP_INT4((n)+4),   BUZZHEAP_INT4((n)+8),   BUZZHEAP_INT4((n)+12)
+#define BUZZHEAP_INT64(n)  BUZZHEAP_INT16(n),  BUZZHEAP_INT16((n)+16), BUZZHEAP_INT16((n)+32), BUZZHEAP_INT16((n)+48)
+#define BUZZHEAP_INT256(n) BUZZHEAP_INT64(n),  BUZZHEAP_INT64((n)+64), BUZZHEAP_INT64((n)+128), BUZZHEAP_INT64((n)+192)
+
+static const union buzzobj_u BUZZHEAP_SHARED[] = {
+   { .n = { BUZZTYPE_NIL, BUZZHEAP_OLD } },
+   BUZZHEAP_INT256(-256),
+   BUZZHEAP_INT256(0),
+   BUZZHEAP_INT256(256),
+   BUZZHEAP_INT256(512),
+   BUZZHEAP_INT256(768)
+};
+
+#define BUZZHEAP_SHARED_COUNT (sizeof(BUZZHEAP_SHARED) / sizeof(union buzzobj_u))
+
+/*
+ * Returns 1 if the passed object is one of the shared objects.
+ */
+#define buzzheap_isshared(o) ((uintptr_t)((const union buzzobj_u*)(o) - BUZZHEAP_SHARED) < BUZZHEAP_SHARED_COUNT)
 
 /****************************************/
 /****************************************/
 
-void buzzheap_destroy_obj(uint32_t pos, void* data, void* params) {
-   buzzobj_destroy((buzzobj_t*)data);
+/*
+ * Releases an object and returns its memory to the heap slab.
+ */
+static void buzzheap_obj_free(buzzheap_t h,
+                              buzzobj_t o) {
+   buzzobj_release(o);
+   buzzslab_free(h->objslab, o);
+}
+
+void buzzheap_release_obj(uint32_t pos, void* data, void* params) {
+   buzzobj_release(*(buzzobj_t*)data);
 }
 
 buzzheap_t buzzheap_new() {
    /* Create heap state */
    buzzheap_t h = (buzzheap_t)malloc(sizeof(struct buzzheap_s));
-   /* Create object list */
-   h->objs = buzzdarray_new(10, sizeof(buzzobj_t), buzzheap_destroy_obj);
+   /* Create object lists */
+   h->objs = buzzdarray_new(10, sizeof(buzzobj_t), NULL);
+   h->young = buzzdarray_new(BUZZHEAP_GC_NURSERY, sizeof(buzzobj_t), NULL);
+   h->remembered = buzzdarray_new(10, sizeof(buzzobj_t), NULL);
+   h->gray = buzzdarray_new(10, sizeof(buzzobj_t), NULL);
+   h->sweeping = buzzdarray_new(10, sizeof(buzzobj_t), NULL);
+   /* Create the slab for the object memory */
+   h->objslab = buzzslab_new(sizeof(union buzzobj_u), BUZZHEAP_SLAB_CHUNK);
+   /* Initialize the GC policy */
+   h->policy.nursery = BUZZHEAP_GC_NURSERY;
+   h->policy.init_threshold = BUZZHEAP_GC_INIT_THRESHOLD;
+   h->policy.growth = BUZZHEAP_GC_GROWTH;
+   h->policy.max_pause = BUZZHEAP_GC_MAX_PAUSE;
+   h->policy.deadline = BUZZHEAP_GC_DEADLINE;
    /* Initialize GC max object threshold */
-   h->max_objs = BUZZHEAP_GC_INIT_MAXOBJS;
+   h->max_objs = h->policy.init_threshold;
+   h->gcpending = BUZZHEAP_GC_NONE;
+   h->gcphase = BUZZHEAP_PHASE_IDLE;
+   h->dirtyroots = 0;
+   h->sliceallocs = 0;
+   h->mem = NULL;
    /* Initialize the marker */
    h->marker = 0;
+   /* Initialize the GC statistics */
+   memset(&h->stats, 0, sizeof(struct buzzheap_stats_s));
    /* All done */
    return h;
 }
@@ -32,8 +110,20 @@ buzzheap_t buzzheap_new() {
 /****************************************/
 
 void buzzheap_destroy(buzzheap_t* h) {
-   /* Get rid of object list */
+   /* Release the charged memory */
+   buzzmem_charge((*h)->mem, BUZZMEM_HEAP, -(int64_t)sizeof(struct buzzheap_s));
+   /* Release the resources held by the objects */
+   buzzdarray_foreach((*h)->objs, buzzheap_release_obj, NULL);
+   buzzdarray_foreach((*h)->young, buzzheap_release_obj, NULL);
+   buzzdarray_foreach((*h)->sweeping, buzzheap_release_obj, NULL);
+   /* Get rid of object lists */
    buzzdarray_destroy(&((*h)->objs));
+   buzzdarray_destroy(&((*h)->young));
+   buzzdarray_destroy(&((*h)->remembered));
+   buzzdarray_destroy(&((*h)->gray));
+   buzzdarray_destroy(&((*h)->sweeping));
+   /* Get rid of the object memory */
+   buzzslab_destroy(&((*h)->objslab));
    /* Get rid of heap state */
    free(*h);
    /* Set heap to NULL */
@@ -43,14 +133,67 @@ void buzzheap_destroy(buzzheap_t* h) {
 /****************************************/
 /****************************************/
 
+void buzzheap_account(buzzheap_t h,
+                      buzzmem_t mem) {
+   buzzmem_charge(h->mem, BUZZMEM_HEAP, -(int64_t)sizeof(struct buzzheap_s));
+   h->mem = mem;
+   buzzmem_charge(h->mem, BUZZMEM_HEAP, sizeof(struct buzzheap_s));
+   buzzdarray_account(h->objs, mem, BUZZMEM_HEAP);
+   buzzdarray_account(h->young, mem, BUZZMEM_HEAP);
+   buzzdarray_account(h->remembered, mem, BUZZMEM_HEAP);
+   buzzdarray_account(h->gray, mem, BUZZMEM_HEAP);
+   buzzdarray_account(h->sweeping, mem, BUZZMEM_HEAP);
+   buzzslab_account(h->objslab, mem, BUZZMEM_HEAP);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Adds a new object to the nursery and checks whether collection
+ * work is due: an emergency collection when the memory is over the
+ * limit, a minor collection when the nursery is full, or the next
+ * slice of the major collection in progress.
+ * Collection is not performed here, because the caller might still
+ * hold unreachable objects; it is deferred to buzzheap_gc().
+ */
+static void buzzheap_track(buzzheap_t h,
+                           buzzobj_t o) {
+   buzzdarray_push(h->young, &o);
+   if(h->gcpending != BUZZHEAP_GC_NONE) return;
+   if(h->mem && buzzmem_over(h->mem))
+      h->gcpending = BUZZHEAP_GC_FULL;
+   else if(h->gcphase != BUZZHEAP_PHASE_IDLE) {
+      if(++h->sliceallocs >= BUZZHEAP_GC_SLICE_ALLOCS)
+         h->gcpending = BUZZHEAP_GC_MAJOR;
+   }
+   else if(buzzdarray_size(h->young) >= h->policy.nursery)
+      h->gcpending = BUZZHEAP_GC_MINOR;
+}
+
+/*
+ * Returns the marker for a new object.
+ * While a major collection is marking, new objects start unmarked,
+ * so that the ones that are not reachable at the end of marking
+ * are freed.
+ */
+#define buzzheap_newmarker(h) ((h)->gcphase == BUZZHEAP_PHASE_MARK ? (((h)->marker - 1) & BUZZHEAP_MARKER) : (h)->marker)
+
 buzzobj_t buzzheap_newobj(buzzvm_t vm,
                           uint16_t type) {
-   /* Create a new object. calloc() fills it with zeroes */
-   buzzobj_t o = buzzobj_new(type);
+   /* Create a new object in the slab, filled with zeroes */
+   buzzobj_t o = (buzzobj_t)buzzslab_alloc(vm->heap->objslab);
+   memset(o, 0, sizeof(union buzzobj_u));
+   buzzobj_init(o, type);
+   /* Charge the structures of tables and closures */
+   if(type == BUZZTYPE_TABLE)
+      buzzdict_account(o->t.value, vm->heap->mem, BUZZMEM_HEAP);
+   else if(type == BUZZTYPE_CLOSURE)
+      buzzdarray_account(o->c.value.actrec, vm->heap->mem, BUZZMEM_HEAP);
    /* Set the object marker */
-   o->o.marker = vm->heap->marker;
+   o->o.marker = buzzheap_newmarker(vm->heap);
    /* Add object to list */
-   buzzdarray_push(vm->heap->objs, &o);
+   buzzheap_track(vm->heap, o);
    /* All done */
    return o;
 }
@@ -58,23 +201,56 @@ buzzobj_t buzzheap_newobj(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
+buzzobj_t buzzheap_newnil(buzzvm_t vm) {
+   return (buzzobj_t)BUZZHEAP_SHARED;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t buzzheap_newint(buzzvm_t vm,
+                          int32_t v) {
+   /* Small values are shared */
+   if(v >= BUZZHEAP_SMALLINT_MIN && v <= BUZZHEAP_SMALLINT_MAX)
+      return (buzzobj_t)(BUZZHEAP_SHARED + 1 + (v - BUZZHEAP_SMALLINT_MIN));
+   /* Other values are allocated */
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = v;
+   return o;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t buzzheap_newfloat(buzzvm_t vm,
+                            float v) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_FLOAT);
+   o->f.value = v;
+   return o;
+}
+
+/****************************************/
+/****************************************/
+
 struct buzzheap_clone_tableelem_s {
    buzzvm_t vm;
-   buzzdict_t t;
+   buzzobj_t t;
 };
 
 void buzzheap_clone_tableelem(const void* key, void* data, void* params) {
    struct buzzheap_clone_tableelem_s* p = (struct buzzheap_clone_tableelem_s*)params;
    buzzobj_t k = buzzheap_clone(p->vm, *(buzzobj_t*)key);
    buzzobj_t d = buzzheap_clone(p->vm, *(buzzobj_t*)data);
-   buzzdict_set(p->t, &k, &d);
+   buzztable_put(p->vm, p->t, k, d);
 }
 
 buzzobj_t buzzheap_clone(buzzvm_t vm, const buzzobj_t o) {
-   buzzobj_t x = (buzzobj_t)malloc(sizeof(union buzzobj_u));
+   /* Immutable objects can be shared */
+   if(buzzheap_isshared(o)) return o;
+   buzzobj_t x = (buzzobj_t)buzzslab_alloc(vm->heap->objslab);
    x->o.type = o->o.type;
-   x->o.marker = o->o.marker;
-   buzzdarray_push(vm->heap->objs, &x);
+   x->o.marker = buzzheap_newmarker(vm->heap);
+   buzzheap_track(vm->heap, x);
    switch(o->o.type) {
       case BUZZTYPE_NIL: {
          return x;
@@ -110,11 +286,15 @@ buzzobj_t buzzheap_clone(buzzvm_t vm, const buzzobj_t o) {
                                    orig->hashf,
                                    orig->keycmpf,
                                    orig->dstryf);
+         buzzdict_account(x->t.value, vm->heap->mem, BUZZMEM_HEAP);
+         x->t.array = NULL;
+         x->t.acount = 0;
+         x->t.shape = 0;
          struct buzzheap_clone_tableelem_s p = {
             .vm = vm,
-            .t = x->t.value
+            .t = x
          };
-         buzzdict_foreach(orig, buzzheap_clone_tableelem, &p);
+         buzztable_foreach(vm, o, buzzheap_clone_tableelem, &p);
          return x;
       }
       default:
@@ -126,27 +306,61 @@ buzzobj_t buzzheap_clone(buzzvm_t vm, const buzzobj_t o) {
 /****************************************/
 /****************************************/
 
+/*
+ * Marks the objects referenced by the given object.
+ */
+static void buzzheap_obj_markrefs(buzzobj_t o,
+                                  buzzvm_t vm) {
+   if(o->o.type == BUZZTYPE_TABLE) {
+      if(o->t.array)
+         buzzdarray_foreach(o->t.array,
+                            buzzheap_darrayobj_mark,
+                            vm);
+      buzzdict_scan(o->t.value,
+                    buzzheap_dictobj_mark,
+                    vm);
+   }
+   else if(o->o.type == BUZZTYPE_CLOSURE)
+      buzzdarray_foreach(o->c.value.actrec,
+                         buzzheap_darrayobj_mark,
+                         vm);
+   else if(o->o.type == BUZZTYPE_UPVALUE && o->v.value.data)
+      buzzheap_obj_mark(o->v.value.data, vm);
+}
+
 void buzzheap_obj_mark(buzzobj_t o,
                        buzzvm_t vm) {
+   buzzheap_t h = vm->heap;
+   /* Shared objects are not part of the heap */
+   if(buzzheap_isshared(o)) return;
    /*
     * Nothing to do if the object is already marked
     * This avoids infinite looping when cycles are present
     */
-   if(o->o.marker == vm->heap->marker) return;
-   /* Update marker */
-   o->o.marker = vm->heap->marker;
-   /* Take care of composite types */
-   if(o->o.type == BUZZTYPE_TABLE)
-      buzzdict_foreach(o->t.value,
-                       buzzheap_dictobj_mark,
-                       vm);
-   else if(o->o.type == BUZZTYPE_CLOSURE)
-      buzzdarray_foreach(o->c.value.actrec,
-                         buzzheap_darrayobj_mark,
-                         vm);
-   else if(o->o.type == BUZZTYPE_STRING)
-      buzzstrman_gc_mark(vm->strings,
-                         o->s.value.sid);
+   if(h->gcphase == BUZZHEAP_PHASE_MINOR) {
+      /*
+       * A minor collection considers old objects alive and does not
+       * go through them; their references to young objects are found
+       * through the remembered set
+       */
+      if(o->o.marker & (BUZZHEAP_OLD | BUZZHEAP_FLAG)) return;
+      o->o.marker |= BUZZHEAP_FLAG;
+      /* Take care of composite types */
+      buzzheap_obj_markrefs(o, vm);
+   }
+   else {
+      if((o->o.marker & BUZZHEAP_MARKER) == h->marker) return;
+      o->o.marker = (o->o.marker & ~BUZZHEAP_MARKER) | h->marker;
+      /* Strings are only collected by a major collection */
+      if(o->o.type == BUZZTYPE_STRING)
+         buzzstrman_gc_mark(vm->strings,
+                            o->s.value.sid);
+      /* Composite types are gone through later */
+      else if(o->o.type == BUZZTYPE_TABLE ||
+              o->o.type == BUZZTYPE_CLOSURE ||
+              o->o.type == BUZZTYPE_UPVALUE)
+         buzzdarray_push(h->gray, &o);
+   }
 }
 
 void buzzheap_dictobj_mark(const void* key, void* data, void* params) {
@@ -158,16 +372,8 @@ void buzzheap_darrayobj_mark(uint32_t pos, void* data, void* params) {
    buzzheap_obj_mark(*(buzzobj_t*)data, (buzzvm_t)params);
 }
 
-void buzzheap_stack_mark(uint32_t pos, void* data, void* params) {
-   buzzdarray_foreach(*(buzzdarray_t*)data,
-                      buzzheap_darrayobj_mark,
-                      params);
-}
-
-void buzzheap_lsyms_mark(uint32_t pos, void* data, void* params) {
-   buzzdarray_foreach((*(buzzvm_lsyms_t*)data)->syms,
-                      buzzheap_darrayobj_mark,
-                      params);
+void buzzheap_frame_mark(uint32_t pos, void* data, void* params) {
+   buzzheap_obj_mark(((buzzvm_frame_t*)data)->closure, (buzzvm_t)params);
 }
 
 void buzzheap_vstigobj_mark(const void* key, void* data, void* params) {
@@ -181,55 +387,406 @@ void buzzheap_vstig_mark(const void* key, void* data, void* params) {
       buzzheap_obj_mark(vstig->onconflict, params);
    if(vstig->onconflictlost)
       buzzheap_obj_mark(vstig->onconflictlost, params);
-   buzzvstig_foreach_elem(vstig,
-                          buzzheap_vstigobj_mark,
-                          params);
+   buzzdict_scan(vstig->data,
+                 buzzheap_vstigobj_mark,
+                 params);
 }
 
 void buzzheap_listener_mark(const void* key, void* data, void* params) {
-   buzzstrman_gc_mark(((buzzvm_t)params)->strings, *(uint16_t*)key);
+   if(((buzzvm_t)params)->heap->gcphase != BUZZHEAP_PHASE_MINOR)
+      buzzstrman_gc_mark(((buzzvm_t)params)->strings, *(uint32_t*)key);
    buzzheap_obj_mark(*(buzzobj_t*)data, params);
 }
 
-void buzzheap_gsymobj_mark(const void* key, void* data, void* params) {
-   buzzheap_obj_mark(*(buzzobj_t*)data, params);
+void buzzheap_gsym_mark(const void* key, void* data, void* params) {
+   buzzstrman_gc_mark(((buzzvm_t)params)->strings, *(uint32_t*)key);
 }
 
-void buzzheap_gc(struct buzzvm_s* vm) {
-   buzzheap_t h = vm->heap;
-   /* Is GC necessary? */
-   if(buzzdarray_size(h->objs) < h->max_objs) return;
-   /* Increase the marker */
-   ++h->marker;
-   /* Prepare string gc */
-   buzzstrman_gc_clear(vm->strings);
+void buzzheap_remembered_mark(uint32_t pos, void* data, void* params) {
+   buzzheap_obj_markrefs(*(buzzobj_t*)data, params);
+}
+
+int buzzheap_remembered_forget(uint32_t pos, void* data, void* params) {
+   (*(buzzobj_t*)data)->o.marker &= ~BUZZHEAP_FLAG;
+   return 0;
+}
+
+int buzzheap_obj_sweep(uint32_t pos, void* data, void* params) {
+   buzzheap_t h = (buzzheap_t)params;
+   buzzobj_t o = *(buzzobj_t*)data;
+   /* Keep the object if the marker is set to the latest value */
+   if((o->o.marker & BUZZHEAP_MARKER) == h->marker) return 1;
+   /* Otherwise, free it */
+   buzzheap_obj_free(h, o);
+   return 0;
+}
+
+int buzzheap_young_sweep(uint32_t pos, void* data, void* params) {
+   buzzheap_t h = (buzzheap_t)params;
+   buzzobj_t o = *(buzzobj_t*)data;
+   /* Was the object reached? */
+   if(h->gcphase == BUZZHEAP_PHASE_MINOR ?
+      (o->o.marker & BUZZHEAP_FLAG) :
+      ((o->o.marker & BUZZHEAP_MARKER) == h->marker)) {
+      /* Yes, promote it to the old generation */
+      o->o.marker = BUZZHEAP_OLD | h->marker;
+      buzzdarray_push(h->objs, &o);
+   }
+   else {
+      /* No, free it */
+      buzzheap_obj_free(h, o);
+   }
+   /* The nursery is emptied */
+   return 0;
+}
+
+static uint64_t buzzheap_usec() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/*
+ * Returns 1 if the time budget of a collection slice is over.
+ * A budget of 0 means no limit.
+ */
+#define buzzheap_slice_over(start, budget) ((budget) > 0 && buzzheap_usec() - (start) >= (budget))
+
+/*
+ * Marks all the objects directly reachable from the VM.
+ */
+static void buzzheap_roots_mark(buzzvm_t vm) {
    /* Go through all the objects in the global symbols and mark them */
-   buzzdict_foreach(vm->gsyms, buzzheap_gsymobj_mark, vm);
+   buzzdict_scan(vm->gsyms, buzzheap_gsym_mark, vm);
+   buzzdarray_foreach(vm->gslots, buzzheap_darrayobj_mark, vm);
    /* Go through all the objects in the VM stack and mark them */
-   buzzdarray_foreach(vm->stacks, buzzheap_stack_mark, vm);
-   /* Go through all the objects in the local symbol stack and mark them */
-   buzzdarray_foreach(vm->lsymts, buzzheap_lsyms_mark, vm);
+   buzzdarray_foreach(vm->stack, buzzheap_darrayobj_mark, vm);
+   /* Go through all the objects in the local symbols and mark them */
+   buzzdarray_foreach(vm->lsyms, buzzheap_darrayobj_mark, vm);
+   /* Go through the running closures and the open upvalues and mark them */
+   buzzdarray_foreach(vm->frames, buzzheap_frame_mark, vm);
+   buzzdarray_foreach(vm->upvals, buzzheap_darrayobj_mark, vm);
    /* Go through all the objects in the virtual stigmergy and mark them */
-   buzzdict_foreach(vm->vstigs, buzzheap_vstig_mark, vm);
+   buzzdict_scan(vm->vstigs, buzzheap_vstig_mark, vm);
+   /* Go through all the objects in the listeners and mark them */
+   buzzdict_scan(vm->listeners, buzzheap_listener_mark, vm);
+   /* Go through all the objects in the out message queue and mark them */
+   buzzoutmsg_gc(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Collects the nursery.
+ */
+static void buzzheap_gc_minor(buzzvm_t vm) {
+   buzzheap_t h = vm->heap;
+   h->gcphase = BUZZHEAP_PHASE_MINOR;
+   /* Go through the young objects referenced by old objects and mark them */
+   buzzdarray_foreach(h->remembered, buzzheap_remembered_mark, vm);
+   /* Go through all the objects in the VM stack and mark them */
+   buzzdarray_foreach(vm->stack, buzzheap_darrayobj_mark, vm);
+   /* Go through all the objects in the local symbols and mark them */
+   buzzdarray_foreach(vm->lsyms, buzzheap_darrayobj_mark, vm);
+   /* Go through the running closures and the open upvalues and mark them */
+   buzzdarray_foreach(vm->frames, buzzheap_frame_mark, vm);
+   buzzdarray_foreach(vm->upvals, buzzheap_darrayobj_mark, vm);
    /* Go through all the objects in the listeners and mark them */
-   buzzdict_foreach(vm->listeners, buzzheap_listener_mark, vm);
+   buzzdict_scan(vm->listeners, buzzheap_listener_mark, vm);
    /* Go through all the objects in the out message queue and mark them */
    buzzoutmsg_gc(vm);
-   /* Go through all the objects in the object list and delete the unmarked ones */
-   int64_t i = buzzdarray_size(h->objs) - 1;
-   while(i >= 0) {
-      /* Check whether the marker is set to the latest value */
-      if(buzzdarray_get(h->objs, i, buzzobj_t)->o.marker != h->marker) {
-         /* No, erase the element */
-         buzzdarray_remove(h->objs, i);
+   /* Go through the global symbols and the virtual stigmergy only if young objects were stored there */
+   if(h->dirtyroots & BUZZHEAP_ROOT_GSYMS)
+      buzzdarray_foreach(vm->gslots, buzzheap_darrayobj_mark, vm);
+   if(h->dirtyroots & BUZZHEAP_ROOT_VSTIGS)
+      buzzdict_scan(vm->vstigs, buzzheap_vstig_mark, vm);
+   /* Delete the unmarked young objects and promote the others */
+   buzzdarray_filter(h->young, buzzheap_young_sweep, h);
+   /* Now no old object points to a young one */
+   buzzdarray_filter(h->remembered, buzzheap_remembered_forget, NULL);
+   h->dirtyroots = 0;
+   h->gcphase = BUZZHEAP_PHASE_IDLE;
+   ++h->stats.minor_collections;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Starts a major collection.
+ */
+static void buzzheap_major_start(buzzvm_t vm) {
+   buzzheap_t h = vm->heap;
+   /* Increase the marker */
+   h->marker = (h->marker + 1) & BUZZHEAP_MARKER;
+   /* The remembered set is not needed, all objects are marked */
+   buzzdarray_filter(h->remembered, buzzheap_remembered_forget, NULL);
+   h->dirtyroots = 0;
+   /* Prepare string gc */
+   buzzstrman_gc_clear(vm->strings);
+   /* Mark the roots */
+   h->gcphase = BUZZHEAP_PHASE_MARK;
+   buzzheap_roots_mark(vm);
+}
+
+/*
+ * Goes through the marked objects until the time budget is over.
+ * Returns 1 if marking is complete, 0 otherwise.
+ */
+static int buzzheap_major_mark(buzzvm_t vm,
+                               uint64_t start,
+                               uint32_t budget) {
+   buzzheap_t h = vm->heap;
+   uint32_t n = 0;
+   while(!buzzdarray_isempty(h->gray)) {
+      /* Check the time every few references */
+      if(n >= BUZZHEAP_GC_CHECK_EVERY) {
+         if(buzzheap_slice_over(start, budget)) return 0;
+         n = 0;
       }
-      /* Next element */
-      --i;
+      buzzobj_t o = buzzdarray_last(h->gray, buzzobj_t);
+      buzzdarray_pop(h->gray);
+      buzzheap_obj_markrefs(o, vm);
+      n += 1 + (o->o.type == BUZZTYPE_TABLE ?
+                buzztable_size(o) :
+                o->o.type == BUZZTYPE_CLOSURE ?
+                buzzdarray_size(o->c.value.actrec) :
+                1);
    }
+   return 1;
+}
+
+/*
+ * Completes marking and starts sweeping.
+ * The roots are marked again, because the VM changes them without
+ * barriers. This work is proportional to the roots and to the
+ * objects created since the beginning of the collection, not to the
+ * heap size.
+ */
+static void buzzheap_major_remark(buzzvm_t vm) {
+   buzzheap_t h = vm->heap;
+   /* Mark the objects that became reachable from the roots */
+   buzzheap_roots_mark(vm);
+   buzzheap_major_mark(vm, 0, 0);
+   /* Delete the unmarked young objects and promote the others */
+   buzzdarray_filter(h->young, buzzheap_young_sweep, h);
+   h->dirtyroots = 0;
    /* Perform string gc */
    buzzstrman_gc_prune(vm->strings);
+   /* Move the old objects to the list of objects to sweep */
+   buzzdarray_t t = h->sweeping;
+   h->sweeping = h->objs;
+   h->objs = t;
+   h->gcphase = BUZZHEAP_PHASE_SWEEP;
+}
+
+/*
+ * Sweeps the old objects until the time budget is over.
+ * Returns 1 if sweeping is complete, 0 otherwise.
+ */
+static int buzzheap_major_sweep(buzzvm_t vm,
+                                uint64_t start,
+                                uint32_t budget) {
+   buzzheap_t h = vm->heap;
+   if(budget == 0 && buzzdarray_isempty(h->objs)) {
+      /* No time limit, sweep the objects in place */
+      buzzdarray_filter(h->sweeping, buzzheap_obj_sweep, h);
+      buzzdarray_t t = h->objs;
+      h->objs = h->sweeping;
+      h->sweeping = t;
+      return 1;
+   }
+   uint32_t n = 0;
+   while(!buzzdarray_isempty(h->sweeping)) {
+      /* Check the time every few objects */
+      if((++n % BUZZHEAP_GC_CHECK_EVERY) == 0 &&
+         buzzheap_slice_over(start, budget))
+         return 0;
+      buzzobj_t o = buzzdarray_last(h->sweeping, buzzobj_t);
+      buzzdarray_pop(h->sweeping);
+      if(buzzheap_obj_sweep(0, &o, h))
+         buzzdarray_push(h->objs, &o);
+   }
+   return 1;
+}
+
+/*
+ * Completes a major collection.
+ */
+static void buzzheap_major_finish(buzzvm_t vm,
+                                  uint32_t pause) {
+   buzzheap_t h = vm->heap;
+   h->gcphase = BUZZHEAP_PHASE_IDLE;
+   ++h->stats.collections;
    /* Update the max objects threshold */
-   h->max_objs = buzzdarray_isempty(h->objs) ? BUZZHEAP_GC_INIT_MAXOBJS : 2 * buzzdarray_size(h->objs);
+   uint32_t live = buzzdarray_size(h->objs);
+   float budget = live * (h->policy.growth - 1.0f);
+   if(h->policy.max_pause > 0 && pause > h->policy.max_pause)
+      budget *= (float)h->policy.max_pause / pause;
+   h->max_objs = live + budget;
+   if(h->max_objs <= live)
+      h->max_objs = live + 1;
+   if(h->max_objs < h->policy.init_threshold)
+      h->max_objs = h->policy.init_threshold;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Performs the pending collection work within the given time budget.
+ * A budget of 0 means no limit.
+ */
+static void buzzheap_gc_slice(buzzvm_t vm,
+                              uint32_t budget) {
+   buzzheap_t h = vm->heap;
+   uint64_t start = buzzheap_usec();
+   int64_t before = buzzheap_count(h);
+   h->sliceallocs = 0;
+   /* Start a new collection, if necessary */
+   if(h->gcphase == BUZZHEAP_PHASE_IDLE) {
+      if(h->gcpending == BUZZHEAP_GC_MINOR)
+         buzzheap_gc_minor(vm);
+      else if(h->gcpending == BUZZHEAP_GC_MAJOR)
+         buzzheap_major_start(vm);
+   }
+   /* Continue the major collection in progress */
+   if(h->gcphase == BUZZHEAP_PHASE_MARK &&
+      buzzheap_major_mark(vm, start, budget))
+      buzzheap_major_remark(vm);
+   if(h->gcphase == BUZZHEAP_PHASE_SWEEP &&
+      buzzheap_major_sweep(vm, start, budget))
+      buzzheap_major_finish(vm, buzzheap_usec() - start);
+   /* Update the statistics */
+   uint32_t pause = buzzheap_usec() - start;
+   h->stats.freed += before - buzzheap_count(h);
+   h->stats.total_pause += pause;
+   h->stats.last_pause = pause;
+   if(pause > h->stats.longest_pause) h->stats.longest_pause = pause;
+   /* Schedule the next collection */
+   if(h->gcphase != BUZZHEAP_PHASE_IDLE)
+      h->gcpending = BUZZHEAP_GC_NONE;
+   else if(buzzdarray_size(h->objs) >= h->max_objs)
+      h->gcpending = BUZZHEAP_GC_MAJOR;
+   else if(buzzdarray_size(h->young) >= h->policy.nursery)
+      h->gcpending = BUZZHEAP_GC_MINOR;
+   else
+      h->gcpending = BUZZHEAP_GC_NONE;
+}
+
+/*
+ * Performs an emergency collection, and sets the VM error if it
+ * does not bring the memory under the limit.
+ */
+static void buzzheap_gc_full(buzzvm_t vm) {
+   buzzheap_t h = vm->heap;
+   /* Complete the major collection in progress */
+   if(h->gcphase != BUZZHEAP_PHASE_IDLE) {
+      h->gcpending = BUZZHEAP_GC_MAJOR;
+      buzzheap_gc_slice(vm, 0);
+   }
+   /* Collect the whole heap at once */
+   h->gcpending = BUZZHEAP_GC_MAJOR;
+   buzzheap_gc_slice(vm, 0);
+   /* Give up if the memory is still over the limit */
+   if(buzzmem_over(h->mem))
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_MEMORY,
+                      "%" PRId64 " bytes in use, the limit is %" PRId64,
+                      h->mem->total,
+                      h->mem->limit);
+}
+
+void buzzheap_gc(struct buzzvm_s* vm) {
+   /* Is GC necessary? */
+   if(!vm->heap->gcpending) return;
+   if(vm->heap->gcpending == BUZZHEAP_GC_FULL)
+      buzzheap_gc_full(vm);
+   else
+      buzzheap_gc_slice(vm, vm->heap->policy.deadline);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzheap_gc_idle(struct buzzvm_s* vm,
+                     uint32_t budget) {
+   buzzheap_t h = vm->heap;
+   if(budget == 0) return (h->gcphase != BUZZHEAP_PHASE_IDLE);
+   /* An emergency collection can't wait for the budget */
+   if(h->gcpending == BUZZHEAP_GC_FULL) {
+      buzzheap_gc_full(vm);
+      return 0;
+   }
+   /* With nothing pending, collect the nursery ahead of time */
+   if(h->gcphase == BUZZHEAP_PHASE_IDLE &&
+      h->gcpending == BUZZHEAP_GC_NONE) {
+      if(buzzdarray_isempty(h->young)) return 0;
+      h->gcpending = BUZZHEAP_GC_MINOR;
+   }
+   buzzheap_gc_slice(vm, budget);
+   return (h->gcphase != BUZZHEAP_PHASE_IDLE);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzheap_wb_slow(struct buzzvm_s* vm,
+                      buzzobj_t c,
+                      buzzobj_t o) {
+   buzzheap_t h = vm->heap;
+   if(h->gcphase == BUZZHEAP_PHASE_MARK) {
+      /* Make sure that marking does not miss the stored object */
+      buzzheap_obj_mark(o, vm);
+   }
+   /* Each object is remembered once */
+   else if(!(c->o.marker & BUZZHEAP_FLAG)) {
+      c->o.marker |= BUZZHEAP_FLAG;
+      buzzdarray_push(h->remembered, &c);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzzheap_policy_set(struct buzzvm_s* vm,
+                         uint32_t nursery,
+                         uint32_t init_threshold,
+                         float growth,
+                         uint32_t max_pause) {
+   buzzheap_t h = vm->heap;
+   h->policy.nursery = nursery > 0 ? nursery : 1;
+   h->policy.init_threshold = init_threshold > 0 ? init_threshold : 1;
+   h->policy.growth = growth >= 1.0f ? growth : 1.0f;
+   h->policy.max_pause = max_pause;
+   /* Apply the new threshold */
+   if(h->stats.collections == 0 ||
+      h->max_objs < h->policy.init_threshold)
+      h->max_objs = h->policy.init_threshold;
+   if(h->gcphase != BUZZHEAP_PHASE_IDLE)
+      return;
+   if(buzzdarray_size(h->objs) >= h->max_objs)
+      h->gcpending = BUZZHEAP_GC_MAJOR;
+   else if(buzzdarray_size(h->young) >= h->policy.nursery)
+      h->gcpending = BUZZHEAP_GC_MINOR;
+   else
+      h->gcpending = BUZZHEAP_GC_NONE;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzheap_incremental_set(struct buzzvm_s* vm,
+                              uint32_t deadline) {
+   vm->heap->policy.deadline = deadline;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzheap_stats_reset(struct buzzvm_s* vm) {
+   memset(&vm->heap->stats, 0, sizeof(struct buzzheap_stats_s));
 }
 
 /****************************************/
@@ -3,6 +3,7 @@
 
 #include <buzz/buzztype.h>
 #include <buzz/buzzdarray.h>
+#include <buzz/buzzslab.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,16 +14,78 @@ extern "C" {
     */
    struct buzzvm_s;
 
+   /**
+    * The garbage collection policy
+    */
+   struct buzzheap_policy_s {
+      /* The number of young objects that triggers a minor collection */
+      uint32_t nursery;
+      /* The old object count that triggers the first major collection */
+      uint32_t init_threshold;
+      /* After a major collection, the next one is triggered when the
+         old generation reaches growth * (surviving objects) */
+      float growth;
+      /* The target pause for a collection, in microseconds (0 = none)
+         When a collection takes longer, the next threshold is lowered
+         proportionally */
+      uint32_t max_pause;
+      /* The time budget of a slice of incremental major collection, in
+         microseconds (0 = major collections are not incremental) */
+      uint32_t deadline;
+   };
+
+   /**
+    * Garbage collection statistics
+    */
+   struct buzzheap_stats_s {
+      /* Number of major collections performed */
+      uint32_t collections;
+      /* Number of minor collections performed */
+      uint32_t minor_collections;
+      /* Total number of objects freed */
+      uint64_t freed;
+      /* Total time spent collecting, in microseconds */
+      uint64_t total_pause;
+      /* Duration of the last collection, in microseconds */
+      uint32_t last_pause;
+      /* Duration of the longest collection, in microseconds */
+      uint32_t longest_pause;
+   };
+
    /**
     * The state of the object heap
     */
    struct buzzheap_s {
-      /* The list of all objects */
+      /* The list of old objects */
       buzzdarray_t objs;
-      /* The maximum number of vars after which GC is triggered */
+      /* The list of young objects (the nursery) */
+      buzzdarray_t young;
+      /* The old objects that may point to young objects */
+      buzzdarray_t remembered;
+      /* The marked objects whose references are yet to be marked */
+      buzzdarray_t gray;
+      /* The old objects yet to be swept */
+      buzzdarray_t sweeping;
+      /* The memory for the objects */
+      buzzslab_t objslab;
+      /* The maximum number of old objects after which a major GC is triggered */
       uint32_t max_objs;
       /* Current marker for garbage collection */
       uint16_t marker;
+      /* The pending collection (BUZZHEAP_GC_*) */
+      uint8_t gcpending;
+      /* The collection in progress (BUZZHEAP_PHASE_*) */
+      uint8_t gcphase;
+      /* The number of allocations since the last collection slice */
+      uint32_t sliceallocs;
+      /* The roots written with young objects (BUZZHEAP_ROOT_*) */
+      uint8_t dirtyroots;
+      /* The collection policy */
+      struct buzzheap_policy_s policy;
+      /* The collection statistics */
+      struct buzzheap_stats_s stats;
+      /* The memory accounting, or NULL */
+      buzzmem_t mem;
    };
    typedef struct buzzheap_s* buzzheap_t;
 
@@ -38,6 +101,17 @@ extern "C" {
     */
    void buzzheap_destroy(buzzheap_t* h);
 
+   /**
+    * Charges the memory of the heap to BUZZMEM_HEAP.
+    * The tables and closures created afterwards are charged too.
+    * When the total goes over the limit, the next allocation
+    * schedules an emergency collection.
+    * @param h The heap.
+    * @param mem The memory accounting.
+    */
+   void buzzheap_account(buzzheap_t h,
+                         buzzmem_t mem);
+
    /**
     * Creates a new Buzz object.
     * @param vm The Buzz VM.
@@ -47,6 +121,37 @@ extern "C" {
    buzzobj_t buzzheap_newobj(struct buzzvm_s* vm,
                              uint16_t type);
 
+   /**
+    * Returns a nil object.
+    * Nil is a shared, immutable object that is never garbage collected.
+    * @param vm The Buzz VM.
+    * @return The nil object.
+    */
+   buzzobj_t buzzheap_newnil(struct buzzvm_s* vm);
+
+   /**
+    * Returns an integer object with the given value.
+    * Values in [BUZZHEAP_SMALLINT_MIN,BUZZHEAP_SMALLINT_MAX] are
+    * served from a table of shared, immutable objects without
+    * allocating; other values are allocated on the heap. In both
+    * cases, the returned object must not be modified.
+    * @param vm The Buzz VM.
+    * @param v The value.
+    * @return The integer object.
+    */
+   buzzobj_t buzzheap_newint(struct buzzvm_s* vm,
+                             int32_t v);
+
+   /**
+    * Returns a float object with the given value.
+    * The returned object must not be modified.
+    * @param vm The Buzz VM.
+    * @param v The value.
+    * @return The float object.
+    */
+   buzzobj_t buzzheap_newfloat(struct buzzvm_s* vm,
+                               float v);
+
    /*
     * Internally used to clones a Buzz object.
     * @param vm The Buzz VM.
@@ -58,11 +163,83 @@ extern "C" {
 
    /**
     * Performs garbage collection, if necessary.
-    * Internally uses a simple mark-and-sweep algorithm.
+    * The heap has two generations. New objects are created in the
+    * nursery; a minor collection is necessary when the nursery is
+    * full. It marks the young objects reachable from the VM stacks,
+    * the dirty roots and the remembered set, frees the others and
+    * promotes the survivors to the old generation. A major collection
+    * is necessary when the old generation exceeds the threshold set
+    * by the policy. It is a full mark-and-sweep of both generations.
+    * When the policy sets a deadline, a major collection is
+    * incremental: each call performs a slice of marking or sweeping
+    * work that lasts about the deadline, and the next slice is
+    * scheduled after a fixed number of allocations. Minor collections
+    * wait for the major collection in progress to complete.
+    * An emergency collection is necessary when the memory in use
+    * exceeds the limit. It completes the major collection in
+    * progress, then collects the whole heap at once. If the memory
+    * is still over the limit, the VM enters the error state with
+    * BUZZVM_ERROR_MEMORY.
+    * The VM calls this function between instructions, when all the
+    * live objects are reachable.
     * @param vm The Buzz VM.
     */
    void buzzheap_gc(struct buzzvm_s* vm);
 
+   /**
+    * Performs garbage collection work within the given time budget.
+    * Continues the major collection in progress, or performs the
+    * pending collection. If no collection is pending, collects the
+    * nursery ahead of time.
+    * Must be called when all the live objects are reachable from the
+    * VM, e.g., between two calls to the script.
+    * @param vm The Buzz VM.
+    * @param budget The time budget in microseconds.
+    * @return 1 if a major collection is still in progress, 0 otherwise.
+    */
+   int buzzheap_gc_idle(struct buzzvm_s* vm,
+                        uint32_t budget);
+
+   /*
+    * Internally used by the write barrier when o is stored into c and
+    * either a major collection is marking or c is old and o is young.
+    * @param vm The Buzz VM.
+    * @param c The container object.
+    * @param o The stored object.
+    */
+   extern void buzzheap_wb_slow(struct buzzvm_s* vm,
+                                buzzobj_t c,
+                                buzzobj_t o);
+
+   /**
+    * Sets the garbage collection policy.
+    * The new thresholds take effect immediately.
+    * @param vm The Buzz VM.
+    * @param nursery The young object count that triggers a minor collection (> 0).
+    * @param init_threshold The old object count that triggers the first major collection.
+    * @param growth The heap growth factor between collections (>= 1).
+    * @param max_pause The target pause in microseconds (0 = none).
+    */
+   void buzzheap_policy_set(struct buzzvm_s* vm,
+                            uint32_t nursery,
+                            uint32_t init_threshold,
+                            float growth,
+                            uint32_t max_pause);
+
+   /**
+    * Sets the time budget of the slices of incremental major collection.
+    * @param vm The Buzz VM.
+    * @param deadline The time budget in microseconds (0 = major collections are not incremental).
+    */
+   void buzzheap_incremental_set(struct buzzvm_s* vm,
+                                 uint32_t deadline);
+
+   /**
+    * Resets the garbage collection statistics.
+    * @param vm The Buzz VM.
+    */
+   void buzzheap_stats_reset(struct buzzvm_s* vm);
+
    extern void buzzheap_obj_mark(buzzobj_t o, struct buzzvm_s* vm);
    extern void buzzheap_darrayobj_mark(uint32_t pos, void* data, void* params);
    extern void buzzheap_dictobj_mark(const void* key, void* data, void* params);
@@ -74,4 +251,70 @@ extern "C" {
 
 #define buzzheap_addvar();
 
+/*
+ * Range of the integers that are shared instead of allocated.
+ */
+#define BUZZHEAP_SMALLINT_MIN -256
+#define BUZZHEAP_SMALLINT_MAX 1023
+
+/*
+ * Pending collections.
+ */
+#define BUZZHEAP_GC_NONE  0
+#define BUZZHEAP_GC_MINOR 1
+#define BUZZHEAP_GC_MAJOR 2
+#define BUZZHEAP_GC_FULL  3
+
+/*
+ * Collections in progress.
+ */
+#define BUZZHEAP_PHASE_IDLE  0
+#define BUZZHEAP_PHASE_MINOR 1
+#define BUZZHEAP_PHASE_MARK  2
+#define BUZZHEAP_PHASE_SWEEP 3
+
+/*
+ * Layout of the object marker.
+ * The lower bits store the major collection marker. BUZZHEAP_OLD is
+ * set for objects in the old generation. BUZZHEAP_FLAG marks a young
+ * object reached in a minor collection, and an old object already
+ * in the remembered set.
+ */
+#define BUZZHEAP_OLD    0x8000
+#define BUZZHEAP_FLAG   0x4000
+#define BUZZHEAP_MARKER 0x3FFF
+
+/*
+ * Roots that are only scanned by a minor collection when a young
+ * object was stored into them.
+ */
+#define BUZZHEAP_ROOT_GSYMS  0x01
+#define BUZZHEAP_ROOT_VSTIGS 0x02
+
+/*
+ * Returns 1 if the object is in the old generation.
+ * Shared objects count as old.
+ * @param x The object.
+ */
+#define buzzheap_isold(x) ((x)->o.marker & BUZZHEAP_OLD)
+
+/*
+ * Write barrier for a reference from an object to another.
+ * Must be called when x is stored into the table or closure c.
+ * @param vm The Buzz VM.
+ * @param c The container object.
+ * @param x The stored object.
+ */
+#define buzzheap_wb(vm, c, x) (((vm)->heap->gcphase == BUZZHEAP_PHASE_MARK || (buzzheap_isold(c) && !buzzheap_isold(x))) ? buzzheap_wb_slow((vm), (c), (x)) : (void)0)
+
+/*
+ * Write barrier for a reference from a root to an object.
+ * Must be called when x is stored into the global symbols or into a
+ * virtual stigmergy.
+ * @param vm The Buzz VM.
+ * @param root The root (BUZZHEAP_ROOT_*).
+ * @param x The stored object.
+ */
+#define buzzheap_wb_root(vm, root, x) (buzzheap_isold(x) ? (void)0 : (void)((vm)->heap->dirtyroots |= (root)))
+
 #endif
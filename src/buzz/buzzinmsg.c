@@ -2,16 +2,225 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <math.h>
 
 /****************************************/
 /****************************************/
 
-void buzzvm_inmsg_queue_destroy_entry(const void* key, void* data, void* param) {
-   free((void*)key);
-   buzzdarray_destroy((buzzdarray_t*)data);
-   free(data);
+#define BUZZINMSG_QUEUE_INIT_CAPACITY 16
+
+/*
+ * No next message.
+ */
+#define BUZZINMSG_NONE UINT32_MAX
+
+/*
+ * Returns the slot of the message with the given sequence number.
+ */
+#define buzzinmsg_slot(q, seq) ((q)->slots + ((seq) & ((q)->cap - 1)))
+
+/*
+ * Returns the number of bytes allocated for the ring buffers.
+ */
+#define buzzinmsg_ring_bytes(cap) ((int64_t)(cap) * (sizeof(struct buzzinmsg_slot_s) + sizeof(uint16_t)))
+
+/*
+ * The messages of a sender waiting in the queue, in fair mode.
+ */
+struct buzzinmsg_sender_s {
+   uint32_t first; // Sequence number of the first message
+   uint32_t last;  // Sequence number of the last message
+};
+
+/****************************************/
+/****************************************/
+
+/*
+ * Frees the payload of a message, if the queue owns it.
+ */
+static void buzzinmsg_free(buzzinmsg_queue_t q,
+                           buzzinmsg_t* m) {
+   if(!m->owned) return;
+   buzzmem_charge(q->mem, BUZZMEM_INMSGS, -(int64_t)m->payload.size);
+   free((void*)m->payload.data);
+   m->owned = 0;
+}
+
+/*
+ * Doubles the capacity of the ring buffers.
+ */
+static void buzzinmsg_queue_grow(buzzinmsg_queue_t q) {
+   uint32_t cap = q->cap * 2, i;
+   struct buzzinmsg_slot_s* slots =
+      (struct buzzinmsg_slot_s*)malloc(cap * sizeof(struct buzzinmsg_slot_s));
+   uint16_t* turns = (uint16_t*)malloc(cap * sizeof(uint16_t));
+   if(!slots || !turns) {
+      fprintf(stderr, "[FATAL] Can't grow the inbound message queue.\n");
+      abort();
+   }
+   /* Sequence numbers don't change, only their slots do */
+   for(i = q->head; i != q->tail; ++i)
+      slots[i & (cap - 1)] = *buzzinmsg_slot(q, i);
+   for(i = q->turn; i != q->turn + q->nturns; ++i)
+      turns[i & (cap - 1)] = q->turns[i & (q->cap - 1)];
+   free(q->slots);
+   free(q->turns);
+   buzzmem_charge(q->mem, BUZZMEM_INMSGS, buzzinmsg_ring_bytes(cap) - buzzinmsg_ring_bytes(q->cap));
+   q->slots = slots;
+   q->turns = turns;
+   q->cap = cap;
+}
+
+/*
+ * Moves the messages left to the front of the ring buffer, closing the
+ * holes left by the messages taken out of order. In fair mode, the
+ * chains of the senders are rebuilt; their turns do not change.
+ */
+static void buzzinmsg_queue_compact(buzzinmsg_queue_t q) {
+   uint32_t i, j = q->head;
+   struct buzzinmsg_sender_s* s;
+   for(i = q->head; i != q->tail; ++i) {
+      if(buzzinmsg_slot(q, i)->taken) continue;
+      if(i != j) *buzzinmsg_slot(q, j) = *buzzinmsg_slot(q, i);
+      buzzinmsg_slot(q, j)->next = BUZZINMSG_NONE;
+      if(q->fair) {
+         s = (struct buzzinmsg_sender_s*)buzzdict_rawget(q->senders, &buzzinmsg_slot(q, j)->msg.robot);
+         s->first = BUZZINMSG_NONE;
+      }
+      ++j;
+   }
+   q->tail = j;
+   if(!q->fair) return;
+   for(i = q->head; i != q->tail; ++i) {
+      s = (struct buzzinmsg_sender_s*)buzzdict_rawget(q->senders, &buzzinmsg_slot(q, i)->msg.robot);
+      if(s->first == BUZZINMSG_NONE) s->first = i;
+      else buzzinmsg_slot(q, s->last)->next = i;
+      s->last = i;
+   }
+}
+
+/*
+ * Adds the message with the given sequence number to the messages of
+ * its sender, in fair mode.
+ */
+static void buzzinmsg_queue_chain(buzzinmsg_queue_t q,
+                                  uint32_t seq) {
+   uint16_t rid = buzzinmsg_slot(q, seq)->msg.robot;
+   struct buzzinmsg_sender_s* s =
+      (struct buzzinmsg_sender_s*)buzzdict_rawget(q->senders, &rid);
+   buzzinmsg_slot(q, seq)->next = BUZZINMSG_NONE;
+   if(s) {
+      /* Known sender, link its last message to this one */
+      buzzinmsg_slot(q, s->last)->next = seq;
+      s->last = seq;
+   }
+   else {
+      /* New sender, give it a turn */
+      struct buzzinmsg_sender_s ns = { .first = seq, .last = seq };
+      buzzdict_set(q->senders, &rid, &ns);
+      q->turns[(q->turn + q->nturns) & (q->cap - 1)] = rid;
+      ++q->nturns;
+   }
+}
+
+/*
+ * Drops the message with the given sequence number. In fair mode, it
+ * must be the first message of its sender.
+ */
+static void buzzinmsg_queue_drop(buzzinmsg_queue_t q,
+                                 uint32_t seq) {
+   struct buzzinmsg_slot_s* m = buzzinmsg_slot(q, seq);
+   if(q->fair) {
+      uint16_t rid = m->msg.robot;
+      struct buzzinmsg_sender_s* s =
+         (struct buzzinmsg_sender_s*)buzzdict_rawget(q->senders, &rid);
+      if(s->first != s->last) {
+         s->first = m->next;
+      }
+      else {
+         /* No messages left for the sender, take its turn away */
+         uint32_t i = q->turn;
+         while(q->turns[i & (q->cap - 1)] != rid) ++i;
+         for(; i != q->turn + q->nturns - 1; ++i)
+            q->turns[i & (q->cap - 1)] = q->turns[(i + 1) & (q->cap - 1)];
+         --q->nturns;
+         buzzdict_remove(q->senders, &rid);
+      }
+   }
+   buzzinmsg_free(q, &m->msg);
+   m->taken = 1;
+   --q->size;
+   ++q->dropped;
+   /* Reclaim the slots of the messages taken at the front */
+   while(q->head != q->tail && buzzinmsg_slot(q, q->head)->taken)
+      ++q->head;
+}
+
+/*
+ * Returns the sequence number of the oldest message of the given sender.
+ */
+static uint32_t buzzinmsg_queue_oldest(buzzinmsg_queue_t q,
+                                       uint16_t rid) {
+   if(q->fair)
+      return ((struct buzzinmsg_sender_s*)buzzdict_rawget(q->senders, &rid))->first;
+   uint32_t i = q->head;
+   while(buzzinmsg_slot(q, i)->taken ||
+         buzzinmsg_slot(q, i)->msg.robot != rid) ++i;
+   return i;
+}
+
+/*
+ * Creates the dictionary of the senders.
+ */
+static buzzdict_t buzzinmsg_senders_new() {
+   return buzzdict_new(16,
+                       sizeof(uint16_t),
+                       sizeof(struct buzzinmsg_sender_s),
+                       buzzdict_uint16keyhash,
+                       buzzdict_uint16keycmp,
+                       NULL);
+}
+
+/****************************************/
+/****************************************/
+
+buzzinmsg_queue_t buzzinmsg_queue_new() {
+   buzzinmsg_queue_t q = (buzzinmsg_queue_t)calloc(1, sizeof(struct buzzinmsg_queue_s));
+   q->cap = BUZZINMSG_QUEUE_INIT_CAPACITY;
+   q->slots = (struct buzzinmsg_slot_s*)malloc(q->cap * sizeof(struct buzzinmsg_slot_s));
+   q->turns = (uint16_t*)malloc(q->cap * sizeof(uint16_t));
+   q->senders = buzzinmsg_senders_new();
+   return q;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzinmsg_queue_destroy(buzzinmsg_queue_t* msgq) {
+   buzzinmsg_queue_t q = *msgq;
+   uint32_t i;
+   /* Free the payloads the queue owns */
+   for(i = q->head; i != q->tail; ++i)
+      if(!buzzinmsg_slot(q, i)->taken)
+         buzzinmsg_free(q, &buzzinmsg_slot(q, i)->msg);
+   /* Get rid of the rest */
+   buzzmem_charge(q->mem, BUZZMEM_INMSGS,
+                  -(int64_t)sizeof(struct buzzinmsg_queue_s) - buzzinmsg_ring_bytes(q->cap));
+   buzzdict_destroy(&q->senders);
+   free(q->slots);
+   free(q->turns);
+   free(q);
+   *msgq = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzinmsg_queue_account(buzzinmsg_queue_t msgq,
+                             buzzmem_t mem) {
+   msgq->mem = mem;
+   buzzmem_charge(mem, BUZZMEM_INMSGS,
+                  (int64_t)sizeof(struct buzzinmsg_queue_s) + buzzinmsg_ring_bytes(msgq->cap));
+   buzzdict_account(msgq->senders, mem, BUZZMEM_INMSGS);
 }
 
 /****************************************/
@@ -19,55 +228,115 @@ void buzzvm_inmsg_queue_destroy_entry(const void* key, void* data, void* param)
 
 void buzzinmsg_queue_append(buzzvm_t vm,
                             uint16_t rid,
-                            buzzmsg_payload_t payload) {
-   /* Check if id is already present */
-   if(!buzzdict_exists(vm->inmsgs, &rid)) {
-      /* Not present, create a new queue */
-      buzzdarray_t q = buzzdarray_new(1, sizeof(buzzmsg_payload_t), NULL);
-      /* Add it to the dict */
-      buzzdict_set(vm->inmsgs, &rid, &q);
+                            buzzmsg_view_t payload) {
+   buzzinmsg_queue_t q = vm->inmsgs;
+   /* Make room for the message, closing the holes first if there are many */
+   if(q->tail - q->head == q->cap) {
+      if(q->size <= q->cap / 2) buzzinmsg_queue_compact(q);
+      else buzzinmsg_queue_grow(q);
+   }
+   /* Append a view of the payload to queue */
+   struct buzzinmsg_slot_s* s = buzzinmsg_slot(q, q->tail);
+   s->msg.payload = payload;
+   s->msg.robot = rid;
+   s->msg.owned = 0;
+   s->next = BUZZINMSG_NONE;
+   s->taken = 0;
+   if(q->fair) buzzinmsg_queue_chain(q, q->tail);
+   ++q->tail;
+   ++q->size;
+   /* Enforce the max size, at the expense of the sender if possible */
+   while(q->max > 0 && q->size > q->max) {
+      uint32_t seq = buzzinmsg_queue_oldest(q, rid);
+      buzzinmsg_queue_drop(q, seq != q->tail - 1 ? seq : q->head);
    }
-   /* Get queue corresponding to given robot id */
-   buzzdarray_t* q = (buzzdarray_t*)buzzdict_rawget(vm->inmsgs, &rid);
-   /* Append payload to queue */
-   buzzdarray_push(*q, &payload);
 }
 
 /****************************************/
 /****************************************/
 
-struct buzzdict_entry_s {
-   void* key;
-   void* data;
-};
-
 int buzzinmsg_queue_extract(buzzvm_t vm,
-                            uint16_t* rid,
-                            buzzmsg_payload_t* payload) {
+                            buzzinmsg_t* msg) {
+   buzzinmsg_queue_t q = vm->inmsgs;
    /* Nothing to do if queue is empty */
-   if(buzzinmsg_queue_isempty(vm->inmsgs)) return 0;
-   /* Look for (id,queue) in first non-empty bucket in dict */
-   buzzdarray_t q = NULL;
-   for(uint32_t i = 0; i < vm->inmsgs->num_buckets; ++i) {
-      if(vm->inmsgs->buckets[i]) {
-         const struct buzzdict_entry_s* e =
-            &buzzdarray_get(vm->inmsgs->buckets[i],
-                            0,
-                            struct buzzdict_entry_s);
-         *rid = *(uint16_t*)(e->key);
-         q = *(buzzdarray_t*)(e->data);
-         break;
+   if(buzzinmsg_queue_isempty(q)) return 0;
+   if(q->fair) {
+      /* Take the first message of the sender whose turn it is */
+      uint16_t rid = q->turns[q->turn & (q->cap - 1)];
+      ++q->turn;
+      --q->nturns;
+      struct buzzinmsg_sender_s* s =
+         (struct buzzinmsg_sender_s*)buzzdict_rawget(q->senders, &rid);
+      struct buzzinmsg_slot_s* m = buzzinmsg_slot(q, s->first);
+      *msg = m->msg;
+      m->taken = 1;
+      if(s->first == s->last) {
+         /* No messages left for the sender */
+         buzzdict_remove(q->senders, &rid);
       }
+      else {
+         /* The sender waits for its next turn */
+         s->first = m->next;
+         q->turns[(q->turn + q->nturns) & (q->cap - 1)] = rid;
+         ++q->nturns;
+      }
+   }
+   else {
+      /* Take the first message */
+      *msg = buzzinmsg_slot(q, q->head)->msg;
+      buzzinmsg_slot(q, q->head)->taken = 1;
    }
-   /* Extract payload from array */
-   *payload = buzzdarray_last(q, buzzmsg_payload_t);
-   buzzdarray_pop(q);
-   /* If array is empty, remove (id,array entry) from dict */
-   if(buzzdarray_isempty(q))
-      buzzdict_remove(vm->inmsgs, rid);
+   --q->size;
+   /* Reclaim the slots of the messages taken at the front */
+   while(q->head != q->tail && buzzinmsg_slot(q, q->head)->taken)
+      ++q->head;
    /* All done */
    return 1;
 }
 
 /****************************************/
 /****************************************/
+
+void buzzinmsg_queue_detach(buzzvm_t vm) {
+   buzzinmsg_queue_t q = vm->inmsgs;
+   uint32_t i;
+   for(i = q->head; i != q->tail; ++i) {
+      buzzinmsg_t* m = &buzzinmsg_slot(q, i)->msg;
+      if(buzzinmsg_slot(q, i)->taken || m->owned) continue;
+      uint8_t* d = (uint8_t*)malloc(m->payload.size > 0 ? m->payload.size : 1);
+      memcpy(d, m->payload.data, m->payload.size);
+      m->payload.data = d;
+      m->owned = 1;
+      buzzmem_charge(q->mem, BUZZMEM_INMSGS, m->payload.size);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzzinmsg_release(buzzvm_t vm,
+                       buzzinmsg_t* msg) {
+   buzzinmsg_free(vm->inmsgs, msg);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzinmsg_queue_fair_set(buzzinmsg_queue_t msgq,
+                              int fair) {
+   uint32_t i;
+   /* Forget the turns */
+   msgq->fair = fair ? 1 : 0;
+   buzzdict_destroy(&msgq->senders);
+   msgq->senders = buzzinmsg_senders_new();
+   buzzdict_account(msgq->senders, msgq->mem, BUZZMEM_INMSGS);
+   msgq->nturns = 0;
+   /* In fair mode, chain the messages left by sender */
+   if(msgq->fair)
+      for(i = msgq->head; i != msgq->tail; ++i)
+         if(!buzzinmsg_slot(msgq, i)->taken)
+            buzzinmsg_queue_chain(msgq, i);
+}
+
+/****************************************/
+/****************************************/
@@ -1,7 +1,7 @@
 #ifndef BUZZINMSG_H
 #define BUZZINMSG_H
 
-#include <buzz/buzzdarray.h>
+#include <buzz/buzzdict.h>
 #include <buzz/buzzmsg.h>
 
 struct buzzvm_s;
@@ -10,81 +10,173 @@ struct buzzvm_s;
 extern "C" {
 #endif
 
+   /*
+    * A message in the queue.
+    */
+   struct buzzinmsg_s {
+      buzzmsg_view_t payload; // The message payload
+      uint16_t robot;         // The id of the robot who sent the message
+      uint8_t owned;          // Whether the payload bytes belong to the queue
+   };
+   typedef struct buzzinmsg_s buzzinmsg_t;
+
+   /*
+    * A slot in the ring buffer of a message queue.
+    */
+   struct buzzinmsg_slot_s {
+      buzzinmsg_t msg; // The message
+      uint32_t next;   // Next message of the same sender, in fair mode
+      uint8_t taken;   // Whether the message was extracted
+   };
+
    /*
     * Data of a Buzz message queue.
+    * The messages are kept in a ring buffer in arrival order, and
+    * identified by a sequence number; the slot of a message is its
+    * sequence number modulo the capacity.
+    * By default, the messages are extracted in arrival order. In fair
+    * mode, the senders take turns, one message each; every sender
+    * chains its messages through the ring buffer.
     */
-   typedef buzzdict_t buzzinmsg_queue_t;
+   struct buzzinmsg_queue_s {
+      struct buzzinmsg_slot_s* slots; // Ring buffer of messages
+      uint32_t cap;                   // Capacity of the ring buffers, a power of two
+      uint32_t head;                  // Sequence number of the first slot in use
+      uint32_t tail;                  // Sequence number past the last message
+      uint32_t size;                  // Number of messages left to extract
+      uint32_t limit;                 // Max messages processed per call, 0 for none
+      uint32_t max;                   // Max messages kept in the queue, 0 for none
+      uint32_t dropped;               // Number of messages dropped to respect max
+      uint8_t fair;                   // Whether the senders take turns
+      buzzdict_t senders;             // Sender id -> first and last message, in fair mode
+      uint16_t* turns;                // Ring buffer of the senders waiting for their turn
+      uint32_t turn;                  // Sequence number of the next turn
+      uint32_t nturns;                // Number of senders waiting for their turn
+      buzzmem_t mem;                  // Memory accounting, or NULL
+   };
+   typedef struct buzzinmsg_queue_s* buzzinmsg_queue_t;
+
+   /*
+    * Creates a new message queue.
+    * @return A new message queue.
+    */
+   extern buzzinmsg_queue_t buzzinmsg_queue_new();
+
+   /*
+    * Destroys a message queue.
+    * @param msgq The message queue.
+    */
+   extern void buzzinmsg_queue_destroy(buzzinmsg_queue_t* msgq);
+
+   /*
+    * Charges the memory of a new message queue to BUZZMEM_INMSGS.
+    * The payloads detached afterwards are charged too.
+    * @param msgq The message queue.
+    * @param mem The memory accounting.
+    */
+   extern void buzzinmsg_queue_account(buzzinmsg_queue_t msgq,
+                                       buzzmem_t mem);
 
    /*
     * Appends a message to the queue.
-    * The ownership of the payload is assumed by the message queue. Make sure
-    * the payload is in the heap.
+    * The payload is not copied: its bytes must stay valid until the
+    * message is extracted or buzzinmsg_queue_detach() is called.
+    * buzzvm_process_inmsgs() detaches the messages it leaves in the
+    * queue, so a buffer only needs to last until that call returns.
+    * If the queue then holds more than buzzinmsg_queue_max_set()
+    * messages, the oldest message of the same sender is dropped, so that
+    * a flooding neighbor mostly loses its own messages. If the sender
+    * has no other message in the queue, the oldest message is dropped.
     * @param vm The Buzz VM.
     * @param id The id of the robot who sent the message.
     * @param payload The message payload.
     */
    extern void buzzinmsg_queue_append(struct buzzvm_s* vm,
                                       uint16_t id,
-                                      buzzmsg_payload_t payload);
+                                      buzzmsg_view_t payload);
 
    /*
     * Extracts a message from the queue.
-    * You are in charge of freeing both the message data and the payload.
-    * If the queue is empty, the values of *id and *payload are left untouched.
+    * Call buzzinmsg_release() when you are done with the message.
+    * If the queue is empty, *msg is left untouched.
     * @param vm The Buzz VM.
-    * @param id The id of the robot who sent the message.
-    * @param payload The message payload.
+    * @param msg The message.
     * @return 1 if the extraction was successful; 0 if no messages are left
     */
    extern int buzzinmsg_queue_extract(struct buzzvm_s* vm,
-                                      uint16_t* id,
-                                      buzzmsg_payload_t* payload);
-
-   /**
-    * Internally used to cleanup a queue entry.
-    * @param key A pointer to the robot id (uint16_t)
-    * @param data A pointer to buzzdarray_t
-    * @param param Unused
+                                      buzzinmsg_t* msg);
+
+   /*
+    * Copies the payloads the queue refers to without owning them.
+    * Call this before the buffers passed to buzzinmsg_queue_append()
+    * go away. The copies are charged to BUZZMEM_INMSGS.
+    * @param vm The Buzz VM.
+    */
+   extern void buzzinmsg_queue_detach(struct buzzvm_s* vm);
+
+   /*
+    * Releases an extracted message.
+    * Frees the payload if it belongs to the queue.
+    * @param vm The Buzz VM.
+    * @param msg The message.
     */
-   extern void buzzvm_inmsg_queue_destroy_entry(const void* key,
-                                                void* data,
-                                                void* param);
+   extern void buzzinmsg_release(struct buzzvm_s* vm,
+                                 buzzinmsg_t* msg);
+
+   /*
+    * Sets whether the senders take turns.
+    * When fair, the messages are extracted one per sender in
+    * round-robin order, so that a chatty neighbor does not delay the
+    * others. Otherwise, they are extracted in arrival order.
+    * The messages already in the queue are reordered.
+    * @param msgq The message queue.
+    * @param fair 1 for round-robin order, 0 for arrival order.
+    */
+   extern void buzzinmsg_queue_fair_set(buzzinmsg_queue_t msgq,
+                                        int fair);
 
 #ifdef __cplusplus
 }
 #endif
 
 /*
- * Create a new message queue.
+ * Returns the size of a message queue.
+ * @param msgq The message queue.
+ * @return The size of a message queue.
  */
-#define buzzinmsg_queue_new() buzzdict_new(20, sizeof(uint16_t), sizeof(buzzmsg_payload_t), buzzdict_uint16keyhash, buzzdict_uint16keycmp, buzzvm_inmsg_queue_destroy_entry)
+#define buzzinmsg_queue_size(msgq) ((msgq)->size)
 
 /*
- * Destroys a message queue.
+ * Returns <tt>true</tt> if the message queue is empty.
  * @param msgq The message queue.
+ * @return <tt>true</tt> if the message queue is empty.
  */
-#define buzzinmsg_queue_destroy(msgq) buzzdict_destroy(msgq)
+#define buzzinmsg_queue_isempty(msgq) ((msgq)->size == 0)
 
 /*
- * Returns the size of a message queue.
+ * Sets the maximum number of messages buzzvm_process_inmsgs() processes
+ * per call. The messages left wait for the next call.
+ * This limit does not bound the memory of the queue: use
+ * buzzinmsg_queue_max_set() for that.
  * @param msgq The message queue.
- * @return The size of a message queue.
+ * @param n The maximum number of messages, or 0 for no limit.
  */
-#define buzzinmsg_queue_size(msgq) buzzdict_size(msgq)
+#define buzzinmsg_queue_limit_set(msgq, n) (msgq)->limit = (n)
 
 /*
- * Returns <tt>true</tt> if the message queue is empty.
+ * Sets the maximum number of messages kept in the queue.
+ * The messages in excess are dropped as buzzinmsg_queue_append()
+ * describes, when the next message arrives.
  * @param msgq The message queue.
- * @return <tt>true</tt> if the message queue is empty.
+ * @param n The maximum number of messages, or 0 for no limit.
  */
-#define buzzinmsg_queue_isempty(msgq) buzzdict_isempty(msgq)
+#define buzzinmsg_queue_max_set(msgq, n) (msgq)->max = (n)
 
 /*
- * Returns the message at the given position in the queue.
- * @param msg The message queue.
- * @param pos The position.
- * @return The message at the given position.
+ * Returns the number of messages dropped because the queue was full.
+ * @param msgq The message queue.
+ * @return The number of dropped messages.
  */
-#define buzzinmsg_queue_get(msg, pos) buzzdict_get(msg, pos, buzzmsg_payload_t)
+#define buzzinmsg_queue_dropped(msgq) ((msgq)->dropped)
 
 #endif
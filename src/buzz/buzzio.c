@@ -217,11 +217,11 @@ int buzzio_fwrite(buzzvm_t vm) {
             err = fprintf(f, "%f", o->f.value);
             break;
          case BUZZTYPE_TABLE:
-            err = fprintf(f, "[table with %" PRIu32" elems]", buzzdict_size(o->t.value));
+            err = fprintf(f, "[table with %" PRIu32" elems]", buzztable_size(o));
             break;
          case BUZZTYPE_CLOSURE:
             if(o->c.value.isnative)
-               err = fprintf(f, "[n-closure @%" PRId32 "]", o->c.value.ref);
+               err = fprintf(f, "[n-closure @%" PRId32 "]", buzzvm_pc2offset(vm, o->c.value.ref));
             else
                err = fprintf(f, "[c-closure @%" PRId32 "]", o->c.value.ref);
             break;
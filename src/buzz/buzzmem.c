@@ -0,0 +1,51 @@
+#include "buzzmem.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/****************************************/
+/****************************************/
+
+const char* buzzmem_sys_desc[] = {
+   "heap",
+   "strings",
+   "vstigs",
+   "inmsgs",
+   "outmsgs",
+   "vm"
+};
+
+/****************************************/
+/****************************************/
+
+buzzmem_t buzzmem_new() {
+   /* calloc() zeroes the counters and the limit */
+   buzzmem_t m = (buzzmem_t)calloc(1, sizeof(struct buzzmem_s));
+   if(!m) {
+      fprintf(stderr, "[FATAL] Can't allocate memory accounting.\n");
+      abort();
+   }
+   return m;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzmem_destroy(buzzmem_t* m) {
+   free(*m);
+   *m = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzmem_charge(buzzmem_t m,
+                    int sys,
+                    int64_t delta) {
+   if(!m) return;
+   m->used[sys] += delta;
+   m->total += delta;
+   if(m->total > m->peak) m->peak = m->total;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,74 @@
+#ifndef BUZZMEM_H
+#define BUZZMEM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * The subsystems whose memory is accounted for.
+    */
+   typedef enum {
+      BUZZMEM_HEAP = 0, // Objects, tables, closures
+      BUZZMEM_STRINGS,  // Interned strings
+      BUZZMEM_VSTIGS,   // Virtual stigmergies
+      BUZZMEM_INMSGS,   // Inbound message queues
+      BUZZMEM_OUTMSGS,  // Outbound message queues
+      BUZZMEM_VM,       // Stack, symbols, code and other VM structures
+      BUZZMEM_COUNT
+   } buzzmem_sys;
+
+   /*
+    * Names of the subsystems.
+    */
+   extern const char* buzzmem_sys_desc[];
+
+   /*
+    * Buzz memory accounting.
+    * The containers of a VM charge the bytes they allocate to a
+    * subsystem of the same accounting structure. The accounting
+    * only counts; enforcing the limit is up to the VM.
+    */
+   struct buzzmem_s {
+      int64_t used[BUZZMEM_COUNT]; // Bytes in use per subsystem
+      int64_t total;               // Bytes in use overall
+      int64_t peak;                // Highest value of the total so far
+      int64_t limit;               // Limit on the total, 0 for none
+   };
+   typedef struct buzzmem_s* buzzmem_t;
+
+   /*
+    * Creates a new accounting structure with no limit.
+    * @return A new accounting structure.
+    */
+   extern buzzmem_t buzzmem_new();
+
+   /*
+    * Destroys an accounting structure.
+    * @param m The accounting structure.
+    */
+   extern void buzzmem_destroy(buzzmem_t* m);
+
+   /*
+    * Adds the given number of bytes to a subsystem.
+    * @param m The accounting structure. Can be NULL, in which case nothing is done.
+    * @param sys The subsystem.
+    * @param delta The number of bytes; negative to release them.
+    */
+   extern void buzzmem_charge(buzzmem_t m,
+                              int sys,
+                              int64_t delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Returns 1 if the total exceeds the limit, 0 otherwise.
+ * @param m The accounting structure.
+ */
+#define buzzmem_over(m) ((m)->limit > 0 && (m)->total > (m)->limit)
+
+#endif
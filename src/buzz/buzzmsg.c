@@ -22,10 +22,10 @@ void buzzmsg_serialize_u8(buzzdarray_t buf,
 /****************************************/
 
 int64_t buzzmsg_deserialize_u8(uint8_t* data,
-                               buzzdarray_t buf,
+                               buzzmsg_view_t buf,
                                uint32_t pos) {
-   if(pos + sizeof(uint8_t) > buzzdarray_size(buf)) return -1;
-   *data = buzzdarray_get(buf, pos, uint8_t);
+   if(pos + sizeof(uint8_t) > buf.size) return -1;
+   *data = buf.data[pos];
    return pos + sizeof(uint8_t);
 }
 
@@ -43,12 +43,10 @@ void buzzmsg_serialize_u16(buzzdarray_t buf,
 /****************************************/
 
 int64_t buzzmsg_deserialize_u16(uint16_t* data,
-                                buzzdarray_t buf,
+                                buzzmsg_view_t buf,
                                 uint32_t pos) {
-   if(pos + sizeof(uint16_t) > buzzdarray_size(buf)) return -1;
-   *data =
-      buzzdarray_get(buf, pos,   uint8_t)       +
-      (buzzdarray_get(buf, pos+1, uint8_t) << 8);
+   if(pos + sizeof(uint16_t) > buf.size) return -1;
+   memcpy(data, buf.data + pos, sizeof(uint16_t));
    *data = ntohs(*data);
    return pos + sizeof(uint16_t);
 }
@@ -69,14 +67,10 @@ void buzzmsg_serialize_u32(buzzdarray_t buf,
 /****************************************/
 
 int64_t buzzmsg_deserialize_u32(uint32_t* data,
-                                buzzdarray_t buf,
+                                buzzmsg_view_t buf,
                                 uint32_t pos) {
-   if(pos + sizeof(uint32_t) > buzzdarray_size(buf)) return -1;
-   *data =
-      buzzdarray_get(buf, pos,   uint8_t)         +
-      (buzzdarray_get(buf, pos+1, uint8_t) << 8)  +
-      (buzzdarray_get(buf, pos+2, uint8_t) << 16) +
-      (buzzdarray_get(buf, pos+3, uint8_t) << 24);
+   if(pos + sizeof(uint32_t) > buf.size) return -1;
+   memcpy(data, buf.data + pos, sizeof(uint32_t));
    *data = ntohl(*data);
    return pos + sizeof(uint32_t);
 }
@@ -127,10 +121,10 @@ void buzzmsg_serialize_float(buzzdarray_t buf,
 /****************************************/
 
 int64_t buzzmsg_deserialize_float(float* data,
-                                  buzzdarray_t buf,
+                                  buzzmsg_view_t buf,
                                   uint32_t pos) {
    /* Make sure enough bytes are left to read */
-   if(pos + 2*sizeof(uint32_t) > buzzdarray_size(buf)) return -1;
+   if(pos + 2*sizeof(uint32_t) > buf.size) return -1;
    /* Read the mantissa and the exponent */
    int32_t mant;
    int32_t exp;
@@ -183,19 +177,19 @@ void buzzmsg_serialize_string(buzzdarray_t buf,
 /****************************************/
 
 int64_t buzzmsg_deserialize_string(char** data,
-                                   buzzdarray_t buf,
+                                   buzzmsg_view_t buf,
                                    uint32_t pos) {
    /* Make sure there are enough bytes to read the string length */
-   if(pos + sizeof(uint16_t) > buzzdarray_size(buf)) return -1;
+   if(pos + sizeof(uint16_t) > buf.size) return -1;
    /* Read the string length */
    uint16_t len;
    pos = buzzmsg_deserialize_u16(&len, buf, pos);
    /* Make sure there are enough bytes to read the string itself */   
-   if(pos + len > buzzdarray_size(buf)) return -1;
+   if(pos + len > buf.size) return -1;
    /* Create a buffer for the string */
    *data = (char*)malloc(len * sizeof(char) + 1);
    /* Read the string characters */
-   memcpy(*data, (uint8_t*)buf->data + pos, len * sizeof(char));
+   memcpy(*data, buf.data + pos, len * sizeof(char));
    /* Set the termination character */
    *(*data + len) = 0;
    /* Return new position */
@@ -204,3 +198,199 @@ int64_t buzzmsg_deserialize_string(char** data,
 
 /****************************************/
 /****************************************/
+
+void buzzmsg_serialize_varint(buzzdarray_t buf,
+                              uint32_t data) {
+   uint8_t b;
+   /* Push 7 bits at a time, flagging the bytes that have a follow-up */
+   while(data >= 0x80) {
+      b = (data & 0x7F) | 0x80;
+      buzzdarray_push(buf, &b);
+      data >>= 7;
+   }
+   b = data;
+   buzzdarray_push(buf, &b);
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzmsg_deserialize_varint(uint32_t* data,
+                                   buzzmsg_view_t buf,
+                                   uint32_t pos) {
+   uint32_t x = 0;
+   uint32_t shift;
+   for(shift = 0; shift < 35; shift += 7) {
+      if(pos >= buf.size) return -1;
+      uint8_t b = buf.data[pos];
+      ++pos;
+      /* The fifth byte can only hold the top 4 bits */
+      if(shift == 28 && b > 0x0F) return -1;
+      x |= (uint32_t)(b & 0x7F) << shift;
+      if(!(b & 0x80)) {
+         *data = x;
+         return pos;
+      }
+   }
+   return -1;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzmsg_serialize_svarint(buzzdarray_t buf,
+                               int32_t data) {
+   /* Zig-zag: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4... */
+   buzzmsg_serialize_varint(buf,
+                            ((uint32_t)data << 1) ^ (data < 0 ? 0xFFFFFFFFu : 0));
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzmsg_deserialize_svarint(int32_t* data,
+                                    buzzmsg_view_t buf,
+                                    uint32_t pos) {
+   uint32_t x;
+   int64_t p = buzzmsg_deserialize_varint(&x, buf, pos);
+   if(p < 0) return -1;
+   *data = (int32_t)((x >> 1) ^ (0u - (x & 1)));
+   return p;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzmsg_serialize_float32(buzzdarray_t buf,
+                               float data) {
+   uint32_t x;
+   memcpy(&x, &data, sizeof(uint32_t));
+   buzzmsg_serialize_u32(buf, x);
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzmsg_deserialize_float32(float* data,
+                                    buzzmsg_view_t buf,
+                                    uint32_t pos) {
+   uint32_t x;
+   int64_t p = buzzmsg_deserialize_u32(&x, buf, pos);
+   if(p < 0) return -1;
+   memcpy(data, &x, sizeof(uint32_t));
+   return p;
+}
+
+/****************************************/
+/****************************************/
+
+uint16_t buzzmsg_float_tohalf(float data) {
+   uint32_t x;
+   memcpy(&x, &data, sizeof(uint32_t));
+   uint16_t sign = (x >> 16) & 0x8000;
+   int32_t exp = (int32_t)((x >> 23) & 0xFF);
+   uint32_t mant = x & 0x7FFFFF;
+   uint32_t h, rem, halfway;
+   /* Infinities and NaNs */
+   if(exp == 0xFF)
+      return sign | 0x7C00 | (mant ? 0x200 : 0);
+   /* Rebias the exponent */
+   exp = exp - 127 + 15;
+   /* Too large: infinity */
+   if(exp >= 0x1F)
+      return sign | 0x7C00;
+   if(exp <= 0) {
+      /* Too small even for a subnormal: zero */
+      if(exp < -10) return sign;
+      /* Subnormal: shift the mantissa, with its implicit bit, in place */
+      mant |= 0x800000;
+      h = mant >> (14 - exp);
+      rem = mant & ((1u << (14 - exp)) - 1);
+      halfway = 1u << (13 - exp);
+   }
+   else {
+      /* Normal: drop the 13 lowest bits of the mantissa */
+      h = ((uint32_t)exp << 10) | (mant >> 13);
+      rem = mant & 0x1FFF;
+      halfway = 0x1000;
+   }
+   /* Round to nearest even; a carry correctly bumps the exponent */
+   if(rem > halfway || (rem == halfway && (h & 1))) ++h;
+   return sign | h;
+}
+
+/****************************************/
+/****************************************/
+
+float buzzmsg_float_fromhalf(uint16_t data) {
+   uint32_t sign = (uint32_t)(data & 0x8000) << 16;
+   uint32_t exp = (data >> 10) & 0x1F;
+   uint32_t mant = data & 0x3FF;
+   uint32_t x;
+   if(exp == 0x1F) {
+      /* Infinities and NaNs */
+      x = sign | 0x7F800000 | (mant << 13);
+   }
+   else if(exp == 0) {
+      if(mant == 0) {
+         /* Zero */
+         x = sign;
+      }
+      else {
+         /* Subnormal: normalize the mantissa */
+         exp = 127 - 15 + 1;
+         while(!(mant & 0x400)) {
+            mant <<= 1;
+            --exp;
+         }
+         x = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+      }
+   }
+   else {
+      /* Normal */
+      x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+   }
+   float f;
+   memcpy(&f, &x, sizeof(float));
+   return f;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzmsg_serialize_vstring(buzzdarray_t buf,
+                               const char* data) {
+   /* Push the length */
+   buzzmsg_serialize_varint(buf, strlen(data));
+   /* Go through the characters and push them into the buffer */
+   const char* c = data;
+   while(*c) {
+      buzzdarray_push(buf, (uint8_t*)(c));
+      ++c;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzmsg_deserialize_vstring(char** data,
+                                    buzzmsg_view_t buf,
+                                    uint32_t pos) {
+   /* Read the string length */
+   uint32_t len;
+   int64_t p = buzzmsg_deserialize_varint(&len, buf, pos);
+   if(p < 0) return -1;
+   /* Make sure there are enough bytes to read the string itself */
+   if(p + len > buf.size) return -1;
+   /* Create a buffer for the string */
+   *data = (char*)malloc(len * sizeof(char) + 1);
+   /* Read the string characters */
+   memcpy(*data, buf.data + p, len * sizeof(char));
+   /* Set the termination character */
+   *(*data + len) = 0;
+   /* Return new position */
+   return p + len;
+}
+
+/****************************************/
+/****************************************/
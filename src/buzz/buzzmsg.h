@@ -21,11 +21,34 @@ extern "C" {
       BUZZMSG_TYPE_COUNT     // How many Buzz message types have been defined
    } buzzmsg_payload_type_e;
 
+   /*
+    * Encoding of the outgoing Buzz objects.
+    * Every object starts with a type byte. In the compact format, the
+    * type byte has the BUZZMSG_COMPACT bit set, so objects in either
+    * format can be decoded.
+    */
+   typedef enum {
+      BUZZMSG_ENC_LEGACY  = 0x0, // Fixed-size integers, floats and lengths
+      BUZZMSG_ENC_COMPACT = 0x1, // Varint integers and lengths, binary32 floats
+      BUZZMSG_ENC_HALF    = 0x2, // With COMPACT: binary16 floats (lossy)
+      BUZZMSG_ENC_STRREF  = 0x4  // With COMPACT: script strings sent by id
+   } buzzmsg_enc_e;
+
    /*
     * Data of a Buzz message.
     */
    typedef buzzdarray_t buzzmsg_payload_t;
 
+   /*
+    * Read-only view of the data of a Buzz message.
+    * The view does not own the bytes it refers to.
+    */
+   struct buzzmsg_view_s {
+      const uint8_t* data; // The first byte
+      uint32_t size;       // The number of bytes
+   };
+   typedef struct buzzmsg_view_s buzzmsg_view_t;
+
    /*
     * Serializes a 8-bit unsigned integer.
     * The data is appended to the given buffer. The buffer is treated as a
@@ -38,15 +61,14 @@ extern "C" {
 
    /*
     * Deserializes a 8-bit unsigned integer.
-    * The data is read from the given buffer starting at the given position.
-    * The buffer is treated as a dynamic array of uint8_t.
+    * The data is read from the given view starting at the given position.
     * @param data The deserialized data of the element.
-    * @param buf The input buffer where the serialized data is stored.
+    * @param buf The view of the serialized data.
     * @param pos The position at which the data starts.
     * @return The new position in the buffer, of -1 in case of error.
     */
    extern int64_t buzzmsg_deserialize_u8(uint8_t* data,
-                                         buzzmsg_payload_t buf,
+                                         buzzmsg_view_t buf,
                                          uint32_t pos);
 
    /*
@@ -61,15 +83,14 @@ extern "C" {
 
    /*
     * Deserializes a 16-bit unsigned integer.
-    * The data is read from the given buffer starting at the given position.
-    * The buffer is treated as a dynamic array of uint8_t.
+    * The data is read from the given view starting at the given position.
     * @param data The deserialized data of the element.
-    * @param buf The input buffer where the serialized data is stored.
+    * @param buf The view of the serialized data.
     * @param pos The position at which the data starts.
     * @return The new position in the buffer, of -1 in case of error.
     */
    extern int64_t buzzmsg_deserialize_u16(uint16_t* data,
-                                          buzzmsg_payload_t buf,
+                                          buzzmsg_view_t buf,
                                           uint32_t pos);
 
    /*
@@ -84,15 +105,14 @@ extern "C" {
 
    /*
     * Deserializes a 32-bit unsigned integer.
-    * The data is read from the given buffer starting at the given position.
-    * The buffer is treated as a dynamic array of uint8_t.
+    * The data is read from the given view starting at the given position.
     * @param data The deserialized data of the element.
-    * @param buf The input buffer where the serialized data is stored.
+    * @param buf The view of the serialized data.
     * @param pos The position at which the data starts.
     * @return The new position in the buffer, of -1 in case of error.
     */
    extern int64_t buzzmsg_deserialize_u32(uint32_t* data,
-                                          buzzmsg_payload_t buf,
+                                          buzzmsg_view_t buf,
                                           uint32_t pos);
 
    /*
@@ -107,15 +127,14 @@ extern "C" {
 
    /*
     * Deserializes a float.
-    * The data is read from the given buffer starting at the given position.
-    * The buffer is treated as a dynamic array of uint8_t.
+    * The data is read from the given view starting at the given position.
     * @param data The deserialized data of the element.
-    * @param buf The input buffer where the serialized data is stored.
+    * @param buf The view of the serialized data.
     * @param pos The position at which the data starts.
     * @return The new position in the buffer, of -1 in case of error.
     */
    extern int64_t buzzmsg_deserialize_float(float* data,
-                                            buzzmsg_payload_t buf,
+                                            buzzmsg_view_t buf,
                                             uint32_t pos);
 
    /*
@@ -130,21 +149,126 @@ extern "C" {
 
    /*
     * Deserializes a string.
-    * The data is read from the given buffer starting at the given position.
-    * The buffer is treated as a dynamic array of uint8_t.
+    * The data is read from the given view starting at the given position.
     * @param data The deserialized data of the element. You are in charge of freeing it.
-    * @param buf The input buffer where the serialized data is stored.
+    * @param buf The view of the serialized data.
     * @param pos The position at which the data starts.
     * @return The new position in the buffer, of -1 in case of error.
     */
    extern int64_t buzzmsg_deserialize_string(char** data,
-                                             buzzmsg_payload_t buf,
+                                             buzzmsg_view_t buf,
+                                             uint32_t pos);
+
+   /*
+    * Serializes a 32-bit unsigned integer as a varint.
+    * The varint takes 1 to 5 bytes, 7 bits per byte starting from the
+    * least significant ones. The high bit of a byte is set when more
+    * bytes follow.
+    * @param buf The output buffer where the serialized data is appended.
+    * @param data The data to serialize.
+    */
+   extern void buzzmsg_serialize_varint(buzzmsg_payload_t buf,
+                                        uint32_t data);
+
+   /*
+    * Deserializes a 32-bit unsigned integer stored as a varint.
+    * @param data The deserialized data of the element.
+    * @param buf The view of the serialized data.
+    * @param pos The position at which the data starts.
+    * @return The new position in the buffer, of -1 in case of error.
+    */
+   extern int64_t buzzmsg_deserialize_varint(uint32_t* data,
+                                             buzzmsg_view_t buf,
                                              uint32_t pos);
 
+   /*
+    * Serializes a 32-bit signed integer as a zig-zag varint.
+    * Small magnitudes, positive or negative, take few bytes.
+    * @param buf The output buffer where the serialized data is appended.
+    * @param data The data to serialize.
+    */
+   extern void buzzmsg_serialize_svarint(buzzmsg_payload_t buf,
+                                         int32_t data);
+
+   /*
+    * Deserializes a 32-bit signed integer stored as a zig-zag varint.
+    * @param data The deserialized data of the element.
+    * @param buf The view of the serialized data.
+    * @param pos The position at which the data starts.
+    * @return The new position in the buffer, of -1 in case of error.
+    */
+   extern int64_t buzzmsg_deserialize_svarint(int32_t* data,
+                                              buzzmsg_view_t buf,
+                                              uint32_t pos);
+
+   /*
+    * Serializes a float as an IEEE 754 binary32.
+    * @param buf The output buffer where the serialized data is appended.
+    * @param data The data to serialize.
+    */
+   extern void buzzmsg_serialize_float32(buzzmsg_payload_t buf,
+                                         float data);
+
+   /*
+    * Deserializes a float stored as an IEEE 754 binary32.
+    * @param data The deserialized data of the element.
+    * @param buf The view of the serialized data.
+    * @param pos The position at which the data starts.
+    * @return The new position in the buffer, of -1 in case of error.
+    */
+   extern int64_t buzzmsg_deserialize_float32(float* data,
+                                              buzzmsg_view_t buf,
+                                              uint32_t pos);
+
+   /*
+    * Converts a float to an IEEE 754 binary16, rounding to nearest even.
+    * Values too large for a binary16 become infinities.
+    * @param data The float.
+    * @return The binary16.
+    */
+   extern uint16_t buzzmsg_float_tohalf(float data);
+
+   /*
+    * Converts an IEEE 754 binary16 to a float.
+    * @param data The binary16.
+    * @return The float.
+    */
+   extern float buzzmsg_float_fromhalf(uint16_t data);
+
+   /*
+    * Serializes a string with a varint length.
+    * @param buf The output buffer where the serialized data is appended.
+    * @param data The data to serialize.
+    */
+   extern void buzzmsg_serialize_vstring(buzzmsg_payload_t buf,
+                                         const char* data);
+
+   /*
+    * Deserializes a string with a varint length.
+    * @param data The deserialized data of the element. You are in charge of freeing it.
+    * @param buf The view of the serialized data.
+    * @param pos The position at which the data starts.
+    * @return The new position in the buffer, of -1 in case of error.
+    */
+   extern int64_t buzzmsg_deserialize_vstring(char** data,
+                                              buzzmsg_view_t buf,
+                                              uint32_t pos);
+
 #ifdef __cplusplus
 }
 #endif
 
+/*
+ * Bit set in the type byte of an object in the compact format.
+ */
+#define BUZZMSG_COMPACT 0x80
+
+/*
+ * Bit set in the type byte of a compact object that uses the alternative
+ * encoding of its type: binary16 for floats, string id for strings.
+ */
+#define BUZZMSG_ALT 0x40
+
 /*
  * Create a new message payload.
  * @param cap The initial capacity of the message payload. Must be >0.
@@ -179,4 +303,12 @@ extern "C" {
  */
 #define buzzmsg_payload_get(msg, pos) buzzdarray_get(msg, pos, uint8_t)
 
+/*
+ * Returns a view of a message payload.
+ * The view is valid until the payload is modified or destroyed.
+ * @param msg The message payload.
+ * @return A view of the message payload.
+ */
+#define buzzmsg_payload_view(msg) ((buzzmsg_view_t){ (const uint8_t*)(msg)->data, buzzdarray_size(msg) })
+
 #endif
@@ -14,7 +14,7 @@
 struct neighbor_filter_s {
    buzzvm_t vm;
    int32_t swarm_id;
-   buzzdict_t result;
+   buzzobj_t result;
 };
 
 /****************************************/
@@ -199,7 +199,7 @@ void neighbor_filter_kin(const void* key, void* data, void* params) {
                                    rid->i.value,
                                    fdata->swarm_id))) {
       /* Add entry to the return table */
-      buzzdict_set(fdata->result, &rid, (buzzobj_t*)data);
+      buzztable_put(fdata->vm, fdata->result, rid, *(buzzobj_t*)data);
    }
 }
 
@@ -211,8 +211,8 @@ int buzzneighbors_kin(buzzvm_t vm) {
    if(!buzzdarray_isempty(vm->swarmstack)) {
       /* Get position in swarm stack */
       uint16_t sstackpos = 1;
-      if(buzzdarray_size(vm->lsyms->syms) > 1)
-         sstackpos = buzzdarray_get(vm->lsyms->syms, 1, buzzobj_t)->i.value;
+      if(buzzvm_lnum(vm) > 0)
+         sstackpos = buzzvm_lsym_at(vm, 1)->i.value;
       /* Get swarm id */
       if(sstackpos <= buzzdarray_size(vm->swarmstack))
          swarmid = buzzdarray_get(vm->swarmstack,
@@ -235,8 +235,8 @@ int buzzneighbors_kin(buzzvm_t vm) {
       /* Create a new data table */
       buzzobj_t kindata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
       /* Filter the neighbors in data and add them to kindata */
-      struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = kindata->t.value };
-      buzzdict_foreach(data->t.value, neighbor_filter_kin, &fdata);
+      struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = kindata };
+      buzztable_foreach(vm, data, neighbor_filter_kin, &fdata);
       /* Add kindata as the POSES field in t */
       buzzvm_push(vm, t);
       buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
@@ -262,7 +262,7 @@ void neighbor_filter_nonkin(const void* key, void* data, void* params) {
                                    rid->i.value,
                                    fdata->swarm_id)) {
       /* Add entry to the return table */
-      buzzdict_set(fdata->result, &rid, (buzzobj_t*)data);
+      buzztable_put(fdata->vm, fdata->result, rid, *(buzzobj_t*)data);
    }
 }
 
@@ -274,8 +274,8 @@ int buzzneighbors_nonkin(buzzvm_t vm) {
    if(!buzzdarray_isempty(vm->swarmstack)) {
       /* Get position in swarm stack */
       uint16_t sstackpos = 1;
-      if(buzzdarray_size(vm->lsyms->syms) > 1)
-         sstackpos = buzzdarray_get(vm->lsyms->syms, 1, buzzobj_t)->i.value;
+      if(buzzvm_lnum(vm) > 0)
+         sstackpos = buzzvm_lsym_at(vm, 1)->i.value;
       /* Get swarm id */
       if(sstackpos <= buzzdarray_size(vm->swarmstack))
          swarmid = buzzdarray_get(vm->swarmstack,
@@ -299,8 +299,8 @@ int buzzneighbors_nonkin(buzzvm_t vm) {
          /* Create a new data table */
          buzzobj_t nonkindata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
          /* Filter the neighbors in data and add them to nonkindata */
-         struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = nonkindata->t.value };
-         buzzdict_foreach(data->t.value, neighbor_filter_nonkin, &fdata);
+         struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = nonkindata };
+         buzztable_foreach(vm, data, neighbor_filter_nonkin, &fdata);
          /* Add nonkindata as the POSES field in t */
          buzzvm_push(vm, t);
          buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
@@ -375,7 +375,7 @@ int buzzneighbors_foreach(struct buzzvm_s* vm) {
          .vm = vm,
          .closure = closure
       };
-      buzzdict_foreach(data->t.value,
+      buzztable_foreach(vm, data,
                        neighbor_for_each,
                        &edata);
    }
@@ -388,7 +388,7 @@ int buzzneighbors_foreach(struct buzzvm_s* vm) {
 struct neighbor_map_each_s {
    buzzvm_t vm;
    buzzobj_t closure;
-   buzzdict_t result;
+   buzzobj_t result;
 };
 
 void neighbor_map_each(const void* key, void* data, void* params) {
@@ -414,7 +414,7 @@ void neighbor_map_each(const void* key, void* data, void* params) {
    }
    /* Add entry to the return table */
    buzzobj_t retval = buzzvm_stack_at(d->vm, 1);
-   buzzdict_set(d->result, &rid, &retval);
+   buzztable_put(d->vm, d->result, rid, retval);
    /* Get rid of return value */
    buzzvm_pop(d->vm);
 }
@@ -450,9 +450,9 @@ int buzzneighbors_map(buzzvm_t vm) {
       struct neighbor_map_each_s fdata = {
          .vm = vm,
          .closure = closure,
-         .result = mapdata->t.value
+         .result = mapdata
       };
-      buzzdict_foreach(data->t.value, neighbor_map_each, &fdata);
+      buzztable_foreach(vm, data, neighbor_map_each, &fdata);
    }
    /* Return the table */
    buzzvm_push(vm, t);
@@ -465,23 +465,21 @@ int buzzneighbors_map(buzzvm_t vm) {
 struct neighbor_reduce_s {
    buzzvm_t vm;
    buzzobj_t closure;
+   uint32_t accum;
 };
 
 void neighbor_reduce(const void* key, void* data, void* params) {
    /* Cast params */
    struct neighbor_reduce_s* d = (struct neighbor_reduce_s*)params;
    if(d->vm->state != BUZZVM_STATE_READY) return;
-   /* Save and pop accumulator from the stack */
-   buzzobj_t accum = buzzvm_stack_at(d->vm, 1);
-   buzzvm_pop(d->vm);
    /* Save current stack size */
    uint32_t ss = buzzvm_stack_top(d->vm);
    /* Push closure and params (key, value, accumulator) */
    buzzvm_push(d->vm, d->closure);
    buzzvm_push(d->vm, *(buzzobj_t*)key);
    buzzvm_push(d->vm, *(buzzobj_t*)data);
-   buzzvm_push(d->vm, accum);
-   /* Call closure - the accumulator is left on the stack */
+   buzzvm_push(d->vm, buzzdarray_get(d->vm->stack, d->accum, buzzobj_t));
+   /* Call closure */
    d->vm->state = buzzvm_closure_call(d->vm, 3);
    if(d->vm->state != BUZZVM_STATE_READY) return;
    /* Make sure a value was returned */
@@ -492,6 +490,10 @@ void neighbor_reduce(const void* key, void* data, void* params) {
                       "neighbors.reduce(function) expects the function to return a value");
       return;
    }
+   /* The return value is the new accumulator */
+   buzzobj_t r = buzzvm_stack_at(d->vm, 1);
+   buzzdarray_set(d->vm->stack, d->accum, &r);
+   buzzvm_pop(d->vm);
 }
 
 int buzzneighbors_reduce(struct buzzvm_s* vm) {
@@ -510,14 +512,18 @@ int buzzneighbors_reduce(struct buzzvm_s* vm) {
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
       buzzobj_t closure = buzzvm_stack_at(vm, 1);
-      /* Put accumulator on the stack */
+      /*
+       * Put accumulator on the stack. It stays in the same place, as
+       * going through the table might push more objects.
+       */
       buzzvm_push(vm, accum);
       /* Go through elements */
       struct neighbor_reduce_s edata = {
          .vm = vm,
-         .closure = closure
+         .closure = closure,
+         .accum = buzzdarray_size(vm->stack) - 1
       };
-      buzzdict_foreach(data->t.value,
+      buzztable_foreach(vm, data,
                        neighbor_reduce,
                        &edata);
       /* The final value of the accumulator is on the stack */
@@ -532,19 +538,20 @@ int buzzneighbors_reduce(struct buzzvm_s* vm) {
 struct neighbor_filter_each_s {
    buzzvm_t vm;
    buzzobj_t closure;
-   buzzdict_t result;
+   buzzobj_t result;
 };
 
 void neighbor_filter_each(const void* key, void* data, void* params) {
    struct neighbor_filter_each_s* d = (struct neighbor_filter_each_s*)params;
    if(d->vm->state != BUZZVM_STATE_READY) return;
    buzzobj_t rid = *(buzzobj_t*)key;
+   buzzobj_t value = *(buzzobj_t*)data;
    /* Save current stack size */
    uint32_t ss = buzzvm_stack_top(d->vm);
    /* Push closure and params (key, value) */
    buzzvm_push(d->vm, d->closure);
    buzzvm_push(d->vm, rid);
-   buzzvm_push(d->vm, *(buzzobj_t*)data);
+   buzzvm_push(d->vm, value);
    /* Call closure */
    d->vm->state = buzzvm_closure_call(d->vm, 2);
    if(d->vm->state != BUZZVM_STATE_READY) return;
@@ -561,7 +568,7 @@ void neighbor_filter_each(const void* key, void* data, void* params) {
    if(retval->o.type != BUZZTYPE_NIL &&
       (retval->o.type != BUZZTYPE_INT ||
        retval->i.value != 0)) {
-      buzzdict_set(d->result, &rid, data);
+      buzztable_put(d->vm, d->result, rid, value);
    }
    /* Get rid of return value */
    buzzvm_pop(d->vm);
@@ -598,9 +605,9 @@ int buzzneighbors_filter(struct buzzvm_s* vm) {
       struct neighbor_map_each_s fdata = {
          .vm = vm,
          .closure = closure,
-         .result = mapdata->t.value
+         .result = mapdata
       };
-      buzzdict_foreach(data->t.value, neighbor_filter_each, &fdata);
+      buzztable_foreach(vm, data, neighbor_filter_each, &fdata);
    }
    /* Return the table */
    buzzvm_push(vm, t);
@@ -619,7 +626,7 @@ int buzzneighbors_count(struct buzzvm_s* vm) {
    buzzvm_tget(vm);
    int32_t count = 0;
    if(buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_NIL) {
-      count = buzzdarray_size(buzzvm_stack_at(vm, 1)->t.value);
+      count = buzztable_size(buzzvm_stack_at(vm, 1));
    }
    buzzvm_pushi(vm, count);
    return buzzvm_ret1(vm);
@@ -4,19 +4,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
-#include <math.h>
-#include <string.h>
 
 /****************************************/
 /****************************************/
 
+#define BUZZOUTMSG_RING_INIT_CAPACITY 4
+#define BUZZOUTMSG_BUF_INIT_CAPACITY  16
+#define BUZZOUTMSG_BUF_MAX_CAPACITY   1024
+
 /*
  * Broadcast message data
  */
 struct buzzoutmsg_broadcast_s {
    int type;
-   buzzobj_t topic;
-   buzzobj_t value;
+   uint32_t seq;
+   uint32_t step;    /* Step in which the message was queued */
+   uint8_t* payload; /* Serialized message */
+   uint32_t size;    /* Size of the serialized message */
 };
 
 /*
@@ -24,6 +28,8 @@ struct buzzoutmsg_broadcast_s {
  */
 struct buzzoutmsg_swarm_s {
    int type;
+   uint32_t seq;
+   uint32_t step;    /* Step in which the message was queued */
    uint16_t* ids;
    uint16_t size;
 };
@@ -33,9 +39,13 @@ struct buzzoutmsg_swarm_s {
  */
 struct buzzoutmsg_vstig_s {
    int type;
+   uint32_t seq;
+   uint32_t step;    /* Step in which the message was queued */
+   uint8_t* payload; /* Serialized message */
+   uint32_t size;    /* Size of the serialized message */
    uint16_t id;
+   uint16_t timestamp;
    buzzobj_t key;
-   buzzvstig_elem_t data;
 };
 
 /*
@@ -49,6 +59,18 @@ union buzzoutmsg_u {
 };
 typedef union buzzoutmsg_u* buzzoutmsg_t;
 
+/*
+ * Message types by decreasing priority
+ */
+static const int BUZZOUTMSG_ORDER[BUZZMSG_TYPE_COUNT] = {
+   BUZZMSG_BROADCAST,
+   BUZZMSG_SWARM_LIST,
+   BUZZMSG_VSTIG_PUT,
+   BUZZMSG_VSTIG_QUERY,
+   BUZZMSG_SWARM_JOIN,
+   BUZZMSG_SWARM_LEAVE
+};
+
 /****************************************/
 /****************************************/
 
@@ -60,53 +82,231 @@ int buzzoutmsg_obj_cmp(const void* a, const void* b) {
    return buzzobj_cmp(*(const buzzobj_t*)a, *(const buzzobj_t*)b);
 }
 
-void buzzoutmsg_destroy(uint32_t pos, void* data, void* params) {
-   buzzoutmsg_t m = *(buzzoutmsg_t*)data;
+/*
+ * Returns the slot of the message with the given sequence number.
+ */
+#define buzzoutmsg_ring_slot(r, seq) ((r)->msgs[(seq) & ((r)->cap - 1)])
+
+/*
+ * Returns the number of bytes allocated for a ring buffer of the given capacity.
+ */
+#define buzzoutmsg_ring_bytes(cap) ((int64_t)(cap) * sizeof(buzzoutmsg_t))
+
+/*
+ * Returns the number of bytes allocated for the given message.
+ */
+static int64_t buzzoutmsg_bytes(buzzoutmsg_t m) {
+   int64_t bytes = sizeof(union buzzoutmsg_u);
+   switch(m->type) {
+      case BUZZMSG_BROADCAST:
+         bytes += m->bc.size;
+         break;
+      case BUZZMSG_SWARM_JOIN:
+      case BUZZMSG_SWARM_LEAVE:
+      case BUZZMSG_SWARM_LIST:
+         bytes += m->sw.size * sizeof(uint16_t);
+         break;
+      case BUZZMSG_VSTIG_PUT:
+      case BUZZMSG_VSTIG_QUERY:
+         bytes += m->vs.size;
+         break;
+   }
+   return bytes;
+}
+
+/*
+ * Returns the size of the given message once serialized.
+ */
+static uint32_t buzzoutmsg_size(buzzoutmsg_t m) {
+   switch(m->type) {
+      case BUZZMSG_BROADCAST:
+         return m->bc.size;
+      case BUZZMSG_SWARM_LIST:
+         return sizeof(uint8_t) + sizeof(uint16_t) + m->sw.size * sizeof(uint16_t);
+      case BUZZMSG_SWARM_JOIN:
+      case BUZZMSG_SWARM_LEAVE:
+         return sizeof(uint8_t) + sizeof(uint16_t);
+      case BUZZMSG_VSTIG_PUT:
+      case BUZZMSG_VSTIG_QUERY:
+         return m->vs.size;
+   }
+   return 0;
+}
+
+/*
+ * Writes a 16-bit unsigned integer in network byte order.
+ */
+static uint8_t* buzzoutmsg_write_u16(uint8_t* buf, uint16_t data) {
+   uint16_t x = htons(data);
+   memcpy(buf, &x, sizeof(uint16_t));
+   return buf + sizeof(uint16_t);
+}
+
+/*
+ * Writes the given message serialized.
+ * The buffer must hold at least buzzoutmsg_size(m) bytes.
+ */
+static void buzzoutmsg_write(buzzoutmsg_t m, uint8_t* buf) {
+   uint16_t i;
+   switch(m->type) {
+      case BUZZMSG_BROADCAST:
+         memcpy(buf, m->bc.payload, m->bc.size);
+         break;
+      case BUZZMSG_SWARM_LIST:
+         *buf = BUZZMSG_SWARM_LIST;
+         buf = buzzoutmsg_write_u16(buf + 1, m->sw.size);
+         for(i = 0; i < m->sw.size; ++i)
+            buf = buzzoutmsg_write_u16(buf, m->sw.ids[i]);
+         break;
+      case BUZZMSG_SWARM_JOIN:
+      case BUZZMSG_SWARM_LEAVE:
+         *buf = m->type;
+         buzzoutmsg_write_u16(buf + 1, m->sw.ids[0]);
+         break;
+      case BUZZMSG_VSTIG_PUT:
+      case BUZZMSG_VSTIG_QUERY:
+         memcpy(buf, m->vs.payload, m->vs.size);
+         break;
+   }
+}
+
+/*
+ * Takes a copy of the message serialized in the scratch buffer and
+ * empties the scratch buffer.
+ */
+static uint8_t* buzzoutmsg_take_buf(buzzoutmsg_queue_t q,
+                                    uint32_t* size) {
+   *size = buzzmsg_payload_size(q->buf);
+   uint8_t* payload = (uint8_t*)malloc(*size);
+   memcpy(payload, q->buf->data, *size);
+   /* Don't hold on to the memory of a large message */
+   if(q->buf->capacity > BUZZOUTMSG_BUF_MAX_CAPACITY)
+      buzzdarray_clear(q->buf, BUZZOUTMSG_BUF_INIT_CAPACITY);
+   else
+      buzzdarray_truncate(q->buf, 0);
+   return payload;
+}
+
+static void buzzoutmsg_destroy(buzzoutmsg_queue_t q,
+                               buzzoutmsg_t m) {
+   buzzmem_charge(q->mem, BUZZMEM_OUTMSGS, -buzzoutmsg_bytes(m));
    switch(m->type) {
       case BUZZMSG_BROADCAST:
+         free(m->bc.payload);
          break;
       case BUZZMSG_SWARM_JOIN:
       case BUZZMSG_SWARM_LEAVE:
       case BUZZMSG_SWARM_LIST:
-         if(m->sw.size > 0) free(m->sw.ids);
+         free(m->sw.ids);
          break;
       case BUZZMSG_VSTIG_PUT:
       case BUZZMSG_VSTIG_QUERY:
-         free(m->vs.data);
+         free(m->vs.payload);
          break;
    }
    free(m);
 }
 
 void buzzoutmsg_vstig_destroy(const void* key, void* data, void* params) {
-   free((void*)key);
    buzzdict_destroy((buzzdict_t*)data);
-   free(data);
 }
 
-int buzzoutmsg_vstig_cmp(const void* a, const void* b) {
-   if((uintptr_t)(*(buzzoutmsg_t*)a) < (uintptr_t)(*(buzzoutmsg_t*)b)) return -1;
-   if((uintptr_t)(*(buzzoutmsg_t*)a) > (uintptr_t)(*(buzzoutmsg_t*)b)) return  1;
-   return 0;
+/****************************************/
+/****************************************/
+
+/*
+ * Moves the messages of a ring buffer into a new one of the given
+ * capacity, dropping the empty slots. The messages are renumbered.
+ */
+static void buzzoutmsg_ring_resize(buzzoutmsg_queue_t q,
+                                   struct buzzoutmsg_ring_s* r,
+                                   uint32_t cap) {
+   buzzoutmsg_t* msgs = (buzzoutmsg_t*)malloc(cap * sizeof(buzzoutmsg_t));
+   uint32_t seq, n = 0;
+   for(seq = r->head; seq != r->tail; ++seq) {
+      buzzoutmsg_t m = buzzoutmsg_ring_slot(r, seq);
+      if(m) {
+         m->bc.seq = n;
+         msgs[n++] = m;
+      }
+   }
+   buzzmem_charge(q->mem, BUZZMEM_OUTMSGS,
+                  buzzoutmsg_ring_bytes(cap) - buzzoutmsg_ring_bytes(r->cap));
+   free(r->msgs);
+   r->msgs = msgs;
+   r->cap = cap;
+   r->head = 0;
+   r->tail = n;
+}
+
+/*
+ * Appends a message to a ring buffer and charges its memory.
+ */
+static void buzzoutmsg_ring_push(buzzoutmsg_queue_t q,
+                                 struct buzzoutmsg_ring_s* r,
+                                 buzzoutmsg_t m) {
+   /* Make room if the ring is full, either by dropping the empty
+      slots or by doubling the capacity */
+   if(r->tail - r->head == r->cap)
+      buzzoutmsg_ring_resize(q, r, r->size < r->cap / 2 ? r->cap : r->cap * 2);
+   m->bc.seq = r->tail;
+   m->bc.step = q->step;
+   buzzoutmsg_ring_slot(r, r->tail) = m;
+   ++r->tail;
+   ++r->size;
+   buzzmem_charge(q->mem, BUZZMEM_OUTMSGS, buzzoutmsg_bytes(m));
+}
+
+/*
+ * Returns the first message of a ring buffer, or NULL.
+ */
+#define buzzoutmsg_ring_first(r) ((r)->size > 0 ? buzzoutmsg_ring_slot(r, (r)->head) : NULL)
+
+/*
+ * Removes and destroys a message from a ring buffer.
+ */
+static void buzzoutmsg_ring_remove(buzzoutmsg_queue_t q,
+                                   struct buzzoutmsg_ring_s* r,
+                                   buzzoutmsg_t m) {
+   buzzoutmsg_ring_slot(r, m->bc.seq) = NULL;
+   --r->size;
+   buzzoutmsg_destroy(q, m);
+   /* Move the head to the next message */
+   while(r->head != r->tail && !buzzoutmsg_ring_slot(r, r->head))
+      ++r->head;
+}
+
+/*
+ * Destroys the messages of a ring buffer.
+ */
+static void buzzoutmsg_ring_clear(buzzoutmsg_queue_t q,
+                                  struct buzzoutmsg_ring_s* r) {
+   for(; r->head != r->tail; ++r->head) {
+      buzzoutmsg_t m = buzzoutmsg_ring_slot(r, r->head);
+      if(m) buzzoutmsg_destroy(q, m);
+   }
+   r->size = 0;
 }
 
 /****************************************/
 /****************************************/
 
 buzzoutmsg_queue_t buzzoutmsg_queue_new() {
-   buzzoutmsg_queue_t q = (buzzoutmsg_queue_t)malloc(sizeof(struct buzzoutmsg_queue_s));
-   q->queues[BUZZMSG_BROADCAST]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
-   q->queues[BUZZMSG_SWARM_LIST]  = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
-   q->queues[BUZZMSG_SWARM_JOIN]  = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
-   q->queues[BUZZMSG_SWARM_LEAVE] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
-   q->queues[BUZZMSG_VSTIG_PUT]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
-   q->queues[BUZZMSG_VSTIG_QUERY] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   buzzoutmsg_queue_t q = (buzzoutmsg_queue_t)calloc(1, sizeof(struct buzzoutmsg_queue_s));
+   int i;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      q->queues[i].cap = BUZZOUTMSG_RING_INIT_CAPACITY;
+      q->queues[i].msgs = (buzzoutmsg_t*)malloc(BUZZOUTMSG_RING_INIT_CAPACITY * sizeof(buzzoutmsg_t));
+   }
    q->vstig = buzzdict_new(10,
                            sizeof(uint16_t),
                            sizeof(buzzdict_t),
                            buzzdict_uint16keyhash,
                            buzzdict_uint16keycmp,
                            buzzoutmsg_vstig_destroy);
+   q->buf = buzzmsg_payload_new(BUZZOUTMSG_BUF_INIT_CAPACITY);
+   q->sched = buzzoutmsg_sched_default;
+   q->cur = -1;
    return q;
 }
 
@@ -114,27 +314,43 @@ buzzoutmsg_queue_t buzzoutmsg_queue_new() {
 /****************************************/
 
 void buzzoutmsg_queue_destroy(buzzoutmsg_queue_t* msgq) {
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_BROADCAST]));
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_LIST]));
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_JOIN]));
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_LEAVE]));
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_PUT]));
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_QUERY]));
-   buzzdict_destroy(&((*msgq)->vstig));
-   free(*msgq);
+   buzzoutmsg_queue_t q = *msgq;
+   int i;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      buzzoutmsg_ring_clear(q, q->queues + i);
+      buzzmem_charge(q->mem, BUZZMEM_OUTMSGS, -buzzoutmsg_ring_bytes(q->queues[i].cap));
+      free(q->queues[i].msgs);
+   }
+   buzzmem_charge(q->mem, BUZZMEM_OUTMSGS, -(int64_t)sizeof(struct buzzoutmsg_queue_s));
+   buzzdict_destroy(&q->vstig);
+   buzzmsg_payload_destroy(&q->buf);
+   free(q);
+   *msgq = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_account(buzzoutmsg_queue_t msgq,
+                              buzzmem_t mem) {
+   int i;
+   msgq->mem = mem;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i)
+      buzzmem_charge(mem, BUZZMEM_OUTMSGS, buzzoutmsg_ring_bytes(msgq->queues[i].cap));
+   buzzdict_account(msgq->vstig, mem, BUZZMEM_OUTMSGS);
+   buzzdarray_account(msgq->buf, mem, BUZZMEM_OUTMSGS);
+   buzzmem_charge(mem, BUZZMEM_OUTMSGS, sizeof(struct buzzoutmsg_queue_s));
 }
 
 /****************************************/
 /****************************************/
 
 uint32_t buzzoutmsg_queue_size(buzzvm_t vm) {
-   return
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_BROADCAST]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_LIST]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY]);
+   uint32_t size = 0;
+   int i;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i)
+      size += vm->outmsgs->queues[i].size;
+   return size;
 }
 
 /****************************************/
@@ -143,13 +359,15 @@ uint32_t buzzoutmsg_queue_size(buzzvm_t vm) {
 void buzzoutmsg_queue_append_broadcast(buzzvm_t vm,
                                        buzzobj_t topic,
                                        buzzobj_t value) {
-   /* Make a new BROADCAST message */
+   /* Make a new BROADCAST message, serialized right away */
    buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
    m->bc.type = BUZZMSG_BROADCAST;
-   m->bc.topic = buzzheap_clone(vm, topic);
-   m->bc.value = buzzheap_clone(vm, value);
+   buzzmsg_serialize_u8(vm->outmsgs->buf, BUZZMSG_BROADCAST);
+   buzzobj_serialize(vm->outmsgs->buf, topic, vm);
+   buzzobj_serialize(vm->outmsgs->buf, value, vm);
+   m->bc.payload = buzzoutmsg_take_buf(vm->outmsgs, &m->bc.size);
    /* Queue it */
-   buzzdarray_push(vm->outmsgs->queues[BUZZMSG_BROADCAST], &m);   
+   buzzoutmsg_ring_push(vm->outmsgs, vm->outmsgs->queues + BUZZMSG_BROADCAST, m);
 }
 
 /****************************************/
@@ -186,9 +404,9 @@ void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
     * - If a list message is already queued, join/leave messages are not
     */
    /* Delete every existing SWARM related message */
-   buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], 1);
-   buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], 1);
-   buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], 1);
+   buzzoutmsg_ring_clear(vm->outmsgs, vm->outmsgs->queues + BUZZMSG_SWARM_LIST);
+   buzzoutmsg_ring_clear(vm->outmsgs, vm->outmsgs->queues + BUZZMSG_SWARM_JOIN);
+   buzzoutmsg_ring_clear(vm->outmsgs, vm->outmsgs->queues + BUZZMSG_SWARM_LEAVE);
    /* Make an array of current swarm id dictionary */
    struct dict_to_array_s da = {
       .count = 0,
@@ -204,53 +422,41 @@ void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
    memcpy(m->sw.ids, da.data, m->sw.size * sizeof(uint16_t));
    free(da.data);
    /* Queue the new LIST message */
-   buzzdarray_push(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], &m);
+   buzzoutmsg_ring_push(vm->outmsgs, vm->outmsgs->queues + BUZZMSG_SWARM_LIST, m);
 }
 
 /****************************************/
 /****************************************/
 
-static void append_to_swarm_queue(buzzdarray_t q, uint16_t id, int type) {
-   /* Is the queue empty? */
-   if(buzzdarray_isempty(q)) {
-      /* Yes, add the element at the end */
+/*
+ * Returns the message of a swarm queue with the given id, or NULL.
+ */
+static buzzoutmsg_t find_in_swarm_queue(struct buzzoutmsg_ring_s* r, uint16_t id) {
+   uint32_t seq;
+   for(seq = r->head; seq != r->tail; ++seq) {
+      buzzoutmsg_t m = buzzoutmsg_ring_slot(r, seq);
+      if(m && m->sw.ids[0] == id) return m;
+   }
+   return NULL;
+}
+
+static void append_to_swarm_queue(buzzoutmsg_queue_t q, uint16_t id, int type) {
+   /* Look for a message with the same id */
+   if(!find_in_swarm_queue(q->queues + type, id)) {
+      /* Not found, append a new message the passed id */
       buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
       m->sw.type = type;
       m->sw.size = 1;
       m->sw.ids = (uint16_t*)malloc(sizeof(uint16_t));
       m->sw.ids[0] = id;
-      buzzdarray_push(q, &m);
-   }
-   else {
-      /* Queue not empty - look for a message with the same id */
-      int found = 0;
-      uint32_t i;
-      for(i = 0; i < buzzdarray_size(q) && !found; ++i) {
-         found = buzzdarray_get(q, i, buzzoutmsg_t)->sw.ids[0] == id;
-      }
-      /* Message found? */
-      if(!found) {
-         /* No, append a new message the passed id */
-         buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
-         m->sw.type = type;
-         m->sw.size = 1;
-         m->sw.ids = (uint16_t*)malloc(sizeof(uint16_t));
-         m->sw.ids[0] = id;
-         buzzdarray_push(q, &m);
-      }
+      buzzoutmsg_ring_push(q, q->queues + type, m);
    }
 }
 
-static void remove_from_swarm_queue(buzzdarray_t q, uint16_t id) {
-   /* Is the queue empty? If so, nothing to do */
-   if(buzzdarray_isempty(q)) return;
-   /* Queue not empty - look for a message with the same id */
-   uint32_t i;
-   for(i = 0; i < buzzdarray_size(q); ++i) {
-      if(buzzdarray_get(q, i, buzzoutmsg_t)->sw.ids[0] == id) break;
-   }
-   /* Message found? If so, remove it */
-   if(i < buzzdarray_size(q)) buzzdarray_remove(q, i);
+static void remove_from_swarm_queue(buzzoutmsg_queue_t q, uint16_t id, int type) {
+   /* Look for a message with the same id; if found, remove it */
+   buzzoutmsg_t m = find_in_swarm_queue(q->queues + type, id);
+   if(m) buzzoutmsg_ring_remove(q, q->queues + type, m);
 }
 
 void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
@@ -261,10 +467,9 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
     * - If a list message is already queued, join/leave messages are not
     */
    /* Is there a LIST message? */
-   if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) {
-      /* Yes, get a handle to the message */
-      buzzoutmsg_t l = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], 0, buzzoutmsg_t);
-      /* Go through the ids in the list and look for the passed id */
+   buzzoutmsg_t l = buzzoutmsg_ring_first(vm->outmsgs->queues + BUZZMSG_SWARM_LIST);
+   if(l) {
+      /* Yes, go through the ids in the list and look for the passed id */
       uint16_t i = 0;
       while(i < l->sw.size && l->sw.ids[i] != id) ++i;
       /* Id found? */
@@ -273,6 +478,7 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
          if(type == BUZZMSG_SWARM_LEAVE) {
             /* Yes: remove it from the list */
             --(l->sw.size);
+            buzzmem_charge(vm->outmsgs->mem, BUZZMEM_OUTMSGS, -(int64_t)sizeof(uint16_t));
             memmove(l->sw.ids+i, l->sw.ids+i+1, (l->sw.size-i) * sizeof(uint16_t));
          }
          /* If the message is a JOIN, there's nothing to do */
@@ -283,6 +489,7 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
             /* Yes: add it to the list */
             ++(l->sw.size);
             l->sw.ids = realloc(l->sw.ids, l->sw.size * sizeof(uint16_t));
+            buzzmem_charge(vm->outmsgs->mem, BUZZMEM_OUTMSGS, sizeof(uint16_t));
             l->sw.ids[l->sw.size-1] = id;
          }
          /* If the message is a LEAVE, there's nothing to do */
@@ -292,15 +499,15 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
       /* No LIST message present - send an individual message */
       if(type == BUZZMSG_SWARM_JOIN) {
          /* Look for a duplicate in the JOIN queue - if not add one  */
-         append_to_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], id, BUZZMSG_SWARM_JOIN);
+         append_to_swarm_queue(vm->outmsgs, id, BUZZMSG_SWARM_JOIN);
          /* Look for an entry in the LEAVE queue and remove it  */
-         remove_from_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], id);
+         remove_from_swarm_queue(vm->outmsgs, id, BUZZMSG_SWARM_LEAVE);
       }
       else if(type == BUZZMSG_SWARM_LEAVE) {
          /* Look for an entry in the JOIN queue and remove it */
-         remove_from_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], id);
+         remove_from_swarm_queue(vm->outmsgs, id, BUZZMSG_SWARM_JOIN);
          /* Look for a duplicate in the LEAVE queue - if not add one  */
-         append_to_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], id, BUZZMSG_SWARM_LEAVE);
+         append_to_swarm_queue(vm->outmsgs, id, BUZZMSG_SWARM_LEAVE);
       }
    }
 }
@@ -314,7 +521,7 @@ void buzzoutmsg_queue_append_vstig(buzzvm_t vm,
                                    const buzzobj_t key,
                                    const buzzvstig_elem_t data) {
    /* Look for a duplicate message in the dictionary */
-   const struct buzzoutmsg_vstig_s** e = NULL;
+   buzzoutmsg_t const* e = NULL;
    /* Virtual stigmergy to actually use */
    buzzdict_t vs = NULL;
    /* Look for the virtual stigmergy */
@@ -322,196 +529,275 @@ void buzzoutmsg_queue_append_vstig(buzzvm_t vm,
    if(tvs) {
       /* Virtual stigmergy found, look for the key */
       vs = *tvs;
-      e = buzzdict_get(vs, &key, struct buzzoutmsg_vstig_s*);
+      e = buzzdict_get(vs, &key, buzzoutmsg_t);
    }
    else {
       /* Virtual stigmergy not found, create it */
       vs = buzzdict_new(10,
                         sizeof(buzzobj_t),
-                        sizeof(struct buzzoutmsg_vstig_s*),
+                        sizeof(buzzoutmsg_t),
                         buzzoutmsg_obj_hash,
                         buzzoutmsg_obj_cmp,
                         NULL);
+      buzzdict_account(vs, vm->mem, BUZZMEM_OUTMSGS);
       buzzdict_set(vm->outmsgs->vstig, &id, &vs);
    }
    /* Do we have a more recent duplicate? */
-   int etype = -1, eidx = -1; /* No message to remove from the queue */
+   buzzoutmsg_t old = NULL; /* No message to remove from the queue */
    if(e) {
       /* Yes; if the duplicate is newer than the passed message, nothing to do */
-      if((*e)->data->timestamp >= data->timestamp) return;
-      /* The duplicate is older, store data to remove it later */
-      etype = (*e)->type;
-      eidx = buzzdarray_find(vm->outmsgs->queues[etype], buzzoutmsg_vstig_cmp, e);
+      if((*e)->vs.timestamp >= data->timestamp) return;
+      /* The duplicate is older, remove it later */
+      old = *e;
    }
-   /* Create a new message */
+   /* Create a new message, serialized right away */
    buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
    m->vs.type = type;
    m->vs.id = id;
+   m->vs.timestamp = data->timestamp;
    m->vs.key = buzzheap_clone(vm, key);
-   m->vs.data = buzzvstig_elem_clone(vm, data);
+   buzzmsg_serialize_u8(vm->outmsgs->buf, type);
+   buzzmsg_serialize_u16(vm->outmsgs->buf, id);
+   buzzvstig_elem_serialize(vm->outmsgs->buf, key, data, vm);
+   m->vs.payload = buzzoutmsg_take_buf(vm->outmsgs, &m->vs.size);
    /* Update the dictionary - this also invalidates e */
    buzzdict_set(vs, &m->vs.key, &m);
-   if(etype > -1) {
+   if(old) {
       /* Remove the entry from the queue */
-      buzzdarray_remove(vm->outmsgs->queues[etype], eidx);
+      buzzoutmsg_ring_remove(vm->outmsgs, vm->outmsgs->queues + old->type, old);
    }
    /* Add a new message to the queue */
-   buzzdarray_push(vm->outmsgs->queues[type], &m);
+   buzzoutmsg_ring_push(vm->outmsgs, vm->outmsgs->queues + type, m);
 }
 
 /****************************************/
 /****************************************/
 
-buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
-   if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_BROADCAST])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_BROADCAST],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_BROADCAST);
-      buzzobj_serialize(m, f->bc.topic);
-      buzzobj_serialize(m, f->bc.value);
-      /* Return message */
-      return m;
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) {
-      uint16_t i;
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_LIST],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_SWARM_LIST);
-      buzzmsg_serialize_u16(m, f->sw.size);
-      for(i = 0; i < f->sw.size; ++i) {
-         buzzmsg_serialize_u16(m, f->sw.ids[i]);
-      }
-      /* Return message */
-      return m;      
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_PUT);
-      buzzmsg_serialize_u16(m, f->vs.id);
-      buzzvstig_elem_serialize(m, f->vs.key, f->vs.data);
-      /* Return message */
-      return m;
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_QUERY);
-      buzzmsg_serialize_u16(m, f->vs.id);
-      buzzvstig_elem_serialize(m, f->vs.key, f->vs.data);
-      /* Return message */
-      return m;
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(5);
-      buzzmsg_serialize_u8(m, BUZZMSG_SWARM_JOIN);
-      buzzmsg_serialize_u16(m, f->sw.ids[0]);
-      /* Return message */
-      return m;      
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(5);
-      buzzmsg_serialize_u8(m, BUZZMSG_SWARM_LEAVE);
-      buzzmsg_serialize_u16(m, f->sw.ids[0]);
-      /* Return message */
-      return m;      
+/*
+ * Returns whether a class has a message to send and bytes in its bucket.
+ */
+#define buzzoutmsg_class_ready(q, t) ((q)->queues[t].size > 0 && ((q)->classes[t].rate == 0 || (q)->classes[t].tokens > 0))
+
+/*
+ * Removes the first message of a ring buffer.
+ */
+static void buzzoutmsg_ring_pop(buzzoutmsg_queue_t q,
+                                struct buzzoutmsg_ring_s* r) {
+   buzzoutmsg_t m = buzzoutmsg_ring_first(r);
+   if(m->type == BUZZMSG_VSTIG_PUT ||
+      m->type == BUZZMSG_VSTIG_QUERY) {
+      /* Remove the element in the vstig dictionary */
+      buzzdict_remove(
+         *buzzdict_get(q->vstig, &m->vs.id, buzzdict_t),
+         &m->vs.key);
    }
-   /* Empty queue */
-   return NULL;
+   buzzoutmsg_ring_remove(q, r, m);
+}
+
+/*
+ * Removes the first message of the given type and counts it as sent.
+ */
+static void buzzoutmsg_queue_pop(buzzoutmsg_queue_t q,
+                                 int type) {
+   struct buzzoutmsg_class_s* c = q->classes + type;
+   uint32_t bytes = sizeof(uint16_t) + buzzoutmsg_size(buzzoutmsg_ring_first(q->queues + type));
+   c->sent += bytes;
+   if(c->rate > 0) c->tokens -= bytes;
+   buzzoutmsg_ring_pop(q, q->queues + type);
+}
+
+/*
+ * Returns the type of the next message to send, or -1.
+ */
+static int buzzoutmsg_queue_pick(buzzvm_t vm,
+                                 uint32_t room) {
+   int t = vm->outmsgs->sched(vm, room, vm->outmsgs->schedparams);
+   /* Make sure the scheduler picked a message */
+   if(t < 0 || t >= BUZZMSG_TYPE_COUNT ||
+      vm->outmsgs->queues[t].size == 0) return -1;
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
+   int t = buzzoutmsg_queue_pick(vm, UINT32_MAX);
+   vm->outmsgs->cur = t;
+   if(t < 0) return NULL;
+   /* Serialize the first message into a new payload */
+   buzzoutmsg_t f = buzzoutmsg_ring_first(vm->outmsgs->queues + t);
+   uint32_t size = buzzoutmsg_size(f);
+   uint8_t* data = (uint8_t*)malloc(size);
+   buzzoutmsg_write(f, data);
+   buzzmsg_payload_t m = buzzmsg_payload_frombuffer(data, size);
+   free(data);
+   return m;
 }
 
 /****************************************/
 /****************************************/
 
 void buzzoutmsg_queue_next(buzzvm_t vm) {
-   if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_BROADCAST])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_BROADCAST], 0);
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], 0);
+   /* Remove the message returned by buzzoutmsg_queue_first(), if any */
+   int t = vm->outmsgs->cur;
+   if(t < 0 || vm->outmsgs->queues[t].size == 0)
+      t = buzzoutmsg_queue_pick(vm, UINT32_MAX);
+   vm->outmsgs->cur = -1;
+   if(t >= 0) buzzoutmsg_queue_pop(vm->outmsgs, t);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzoutmsg_queue_isready(buzzvm_t vm) {
+   return buzzoutmsg_queue_pick(vm, UINT32_MAX) >= 0;
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzoutmsg_pack(buzzvm_t vm,
+                         uint8_t* buf,
+                         uint32_t cap) {
+   uint32_t pos = 0;
+   int t;
+   /* No message fits without room for its size */
+   if(cap < sizeof(uint16_t)) return 0;
+   vm->outmsgs->cur = -1;
+   while((t = buzzoutmsg_queue_pick(vm, cap - pos)) >= 0) {
+      buzzoutmsg_t m = buzzoutmsg_ring_first(vm->outmsgs->queues + t);
+      uint32_t size = buzzoutmsg_size(m);
+      /* Drop the messages that could never fit, or they would
+         clog the queue forever */
+      if(size > UINT16_MAX || size + sizeof(uint16_t) > cap) {
+         ++vm->outmsgs->discarded;
+         buzzoutmsg_ring_pop(vm->outmsgs, vm->outmsgs->queues + t);
+         continue;
+      }
+      /* Stop at the first message that does not fit */
+      if(pos + sizeof(uint16_t) + size > cap) break;
+      /* Write size and message */
+      buzzoutmsg_write_u16(buf + pos, size);
+      buzzoutmsg_write(m, buf + pos + sizeof(uint16_t));
+      pos += sizeof(uint16_t) + size;
+      buzzoutmsg_queue_pop(vm->outmsgs, t);
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                                      0, buzzoutmsg_t);
-      /* Remove the element in the vstig dictionary */
-      buzzdict_remove(
-         *buzzdict_get(vm->outmsgs->vstig, &f->vs.id, buzzdict_t),
-         &f->vs.key);
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT], 0);
+   return pos;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_step(buzzvm_t vm) {
+   int i;
+   ++vm->outmsgs->step;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      struct buzzoutmsg_class_s* c = vm->outmsgs->classes + i;
+      c->sent = 0;
+      if(c->rate > 0) {
+         c->tokens += c->rate;
+         if(c->tokens > c->burst) c->tokens = c->burst;
+      }
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                                      0, buzzoutmsg_t);
-      /* Remove the element in the vstig dictionary */
-      buzzdict_remove(
-         *buzzdict_get(vm->outmsgs->vstig, &f->vs.id, buzzdict_t),
-         &f->vs.key);
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY], 0);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_class_set(buzzvm_t vm,
+                          int type,
+                          uint32_t weight,
+                          uint32_t rate,
+                          uint32_t burst) {
+   struct buzzoutmsg_class_s* c = vm->outmsgs->classes + type;
+   c->weight = weight;
+   c->rate = rate;
+   c->burst = burst > 0 ? burst : rate;
+   c->tokens = c->burst;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_sched_set(buzzvm_t vm,
+                          buzzoutmsg_sched_funp sched,
+                          void* params) {
+   vm->outmsgs->sched = sched ? sched : buzzoutmsg_sched_default;
+   vm->outmsgs->schedparams = params;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzoutmsg_sched_default(buzzvm_t vm,
+                             uint32_t room,
+                             void* params) {
+   buzzoutmsg_queue_t q = vm->outmsgs;
+   int i, t, best = -1;
+   /* A message that waited too long goes first, the oldest first */
+   if(q->maxage > 0) {
+      uint32_t age, oldest = 0;
+      for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+         t = BUZZOUTMSG_ORDER[i];
+         age = buzzoutmsg_queue_head_age(vm, t);
+         if(q->queues[t].size > 0 && age >= q->maxage && (best < 0 || age > oldest)) {
+            best = t;
+            oldest = age;
+         }
+      }
+      if(best >= 0) return best;
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], 0);
+   /* The classes with no weight go in order of priority */
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      t = BUZZOUTMSG_ORDER[i];
+      if(q->classes[t].weight == 0 && buzzoutmsg_class_ready(q, t))
+         return t;
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], 0);
+   /* The others go by the fewest bytes sent in this step for their weight */
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      t = BUZZOUTMSG_ORDER[i];
+      if(q->classes[t].weight > 0 && buzzoutmsg_class_ready(q, t) &&
+         (best < 0 ||
+          (uint64_t)q->classes[t].sent * q->classes[best].weight <
+          (uint64_t)q->classes[best].sent * q->classes[t].weight))
+         best = t;
    }
+   return best;
 }
 
 /****************************************/
 /****************************************/
 
-void buzzoutmsg_broadcast_mark(uint32_t pos, void* data, void* params) {
-   struct buzzoutmsg_broadcast_s* msg = *(struct buzzoutmsg_broadcast_s**)data;
-   buzzvm_t vm = (buzzvm_t)params;
-   buzzheap_obj_mark(msg->topic, vm);
-   buzzheap_obj_mark(msg->value, vm);
+uint32_t buzzoutmsg_queue_head_size(buzzvm_t vm,
+                                    int type) {
+   buzzoutmsg_t m = buzzoutmsg_ring_first(vm->outmsgs->queues + type);
+   return m ? buzzoutmsg_size(m) : 0;
 }
 
-void buzzoutmsg_vstig_mark(uint32_t pos, void* data, void* params) {
-   struct buzzoutmsg_vstig_s* msg = *(struct buzzoutmsg_vstig_s**)data;
-   buzzvm_t vm = (buzzvm_t)params;
-   buzzheap_vstigobj_mark(&msg->key, &msg->data, vm);
+/****************************************/
+/****************************************/
+
+uint32_t buzzoutmsg_queue_head_age(buzzvm_t vm,
+                                   int type) {
+   buzzoutmsg_t m = buzzoutmsg_ring_first(vm->outmsgs->queues + type);
+   return m ? vm->outmsgs->step - m->bc.step : 0;
 }
 
+/****************************************/
+/****************************************/
+
 void buzzoutmsg_gc(struct buzzvm_s* vm) {
-   /* Go through all the broadcast topic strings and mark them */
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_BROADCAST],
-                      buzzoutmsg_broadcast_mark,
-                      vm);
-   /* Go through all the vstig keys and values and mark them */
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                      buzzoutmsg_vstig_mark,
-                      vm);
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                      buzzoutmsg_vstig_mark,
-                      vm);
+   /* Go through all the vstig keys and mark them */
+   int i;
+   for(i = BUZZMSG_VSTIG_PUT; i <= BUZZMSG_VSTIG_QUERY; ++i) {
+      struct buzzoutmsg_ring_s* r = vm->outmsgs->queues + i;
+      uint32_t seq;
+      for(seq = r->head; seq != r->tail; ++seq) {
+         buzzoutmsg_t m = buzzoutmsg_ring_slot(r, seq);
+         if(m) buzzheap_obj_mark(m->vs.key, vm);
+      }
+   }
 }
 
 /****************************************/
@@ -11,14 +11,75 @@ struct buzzvm_s;
 extern "C" {
 #endif
 
+   union buzzoutmsg_u;
+
+   /*
+    * A queue of messages of the same type.
+    * The messages are kept in a ring buffer in order of arrival, and
+    * identified by a sequence number; the slot of a message is its
+    * sequence number modulo the capacity. Removed messages leave an
+    * empty slot behind until the head moves past it.
+    */
+   struct buzzoutmsg_ring_s {
+      union buzzoutmsg_u** msgs; // Ring buffer of messages, NULL when removed
+      uint32_t cap;              // Capacity of the ring buffer, a power of two
+      uint32_t head;             // Sequence number of the first slot in use
+      uint32_t tail;             // Sequence number past the last message
+      uint32_t size;             // Number of messages
+   };
+
+   /*
+    * Scheduling data of a class of messages.
+    * Every message type is a class.
+    */
+   struct buzzoutmsg_class_s {
+      uint32_t weight; // Share of the bandwidth, 0 for strict priority
+      uint32_t rate;   // Bytes added to the bucket at each step, 0 for no limit
+      uint32_t burst;  // Max bytes in the bucket
+      int64_t tokens;  // Bytes in the bucket, negative when in debt
+      uint32_t sent;   // Bytes sent in the current step
+   };
+
+   /*
+    * Function pointer for an outgoing message scheduler.
+    * The scheduler picks the class of the next message to send. It may
+    * be called more than once for the same message, so it must not
+    * change any state.
+    * @param vm The Buzz VM.
+    * @param room The bytes left in the packet being filled.
+    * @param params The parameters passed to buzzoutmsg_sched_set().
+    * @return The type of the next message to send, or -1 to stop.
+    */
+   typedef int (*buzzoutmsg_sched_funp)(struct buzzvm_s* vm,
+                                        uint32_t room,
+                                        void* params);
+
    /*
     * Data of a Buzz message queue.
     */
    struct buzzoutmsg_queue_s {
       /* One queue for each message type */
-      buzzdarray_t queues[BUZZMSG_TYPE_COUNT];
+      struct buzzoutmsg_ring_s queues[BUZZMSG_TYPE_COUNT];
       /* Vstig message dict for fast duplicate management */
       buzzdict_t vstig;
+      /* Scratch buffer to serialize messages */
+      buzzmsg_payload_t buf;
+      /* Number of messages dropped by buzzoutmsg_pack() for being too large */
+      uint32_t discarded;
+      /* Scheduling data of each message class */
+      struct buzzoutmsg_class_s classes[BUZZMSG_TYPE_COUNT];
+      /* Current step, counted by buzzoutmsg_queue_step() */
+      uint32_t step;
+      /* Steps after which a message is sent first, 0 for never */
+      uint32_t maxage;
+      /* The scheduler */
+      buzzoutmsg_sched_funp sched;
+      /* The parameters of the scheduler */
+      void* schedparams;
+      /* Class picked by buzzoutmsg_queue_first(), or -1 */
+      int cur;
+      /* Memory accounting, or NULL */
+      buzzmem_t mem;
    };
    typedef struct buzzoutmsg_queue_s* buzzoutmsg_queue_t;
 
@@ -34,6 +95,15 @@ extern "C" {
     */
    extern void buzzoutmsg_queue_destroy(buzzoutmsg_queue_t* msgq);
 
+   /*
+    * Charges the memory of a new message queue to BUZZMEM_OUTMSGS.
+    * The messages appended afterwards are charged too.
+    * @param msgq The message queue.
+    * @param mem The memory accounting.
+    */
+   extern void buzzoutmsg_queue_account(buzzoutmsg_queue_t msgq,
+                                        buzzmem_t mem);
+
    /*
     * Returns the size of a message queue.
     * @param vm The Buzz VM.
@@ -87,20 +157,128 @@ extern "C" {
 
    /*
     * Returns the first serialized message in the queue.
+    * The message is the one the scheduler picks. This function returns
+    * NULL exactly when buzzoutmsg_queue_isempty() is true, so the loop
+    * <tt>while(!buzzoutmsg_queue_isempty(vm)) { first(); next(); }</tt>
+    * sends what the scheduler allows in this step and then stops. The
+    * messages it holds back, e.g., those of a class whose token bucket is
+    * empty, stay queued for the next steps.
     * You are in charge of freeing both the message data and the payload.
     * @param vm The Buzz VM.
     * @return The message data or NULL.
-    * @see buzzoutmsg_queue_first
+    * @see buzzoutmsg_queue_next
+    * @see buzzoutmsg_pack
     */
    extern buzzmsg_payload_t buzzoutmsg_queue_first(struct buzzvm_s* vm);
 
    /*
     * Removes the first message from the queue.
+    * The message is counted as sent.
     * @param vm The Buzz VM.
     * @see buzzoutmsg_queue_first
     */
    extern void buzzoutmsg_queue_next(struct buzzvm_s* vm);
 
+   /*
+    * Returns whether the scheduler has a message to send now.
+    * This is false when the queue is empty, but also when every queued
+    * message is held back, e.g., by an empty token bucket.
+    * @param vm The Buzz VM.
+    * @return 1 if buzzoutmsg_queue_first() would return a message, 0 otherwise.
+    * @see buzzoutmsg_queue_size
+    */
+   extern int buzzoutmsg_queue_isready(struct buzzvm_s* vm);
+
+   /*
+    * Moves as many messages as fit from the queue into a packet.
+    * Each message is written as its size (16-bit unsigned, network byte
+    * order) followed by its bytes. The messages are taken in the order
+    * the scheduler picks, and packing stops at the first one that does
+    * not fit or when the scheduler returns -1. A message that could never fit is
+    * dropped and counted in buzzoutmsg_queue_discarded().
+    * The bytes of the packet past the returned size are left untouched.
+    * If cap is less than 2 bytes, this function returns 0 and leaves the
+    * queue untouched.
+    * @param vm The Buzz VM.
+    * @param buf The packet buffer.
+    * @param cap The capacity of the packet buffer, in bytes.
+    * @return The number of bytes written.
+    */
+   extern uint32_t buzzoutmsg_pack(struct buzzvm_s* vm,
+                                   uint8_t* buf,
+                                   uint32_t cap);
+
+   /*
+    * Starts a new step.
+    * Refills the token buckets and zeroes the bytes sent by each class.
+    * You should never call this function. It is called by
+    * buzzvm_process_outmsgs().
+    * @param vm The Buzz VM.
+    */
+   extern void buzzoutmsg_queue_step(struct buzzvm_s* vm);
+
+   /*
+    * Configures the scheduling of a message class.
+    * The classes with weight 0 are sent first, in order of priority.
+    * The others share the rest of the bandwidth in proportion to their
+    * weight. A class with a rate is only sent while its token bucket
+    * is not empty; the bucket gains rate bytes at each step, up to
+    * burst bytes. By default, all classes have weight 0 and no rate.
+    * @param vm The Buzz VM.
+    * @param type The message type.
+    * @param weight The share of the bandwidth, or 0 for strict priority.
+    * @param rate The bytes per step, or 0 for no limit.
+    * @param burst The max bytes in the bucket, or 0 for the rate.
+    */
+   extern void buzzoutmsg_class_set(struct buzzvm_s* vm,
+                                    int type,
+                                    uint32_t weight,
+                                    uint32_t rate,
+                                    uint32_t burst);
+
+   /*
+    * Sets the outgoing message scheduler.
+    * @param vm The Buzz VM.
+    * @param sched The scheduler, or NULL for buzzoutmsg_sched_default().
+    * @param params The parameters to pass to the scheduler.
+    */
+   extern void buzzoutmsg_sched_set(struct buzzvm_s* vm,
+                                    buzzoutmsg_sched_funp sched,
+                                    void* params);
+
+   /*
+    * The default outgoing message scheduler.
+    * The first message of a class that waited longer than
+    * buzzoutmsg_maxage_set() steps goes first, the oldest first.
+    * Otherwise, the classes are picked as buzzoutmsg_class_set()
+    * describes. The room left in the packet is ignored.
+    * @param vm The Buzz VM.
+    * @param room The bytes left in the packet being filled.
+    * @param params Unused.
+    * @return The type of the next message to send, or -1 to stop.
+    */
+   extern int buzzoutmsg_sched_default(struct buzzvm_s* vm,
+                                       uint32_t room,
+                                       void* params);
+
+   /*
+    * Returns the size of the first message of the given type, once serialized.
+    * @param vm The Buzz VM.
+    * @param type The message type.
+    * @return The size of the message, or 0 if there are no messages of this type.
+    */
+   extern uint32_t buzzoutmsg_queue_head_size(struct buzzvm_s* vm,
+                                              int type);
+
+   /*
+    * Returns the number of steps the first message of the given type waited.
+    * @param vm The Buzz VM.
+    * @param type The message type.
+    * @return The age of the message, or 0 if there are no messages of this type.
+    */
+   extern uint32_t buzzoutmsg_queue_head_age(struct buzzvm_s* vm,
+                                             int type);
+
    /*
     * Performs garbage collection.
     * You should never call this function. It is called by
@@ -114,10 +292,45 @@ extern "C" {
 #endif
 
 /*
- * Returns <tt>true</tt> if the message queue is empty.
- * @param msgq The message queue.
- * @return <tt>true</tt> if the message queue is empty.
+ * Returns <tt>true</tt> if the message queue has nothing to send now.
+ * Messages the scheduler holds back do not count; use
+ * buzzoutmsg_queue_size() to know whether the queue is really empty.
+ * @param vm The Buzz VM.
+ * @return <tt>true</tt> if the message queue has nothing to send now.
+ */
+#define buzzoutmsg_queue_isempty(vm) (!buzzoutmsg_queue_isready(vm))
+
+/*
+ * Returns the number of queued messages of the given type.
+ * @param vm The Buzz VM.
+ * @param type The message type.
+ * @return The number of queued messages of the given type.
+ */
+#define buzzoutmsg_queue_count(vm, type) ((vm)->outmsgs->queues[type].size)
+
+/*
+ * Returns the number of messages buzzoutmsg_pack() dropped for being
+ * too large for the packet.
+ * @param vm The Buzz VM.
+ * @return The number of dropped messages.
+ */
+#define buzzoutmsg_queue_discarded(vm) ((vm)->outmsgs->discarded)
+
+/*
+ * Returns the bytes sent for the given message type in the current step.
+ * The size prefix of each message is included.
+ * @param vm The Buzz VM.
+ * @param type The message type.
+ * @return The bytes sent in the current step.
+ */
+#define buzzoutmsg_queue_sent(vm, type) ((vm)->outmsgs->classes[type].sent)
+
+/*
+ * Sets the number of steps after which a waiting message is sent before
+ * any other by buzzoutmsg_sched_default().
+ * @param vm The Buzz VM.
+ * @param n The number of steps, or 0 for no limit.
  */
-#define buzzoutmsg_queue_isempty(vm) (buzzoutmsg_queue_size(vm) == 0)
+#define buzzoutmsg_maxage_set(vm, n) (vm)->outmsgs->maxage = (n)
 
 #endif
@@ -16,6 +16,7 @@ static int TYPE_TABLE     = -3;
 static int SCOPE_LOCAL    =  0;
 static int SCOPE_GLOBAL   =  1;
 static int SCOPE_AUTO     =  2;
+static int SCOPE_UPVALUE  =  3;
 
 /****************************************/
 /****************************************/
@@ -155,8 +156,6 @@ void sym_destroy(const void* key,
                 void* data,
                 void* params) {
    free(*(char**)key);
-   free((void*)key);
-   free(data);
 }
 
 #define SYMT_BUCKETS 100
@@ -193,11 +192,111 @@ struct idrefinfo_s {
    int info;
    /* For info >=0, says whether the idref is for local or global variable */
    int global;
+   /* For info >=0, says whether the idref is for a captured variable */
+   int upval;
 };
 
 /****************************************/
 /****************************************/
 
+/*
+ * A variable captured by a function from an enclosing function.
+ */
+struct upval_s {
+   /* The variable name */
+   char* name;
+   /* 1 if the variable is a local of the enclosing function, 0 if it's an upvalue of it */
+   int fromlocal;
+   /* The position in the locals or upvalues of the enclosing function */
+   int64_t pos;
+};
+
+/*
+ * A function being parsed.
+ */
+struct fun_s {
+   /* The position in the symbol table stack of the first table of the function */
+   uint32_t symbase;
+   /* The variables captured by the function, in order of upvalue index */
+   buzzdarray_t upvals;
+};
+
+void upval_destroy(uint32_t pos, void* data, void* params) {
+   free(((struct upval_s*)data)->name);
+}
+
+void fun_destroy(uint32_t pos, void* data, void* params) {
+   buzzdarray_destroy(&((struct fun_s*)data)->upvals);
+}
+
+#define fun_push() { struct fun_s f = { .symbase = buzzdarray_size(par->symstack), .upvals = buzzdarray_new(1, sizeof(struct upval_s), upval_destroy) }; buzzdarray_push(par->funstack, &f); }
+
+#define fun_pop() { buzzdarray_pop(par->funstack); }
+
+/*
+ * Resolves a symbol as seen from the function at the given level of
+ * the function stack.
+ * A symbol that is a local of an enclosing function is captured as an
+ * upvalue by every function between that one and the given one.
+ * @param par The parser state.
+ * @param sym The symbol name.
+ * @param level The function level.
+ * @param pos Set to the symbol position: the local position, the upvalue index, or the string id.
+ * @return The symbol scope (SCOPE_LOCAL, SCOPE_UPVALUE, SCOPE_GLOBAL), or -1 if the symbol is unknown.
+ */
+int sym_resolve(buzzparser_t par,
+                const char* sym,
+                int64_t level,
+                int64_t* pos) {
+   const struct fun_s* f = &buzzdarray_get(par->funstack, level, struct fun_s);
+   /* Within a function, the last symbol table contains all the visible locals */
+   int64_t top = (level == buzzdarray_size(par->funstack) - 1) ?
+      buzzdarray_size(par->symstack) - 1 :
+      buzzdarray_get(par->funstack, level + 1, struct fun_s).symbase - 1;
+   if(top >= f->symbase) {
+      const struct sym_s* s = buzzdict_get(buzzdarray_get(par->symstack, top, buzzdict_t),
+                                           &sym, struct sym_s);
+      if(s) {
+         *pos = s->pos;
+         return SCOPE_LOCAL;
+      }
+   }
+   /* Look for a variable already captured by this function */
+   int64_t i;
+   for(i = 0; i < buzzdarray_size(f->upvals); ++i) {
+      if(strcmp(buzzdarray_get(f->upvals, i, struct upval_s).name, sym) == 0) {
+         *pos = i;
+         return SCOPE_UPVALUE;
+      }
+   }
+   /* The outermost level sees the global symbols */
+   if(level == 0) {
+      const struct sym_s* s = buzzdict_get(buzzdarray_get(par->symstack, 0, buzzdict_t),
+                                           &sym, struct sym_s);
+      if(!s) return -1;
+      *pos = s->pos;
+      return SCOPE_GLOBAL;
+   }
+   /* Look into the enclosing function, and capture its variables */
+   int64_t outpos;
+   int scope = sym_resolve(par, sym, level - 1, &outpos);
+   if(scope != SCOPE_LOCAL && scope != SCOPE_UPVALUE) {
+      *pos = outpos;
+      return scope;
+   }
+   struct upval_s u = {
+      .name = strdup(sym),
+      .fromlocal = (scope == SCOPE_LOCAL),
+      .pos = outpos
+   };
+   buzzdarray_push(f->upvals, &u);
+   *pos = buzzdarray_size(f->upvals) - 1;
+   return SCOPE_UPVALUE;
+}
+
+/****************************************/
+/****************************************/
+
 #define LABELREF "@__label_"
 
 /*
@@ -212,8 +311,14 @@ struct chunk_s {
    uint32_t label;
    /* The code for this chunk */
    char* code;
-   /* not-NULL if a symbol must be registered (function), NULL if not (lambda) */
-   const struct sym_s* sym;
+   /* 1 if a symbol must be registered (function), 0 if not (lambda) */
+   int hassym;
+   /*
+    * A copy of the symbol to register. The symbol table may be
+    * resized while the chunk is parsed, so a pointer into it would
+    * not stay valid.
+    */
+   struct sym_s sym;
    /* The code size */
    size_t csize;
    /* The buffer capacity */
@@ -227,7 +332,8 @@ chunk_t chunk_new(uint32_t label, const struct sym_s* sym) {
    c->csize = 0;
    c->ccap = 10;
    c->code = (char*)malloc(c->ccap);
-   c->sym = sym;
+   c->hassym = (sym != NULL);
+   if(sym) c->sym = *sym;
    return c;
 }
 
@@ -282,11 +388,10 @@ void chunk_register(uint32_t pos, void* data, void* params) {
    chunk_t c = *(chunk_t*)data;
    FILE* f = (FILE*)params;
    /* Print registration code */
-   if(c->sym) {
-      if(c->sym->global) fprintf(f, "\tpushs %" PRId64 "\n", c->sym->pos);
+   if(c->hassym) {
       fprintf(f, "\tpushcn " LABELREF "%u\n", c->label);
-      if(c->sym->global) fprintf(f, "\tgstore\n");
-      else               fprintf(f, "\tlstore %" PRId64 "\n", c->sym->pos);
+      if(c->sym.global) fprintf(f, "\tgstores %" PRId64 "\n", c->sym.pos);
+      else              fprintf(f, "\tlstore %" PRId64 "\n", c->sym.pos);
    }
 }
 
@@ -426,20 +531,24 @@ int parse_script(buzzparser_t par) {
       par->tok = buzzlex_nexttok(par->lex);
    }
    /* Make sure a file inclusion error did not happen */
-   if(par->tok->type == BUZZTOK_EOF) {
-      return buzzlex_done(par->lex)?PARSE_OK:PARSE_ERROR;
+   if(par->tok->type == BUZZTOK_EOF && !buzzlex_done(par->lex)) {
+      return PARSE_ERROR;
    }
 
    /* Add a symbol table */
    symt_push();
+   /* The global scope is the outermost function */
+   fun_push();
    /* Add the first chunk for the global scope */
    chunk_push(0);
-   /* Parse the statements */
-   if(!parse_statlist(par)) return PARSE_ERROR;
+   /* Parse the statements, if any */
+   if(par->tok->type != BUZZTOK_EOF &&
+      !parse_statlist(par)) return PARSE_ERROR;
    /* Finalize the output */
    chunk_append("\n@__exitpoint");
    chunk_append("\tdone");
    chunk_pop();
+   fun_pop();
    return PARSE_OK;
 }
 
@@ -574,8 +683,8 @@ int parse_var(buzzparser_t par) {
    fetchtok();
    /* Match an id */
    tokmatch(BUZZTOK_ID);
-   /* Look it up in the symbol table */
-   const struct sym_s* s = sym_lookup(par->tok->value, par->symstack);
+   /* Look it up in the symbol table of the current scope */
+   const struct sym_s* s = buzzdict_get(par->syms, &par->tok->value, struct sym_s);
    if(s && s->global == SCOPE_LOCAL) {
       fprintf(stderr,
               "%s:%" PRIu64 ":%" PRIu64 ": Duplicated symbol '%s'\n",
@@ -587,12 +696,9 @@ int parse_var(buzzparser_t par) {
    }
    /* Add a symbol for this variable */
    sym_add(par, par->tok->value, SCOPE_AUTO);
-   s = sym_lookup(par->tok->value, par->symstack);
-   /* Is lvalue a global symbol? */
-   if(s->global) {
-      /*  Push its string id */
-      chunk_append("\tpushs %" PRId64, s->pos);
-   }
+   /* Keep a copy, the symbol table may be resized while parsing the expression */
+   const struct sym_s sv = *sym_lookup(par->tok->value, par->symstack);
+   s = &sv;
    /* Is the variable initialized? */
    fetchtok();
    if(par->tok->type == BUZZTOK_ASSIGN) {
@@ -614,7 +720,7 @@ int parse_var(buzzparser_t par) {
    }
    if(s->global) {
       /* The lvalue is a global symbol */
-      chunk_append("\tgstore");
+      chunk_append("\tgstores %" PRId64, s->pos);
    }
    else {
       /* The lvalue is a local variable */
@@ -651,6 +757,7 @@ int parse_fun(buzzparser_t par) {
    tokmatch(BUZZTOK_PAROPEN);
    fetchtok();
    /* Make a new symbol table */
+   fun_push();
    symt_push();
    /* Add "self" symbol */
    const struct sym_s* sym = sym_lookup("self", par->symstack);
@@ -669,6 +776,7 @@ int parse_fun(buzzparser_t par) {
    chunk_append("\tret0");
    /* Get rid of symbol table and close chunk */
    symt_pop();
+   fun_pop();
    chunk_pop();
    free(funname);
    return PARSE_OK;
@@ -1130,21 +1238,20 @@ int parse_command(buzzparser_t par) {
             return PARSE_ERROR;
          }
          /* lvalue is OK */
-         /* Is lvalue a global symbol? If so, push its string id */
-         if(idrefinfo.global) chunk_append("\tpushs %d", idrefinfo.info);
          /* Consume the = */
          fetchtok();
          /* Parse the expression */
          if(!parse_expression(par)) return PARSE_ERROR;
          if(idrefinfo.global) {
-            /* The lvalue is a global symbol, just add gstore */
-            chunk_append("\tgstore");
+            /* The lvalue is a global symbol, store by string id */
+            chunk_append("\tgstores %d", idrefinfo.info);
          }
          else {
             /* The lvalue is a local symbol or a table reference */
             if(idrefinfo.info >= 0) {
-               /* Local variable */
-               chunk_append("\tlstore %d", idrefinfo.info);
+               /* Local or captured variable */
+               if(idrefinfo.upval) { chunk_append("\tustore %d", idrefinfo.info); }
+               else                { chunk_append("\tlstore %d", idrefinfo.info); }
             }
             else if(idrefinfo.info == TYPE_TABLE) {
                /* Table reference */
@@ -1176,14 +1283,13 @@ int parse_idlist(buzzparser_t par) {
       return PARSE_OK;
    /* Match an id for the first argument */
    tokmatch(BUZZTOK_ID);
-   /* Look for the argument symbol in the context
+   /* Look for the argument symbol in the function scope
     * If a symbol is found and is not global,
     * do not add a new symbol; otherwise do
-    * This allows lambdas and nested functions to
-    * reuse the parameters and local variables of
-    * the parent
+    * The arguments shadow the variables of
+    * the enclosing functions
     */
-   const struct sym_s* sym = sym_lookup(par->tok->value, par->symstack);
+   const struct sym_s* sym = buzzdict_get(par->syms, &par->tok->value, struct sym_s);
    if(!sym || sym->global) {
       sym_add(par, par->tok->value, SCOPE_LOCAL);
    }
@@ -1192,7 +1298,7 @@ int parse_idlist(buzzparser_t par) {
    while(par->tok->type == BUZZTOK_LISTSEP) {
       fetchtok();
       tokmatch(BUZZTOK_ID);
-      const struct sym_s* sym = sym_lookup(par->tok->value, par->symstack);
+      const struct sym_s* sym = buzzdict_get(par->syms, &par->tok->value, struct sym_s);
       if(!sym || sym->global) {
          sym_add(par, par->tok->value, SCOPE_LOCAL);
       }
@@ -1230,16 +1336,20 @@ int parse_idref(buzzparser_t par,
                 struct idrefinfo_s* idrefinfo) {
    /* Start with an id */
    tokmatch(BUZZTOK_ID);
-   /* Look it up in the symbol table */
-   const struct sym_s* s = sym_lookup(par->tok->value, par->symstack);
-   if(!s) {
+   /* Look it up in the symbol tables of this function and of the enclosing ones */
+   int64_t pos;
+   int scope = sym_resolve(par, par->tok->value,
+                           buzzdarray_size(par->funstack) - 1, &pos);
+   if(scope < 0) {
       /* Symbol not found, add it */
       sym_add(par, par->tok->value, SCOPE_GLOBAL);
-      s = sym_lookup(par->tok->value, par->symstack);
+      scope = sym_resolve(par, par->tok->value,
+                          buzzdarray_size(par->funstack) - 1, &pos);
    }
    /* Save symbol info */
-   idrefinfo->info = s->pos;
-   idrefinfo->global = s->global;
+   idrefinfo->info = pos;
+   idrefinfo->global = (scope == SCOPE_GLOBAL);
+   idrefinfo->upval = (scope == SCOPE_UPVALUE);
    /* Go on parsing the reference */
    fetchtok();
    chunk_buf_push();
@@ -1258,11 +1368,13 @@ int parse_idref(buzzparser_t par,
          // If the next token is a closure and is not called from a table, we push nil for the self table.
          if(par->tok->type == BUZZTOK_PAROPEN)
             chunk_append("\tpushnil");
-         chunk_append("\tlload %" PRId64, s->pos);
+         if(idrefinfo->upval) { chunk_append("\tuload %" PRId64, pos); }
+         else                 { chunk_append("\tlload %" PRId64, pos); }
       }
       else if(idrefinfo->info == TYPE_TABLE)   { chunk_append("\ttget"); }
       else if(idrefinfo->info == TYPE_CLOSURE) { chunk_append("\tcallc"); }
       idrefinfo->global = 0;
+      idrefinfo->upval = 0;
       /* Go on parsing structure type */
       if(par->tok->type == BUZZTOK_DOT) {
          idrefinfo->info = TYPE_TABLE;
@@ -1306,7 +1418,8 @@ int parse_idref(buzzparser_t par,
          chunk_append("\tgload");
       }
       else if(idrefinfo->info >= 0) {
-         chunk_append("\tlload %d", idrefinfo->info);
+         if(idrefinfo->upval) { chunk_append("\tuload %d", idrefinfo->info); }
+         else                 { chunk_append("\tlload %d", idrefinfo->info); }
       }
       else if(idrefinfo->info == TYPE_TABLE) {
          chunk_append("\ttget");
@@ -1329,21 +1442,14 @@ int parse_lambda(buzzparser_t par) {
    chunk_push(NULL);
    tokmatch(BUZZTOK_PAROPEN);
    fetchtok();
-   /* Check whether it's necessary to create a brand new symbol table
-    * or clone the current one
-    * If the parent symtable is the global one, it is necessary;
-    * otherwise, clone the parent's
+   /* Make a new symbol table
+    * The variables of the enclosing functions are
+    * resolved on use and captured as upvalues
     */
-   if(buzzdarray_size(par->symstack) == 1) {
-      /* Add new symtable */
-      symt_push();
-      /* Add "self" symbol */
-      const struct sym_s* sym = sym_lookup("self", par->symstack);
-      if(!sym || sym->global) { sym_add(par, "self", SCOPE_LOCAL); }
-   }
-   else {
-      symt_clone();
-   }
+   fun_push();
+   symt_push();
+   /* Add "self" symbol */
+   sym_add(par, "self", SCOPE_LOCAL);
    /* Parse lambda arguments */
    if(!parse_idlist(par)) return PARSE_ERROR;
    tokmatch(BUZZTOK_PARCLOSE);
@@ -1355,6 +1461,15 @@ int parse_lambda(buzzparser_t par) {
    /* Get rid of symbol table and close chunk */
    symt_pop();
    chunk_pop();
+   /* Capture the variables into the new closure */
+   const struct fun_s* f = &buzzdarray_last(par->funstack, struct fun_s);
+   int64_t i;
+   for(i = 0; i < buzzdarray_size(f->upvals); ++i) {
+      const struct upval_s* u = &buzzdarray_get(f->upvals, i, struct upval_s);
+      if(u->fromlocal) { chunk_append("\tucapl %" PRId64, u->pos); }
+      else             { chunk_append("\tucapu %" PRId64, u->pos); }
+   }
+   fun_pop();
    return PARSE_OK;
 }
 
@@ -1395,6 +1510,8 @@ buzzparser_t buzzparser_new(int argc,
    /* Initialize symbol table stack */
    par->symstack = buzzdarray_new(10, sizeof(buzzdict_t), symt_destroy);
    par->syms = NULL;
+   /* Initialize function stack */
+   par->funstack = buzzdarray_new(4, sizeof(struct fun_s), fun_destroy);
    /* Initialize string list */
    par->strings = buzzdict_new(100,
                                sizeof(char*),
@@ -1438,6 +1555,7 @@ void buzzparser_destroy(buzzparser_t* par) {
    buzzdict_destroy(&((*par)->strings));
    buzzdarray_destroy(&((*par)->chunks));
    buzzdarray_destroy(&((*par)->symstack));
+   buzzdarray_destroy(&((*par)->funstack));
    free((*par)->asmfn);
    fclose((*par)->asmstream);
    free((*par)->scriptfn);
@@ -17,6 +17,9 @@ extern "C" {
    /* Forward declaration to contain a code chunk */
    struct chunk_s;
 
+   /* Forward declaration to contain the data of a function being parsed */
+   struct fun_s;
+
    /* The parser state */
    struct buzzparser_s {
       /* The script file name */
@@ -37,6 +40,8 @@ extern "C" {
       buzzdarray_t symstack;
       /* The top of the symbol table stack */
       buzzdict_t syms;
+      /* Stack of the functions being parsed, the outermost first */
+      buzzdarray_t funstack;
       /* List of string symbols */
       buzzdict_t strings;
       /* Label counter */
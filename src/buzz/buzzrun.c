@@ -9,7 +9,7 @@ void usage(const char* path, int status) {
 }
 
 int print(buzzvm_t vm) {
-   for(int i = 1; i < buzzdarray_size(vm->lsyms->syms); ++i) {
+   for(int i = 1; i <= buzzvm_lnum(vm); ++i) {
       buzzvm_lload(vm, i);
       buzzobj_t o = buzzvm_stack_at(vm, 1);
       buzzvm_pop(vm);
@@ -24,11 +24,11 @@ int print(buzzvm_t vm) {
             fprintf(stdout, "%f", o->f.value);
             break;
          case BUZZTYPE_TABLE:
-            fprintf(stdout, "[table with %d elems]", (buzzdict_size(o->t.value)));
+            fprintf(stdout, "[table with %d elems]", (buzztable_size(o)));
             break;
          case BUZZTYPE_CLOSURE:
             if(o->c.value.isnative)
-               fprintf(stdout, "[n-closure @%d]", o->c.value.ref);
+               fprintf(stdout, "[n-closure @%d]", buzzvm_pc2offset(vm, o->c.value.ref));
             else
                fprintf(stdout, "[c-closure @%d]", o->c.value.ref);
             break;
@@ -93,8 +93,11 @@ int main(int argc, char** argv) {
    buzzvm_pushcc(vm, buzzvm_function_register(vm, print));
    buzzvm_gstore(vm);
    /* Run byte code */
-   do if(trace) buzzdebug_stack_dump(vm, 1, stdout);
-   while(buzzvm_step(vm) == BUZZVM_STATE_READY);
+   if(trace) {
+      do buzzdebug_stack_dump(vm, 1, stdout);
+      while(buzzvm_step(vm) == BUZZVM_STATE_READY);
+   }
+   else buzzvm_run(vm, 0);
    /* Done running, check final state */
    int retval;
    if(vm->state == BUZZVM_STATE_DONE) {
@@ -107,7 +110,8 @@ int main(int argc, char** argv) {
    else {
       /* Execution terminated with errors */
       if(trace) buzzdebug_stack_dump(vm, 1, stdout);
-      const buzzdebug_entry_t* dbg = buzzdebug_info_get_fromoffset(dbg_buf, &vm->oldpc);
+      int32_t off = buzzvm_pc2offset(vm, vm->oldpc);
+      const buzzdebug_entry_t* dbg = buzzdebug_info_get_fromoffset(dbg_buf, &off);
       if(dbg != NULL) {
          fprintf(stderr, "%s: execution terminated abnormally at %s:%" PRIu64 ":%" PRIu64 " : %s\n\n",
                  bcfname,
@@ -119,7 +123,7 @@ int main(int argc, char** argv) {
       else {
          fprintf(stderr, "%s: execution terminated abnormally at bytecode offset %d: %s\n\n",
                  bcfname,
-                 vm->oldpc,
+                 off,
                  vm->errormsg);
       }
       retval = 1;
@@ -0,0 +1,99 @@
+#include "buzzslab.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * Blocks are aligned to this size, and must be large enough to
+ * store the free list link.
+ */
+#define BUZZSLAB_ALIGN sizeof(void*)
+
+/****************************************/
+/****************************************/
+
+void buzzslab_chunk_destroy(uint32_t pos, void* data, void* params) {
+   free(*(void**)data);
+}
+
+buzzslab_t buzzslab_new(uint32_t elem_size,
+                        uint32_t chunk_elems) {
+   /* Create a new slab */
+   buzzslab_t s = (buzzslab_t)malloc(sizeof(struct buzzslab_s));
+   /* Round the block size to the alignment */
+   s->elem_size = ((elem_size + BUZZSLAB_ALIGN - 1) / BUZZSLAB_ALIGN) * BUZZSLAB_ALIGN;
+   if(s->elem_size == 0) s->elem_size = BUZZSLAB_ALIGN;
+   s->chunk_elems = chunk_elems;
+   /* No chunks yet */
+   s->chunks = buzzdarray_new(4, sizeof(void*), buzzslab_chunk_destroy);
+   s->free = NULL;
+   s->used = 0;
+   s->mem = NULL;
+   s->memsys = 0;
+   return s;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzslab_destroy(buzzslab_t* s) {
+   buzzmem_charge((*s)->mem, (*s)->memsys, -(int64_t)(sizeof(struct buzzslab_s) + buzzslab_bytes(*s)));
+   buzzdarray_destroy(&((*s)->chunks));
+   free(*s);
+   *s = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void* buzzslab_alloc(buzzslab_t s) {
+   /* Refill the free list if necessary */
+   if(!s->free) {
+      char* c = (char*)malloc((size_t)s->chunk_elems * s->elem_size);
+      if(!c) {
+         fprintf(stderr, "[FATAL] Can't allocate slab chunk.\n");
+         abort();
+      }
+      buzzdarray_push(s->chunks, &c);
+      buzzmem_charge(s->mem, s->memsys, (int64_t)s->chunk_elems * s->elem_size);
+      /* Thread the new blocks into the free list, in address order */
+      int64_t i;
+      for(i = s->chunk_elems - 1; i >= 0; --i) {
+         *(void**)(c + i * s->elem_size) = s->free;
+         s->free = c + i * s->elem_size;
+      }
+   }
+   /* Pop a block from the free list */
+   void* p = s->free;
+   s->free = *(void**)p;
+   ++s->used;
+   return p;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzslab_free(buzzslab_t s,
+                   void* p) {
+   *(void**)p = s->free;
+   s->free = p;
+   --s->used;
+}
+
+/****************************************/
+/****************************************/
+void buzzslab_account(buzzslab_t s,
+                      buzzmem_t mem,
+                      uint32_t sys) {
+   int64_t bytes = sizeof(struct buzzslab_s) + buzzslab_bytes(s);
+   buzzmem_charge(s->mem, s->memsys, -bytes);
+   s->mem = mem;
+   s->memsys = sys;
+   buzzmem_charge(s->mem, s->memsys, bytes);
+   buzzdarray_account(s->chunks, mem, sys);
+}
+
+/****************************************/
+/****************************************/
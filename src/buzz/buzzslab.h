@@ -0,0 +1,89 @@
+#ifndef BUZZSLAB_H
+#define BUZZSLAB_H
+
+#include <buzz/buzzdarray.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Buzz slab allocator.
+    * A slab hands out blocks of a fixed size, carved from chunks that
+    * hold many blocks each. Freed blocks are kept in a free list and
+    * reused by later allocations. Chunks are returned to the system
+    * only when the slab is destroyed.
+    * A slab is not thread-safe; each VM owns its own slabs.
+    */
+   struct buzzslab_s {
+      buzzdarray_t chunks;  // The allocated chunks
+      void* free;           // The free list
+      uint32_t elem_size;   // The size of a block
+      uint32_t chunk_elems; // The number of blocks per chunk
+      uint32_t used;        // The number of blocks in use
+      buzzmem_t mem;        // Memory accounting, or NULL
+      uint32_t memsys;      // Subsystem charged for the memory
+   };
+   typedef struct buzzslab_s* buzzslab_t;
+
+   /*
+    * Creates a new slab.
+    * @param elem_size The size of a block.
+    * @param chunk_elems The number of blocks per chunk. Must be >0.
+    * @return A new slab.
+    */
+   extern buzzslab_t buzzslab_new(uint32_t elem_size,
+                                  uint32_t chunk_elems);
+
+   /*
+    * Destroys a slab.
+    * All the blocks allocated from the slab become invalid.
+    * @param s The slab.
+    */
+   extern void buzzslab_destroy(buzzslab_t* s);
+
+   /*
+    * Allocates a block.
+    * The content of the block is undefined.
+    * @param s The slab.
+    * @return The block.
+    */
+   extern void* buzzslab_alloc(buzzslab_t s);
+
+   /*
+    * Returns a block to the slab.
+    * @param s The slab.
+    * @param p The block.
+    */
+   extern void buzzslab_free(buzzslab_t s,
+                             void* p);
+
+   /*
+    * Charges the memory of the slab to the given subsystem.
+    * The memory already charged elsewhere is moved over, and new
+    * chunks are charged from now on.
+    * @param s The slab.
+    * @param mem The memory accounting, or NULL to stop accounting.
+    * @param sys The subsystem (a buzzmem_sys value).
+    */
+   extern void buzzslab_account(buzzslab_t s,
+                                buzzmem_t mem,
+                                uint32_t sys);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Returns the number of blocks in use.
+ * @param s The slab.
+ */
+#define buzzslab_used(s) ((s)->used)
+
+/*
+ * Returns the number of bytes allocated by the slab.
+ * @param s The slab.
+ */
+#define buzzslab_bytes(s) ((uint64_t)buzzdarray_size((s)->chunks) * (s)->chunk_elems * (s)->elem_size)
+
+#endif
@@ -1,4 +1,5 @@
 #include "buzzstrman.h"
+#include "buzzdict.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -8,141 +9,109 @@
 /****************************************/
 
 /*
- * String container for the id2str dictionary.
- * The string container stores both a pointer to the string data and
- * the 'protect' flag.
+ * Entry flags.
  */
-struct buzzid2strdata_s {
-   char* str;
-   int protect;
-};
-typedef struct buzzid2strdata_s* buzzid2strdata_t;
-
-static buzzid2strdata_t buzzid2strdata_new(char* str,
-                                           int protect) {
-   buzzid2strdata_t x = (buzzid2strdata_t)malloc(sizeof(struct buzzid2strdata_s));
-   x->str = str;
-   x->protect = protect;
-   return x;
-}
+#define BUZZSTRMAN_PROTECT 0x1
+#define BUZZSTRMAN_MARK    0x2
 
-static void buzzid2strdata_destroy(const void* key,
-                                   void* data,
-                                   void* params) {
-   free((void*)key);
-   free(*(buzzid2strdata_t*)data);
-   free(data);
-}
+/*
+ * Marks the end of the free id list.
+ */
+#define BUZZSTRMAN_NOID UINT32_MAX
+
+/*
+ * Initial number of slots in the index.
+ */
+#define BUZZSTRMAN_INDEX_INIT 64
+
+/*
+ * Returns a pointer to the entry for the given id.
+ */
+#define buzzstrman_entry(sm, sid) ((struct buzzstrman_entry_s*)((sm)->entries->data) + (sid))
+
+/*
+ * Returns the home slot in the index of the given hash. The hash is
+ * spread over all the bits to cope with weak string hashes.
+ */
+#define buzzstrman_home(sm, h) (((h) * 2654435769u) & ((sm)->index_size - 1))
+
+/*
+ * Returns the number of bytes allocated for the given string.
+ */
+#define buzzstrman_strbytes(str) ((int64_t)strlen(str) + 1)
 
 /****************************************/
 /****************************************/
 
 /*
- * This is a binary tree used to manage garbage collection of strings.
- *
- * If a string is stored in the tree, it will be considered unmarked
- * and, thus, to dispose of.  A binary tree is used because it ensures
- * fast insertion and removal even when many strings are present.
- *
- * Also, the string ids are sparse, making it important to have a data
- * structure that does not care about holes in the id set.
+ * The index is an open addressing hash table with linear probing. Each
+ * slot contains the id of a string plus one, so that zero means
+ * empty. The hashes are cached in the entries, so the strings are
+ * hashed only once, when they are registered.
  */
-struct buzzidtree_s {
-   uint16_t sid;
-   struct buzzidtree_s* left;
-   struct buzzidtree_s* right;
-};
-typedef struct buzzidtree_s* buzzidtree_t;
-
-/* Creates a new tree node */
-buzzidtree_t buzzidtree_new(uint16_t sid) {
-   buzzidtree_t x = (buzzidtree_t)malloc(sizeof(struct buzzidtree_s));
-   x->sid = sid;
-   x->left = NULL;
-   x->right = NULL;
-   return x;
-}
-
-/* Destroys a tree and its children */
-void buzzidtree_destroy(buzzidtree_t t) {
-   if(!t) return;
-   if(t->left) buzzidtree_destroy(t->left);
-   if(t->right) buzzidtree_destroy(t->right);
-   free(t);
-}
 
-/* Inserts a new node in the tree */
-static buzzidtree_t buzzidtree_insert(buzzidtree_t t,
-                                      uint16_t sid) {
-   /* Insert element here */
-   if(!t) return buzzidtree_new(sid);
-   /* Insert element on the left */
-   else if(sid < t->sid) t->left = buzzidtree_insert(t->left, sid);
-   /* Insert element on the right */
-   else if(sid > t->sid) t->right = buzzidtree_insert(t->right, sid);
-   /* Return current tree */
-   return t;
+/* Inserts an id in the index, which must have a free slot */
+static void buzzstrman_index_insert(buzzstrman_t sm,
+                                    uint32_t sid) {
+   uint32_t mask = sm->index_size - 1;
+   uint32_t i = buzzstrman_home(sm, buzzstrman_entry(sm, sid)->hash);
+   while(sm->index[i]) i = (i + 1) & mask;
+   sm->index[i] = sid + 1;
 }
 
-/* Finds the smallest node in a tree */
-static buzzidtree_t buzzidtree_find_min(buzzidtree_t t) {
-   /* This node has no smaller child */
-   if(t->left == NULL) return t;
-   /* Go to the smaller child */
-   return buzzidtree_find_min(t->left);
+/* Doubles the size of the index */
+static void buzzstrman_index_grow(buzzstrman_t sm) {
+   uint32_t* old = sm->index;
+   uint32_t oldsize = sm->index_size;
+   sm->index_size *= 2;
+   sm->index = (uint32_t*)calloc(sm->index_size, sizeof(uint32_t));
+   if(!sm->index) {
+      fprintf(stderr, "[FATAL] Can't allocate string index.\n");
+      abort();
+   }
+   uint32_t i;
+   for(i = 0; i < oldsize; ++i)
+      if(old[i]) buzzstrman_index_insert(sm, old[i] - 1);
+   free(old);
+   buzzmem_charge(sm->mem, BUZZMEM_STRINGS, (int64_t)oldsize * sizeof(uint32_t));
 }
 
-/* Removes a node with the given id from the tree */
-static buzzidtree_t buzzidtree_remove(buzzidtree_t t,
-                                      uint16_t sid) {
-   /* If the tree is empty, nothing to do */
-   if(!t) return NULL;
-   /* If the id is smaller than the current id, remove on the left */
-   if(sid < t->sid) t->left = buzzidtree_remove(t->left, sid);
-   /* If the id is greater than the current id, remove on the right */
-   else if(sid > t->sid) t->right = buzzidtree_remove(t->right, sid);
-   else {
-      /* We found the node to remove */
-      /* If the node has no children, simply remove it */
-      if(!t->left && !t->right) {
-         free(t);
-         t = NULL;
-      }
-      /* If the element has one child, put the child in place of this tree, and remove the tree */
-      else if(!t->right) {
-         buzzidtree_t x = t;
-         t = t->left;
-         free(x);
-      }
-      else if(!t->left) {
-         buzzidtree_t x = t;
-         t = t->right;
-         free(x);
-      }
-      /* Both children exist for this node */
-      else {
-         /* Look for the minimum id on the right of the node to eliminate */
-         buzzidtree_t m = buzzidtree_find_min(t->right);
-         /* Copy its value over the current root */
-         t->sid = m->sid;
-         /* Delete the minimum node */
-         t->right = buzzidtree_remove(t->right, m->sid);
-      }
+/* Returns the index slot of the given string, or of the free slot where it would go */
+static uint32_t buzzstrman_index_find(buzzstrman_t sm,
+                                      const char* str,
+                                      uint32_t hash) {
+   uint32_t mask = sm->index_size - 1;
+   uint32_t i = buzzstrman_home(sm, hash);
+   while(sm->index[i]) {
+      struct buzzstrman_entry_s* e = buzzstrman_entry(sm, sm->index[i] - 1);
+      if(e->hash == hash && strcmp(e->str, str) == 0) return i;
+      i = (i + 1) & mask;
    }
-   return t;
+   return i;
 }
 
-/* Function pointer for buzzidtree_foreach() */
-typedef void (*buzzidtree_funp)(uint16_t sid, void* params);
-
-/* Visits every node in the tree and executes the given function */
-static void buzzidtree_foreach(buzzidtree_t t,
-                               buzzidtree_funp fun,
-                               void* params) {
-   if(!t) return;
-   fun(t->sid, params);
-   if(t->left)  buzzidtree_foreach(t->left, fun, params);
-   if(t->right) buzzidtree_foreach(t->right, fun, params);
+/* Removes an id from the index */
+static void buzzstrman_index_remove(buzzstrman_t sm,
+                                    uint32_t sid) {
+   uint32_t mask = sm->index_size - 1;
+   /* Look for the slot of the id */
+   uint32_t i = buzzstrman_home(sm, buzzstrman_entry(sm, sid)->hash);
+   while(sm->index[i] != sid + 1) i = (i + 1) & mask;
+   /*
+    * Shift back the following slots of the cluster that can be moved
+    * closer to their home, so that no lookup stops too early
+    */
+   uint32_t j = i;
+   while(1) {
+      j = (j + 1) & mask;
+      if(!sm->index[j]) break;
+      uint32_t k = buzzstrman_home(sm, buzzstrman_entry(sm, sm->index[j] - 1)->hash);
+      /* Skip the slot if its home lies cyclically in (i,j] */
+      if(i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+      sm->index[i] = sm->index[j];
+      i = j;
+   }
+   sm->index[i] = 0;
 }
 
 /****************************************/
@@ -150,36 +119,30 @@ static void buzzidtree_foreach(buzzidtree_t t,
 
 buzzstrman_t buzzstrman_new() {
    buzzstrman_t x = (buzzstrman_t)malloc(sizeof(struct buzzstrman_s));
-   x->str2id = buzzdict_new(10,
-                            sizeof(char*),
-                            sizeof(uint16_t),
-                            buzzdict_strkeyhash,
-                            buzzdict_strkeycmp,
-                            NULL);
-   x->id2str = buzzdict_new(10,
-                            sizeof(uint16_t),
-                            sizeof(buzzid2strdata_t),
-                            buzzdict_int16keyhash,
-                            buzzdict_int16keycmp,
-                            buzzid2strdata_destroy);
-   x->maxsid = 0;
-   x->gcdata = NULL;
+   x->entries = buzzdarray_new(BUZZSTRMAN_INDEX_INIT,
+                               sizeof(struct buzzstrman_entry_s),
+                               NULL);
+   x->index_size = BUZZSTRMAN_INDEX_INIT;
+   x->index = (uint32_t*)calloc(x->index_size, sizeof(uint32_t));
+   x->count = 0;
+   x->freeid = BUZZSTRMAN_NOID;
+   x->mem = NULL;
    return x;
 }
 
 /****************************************/
 /****************************************/
 
-void buzzstrman_str_destroy(const void* key, void* data, void* params) {
-   free(*(char**)key);
-}
-
 void buzzstrman_destroy(buzzstrman_t* sm) {
+   /* Release the charged memory */
+   buzzstrman_account(*sm, NULL);
    /* Dispose of the strings */
-   buzzdict_foreach((*sm)->str2id, buzzstrman_str_destroy, NULL);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size((*sm)->entries); ++i)
+      free(buzzstrman_entry(*sm, i)->str);
    /* Dispose of the structures */
-   buzzdict_destroy(&((*sm)->str2id));
-   buzzdict_destroy(&((*sm)->id2str));
+   buzzdarray_destroy(&((*sm)->entries));
+   free((*sm)->index);
    /* Dispose of the manager */
    free(*sm);
    *sm = 0;
@@ -188,135 +151,158 @@ void buzzstrman_destroy(buzzstrman_t* sm) {
 /****************************************/
 /****************************************/
 
-uint16_t buzzstrman_register(buzzstrman_t sm,
+uint32_t buzzstrman_register(buzzstrman_t sm,
                              const char* str,
                              int protect) {
    /* Look for the id */
-   const uint16_t* id = buzzdict_get(sm->str2id, &str, uint16_t);
+   uint32_t hash = buzzdict_strkeyhash(&str);
+   uint32_t i = buzzstrman_index_find(sm, str, hash);
    /* Found? */
-   if(id) {
+   if(sm->index[i]) {
       /* Yes; is the passed 'protect' flag set? */
-      if(protect) {
+      if(protect)
          /* Set the flag for the record too */
-         buzzid2strdata_t sd = *buzzdict_get(sm->id2str, id, buzzid2strdata_t);
-         sd->protect = 1;
-      }
+         buzzstrman_entry(sm, sm->index[i] - 1)->flags |= BUZZSTRMAN_PROTECT;
       /* Return the found id */
-      return *id;
+      return sm->index[i] - 1;
+   }
+   /* Not found, take a free id or append a new entry */
+   uint32_t sid;
+   if(sm->freeid != BUZZSTRMAN_NOID) {
+      sid = sm->freeid;
+      sm->freeid = buzzstrman_entry(sm, sid)->hash;
+   }
+   else {
+      sid = buzzdarray_size(sm->entries);
+      if(sid == BUZZSTRMAN_NOID) {
+         fprintf(stderr, "[FATAL] Too many strings.\n");
+         abort();
+      }
+      buzzdarray_makeslot(sm->entries, sid);
    }
-   /* Not found, add a new string */
-   uint16_t id2 = sm->maxsid;
-   ++sm->maxsid;
-
-   /* Avoid id = 0 */
-   if( !sm->maxsid ) ++sm->maxsid;
-
-   /* Avoid overwriting existing strings */
-   while(buzzdict_get(sm->id2str, &sm->maxsid, buzzid2strdata_t))
-     ++sm->maxsid;
-
-   char* str2 = strdup(str);
-   buzzid2strdata_t sd = buzzid2strdata_new(str2, protect);
-   buzzdict_set(sm->str2id, &str2, &id2);
-   buzzdict_set(sm->id2str, &id2, &sd);
-   return id2;
+   /*
+    * The new string is marked, so a garbage collection already in
+    * progress spares it
+    */
+   struct buzzstrman_entry_s* e = buzzstrman_entry(sm, sid);
+   e->str = strdup(str);
+   buzzmem_charge(sm->mem, BUZZMEM_STRINGS, buzzstrman_strbytes(str));
+   e->hash = hash;
+   e->flags = BUZZSTRMAN_MARK | (protect ? BUZZSTRMAN_PROTECT : 0);
+   /* Add the id to the index, keeping the load factor under 3/4 */
+   ++sm->count;
+   if(sm->count * 4 > sm->index_size * 3) {
+      buzzstrman_index_grow(sm);
+      buzzstrman_index_insert(sm, sid);
+   }
+   else {
+      sm->index[i] = sid + 1;
+   }
+   return sid;
 }
 
 /****************************************/
 /****************************************/
 
-const char* buzzstrman_get(buzzstrman_t sm,
-                           uint16_t sid) {
-   const buzzid2strdata_t* x = buzzdict_get(sm->id2str, &sid, buzzid2strdata_t);
-   if(x) return (*x)->str;
-   return NULL;
+void buzzstrman_account(buzzstrman_t sm,
+                        buzzmem_t mem) {
+   /* Count the structures and the strings */
+   int64_t bytes =
+      sizeof(struct buzzstrman_s) +
+      (int64_t)sm->index_size * sizeof(uint32_t);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(sm->entries); ++i)
+      if(buzzstrman_entry(sm, i)->str)
+         bytes += buzzstrman_strbytes(buzzstrman_entry(sm, i)->str);
+   /* Move the charge */
+   buzzmem_charge(sm->mem, BUZZMEM_STRINGS, -bytes);
+   sm->mem = mem;
+   buzzmem_charge(sm->mem, BUZZMEM_STRINGS, bytes);
+   buzzdarray_account(sm->entries, mem, BUZZMEM_STRINGS);
 }
 
 /****************************************/
 /****************************************/
 
-void buzzstrman_gc_unmark(const void* key,
-                          void* data,
-                          void* param) {
-   /* Make sure we're not adding protected strings to the tree */
-   const buzzid2strdata_t* sd = buzzdict_get(((buzzstrman_t)param)->id2str,
-                                             (uint16_t*)data,
-                                             buzzid2strdata_t);
-   if(sd) {
-      /* Nothing to do if string is protected */
-      if((*sd)->protect) return;
-      /* Add string */
-      ((buzzstrman_t)param)->gcdata =
-         buzzidtree_insert(((buzzstrman_t)param)->gcdata,
-                           *(uint16_t*)data);
-   }
-}
-
 void buzzstrman_gc_clear(buzzstrman_t sm) {
-   /* Go through all the strings and add them to the tree */
-   buzzdict_foreach(sm->str2id, buzzstrman_gc_unmark, sm);
+   /* Go through all the strings and clear their mark */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(sm->entries); ++i)
+      buzzstrman_entry(sm, i)->flags &= ~BUZZSTRMAN_MARK;
 }
 
 /****************************************/
 /****************************************/
 
-void buzzstrman_gc_mark(buzzstrman_t sm,
-                        uint16_t sid) {
-   /* Get string corresponding to given sid */
-   const buzzid2strdata_t* sd = buzzdict_get(sm->id2str, &sid, buzzid2strdata_t);
-   if(sd) {
-      /* Nothing to do if string is protected */
-      if((*sd)->protect) return;
-      /* Remove string from the tree */
-      sm->gcdata = buzzidtree_remove((buzzidtree_t)sm->gcdata, sid);
-   }
+int buzzstrman_isprotected(buzzstrman_t sm,
+                           uint32_t sid) {
+   return
+      sid < buzzdarray_size(sm->entries) &&
+      buzzstrman_entry(sm, sid)->str &&
+      (buzzstrman_entry(sm, sid)->flags & BUZZSTRMAN_PROTECT);
 }
 
 /****************************************/
 /****************************************/
 
-void buzzstrman_gc_dispose(uint16_t sid,
-                           void* param) {
-   /* Get string corresponding to given sid */
-   buzzid2strdata_t sd = *buzzdict_get(((buzzstrman_t)param)->id2str, &sid, buzzid2strdata_t);
-   /* Get rid of both the sid and the string */
-   char* str = sd->str;
-   buzzdict_remove(((buzzstrman_t)param)->str2id, &str);
-   buzzdict_remove(((buzzstrman_t)param)->id2str, &sid);
-   free(str);
-}
-
-void buzzstrman_gc_prune(buzzstrman_t sm) {
-   /* Remove all the strings in the tree */
-   buzzidtree_foreach((buzzidtree_t)sm->gcdata, buzzstrman_gc_dispose, sm);
-   /* Get rid of the tree */
-   buzzidtree_destroy(sm->gcdata);
-   sm->gcdata = NULL;
+void buzzstrman_gc_mark(buzzstrman_t sm,
+                        uint32_t sid) {
+   if(sid < buzzdarray_size(sm->entries))
+      buzzstrman_entry(sm, sid)->flags |= BUZZSTRMAN_MARK;
 }
 
 /****************************************/
 /****************************************/
 
-void buzzstrman_print_id2str(const void* key,
-                             void* data,
-                             void* param) {
-   buzzid2strdata_t sd = *(buzzid2strdata_t*)data;
-   char c = ' ';
-   if(sd->protect) c = '*';
-   printf("\t[%c] %" PRIu16 " -> '%s'\n", c, *(uint16_t*)key, sd->str);
+void buzzstrman_gc_prune(buzzstrman_t sm) {
+   /* Remove all the unmarked, unprotected strings */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(sm->entries); ++i) {
+      struct buzzstrman_entry_s* e = buzzstrman_entry(sm, i);
+      if(!e->str || e->flags) continue;
+      /* Get rid of the id in the index, then of the string */
+      buzzstrman_index_remove(sm, i);
+      buzzmem_charge(sm->mem, BUZZMEM_STRINGS, -buzzstrman_strbytes(e->str));
+      free(e->str);
+      e->str = NULL;
+      --sm->count;
+   }
+   /* Drop the free ids at the end of the entries */
+   while(!buzzdarray_isempty(sm->entries) &&
+         !buzzstrman_entry(sm, buzzdarray_size(sm->entries) - 1)->str)
+      buzzdarray_pop(sm->entries);
+   /* Rebuild the free list, lowest id first */
+   sm->freeid = BUZZSTRMAN_NOID;
+   i = buzzdarray_size(sm->entries);
+   while(i > 0) {
+      --i;
+      struct buzzstrman_entry_s* e = buzzstrman_entry(sm, i);
+      if(e->str) continue;
+      e->hash = sm->freeid;
+      sm->freeid = i;
+   }
 }
 
-void buzzstrman_print_str2id(const void* key,
-                             void* data,
-                             void* param) {
-   printf("\t'%s' -> %" PRIu16 "\n", *(char**)key, *(uint16_t*)data);
-}
+/****************************************/
+/****************************************/
 
 void buzzstrman_print(buzzstrman_t sm) {
-   printf("ID -> STRING (%" PRIu32 " elements)\n", buzzdict_size(sm->id2str));
-   buzzdict_foreach(sm->id2str, buzzstrman_print_id2str, sm);
-   printf("STRING -> ID (%" PRIu32 " elements)\n", buzzdict_size(sm->str2id));
-   buzzdict_foreach(sm->str2id, buzzstrman_print_str2id, sm);
+   uint32_t i;
+   printf("ID -> STRING (%" PRIu32 " elements)\n", sm->count);
+   for(i = 0; i < buzzdarray_size(sm->entries); ++i) {
+      struct buzzstrman_entry_s* e = buzzstrman_entry(sm, i);
+      if(!e->str) continue;
+      char c = ' ';
+      if(e->flags & BUZZSTRMAN_PROTECT) c = '*';
+      printf("\t[%c] %" PRIu32 " -> '%s'\n", c, i, e->str);
+   }
+   printf("STRING -> ID (%" PRIu32 " elements)\n", sm->count);
+   for(i = 0; i < sm->index_size; ++i) {
+      if(!sm->index[i]) continue;
+      printf("\t'%s' -> %" PRIu32 "\n",
+             buzzstrman_entry(sm, sm->index[i] - 1)->str,
+             sm->index[i] - 1);
+   }
    printf("\n\n");
 }
 
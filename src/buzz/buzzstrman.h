@@ -1,17 +1,28 @@
 #ifndef BUZZSTRMAN_H
 #define BUZZSTRMAN_H
 
-#include <buzz/buzzdict.h>
+#include <buzz/buzzdarray.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+   /*
+    * A string manager entry.
+    */
+   struct buzzstrman_entry_s {
+      char* str;      /* the string, or NULL if the id is free */
+      uint32_t hash;  /* hash of the string; for a free id, the next free id */
+      uint32_t flags; /* protection and garbage collection marks */
+   };
+
    struct buzzstrman_s {
-      buzzdict_t str2id;  /* string -> id data */
-      buzzdict_t id2str;  /* id -> string data */
-      uint16_t maxsid;    /* maximum string id ever assigned */
-      void* gcdata;       /* pointer to data for garbage collection */
+      buzzdarray_t entries; /* id -> string entry */
+      uint32_t* index;      /* string -> id hash index */
+      uint32_t index_size;  /* number of slots in the index, a power of two */
+      uint32_t count;       /* number of registered strings */
+      uint32_t freeid;      /* first free id in the entries */
+      buzzmem_t mem;        /* memory accounting, or NULL */
    };
    typedef struct buzzstrman_s* buzzstrman_t;
 
@@ -31,7 +42,8 @@ extern "C" {
     * Registers a string into the string manager.
     * The string is cloned internally.
     * If a string has already been registered, its index is
-    * returned. Only one copy of each string is kept.
+    * returned. Only one copy of each string is kept. The ids of
+    * garbage-collected strings are reused.
     * If a previously unprotected string is re-registered as
     * protected, the protected flag is set.
     * @param sm The string manager.
@@ -39,18 +51,26 @@ extern "C" {
     * @param protect Whether the string is protected (!= 0) or not (== 0).
     * @return The id associated to the given string.
     */
-   extern uint16_t buzzstrman_register(buzzstrman_t sm,
+   extern uint32_t buzzstrman_register(buzzstrman_t sm,
                                        const char* str,
                                        int protect);
 
    /*
-    * Get the string corresponding to the given string id.
+    * Returns whether a string is protected from garbage collection.
+    * @param sm The string manager.
+    * @param sid The id associated to the string.
+    * @return 1 if the string exists and is protected, 0 otherwise.
+    */
+   extern int buzzstrman_isprotected(buzzstrman_t sm,
+                                     uint32_t sid);
+
+   /*
+    * Charges the memory of the string manager to BUZZMEM_STRINGS.
     * @param sm The string manager.
-    * @param sid The id associated to the wanted string.
-    * @return The string, or NULL if nothing is found.
+    * @param mem The memory accounting, or NULL to stop accounting.
     */
-   extern const char* buzzstrman_get(buzzstrman_t sm,
-                                     uint16_t sid);
+   extern void buzzstrman_account(buzzstrman_t sm,
+                                  buzzmem_t mem);
 
    /*
     * Clears the marks for garbage collection.
@@ -64,12 +84,12 @@ extern "C" {
     * @param sid The id associated to the string.
     */
    extern void buzzstrman_gc_mark(buzzstrman_t sm,
-                                  uint16_t sid);
+                                  uint32_t sid);
    
    /*
     * Performs garbage collection on the unmarked strings.
-    * The strings whose id is lower than the protected id are exempt
-    * from garbage collection.
+    * Protected strings and strings registered after the last call to
+    * buzzstrman_gc_clear() are exempt from garbage collection.
     * @param sm The string manager.
     */
    extern void buzzstrman_gc_prune(buzzstrman_t sm);
@@ -84,4 +104,12 @@ extern "C" {
 }
 #endif
 
+/*
+ * Get the string corresponding to the given string id.
+ * @param sm The string manager.
+ * @param sid The id associated to the wanted string.
+ * @return The string, or NULL if nothing is found.
+ */
+#define buzzstrman_get(sm, sid) ((uint32_t)(sid) < buzzdarray_size((sm)->entries) ? buzzdarray_get((sm)->entries, (sid), struct buzzstrman_entry_s).str : NULL)
+
 #endif
@@ -42,8 +42,6 @@ void buzzswarm_elem_destroy(const void* key, void* data, void* params) {
    buzzswarm_elem_t e = *(buzzswarm_elem_t*)data;
    buzzdarray_destroy(&(e->swarms));
    free(e);
-   free((void*)key);
-   free(data);
 }
 
 /****************************************/
@@ -499,16 +497,16 @@ int buzzswarm_exec(buzzvm_t vm) {
       /* Get rid of the current call structure */
       if(buzzvm_ret0(vm) != BUZZVM_STATE_READY) return vm->state;
       /* Save the current stack depth */
-      uint32_t stacks = buzzdarray_size(vm->stacks);
+      uint32_t depth = buzzvm_stack_depth(vm);
       /* Push the current swarm in the stack */
       buzzdarray_push(vm->swarmstack, &id);
       /* Call the closure */
       buzzvm_push(vm, c);
       int32_t numargs = 0;
       buzzvm_pushi(vm, numargs);
-      buzzvm_calls(vm);
-      do if(buzzvm_step(vm) != BUZZVM_STATE_READY) return vm->state;
-      while(stacks < buzzdarray_size(vm->stacks));
+      if(buzzvm_calls(vm) != BUZZVM_STATE_READY) return vm->state;
+      if(depth < buzzvm_stack_depth(vm))
+         buzzvm_run_to_depth(vm, depth);
       return vm->state;
    }
    else {
@@ -0,0 +1,236 @@
+#include "buzztable.h"
+#include "buzzvm.h"
+
+/****************************************/
+/****************************************/
+
+/*
+ * An array part of at least this many slots is moved to the hash part
+ * when less than a quarter of its slots are used.
+ */
+#define BUZZTABLE_ARRAY_MIN 16
+
+/*
+ * Returns the array part size.
+ */
+#define buzztable_asize(o) ((o)->t.array ? buzzdarray_size((o)->t.array) : 0)
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the array index corresponding to the given key, or -1 if
+ * the key can't be stored in the array part.
+ * Floats with a non-negative integer value are treated as the
+ * matching integers, as they are by the key comparison.
+ */
+static int64_t buzztable_index(const buzzobj_t k) {
+   if(k->o.type == BUZZTYPE_INT)
+      return k->i.value >= 0 ? k->i.value : -1;
+   if(k->o.type == BUZZTYPE_FLOAT &&
+      k->f.value >= 0.0f &&
+      k->f.value < 2147483648.0f &&
+      k->f.value == (float)(int32_t)k->f.value)
+      return (int32_t)k->f.value;
+   return -1;
+}
+
+/*
+ * Moves the keys following the array part from the hash part to the
+ * array part.
+ */
+static void buzztable_migrate(buzzvm_t vm,
+                              buzzobj_t t) {
+   union buzzobj_u key;
+   buzzobj_t k = &key;
+   key.i.type = BUZZTYPE_INT;
+   key.i.marker = 0;
+   while(!buzzdict_isempty(t->t.value)) {
+      key.i.value = buzzdarray_size(t->t.array);
+      const buzzobj_t* v = buzzdict_get(t->t.value, &k, buzzobj_t);
+      if(!v) return;
+      buzzdarray_push(t->t.array, v);
+      ++t->t.acount;
+      buzzdict_remove(t->t.value, &k);
+      t->t.shape = 0;
+   }
+}
+
+/*
+ * Moves the whole array part to the hash part.
+ */
+static void buzztable_array2hash(buzzvm_t vm,
+                                 buzzobj_t t) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(t->t.array); ++i) {
+      buzzobj_t v = buzzdarray_get(t->t.array, i, buzzobj_t);
+      if(v->o.type == BUZZTYPE_NIL) continue;
+      buzzobj_t k = buzzheap_newint(vm, i);
+      buzzheap_wb(vm, t, k);
+      buzzdict_set(t->t.value, &k, &v);
+   }
+   buzzdarray_clear(t->t.array, 1);
+   t->t.acount = 0;
+   t->t.shape = 0;
+}
+
+/****************************************/
+/****************************************/
+
+const buzzobj_t* buzztable_get(const buzzobj_t t,
+                               const buzzobj_t k) {
+   /* String keys are always in the hash part */
+   if(k->o.type == BUZZTYPE_STRING)
+      return buzzdict_get(t->t.value, &k, buzzobj_t);
+   /* Look in the array part first */
+   int64_t i = buzztable_index(k);
+   if(i >= 0 && i < buzztable_asize(t)) {
+      const buzzobj_t* v = &buzzdarray_get(t->t.array, i, buzzobj_t);
+      return (*v)->o.type != BUZZTYPE_NIL ? v : NULL;
+   }
+   /* Look in the hash part */
+   return buzzdict_get(t->t.value, &k, buzzobj_t);
+}
+
+/****************************************/
+/****************************************/
+
+void buzztable_put(buzzvm_t vm,
+                   buzzobj_t t,
+                   buzzobj_t k,
+                   buzzobj_t v) {
+   /* Setting nil means removing */
+   if(v->o.type == BUZZTYPE_NIL) {
+      buzztable_remove(vm, t, k);
+      return;
+   }
+   int64_t i = buzztable_index(k);
+   uint32_t n = buzztable_asize(t);
+   if(i >= 0 && i < n) {
+      /* Replace the element in the array part */
+      if(buzzdarray_get(t->t.array, i, buzzobj_t)->o.type == BUZZTYPE_NIL)
+         ++t->t.acount;
+      buzzheap_wb(vm, t, v);
+      buzzdarray_set(t->t.array, i, &v);
+   }
+   else if(i == n) {
+      /* Append the element to the array part */
+      if(!t->t.array) {
+         t->t.array = buzzdarray_new(4, sizeof(buzzobj_t), NULL);
+         buzzdarray_account(t->t.array, vm->heap->mem, BUZZMEM_HEAP);
+      }
+      buzzheap_wb(vm, t, v);
+      buzzdarray_push(t->t.array, &v);
+      ++t->t.acount;
+      /* The next keys might be in the hash part */
+      buzztable_migrate(vm, t);
+   }
+   else {
+      /* Set the element in the hash part */
+      buzzheap_wb(vm, t, k);
+      buzzheap_wb(vm, t, v);
+      uint32_t size = buzzdict_size(t->t.value);
+      buzzdict_set(t->t.value, &k, &v);
+      /* A new key changes the shape */
+      if(buzzdict_size(t->t.value) != size) t->t.shape = 0;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+int buzztable_remove(buzzvm_t vm,
+                     buzzobj_t t,
+                     buzzobj_t k) {
+   int64_t i = buzztable_index(k);
+   uint32_t n = buzztable_asize(t);
+   if(i < 0 || i >= n) {
+      /* Remove the element from the hash part */
+      if(!buzzdict_remove(t->t.value, &k)) return 0;
+      t->t.shape = 0;
+      return 1;
+   }
+   /* Remove the element from the array part */
+   if(buzzdarray_get(t->t.array, i, buzzobj_t)->o.type == BUZZTYPE_NIL)
+      return 0;
+   buzzobj_t nil = buzzheap_newnil(vm);
+   buzzdarray_set(t->t.array, i, &nil);
+   --t->t.acount;
+   /* Drop the trailing holes */
+   while(!buzzdarray_isempty(t->t.array) &&
+         buzzdarray_last(t->t.array, buzzobj_t)->o.type == BUZZTYPE_NIL)
+      buzzdarray_pop(t->t.array);
+   /* Give up on a sparse array part, e.g. a queue popped at the front */
+   n = buzzdarray_size(t->t.array);
+   if(n >= BUZZTABLE_ARRAY_MIN && t->t.acount * 4 < n)
+      buzztable_array2hash(vm, t);
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Parameters to take a snapshot of the keys of the hash part.
+ */
+struct buzztable_foreach_s {
+   buzzdarray_t stack;
+   uint32_t visited;
+};
+
+/*
+ * Pushes a key of the hash part on the stack, unless it was already
+ * visited in the array part.
+ */
+static void buzztable_foreach_key(const void* key, void* data, void* params) {
+   struct buzztable_foreach_s* p = (struct buzztable_foreach_s*)params;
+   int64_t i = buzztable_index(*(const buzzobj_t*)key);
+   if(i >= 0 && i < p->visited) return;
+   buzzdarray_push(p->stack, key);
+}
+
+/****************************************/
+/****************************************/
+
+void buzztable_foreach(buzzvm_t vm,
+                       buzzobj_t t,
+                       buzzdict_elem_funp fun,
+                       void* params) {
+   /*
+    * Go through the array part. The size is checked at each step
+    * because the function might modify the table.
+    */
+   uint32_t i;
+   for(i = 0; i < buzztable_asize(t); ++i) {
+      buzzobj_t* v = (buzzobj_t*)&buzzdarray_get(t->t.array, i, buzzobj_t);
+      if((*v)->o.type == BUZZTYPE_NIL) continue;
+      buzzobj_t k = buzzheap_newint(vm, i);
+      fun(&k, v, params);
+   }
+   /*
+    * Go through the hash part. The function might add or remove keys,
+    * which moves the elements around, so go through a snapshot of the
+    * keys and look each one up again. The snapshot is on the stack, so
+    * the garbage collector keeps the keys. If the array part shrank,
+    * possibly because the function made it move to the hash part, the
+    * keys of the slots already visited are left out.
+    */
+   uint32_t base = buzzdarray_size(vm->stack);
+   struct buzztable_foreach_s p = {
+      .stack = vm->stack,
+      .visited = buzztable_asize(t) < i ? i : 0
+   };
+   buzzdict_scan(t->t.value, buzztable_foreach_key, &p);
+   uint32_t end = buzzdarray_size(vm->stack);
+   for(i = base; i < end && i < buzzdarray_size(vm->stack); ++i) {
+      buzzobj_t k = buzzdarray_get(vm->stack, i, buzzobj_t);
+      const buzzobj_t* v = buzztable_get(t, k);
+      if(v) fun(&k, (void*)v, params);
+   }
+   /* Get rid of the snapshot */
+   while(buzzdarray_size(vm->stack) > base)
+      buzzdarray_pop(vm->stack);
+}
+
+/****************************************/
+/****************************************/
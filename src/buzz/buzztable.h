@@ -0,0 +1,88 @@
+#ifndef BUZZTABLE_H
+#define BUZZTABLE_H
+
+#include <buzz/buzztype.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Forward declaration of the Buzz VM.
+    */
+   struct buzzvm_s;
+
+   /*
+    * The shape of a table identifies the layout of its hash part. It
+    * is assigned by the VM when an inline cache looks into the table,
+    * and reset to 0 whenever a key is added to or removed from the
+    * hash part. Updating the value of a key keeps the shape. As long
+    * as the shape is unchanged, an element of the hash part stays at
+    * the same address.
+    */
+
+   /*
+    * Looks for the element with the given key in a table.
+    * @param t The table.
+    * @param k The key.
+    * @return A pointer to the element if found, or NULL.
+    */
+   extern const buzzobj_t* buzztable_get(const buzzobj_t t,
+                                         const buzzobj_t k);
+
+   /*
+    * Sets an element in a table.
+    * Setting an element to nil removes it. The write barrier is
+    * taken care of.
+    * @param vm The VM data.
+    * @param t The table.
+    * @param k The key.
+    * @param v The element.
+    */
+   extern void buzztable_put(struct buzzvm_s* vm,
+                             buzzobj_t t,
+                             buzzobj_t k,
+                             buzzobj_t v);
+
+   /*
+    * Removes the element with the given key from a table.
+    * If the element is not found, nothing is done.
+    * @param vm The VM data.
+    * @param t The table.
+    * @param k The key.
+    * @return 1 if the element was found and removed; 0 otherwise
+    */
+   extern int buzztable_remove(struct buzzvm_s* vm,
+                               buzzobj_t t,
+                               buzzobj_t k);
+
+   /*
+    * Applies the given function to each element in a table.
+    * The array part is visited first, in key order; the keys of the
+    * array part are made as integer objects.
+    * The key and element pointers are valid until the table is
+    * modified.
+    * The function may add, change and remove elements. Each element
+    * present when the walk starts is visited once, unless it is removed
+    * first; keys added during the walk might not be visited.
+    * @param vm The VM data.
+    * @param t The table.
+    * @param fun The function.
+    * @param params A buffer to pass along.
+    */
+   extern void buzztable_foreach(struct buzzvm_s* vm,
+                                 buzzobj_t t,
+                                 buzzdict_elem_funp fun,
+                                 void* params);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Returns the number of elements in a table.
+ * @param o The table.
+ */
+#define buzztable_size(o) ((o)->t.acount + buzzdict_size((o)->t.value))
+
+#endif
@@ -2,13 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 /****************************************/
 /****************************************/
 
 #define BUZZTYPE_TABLE_BUCKETS 10
 
-const char *buzztype_desc[] = { "nil", "integer", "float", "string", "table", "closure", "userdata" };
+const char *buzztype_desc[] = { "nil", "integer", "float", "string", "table", "closure", "userdata", "upvalue" };
 
 /****************************************/
 /****************************************/
@@ -17,13 +18,15 @@ uint32_t buzzobj_table_hash(const void* key) {
    buzzobj_t k = *(buzzobj_t*)key;
    switch(k->o.type) {
       case BUZZTYPE_INT: {
-         return (k->i.value % BUZZTYPE_TABLE_BUCKETS);
+         return (uint32_t)(k->i.value);
       }
       case BUZZTYPE_FLOAT: {
-         return ((uint32_t)(k->f.value) % BUZZTYPE_TABLE_BUCKETS);
+         /* Floats with an integer value must match the integer key */
+         return (uint32_t)(int32_t)(k->f.value);
       }
       case BUZZTYPE_STRING: {
-         return ((uint32_t)(k->s.value.sid) % BUZZTYPE_TABLE_BUCKETS);
+         /* Strings are interned, the id identifies them */
+         return (uint32_t)(k->s.value.sid);
       }
       default:
          fprintf(stderr, "Can't use a %s value as table key\n", buzztype_desc[k->o.type]);
@@ -32,12 +35,42 @@ uint32_t buzzobj_table_hash(const void* key) {
 }
 
 int buzzobj_table_keycmp(const void* a, const void* b) {
-   return buzzobj_cmp(*(buzzobj_t*)a, *(buzzobj_t*)b);
+   buzzobj_t ka = *(buzzobj_t*)a;
+   buzzobj_t kb = *(buzzobj_t*)b;
+   /*
+    * String keys are compared by id without looking at the
+    * characters, and are never equal to numeric keys
+    */
+   if(ka->o.type == BUZZTYPE_STRING || kb->o.type == BUZZTYPE_STRING) {
+      if(ka->o.type != kb->o.type) return ka->o.type < kb->o.type ? -1 : 1;
+      if(ka->s.value.sid < kb->s.value.sid) return -1;
+      if(ka->s.value.sid > kb->s.value.sid) return 1;
+      return 0;
+   }
+   return buzzobj_cmp(ka, kb);
 }
 
 buzzobj_t buzzobj_new(uint16_t type) {
    /* Create a new object. calloc() fills it with zeroes */
    buzzobj_t o = (buzzobj_t)calloc(1, sizeof(union buzzobj_u));
+   buzzobj_init(o, type);
+   return o;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzobj_destroy(buzzobj_t* o) {
+   buzzobj_release(*o);
+   free(*o);
+   *o = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzobj_init(buzzobj_t o,
+                  uint16_t type) {
    /* Set the object type */
    o->o.type = type;
    /* Set the object marker */
@@ -50,26 +83,26 @@ buzzobj_t buzzobj_new(uint16_t type) {
                                 buzzobj_table_hash,
                                 buzzobj_table_keycmp,
                                 NULL);
+      o->t.array = NULL;
+      o->t.acount = 0;
+      o->t.shape = 0;
    }
    else if(type == BUZZTYPE_CLOSURE) {
       o->c.value.actrec = buzzdarray_new(1, sizeof(buzzobj_t), NULL);
    }
-   /* All done */
-   return o;
 }
 
 /****************************************/
 /****************************************/
 
-void buzzobj_destroy(buzzobj_t* o) {
-   if((*o)->o.type == BUZZTYPE_TABLE) {
-      buzzdict_destroy(&((*o)->t.value));
+void buzzobj_release(buzzobj_t o) {
+   if(o->o.type == BUZZTYPE_TABLE) {
+      buzzdict_destroy(&(o->t.value));
+      if(o->t.array) buzzdarray_destroy(&(o->t.array));
    }
-   else if((*o)->o.type == BUZZTYPE_CLOSURE) {
-      buzzdarray_destroy(&((*o)->c.value.actrec));
+   else if(o->o.type == BUZZTYPE_CLOSURE) {
+      buzzdarray_destroy(&(o->c.value.actrec));
    }
-   free(*o);
-   *o = NULL;
 }
 
 /****************************************/
@@ -88,7 +121,8 @@ uint32_t buzzobj_hash(const buzzobj_t o) {
          return buzzdict_int32keyhash(&x);
       }
       case BUZZTYPE_STRING: {
-         return buzzdict_strkeyhash(&(o->s.value.str));
+         /* Strings are interned, the id identifies them */
+         return o->s.value.sid;
       }
       case BUZZTYPE_TABLE: {
          uint32_t p = (uintptr_t)(o->t.value);
@@ -117,7 +151,7 @@ int buzzobj_eq(const buzzobj_t a,
       case BUZZTYPE_NIL:    return 1;
       case BUZZTYPE_INT:    return (a->i.value == b->i.value);
       case BUZZTYPE_FLOAT:  return (a->f.value == b->f.value);
-      case BUZZTYPE_STRING: return 0; // TODO
+      case BUZZTYPE_STRING: return (a->s.value.sid == b->s.value.sid);
       case BUZZTYPE_TABLE:  return ((uintptr_t)(a->t.value) == (uintptr_t)(b->t.value));
       case BUZZTYPE_CLOSURE:
          return((a->c.value.isnative == b->c.value.isnative) &&
@@ -175,6 +209,8 @@ int buzzobj_cmp(const buzzobj_t a,
    }
    /* String and other types */
    if(a->o.type == BUZZTYPE_STRING && b->o.type == BUZZTYPE_STRING) {
+      /* Interned strings with the same id are the same string */
+      if(a->s.value.sid == b->s.value.sid) return 0;
       return buzzobj_strcmp(a->s.value.str, b->s.value.str);
    }
    if(a->o.type == BUZZTYPE_STRING && b->o.type == BUZZTYPE_INT) {
@@ -291,7 +327,7 @@ int buzzobj_size(buzzvm_t vm) {
    buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
    buzzobj_t t = buzzvm_stack_at(vm, 1);
    buzzvm_pop(vm);
-   buzzvm_pushi(vm, buzzdict_size(t->t.value));
+   buzzvm_pushi(vm, buzztable_size(t));
    return buzzvm_ret1(vm);
 }
 
@@ -331,7 +367,7 @@ int buzzobj_foreach(buzzvm_t vm) {
    buzzobj_t c = buzzvm_stack_at(vm, 1);
    /* Go through the table element and apply the closure */
    struct buzzobj_foreach_params p = { .vm = vm, .fun = c };
-   buzzdict_foreach(t->t.value, buzzobj_foreach_entry, &p);
+   buzztable_foreach(vm, t, buzzobj_foreach_entry, &p);
    return buzzvm_ret0(vm);
 }
 
@@ -341,19 +377,25 @@ int buzzobj_foreach(buzzvm_t vm) {
 struct buzzobj_map_params {
    buzzvm_t vm;
    buzzobj_t fun;
-   buzzdict_t result;
+   buzzobj_t result;
 };
 
 void buzzobj_map_entry(const void* key, void* data, void* params) {
    /* Cast params */
    struct buzzobj_map_params* p = (struct buzzobj_map_params*)params;
    if(p->vm->state != BUZZVM_STATE_READY) return;
+   /*
+    * Copy key and value, the closure might resize the table and
+    * invalidate the pointers
+    */
+   buzzobj_t k = *(buzzobj_t*)key;
+   buzzobj_t v = *(buzzobj_t*)data;
    /* Save current stack size */
    uint32_t ss = buzzvm_stack_top(p->vm);
    /* Push closure and params (key and value) */
    buzzvm_push(p->vm, p->fun);
-   buzzvm_push(p->vm, *(buzzobj_t*)key);
-   buzzvm_push(p->vm, *(buzzobj_t*)data);
+   buzzvm_push(p->vm, k);
+   buzzvm_push(p->vm, v);
    /* Call closure */
    p->vm->state = buzzvm_closure_call(p->vm, 2);
    if(p->vm->state != BUZZVM_STATE_READY) return;
@@ -367,12 +409,7 @@ void buzzobj_map_entry(const void* key, void* data, void* params) {
    }
    /* Manage return value */
    buzzobj_t r = buzzvm_stack_at(p->vm, 1);
-   if(r->o.type != BUZZTYPE_NIL) {
-      buzzdict_set(p->result, key, &r);
-   }
-   else {
-      buzzdict_remove(p->result, key);
-   }
+   buzztable_put(p->vm, p->result, k, r);
    /* Get rid of return value */
    buzzvm_pop(p->vm);
 }
@@ -395,9 +432,9 @@ int buzzobj_map(buzzvm_t vm) {
    struct buzzobj_map_params p = {
       .vm = vm,
       .fun = c,
-      .result = r->t.value
+      .result = r
    };
-   buzzdict_foreach(t->t.value, buzzobj_map_entry, &p);
+   buzztable_foreach(vm, t, buzzobj_map_entry, &p);
    /* Return the table */
    return buzzvm_ret1(vm);
 }
@@ -408,31 +445,35 @@ int buzzobj_map(buzzvm_t vm) {
 struct buzzobj_reduce_params {
    buzzvm_t vm;
    buzzobj_t fun;
+   uint32_t accum;
 };
 
 void buzzobj_reduce_entry(const void* key, void* data, void* params) {
    /* Cast params */
    struct buzzobj_reduce_params* p = (struct buzzobj_reduce_params*)params;
    if(p->vm->state != BUZZVM_STATE_READY) return;
-   /* Save and pop accumulator from the stack */
-   buzzobj_t accum = buzzvm_stack_at(p->vm, 1);
-   buzzvm_pop(p->vm);
    /* Save current stack size */
    uint32_t ss = buzzvm_stack_top(p->vm);
-   /* Push closure and params (key and value) */
+   /* Push closure and params (key, value and accumulator) */
    buzzvm_push(p->vm, p->fun);
    buzzvm_push(p->vm, *(buzzobj_t*)key);
    buzzvm_push(p->vm, *(buzzobj_t*)data);
-   buzzvm_push(p->vm, accum);
+   buzzvm_push(p->vm, buzzdarray_get(p->vm->stack, p->accum, buzzobj_t));
    /* Call closure */
    p->vm->state = buzzvm_closure_call(p->vm, 3);
    if(p->vm->state != BUZZVM_STATE_READY) return;
    /* Make sure a value was returned */
-   if(buzzvm_stack_top(p->vm) <= ss)
+   if(buzzvm_stack_top(p->vm) <= ss) {
       /* Error */
       buzzvm_seterror(p->vm,
                       BUZZVM_ERROR_STACK,
                       "reduce(table,function,accumulator) expects the function to return a value");
+      return;
+   }
+   /* The return value is the new accumulator */
+   buzzobj_t r = buzzvm_stack_at(p->vm, 1);
+   buzzdarray_set(p->vm->stack, p->accum, &r);
+   buzzvm_pop(p->vm);
 }
 
 int buzzobj_reduce(buzzvm_t vm) {
@@ -446,11 +487,18 @@ int buzzobj_reduce(buzzvm_t vm) {
    buzzvm_lload(vm, 2);
    buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
    buzzobj_t c = buzzvm_stack_at(vm, 1);
-   /* Put initial accumulator value on the stack */
+   /*
+    * Put initial accumulator value on the stack. It stays in the same
+    * place, as going through the table might push more objects.
+    */
    buzzvm_lload(vm, 3);
    /* Go through the table element and apply the closure */
-   struct buzzobj_reduce_params p = { .vm = vm, .fun = c };
-   buzzdict_foreach(t->t.value, buzzobj_reduce_entry, &p);
+   struct buzzobj_reduce_params p = {
+      .vm = vm,
+      .fun = c,
+      .accum = buzzdarray_size(vm->stack) - 1
+   };
+   buzztable_foreach(vm, t, buzzobj_reduce_entry, &p);
    /* The final value of the accumulator is on the stack */
    return buzzvm_ret1(vm);
 }
@@ -461,19 +509,25 @@ int buzzobj_reduce(buzzvm_t vm) {
 struct buzzobj_filter_params {
    buzzvm_t vm;
    buzzobj_t fun;
-   buzzdict_t result;
+   buzzobj_t result;
 };
 
 void buzzobj_filter_entry(const void* key, void* data, void* params) {
    /* Cast params */
    struct buzzobj_filter_params* p = (struct buzzobj_filter_params*)params;
    if(p->vm->state != BUZZVM_STATE_READY) return;
+   /*
+    * Copy key and value, the closure might resize the table and
+    * invalidate the pointers
+    */
+   buzzobj_t k = *(buzzobj_t*)key;
+   buzzobj_t v = *(buzzobj_t*)data;
    /* Save current stack size */
    uint32_t ss = buzzvm_stack_top(p->vm);
    /* Push closure and params (key and value) */
    buzzvm_push(p->vm, p->fun);
-   buzzvm_push(p->vm, *(buzzobj_t*)key);
-   buzzvm_push(p->vm, *(buzzobj_t*)data);
+   buzzvm_push(p->vm, k);
+   buzzvm_push(p->vm, v);
    /* Call closure */
    p->vm->state = buzzvm_closure_call(p->vm, 2);
    if(p->vm->state != BUZZVM_STATE_READY) return;
@@ -489,9 +543,8 @@ void buzzobj_filter_entry(const void* key, void* data, void* params) {
    buzzobj_t retval = buzzvm_stack_at(p->vm, 1);
    if(retval->o.type != BUZZTYPE_NIL &&
       (retval->o.type != BUZZTYPE_INT ||
-       retval->i.value != 0)) {
-      buzzdict_set(p->result, key, data);
-   }
+       retval->i.value != 0))
+      buzztable_put(p->vm, p->result, k, v);
    /* Get rid of return value */
    buzzvm_pop(p->vm);
 }
@@ -514,9 +567,9 @@ int buzzobj_filter(buzzvm_t vm) {
    struct buzzobj_filter_params p = {
       .vm = vm,
       .fun = c,
-      .result = r->t.value
+      .result = r
    };
-   buzzdict_foreach(t->t.value, buzzobj_filter_entry, &p);
+   buzztable_foreach(vm, t, buzzobj_filter_entry, &p);
    /* Return the table */
    return buzzvm_ret1(vm);
 }
@@ -524,36 +577,115 @@ int buzzobj_filter(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+struct buzzobj_serialize_params {
+   buzzdarray_t buf;
+   buzzvm_t vm;
+};
+
 void buzzobj_serialize_tableelem(const void* key, void* data, void* params) {
-   buzzobj_serialize((buzzdarray_t)params, *(buzzobj_t*)key);
-   buzzobj_serialize((buzzdarray_t)params, *(buzzobj_t*)data);
+   struct buzzobj_serialize_params* p = (struct buzzobj_serialize_params*)params;
+   buzzobj_serialize(p->buf, *(buzzobj_t*)key, p->vm);
+   buzzobj_serialize(p->buf, *(buzzobj_t*)data, p->vm);
+}
+
+/*
+ * Serializes a float in the compact format.
+ * The float is sent as a binary16 when the conversion loses nothing, or
+ * when the encoding asks for it and the float is within range.
+ */
+static void buzzobj_serialize_compactfloat(buzzdarray_t buf,
+                                           float data,
+                                           uint32_t enc) {
+   uint16_t h = buzzmsg_float_tohalf(data);
+   float back = buzzmsg_float_fromhalf(h);
+   if(memcmp(&back, &data, sizeof(float)) == 0 ||
+      ((enc & BUZZMSG_ENC_HALF) && (isinf(back) == isinf(data)))) {
+      buzzmsg_serialize_u8(buf, BUZZTYPE_FLOAT | BUZZMSG_COMPACT | BUZZMSG_ALT);
+      buzzmsg_serialize_u16(buf, h);
+   }
+   else {
+      buzzmsg_serialize_u8(buf, BUZZTYPE_FLOAT | BUZZMSG_COMPACT);
+      buzzmsg_serialize_float32(buf, data);
+   }
 }
 
 void buzzobj_serialize(buzzdarray_t buf,
-                       const buzzobj_t data) {
-   buzzmsg_serialize_u8(buf, data->o.type);
+                       const buzzobj_t data,
+                       struct buzzvm_s* vm) {
+   uint8_t compact = (vm->msgenc & BUZZMSG_ENC_COMPACT) ? BUZZMSG_COMPACT : 0;
    switch(data->o.type) {
       case BUZZTYPE_NIL: {
+         buzzmsg_serialize_u8(buf, data->o.type | compact);
          break;
       }
       case BUZZTYPE_INT: {
-         buzzmsg_serialize_u32(buf, data->i.value);
+         buzzmsg_serialize_u8(buf, data->o.type | compact);
+         if(compact) buzzmsg_serialize_svarint(buf, data->i.value);
+         else        buzzmsg_serialize_u32(buf, data->i.value);
          break;
       }
       case BUZZTYPE_FLOAT: {
-         buzzmsg_serialize_float(buf, data->f.value);
+         if(compact) {
+            buzzobj_serialize_compactfloat(buf, data->f.value, vm->msgenc);
+         }
+         else {
+            buzzmsg_serialize_u8(buf, data->o.type);
+            buzzmsg_serialize_float(buf, data->f.value);
+         }
          break;
       }
       case BUZZTYPE_STRING: {
-         buzzmsg_serialize_string(buf, data->s.value.str);
+         if(compact &&
+            (vm->msgenc & BUZZMSG_ENC_STRREF) &&
+            data->s.value.sid < vm->sharedstrs &&
+            buzzstrman_isprotected(vm->strings, data->s.value.sid)) {
+            /* The receiver knows the string by the same id */
+            buzzmsg_serialize_u8(buf, data->o.type | BUZZMSG_COMPACT | BUZZMSG_ALT);
+            buzzmsg_serialize_varint(buf, data->s.value.sid);
+         }
+         else if(compact) {
+            buzzmsg_serialize_u8(buf, data->o.type | BUZZMSG_COMPACT);
+            buzzmsg_serialize_vstring(buf, data->s.value.str);
+         }
+         else {
+            buzzmsg_serialize_u8(buf, data->o.type);
+            buzzmsg_serialize_string(buf, data->s.value.str);
+         }
          break;
       }
       case BUZZTYPE_TABLE: {
-         buzzmsg_serialize_u8(buf, buzzdict_size(data->t.value));
-         buzzdict_foreach(data->t.value, buzzobj_serialize_tableelem, buf);
+         /* The legacy size is a single byte, so larger tables are always
+            sent with the compact size */
+         uint32_t size = buzztable_size(data);
+         if(compact || size > 0xFF) {
+            buzzmsg_serialize_u8(buf, data->o.type | BUZZMSG_COMPACT);
+            buzzmsg_serialize_varint(buf, size);
+         }
+         else {
+            buzzmsg_serialize_u8(buf, data->o.type);
+            buzzmsg_serialize_u8(buf, size);
+         }
+         /* Array part, with the integer keys made on the spot */
+         if(data->t.array) {
+            union buzzobj_u key;
+            key.i.type = BUZZTYPE_INT;
+            key.i.marker = 0;
+            uint32_t i;
+            for(i = 0; i < buzzdarray_size(data->t.array); ++i) {
+               buzzobj_t v = buzzdarray_get(data->t.array, i, buzzobj_t);
+               if(v->o.type == BUZZTYPE_NIL) continue;
+               key.i.value = i;
+               buzzobj_serialize(buf, &key, vm);
+               buzzobj_serialize(buf, v, vm);
+            }
+         }
+         /* Hash part */
+         struct buzzobj_serialize_params p = { .buf = buf, .vm = vm };
+         buzzdict_scan(data->t.value, buzzobj_serialize_tableelem, &p);
          break;
       }
       case BUZZTYPE_CLOSURE: {
+         buzzmsg_serialize_u8(buf, data->o.type | compact);
          // TODO here we assume that the first and only element of the
          // activation record is nil, which is true only for basic
          // functions. For table closures, we currently have no check,
@@ -565,7 +697,12 @@ void buzzobj_serialize(buzzdarray_t buf,
          // testmobilecode.bzz, which involves a table.
          if(buzzdarray_size(data->c.value.actrec) == 1) {
             buzzmsg_serialize_u8(buf, data->c.value.isnative);
-            buzzmsg_serialize_u32(buf, data->c.value.ref);
+            /* Send the bytecode offset, not the position in the decoded code */
+            uint32_t ref = data->c.value.isnative ?
+               buzzvm_pc2offset(vm, data->c.value.ref) :
+               data->c.value.ref;
+            if(compact) buzzmsg_serialize_varint(buf, ref);
+            else        buzzmsg_serialize_u32(buf, ref);
          }
          else {
             fprintf(stderr, "[TODO] %s:%d: can't serialize a nested closure\n", __FILE__, __LINE__);
@@ -573,6 +710,7 @@ void buzzobj_serialize(buzzdarray_t buf,
          break;
       }
       default:
+         buzzmsg_serialize_u8(buf, data->o.type);
          fprintf(stderr, "[TODO] %s:%d Can't serialize an object of type %s\n", __FILE__, __LINE__, buzztype_desc[data->o.type]);
    }
 }
@@ -581,37 +719,80 @@ void buzzobj_serialize(buzzdarray_t buf,
 /****************************************/
 
 int64_t buzzobj_deserialize(buzzobj_t* data,
-                            buzzdarray_t buf,
+                            buzzmsg_view_t buf,
                             uint32_t pos,
                             struct buzzvm_s* vm) {
    int64_t p = pos;
-   uint8_t type;
-   p = buzzmsg_deserialize_u8(&type, buf, p);
+   uint8_t tag;
+   p = buzzmsg_deserialize_u8(&tag, buf, p);
    if(p < 0) return -1;
-   *data = buzzheap_newobj(vm, type);
+   /* The type byte also tells the format of the object */
+   uint8_t compact = tag & BUZZMSG_COMPACT;
+   uint8_t alt = tag & BUZZMSG_ALT;
+   uint8_t type = tag & ~(BUZZMSG_COMPACT | BUZZMSG_ALT);
    switch(type) {
       case BUZZTYPE_NIL: {
+         *data = buzzheap_newnil(vm);
          return p;
       }
       case BUZZTYPE_INT: {
-         return buzzmsg_deserialize_u32((uint32_t*)(&((*data)->i.value)), buf, p);
+         int32_t value;
+         if(compact) p = buzzmsg_deserialize_svarint(&value, buf, p);
+         else        p = buzzmsg_deserialize_u32((uint32_t*)(&value), buf, p);
+         if(p < 0) return -1;
+         *data = buzzheap_newint(vm, value);
+         return p;
       }
       case BUZZTYPE_FLOAT: {
-         return buzzmsg_deserialize_float(&((*data)->f.value), buf, p);
+         float value;
+         if(compact && alt) {
+            uint16_t h;
+            p = buzzmsg_deserialize_u16(&h, buf, p);
+            value = buzzmsg_float_fromhalf(h);
+         }
+         else if(compact) {
+            p = buzzmsg_deserialize_float32(&value, buf, p);
+         }
+         else {
+            p = buzzmsg_deserialize_float(&value, buf, p);
+         }
+         if(p < 0) return -1;
+         *data = buzzheap_newfloat(vm, value);
+         return p;
       }
       case BUZZTYPE_STRING: {
-         char* str;
-         p = buzzmsg_deserialize_string(&str, buf, p);
-         if(p < 0) return -1;
-         (*data)->s.value.sid = buzzstrman_register(vm->strings, str, 0);
+         *data = buzzheap_newobj(vm, type);
+         if(compact && alt) {
+            /* String reference: the id must be one of the script strings */
+            uint32_t sid;
+            p = buzzmsg_deserialize_varint(&sid, buf, p);
+            if(p < 0) return -1;
+            if(sid >= vm->sharedstrs ||
+               !buzzstrman_isprotected(vm->strings, sid)) return -1;
+            (*data)->s.value.sid = sid;
+         }
+         else {
+            char* str;
+            if(compact) p = buzzmsg_deserialize_vstring(&str, buf, p);
+            else        p = buzzmsg_deserialize_string(&str, buf, p);
+            if(p < 0) return -1;
+            (*data)->s.value.sid = buzzstrman_register(vm->strings, str, 0);
+            free(str);
+         }
          (*data)->s.value.str = buzzstrman_get(vm->strings, (*data)->s.value.sid);
-         free(str);
          return p;
       }
       case BUZZTYPE_TABLE: {
-         uint8_t size;
-         uint16_t i;
-         p = buzzmsg_deserialize_u8(&size, buf, p);
+         *data = buzzheap_newobj(vm, type);
+         uint32_t size, i;
+         if(compact) {
+            p = buzzmsg_deserialize_varint(&size, buf, p);
+         }
+         else {
+            uint8_t sz;
+            p = buzzmsg_deserialize_u8(&sz, buf, p);
+            size = sz;
+         }
          if(p < 0) return -1;
          for(i = 0; i < size; ++i) {
             buzzobj_t k;
@@ -620,19 +801,31 @@ int64_t buzzobj_deserialize(buzzobj_t* data,
             if(p < 0) return -1;
             p = buzzobj_deserialize(&v, buf, p, vm);
             if(p < 0) return -1;
-            buzzdict_set((*data)->t.value, &k, &v);
+            buzztable_put(vm, *data, k, v);
          }
          return p;
       }
       case BUZZTYPE_CLOSURE: {
-         buzzobj_t nil = buzzheap_newobj(vm, BUZZTYPE_NIL);
+         *data = buzzheap_newobj(vm, type);
+         buzzobj_t nil = buzzheap_newnil(vm);
          buzzdarray_push((*data)->c.value.actrec, &nil);
          p = buzzmsg_deserialize_u8(&((*data)->c.value.isnative), buf, p);
          if(p < 0) return -1;
-         return buzzmsg_deserialize_u32((uint32_t*)(&((*data)->c.value.ref)), buf, p);
+         uint32_t ref;
+         if(compact) p = buzzmsg_deserialize_varint(&ref, buf, p);
+         else        p = buzzmsg_deserialize_u32(&ref, buf, p);
+         if(p < 0) return -1;
+         if((*data)->c.value.isnative) {
+            /* The bytecode offset must be the start of an instruction */
+            int32_t pc = ref <= INT32_MAX ? buzzvm_offset2pc(vm, ref) : -1;
+            if(pc < 0) return -1;
+            (*data)->c.value.ref = pc;
+         }
+         else (*data)->c.value.ref = ref;
+         return p;
       }
       default:
-         fprintf(stderr, "[TODO] %s:%d Can't deserialize an object of type %s\n", __FILE__, __LINE__, buzztype_desc[type]);
+         fprintf(stderr, "[TODO] %s:%d Can't deserialize an object of type %s\n", __FILE__, __LINE__, type <= BUZZTYPE_UPVALUE ? buzztype_desc[type] : "unknown");
          return -1;
    }
 }
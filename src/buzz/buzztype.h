@@ -15,6 +15,7 @@
 #define BUZZTYPE_TABLE    4
 #define BUZZTYPE_CLOSURE  5
 #define BUZZTYPE_USERDATA 6
+#define BUZZTYPE_UPVALUE  7
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,18 +56,24 @@ extern "C" {
       uint16_t type;
       uint16_t marker;
       struct {
-         uint16_t sid;    // The string id
+         uint32_t sid;    // The string id
          const char* str; // The actual string
       } value;
    } buzzstring_t;
 
    /*
     * Table
+    * The integer keys 0..n-1 are stored in the array part, indexed by
+    * key, with nil marking the missing keys. All the other keys are
+    * stored in the hash part. See buzztable.h for the operations.
     */
    typedef struct {
-      uint16_t   type;
-      uint16_t   marker;
-      buzzdict_t value;
+      uint16_t     type;
+      uint16_t     marker;
+      buzzdict_t   value;  // hash part
+      buzzdarray_t array;  // array part, NULL until used
+      uint32_t     acount; // number of elements in the array part
+      uint32_t     shape;  // layout id of the hash part, 0 if none
    } buzztable_t;
 
    /*
@@ -77,7 +84,7 @@ extern "C" {
       uint16_t marker;
       struct {
          int32_t ref;         // jump address or function id
-         buzzdarray_t actrec; // activation record
+         buzzdarray_t actrec; // activation record: self, then the upvalues
          uint8_t isnative;    // 1 for native closure, 0 for c closure
       } value;
    } buzzclosure_t;
@@ -91,6 +98,23 @@ extern "C" {
       void*    value;
    } buzzuserdata_t;
 
+   /*
+    * Upvalue, a local variable captured by closures
+    * While the call frame that owns the variable is active, the
+    * upvalue is open and refers to the variable in the local symbols.
+    * When the variable goes out of scope, the upvalue is closed and
+    * keeps the last value. Upvalues are internal to the VM and never
+    * appear on the stack.
+    */
+   typedef struct {
+      uint16_t type;
+      uint16_t marker;
+      struct {
+         int64_t slot;           // position in the local symbols, or -1 when closed
+         union buzzobj_u* data;  // the value, when closed
+      } value;
+   } buzzupvalue_t;
+
    /*
     * A handle for a object
     */
@@ -106,6 +130,7 @@ extern "C" {
       buzztable_t    t;    // as table
       buzzclosure_t  c;    // as closure
       buzzuserdata_t u;    // as user data
+      buzzupvalue_t  v;    // as upvalue
    };
    typedef union buzzobj_u* buzzobj_t;
 
@@ -127,6 +152,22 @@ extern "C" {
     */
    extern void buzzobj_destroy(buzzobj_t* o);
 
+   /*
+    * Initializes a Buzz object in the given memory.
+    * The memory must be filled with zeroes.
+    * @param o The memory for the object.
+    * @param type The type of the Buzz object.
+    */
+   extern void buzzobj_init(buzzobj_t o,
+                            uint16_t type);
+
+   /*
+    * Releases the resources held by a Buzz object.
+    * The memory of the object itself is not freed.
+    * @param o The object.
+    */
+   extern void buzzobj_release(buzzobj_t o);
+
    /*
     * Returns the hash of the passed Buzz object.
     * @param o The Buzz object to hash.
@@ -137,9 +178,11 @@ extern "C" {
    /*
     * Returns 1 if two Buzz objects are equal, 0 otherwise.
     * To be equal, two objects must have the same type and equal value.
-    * For numeric types, value equality is as expected; for closures,
-    * equality means pointing to the same code; for tables, equality
-    * means having the same reference (no deep check).
+    * For numeric types, value equality is as expected; for strings,
+    * equality means having the same string id, since strings are
+    * interned; for closures, equality means pointing to the same
+    * code; for tables, equality means having the same reference (no
+    * deep check).
     * @param a The first object.
     * @param b The second object.
     * @return 1 if two Buzz objects are equal, 0 otherwise.
@@ -219,25 +262,28 @@ extern "C" {
    /*
     * Serializes a Buzz object.
     * The data is appended to the given buffer. The buffer is treated as a
-    * dynamic array of uint8_t.
+    * dynamic array of uint8_t. The object is encoded as set by
+    * buzzvm_msgenc_set().
     * @param buf The output buffer where the serialized data is appended.
     * @param data The data to serialize.
+    * @param vm The Buzz VM data.
     */
    extern void buzzobj_serialize(buzzdarray_t buf,
-                                 const buzzobj_t data);
+                                 const buzzobj_t data,
+                                 struct buzzvm_s* vm);
 
    /*
     * Deserializes a Buzz object.
-    * The data is read from the given buffer starting at the given position.
-    * The buffer is treated as a dynamic array of uint8_t.
+    * The data is read from the given view starting at the given position.
+    * Both the legacy and the compact encoding are understood.
     * @param data The deserialized data of the element.
-    * @param buf The input buffer where the serialized data is stored.
+    * @param buf The view of the serialized data.
     * @param pos The position at which the data starts.
     * @param vm The Buzz VM data.
     * @return The new position in the buffer, of -1 in case of error.
     */
    extern int64_t buzzobj_deserialize(buzzobj_t* data,
-                                      buzzdarray_t buf,
+                                      buzzmsg_view_t buf,
                                       uint32_t pos,
                                       struct buzzvm_s* vm);
 
@@ -14,9 +14,9 @@
 
 const char *buzzvm_state_desc[] = { "no code", "ready", "done", "error", "stopped" };
 
-const char *buzzvm_error_desc[] = { "none", "unknown instruction", "stack error", "wrong number of local variables", "pc out of range", "function id out of range", "type mismatch", "unknown string id", "unknown swarm id" };
+const char *buzzvm_error_desc[] = { "none", "unknown instruction", "stack error", "wrong number of local variables", "pc out of range", "function id out of range", "type mismatch", "unknown string id", "unknown swarm id", "out of memory" };
 
-const char *buzzvm_instr_desc[] = {"nop", "done", "pushnil", "dup", "pop", "ret0", "ret1", "add", "sub", "mul", "div", "mod", "pow", "unm", "land", "lor", "lnot", "band", "bor", "bnot", "lshift", "rshift", "eq", "neq", "gt", "gte", "lt", "lte", "gload", "gstore", "pusht", "tput", "tget", "callc", "calls", "pushf", "pushi", "pushs", "pushcn", "pushcc", "pushl", "lload", "lstore", "lremove", "jump", "jumpz", "jumpnz"};
+const char *buzzvm_instr_desc[] = {"nop", "done", "pushnil", "dup", "pop", "ret0", "ret1", "add", "sub", "mul", "div", "mod", "pow", "unm", "land", "lor", "lnot", "band", "bor", "bnot", "lshift", "rshift", "eq", "neq", "gt", "gte", "lt", "lte", "gload", "gstore", "pusht", "tput", "tget", "callc", "calls", "pushf", "pushi", "pushs", "pushcn", "pushcc", "pushl", "lload", "lstore", "lremove", "jump", "jumpz", "jumpnz", "gloads", "tgets", "addi", "callci", "uload", "ustore", "ucapl", "ucapu", "gstores"};
 
 static uint16_t SWARM_BROADCAST_PERIOD = 10;
 
@@ -48,26 +48,18 @@ static uint16_t SWARM_BROADCAST_PERIOD = 10;
    buzzdarray_pop(vm->stack);                                           \
    if(op1->o.type == BUZZTYPE_INT &&                                    \
       op2->o.type == BUZZTYPE_INT) {                                    \
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);              \
-      res->i.value = op2->i.value oper op1->i.value;                    \
-      buzzvm_push(vm, res);                                             \
+      buzzvm_push(vm, buzzheap_newint((vm), op2->i.value oper op1->i.value)); \
    }                                                                    \
    else if(op1->o.type == BUZZTYPE_INT &&                               \
            op2->o.type == BUZZTYPE_FLOAT) {                             \
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);            \
-      res->f.value = op2->f.value oper op1->i.value;                    \
-      buzzvm_push(vm, res);                                             \
+      buzzvm_push(vm, buzzheap_newfloat((vm), op2->f.value oper op1->i.value)); \
    }                                                                    \
    else if(op1->o.type == BUZZTYPE_FLOAT &&                             \
            op2->o.type == BUZZTYPE_INT) {                               \
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);            \
-      res->f.value = op2->i.value oper op1->f.value;                    \
-      buzzvm_push(vm, res);                                             \
+      buzzvm_push(vm, buzzheap_newfloat((vm), op2->i.value oper op1->f.value)); \
    }                                                                    \
    else {                                                               \
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);            \
-      res->f.value = op2->f.value oper op1->f.value;                    \
-      buzzvm_push(vm, res);                                             \
+      buzzvm_push(vm, buzzheap_newfloat((vm), op2->f.value oper op1->f.value)); \
    }                                                                    \
    return (vm)->state;
 
@@ -86,14 +78,13 @@ static uint16_t SWARM_BROADCAST_PERIOD = 10;
    buzzobj_t op2 = buzzvm_stack_at(vm, 2);                              \
    buzzdarray_pop(vm->stack);                                           \
    buzzdarray_pop(vm->stack);                                           \
-   buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);                 \
-   res->i.value =                                                       \
+   int32_t res =                                                        \
       !(op2->o.type == BUZZTYPE_NIL ||                                  \
         (op2->i.type == BUZZTYPE_INT && op2->i.value == 0))             \
       oper                                                              \
       !(op1->o.type == BUZZTYPE_NIL ||                                  \
         (op1->i.type == BUZZTYPE_INT && op1->i.value == 0));            \
-   return buzzvm_push(vm, res);
+   return buzzvm_push(vm, buzzheap_newint((vm), res));
 
 /*
  * Pops two operands from the stack and pushes the result of a bitwise operation on them.
@@ -112,9 +103,7 @@ static uint16_t SWARM_BROADCAST_PERIOD = 10;
    buzzobj_t op2 = buzzvm_stack_at(vm, 2);                              \
    buzzdarray_pop(vm->stack);                                           \
    buzzdarray_pop(vm->stack);                                           \
-   buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);                 \
-   res->i.value = op2->i.value oper op1->i.value;                       \
-   return buzzvm_push(vm, res);
+   return buzzvm_push(vm, buzzheap_newint((vm), op2->i.value oper op1->i.value));
 
 /*
  * Pops two numeric operands from the stack and pushes the result of a comparison operation on them.
@@ -131,10 +120,8 @@ static uint16_t SWARM_BROADCAST_PERIOD = 10;
    buzzobj_t op2 = buzzvm_stack_at(vm, 2);                              \
    buzzdarray_pop(vm->stack);                                           \
    buzzdarray_pop(vm->stack);                                           \
-   buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);                 \
    int cmp = buzzobj_cmp(op2, op1);                                     \
-   res->i.value = (cmp oper 0);                                         \
-   return buzzvm_push(vm, res);
+   return buzzvm_push(vm, buzzheap_newint((vm), (cmp oper 0)));
 
 /****************************************/
 /****************************************/
@@ -143,13 +130,16 @@ void buzzvm_dump(buzzvm_t vm) {
    int64_t i, j;
    fprintf(stderr, "============================================================\n");
    fprintf(stderr, "state: %d\terror: %d\n", vm->state, vm->error);
-   fprintf(stderr, "code size: %u\tpc: %d\n", vm->bcode_size, vm->pc);
-   fprintf(stderr, "stacks: %" PRId64 "\tcur elem: %" PRId64 " (size %" PRId64 ")\n", buzzdarray_size(vm->stacks), buzzvm_stack_top(vm), buzzvm_stack_top(vm));
-   for(i = buzzdarray_size(vm->stacks)-1; i >= 0 ; --i) {
+   fprintf(stderr, "code size: %u\tpc: %d\n", vm->bcode_size, buzzvm_pc2offset(vm, vm->pc));
+   fprintf(stderr, "stacks: %" PRId64 "\tcur elem: %" PRId64 " (size %" PRId64 ")\n", buzzvm_stack_depth(vm), buzzvm_stack_top(vm), buzzvm_stack_top(vm));
+   int64_t end = buzzdarray_size(vm->stack);
+   for(i = buzzvm_stack_depth(vm)-1; i >= 0 ; --i) {
+      /* The stack of frame i starts at its base and ends at the base of frame i+1 */
+      int64_t base = i > 0 ? buzzdarray_get(vm->frames, i-1, buzzvm_frame_t).stackbase : 0;
       fprintf(stderr, "===== stack: %" PRId64 " =====\n", i);
-      for(j = buzzdarray_size(buzzdarray_get(vm->stacks, i, buzzdarray_t)) - 1; j >= 0; --j) {
+      for(j = end - base - 1; j >= 0; --j) {
          fprintf(stderr, "\t%" PRId64 "\t", j);
-         buzzobj_t o = buzzdarray_get(buzzdarray_get(vm->stacks, i, buzzdarray_t), j, buzzobj_t);
+         buzzobj_t o = buzzdarray_get(vm->stack, base + j, buzzobj_t);
          switch(o->o.type) {
             case BUZZTYPE_NIL:
                fprintf(stderr, "[nil]\n");
@@ -161,23 +151,24 @@ void buzzvm_dump(buzzvm_t vm) {
                fprintf(stderr, "[float] %f\n", o->f.value);
                break;
             case BUZZTYPE_TABLE:
-               fprintf(stderr, "[table] %d elements\n", buzzdict_size(o->t.value));
+               fprintf(stderr, "[table] %d elements\n", buzztable_size(o));
                break;
             case BUZZTYPE_CLOSURE:
                if(o->c.value.isnative) {
-                  fprintf(stderr, "[n-closure] %d\n", o->c.value.ref);
+                  fprintf(stderr, "[n-closure] %d\n", buzzvm_pc2offset(vm, o->c.value.ref));
                }
                else {
                   fprintf(stderr, "[c-closure] %d\n", o->c.value.ref);
                }
                break;
             case BUZZTYPE_STRING:
-               fprintf(stderr, "[string] %d:'%s'\n", o->s.value.sid, o->s.value.str);
+               fprintf(stderr, "[string] %" PRIu32 ":'%s'\n", o->s.value.sid, o->s.value.str);
                break;
             default:
                fprintf(stderr, "[TODO] type = %d\n", o->o.type);
          }
       }
+      end = base;
    }
    fprintf(stderr, "============================================================\n\n");
 }
@@ -196,38 +187,17 @@ const char* buzzvm_strerror(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
-#define BUZZVM_STACKS_INIT_CAPACITY  20
-#define BUZZVM_STACK_INIT_CAPACITY   20
-#define BUZZVM_LSYMTS_INIT_CAPACITY  20
+#define BUZZVM_STACK_INIT_CAPACITY   64
+#define BUZZVM_LSYMS_INIT_CAPACITY   64
+#define BUZZVM_FRAMES_INIT_CAPACITY  16
 #define BUZZVM_SYMS_INIT_CAPACITY    20
 #define BUZZVM_STRINGS_INIT_CAPACITY 20
 
 /****************************************/
 /****************************************/
 
-buzzvm_lsyms_t buzzvm_lsyms_new(uint8_t isswarm,
-                                buzzdarray_t syms) {
-   buzzvm_lsyms_t s = (buzzvm_lsyms_t)malloc(sizeof(struct buzzvm_lsyms_s));
-   s->isswarm = isswarm;
-   s->syms = syms;
-   return s;
-}
-
-void buzzvm_lsyms_destroy(uint32_t pos,
-                          void* data,
-                          void* params) {
-   buzzvm_lsyms_t s = *(buzzvm_lsyms_t*)data;
-   buzzdarray_destroy(&(s->syms));
-   free(s);
-}
-
-/****************************************/
-/****************************************/
-
 void buzzvm_vstig_destroy(const void* key, void* data, void* params) {
-   free((void*)key);
    buzzvstig_destroy((buzzvstig_t*)data);
-   free(data);
 }
 
 /****************************************/
@@ -238,20 +208,28 @@ void buzzvm_outmsg_destroy(uint32_t pos, void* data, void* param) {
 }
 
 void buzzvm_process_inmsgs(buzzvm_t vm) {
-   /* Go through the messages */
+   /* Go through the messages, up to the limit */
+   uint32_t n = vm->inmsgs->limit;
    while(!buzzinmsg_queue_isempty(vm->inmsgs)) {
       /* Make sure the VM is in the right state */
-      if(vm->state != BUZZVM_STATE_READY) return;
+      if(vm->state != BUZZVM_STATE_READY) break;
+      /* Leave the rest for the next call */
+      if(vm->inmsgs->limit > 0 && n-- == 0) break;
       /* Extract the message data */
-      uint16_t rid;
-      buzzmsg_payload_t msg;
-      buzzinmsg_queue_extract(vm, &rid, &msg);
-      /* Dispatch the message wrt its type in msg->payload[0] */
-      switch(buzzmsg_payload_get(msg, 0)) {
+      buzzinmsg_t m;
+      buzzinmsg_queue_extract(vm, &m);
+      uint16_t rid = m.robot;
+      buzzmsg_view_t msg = m.payload;
+      /* Dispatch the message wrt its type in msg.data[0] */
+      switch(msg.size > 0 ? msg.data[0] : BUZZMSG_TYPE_COUNT) {
          case BUZZMSG_BROADCAST: {
             /* Deserialize the topic */
             buzzobj_t topic;
             int64_t pos = buzzobj_deserialize(&topic, msg, 1, vm);
+            if(pos < 0 || topic->o.type != BUZZTYPE_STRING) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_BROADCAST message received\n", vm->robot);
+               break;
+            }
             /* Make sure there's a listener to call */
             const buzzobj_t* l = buzzdict_get(vm->listeners, &topic->s.value.sid, buzzobj_t);
             if(!l) {
@@ -261,9 +239,12 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             /* Deserialize value */
             buzzobj_t value;
             pos = buzzobj_deserialize(&value, msg, pos, vm);
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_BROADCAST message received\n", vm->robot);
+               break;
+            }
             /* Make an object for the robot id */
-            buzzobj_t rido = buzzheap_newobj(vm, BUZZTYPE_INT);
-            rido->i.value = rid;
+            buzzobj_t rido = buzzheap_newint(vm, rid);
             /* Call listener */
             buzzvm_push(vm, *l);
             buzzvm_push(vm, topic);
@@ -301,7 +282,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                ((*l)->timestamp < v->timestamp)) { /* Local element is older */
                /* Local element must be updated */
                /* Store element */
-               buzzvstig_store(*vs, &k, &v);
+               buzzvstig_store(vm, *vs, &k, &v);
                buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
             }
             else if(((*l)->timestamp == v->timestamp) && /* Same timestamp */
@@ -316,21 +297,29 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                }
                /* Get rid of useless vstig element */
                free(v);
+               /* The conflict manager may have changed the virtual
+                  stigmergies, which moves their elements: fetch again */
+               vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+               if(!vs) {
+                  free(c);
+                  break;
+               }
+               l = buzzvstig_fetch(*vs, &k);
                /* Did this robot lose the conflict? */
                if((c->robot != vm->robot) &&
-                  ((*l)->robot == vm->robot)) {
+                  l && ((*l)->robot == vm->robot)) {
                   /* Yes */
                   /* Save current local entry */
                   buzzvstig_elem_t ol = buzzvstig_elem_clone(vm, *l);
                   /* Store winning value */
-                  buzzvstig_store(*vs, &k, &c);
+                  buzzvstig_store(vm, *vs, &k, &c);
                   /* Call conflict lost manager */
                   buzzvstig_onconflictlost_call(vm, *vs, k, ol);
                }
                else {
                   /* This robot did not lose the conflict */
                   /* Just propagate the PUT message */
-                  buzzvstig_store(*vs, &k, &c);
+                  buzzvstig_store(vm, *vs, &k, &c);
                }
                buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
             }
@@ -378,7 +367,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                }
                else {
                   /* Store element and propagate PUT message */
-                  buzzvstig_store(*vs, &k, &v);
+                  buzzvstig_store(vm, *vs, &k, &v);
                   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
                }
                break;
@@ -387,7 +376,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             if((*l)->timestamp < v->timestamp) {
                /* Local element is older */
                /* Store element */
-               buzzvstig_store(*vs, &k, &v);
+               buzzvstig_store(vm, *vs, &k, &v);
                buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
             }
             else if((*l)->timestamp > v->timestamp) {
@@ -405,21 +394,29 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                free(v);
                /* Make sure conflict manager returned with an element to process */
                if(!c) break;
+               /* The conflict manager may have changed the virtual
+                  stigmergies, which moves their elements: fetch again */
+               vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+               if(!vs) {
+                  free(c);
+                  break;
+               }
+               l = buzzvstig_fetch(*vs, &k);
                /* Did this robot lose the conflict? */
                if((c->robot != vm->robot) &&
-                  ((*l)->robot == vm->robot)) {
+                  l && ((*l)->robot == vm->robot)) {
                   /* Yes */
                   /* Save current local entry */
                   buzzvstig_elem_t ol = buzzvstig_elem_clone(vm, *l);
                   /* Store winning value */
-                  buzzvstig_store(*vs, &k, &c);
+                  buzzvstig_store(vm, *vs, &k, &c);
                   /* Call conflict lost manager */
                   buzzvstig_onconflictlost_call(vm, *vs, k, ol);
                }
                else {
                   /* This robot did not lose the conflict */
                   /* Just propagate the PUT message */
-                  buzzvstig_store(*vs, &k, &c);
+                  buzzvstig_store(vm, *vs, &k, &c);
                }
                buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
             }
@@ -479,8 +476,10 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
          }
       }
       /* Get rid of the message */
-      buzzmsg_payload_destroy(&msg);
+      buzzinmsg_release(vm, &m);
    }
+   /* The messages left refer to buffers that may not outlive this call */
+   buzzinmsg_queue_detach(vm);
    /* Update swarm membership */
    buzzswarm_members_update(vm->swarmmembers);
 }
@@ -489,6 +488,8 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
 /****************************************/
 
 void buzzvm_process_outmsgs(buzzvm_t vm) {
+   /* Start a new step for the scheduler */
+   buzzoutmsg_queue_step(vm);
    /* Must broadcast swarm list message? */
    if(vm->swarmbroadcast > 0)
       --vm->swarmbroadcast;
@@ -503,36 +504,61 @@ void buzzvm_process_outmsgs(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
-void buzzvm_darray_destroy(uint32_t pos,
-                           void* data,
-                           void* params) {
-   buzzdarray_t* s = (buzzdarray_t*)data;
-   buzzdarray_destroy(s);
+/*
+ * Returns the number of bytes allocated for the decoded code.
+ */
+#define buzzvm_code_bytes(vm) ((int64_t)(vm)->code_size * sizeof(buzzvm_code_t) + ((int64_t)(vm)->code_size + 1) * sizeof(uint32_t) + (int64_t)((vm)->tcache_size ? (vm)->tcache_size : 1) * sizeof(buzzvm_tcache_t))
+
+/*
+ * Gets rid of the decoded code.
+ */
+static void buzzvm_code_free(buzzvm_t vm) {
+   if(vm->code)
+      buzzmem_charge(vm->mem, BUZZMEM_VM, -buzzvm_code_bytes(vm));
+   free(vm->code);
+   free(vm->code_off);
+   free(vm->tcache);
+   vm->code = NULL;
+   vm->code_off = NULL;
+   vm->tcache = NULL;
+   vm->code_size = 0;
+   vm->tcache_size = 0;
 }
 
+/****************************************/
+/****************************************/
+
 buzzvm_t buzzvm_new(uint16_t robot) {
    /* Create VM state. calloc() takes care of zeroing everything */
    buzzvm_t vm = (buzzvm_t)calloc(1, sizeof(struct buzzvm_s));
-   /* Create stacks */
-   vm->stacks = buzzdarray_new(BUZZVM_STACKS_INIT_CAPACITY,
-                               sizeof(buzzdarray_t),
-                               buzzvm_darray_destroy);
+   /* Create the memory accounting */
+   vm->mem = buzzmem_new();
+   /* Create the value stack */
    vm->stack = buzzdarray_new(BUZZVM_STACK_INIT_CAPACITY,
                               sizeof(buzzobj_t),
                               NULL);
-   buzzdarray_push(vm->stacks, &(vm->stack));
-   /* Create local variable tables */
-   vm->lsymts = buzzdarray_new(BUZZVM_LSYMTS_INIT_CAPACITY,
-                               sizeof(buzzvm_lsyms_t),
-                               buzzvm_lsyms_destroy);
-   vm->lsyms = NULL;
+   /* Create the local symbols */
+   vm->lsyms = buzzdarray_new(BUZZVM_LSYMS_INIT_CAPACITY,
+                              sizeof(buzzobj_t),
+                              NULL);
+   /* Create the call frames */
+   vm->frames = buzzdarray_new(BUZZVM_FRAMES_INIT_CAPACITY,
+                               sizeof(buzzvm_frame_t),
+                               NULL);
+   /* Create the open upvalue list */
+   vm->upvals = buzzdarray_new(BUZZVM_FRAMES_INIT_CAPACITY,
+                               sizeof(buzzobj_t),
+                               NULL);
    /* Create global variable tables */
    vm->gsyms = buzzdict_new(BUZZVM_SYMS_INIT_CAPACITY,
-                            sizeof(int32_t),
-                            sizeof(buzzobj_t),
-                            buzzdict_int32keyhash,
-                            buzzdict_int32keycmp,
+                            sizeof(uint32_t),
+                            sizeof(uint32_t),
+                            buzzdict_uint32keyhash,
+                            buzzdict_uint32keycmp,
                             NULL);
+   vm->gslots = buzzdarray_new(BUZZVM_SYMS_INIT_CAPACITY,
+                               sizeof(buzzobj_t),
+                               NULL);
    /* Create string list */
    vm->strings = buzzstrman_new();
    /* Create heap */
@@ -565,13 +591,33 @@ buzzvm_t buzzvm_new(uint16_t robot) {
                              buzzvm_vstig_destroy);
    /* Create virtual stigmergy */
    vm->listeners = buzzdict_new(10,
-                                sizeof(uint16_t),
+                                sizeof(uint32_t),
                                 sizeof(buzzobj_t),
-                                buzzdict_uint16keyhash,
-                                buzzdict_uint16keycmp,
+                                buzzdict_uint32keyhash,
+                                buzzdict_uint32keycmp,
                                 NULL);
+   /* Charge the memory of the structures */
+   buzzmem_charge(vm->mem, BUZZMEM_VM, sizeof(struct buzzvm_s));
+   buzzdarray_account(vm->stack, vm->mem, BUZZMEM_VM);
+   buzzdarray_account(vm->lsyms, vm->mem, BUZZMEM_VM);
+   buzzdarray_account(vm->frames, vm->mem, BUZZMEM_VM);
+   buzzdarray_account(vm->upvals, vm->mem, BUZZMEM_VM);
+   buzzdict_account(vm->gsyms, vm->mem, BUZZMEM_VM);
+   buzzdarray_account(vm->gslots, vm->mem, BUZZMEM_VM);
+   buzzstrman_account(vm->strings, vm->mem);
+   buzzheap_account(vm->heap, vm->mem);
+   buzzdarray_account(vm->flist, vm->mem, BUZZMEM_VM);
+   buzzdict_account(vm->swarms, vm->mem, BUZZMEM_VM);
+   buzzdarray_account(vm->swarmstack, vm->mem, BUZZMEM_VM);
+   buzzdict_account(vm->swarmmembers, vm->mem, BUZZMEM_VM);
+   buzzinmsg_queue_account(vm->inmsgs, vm->mem);
+   buzzoutmsg_queue_account(vm->outmsgs, vm->mem);
+   buzzdict_account(vm->vstigs, vm->mem, BUZZMEM_VSTIGS);
+   buzzdict_account(vm->listeners, vm->mem, BUZZMEM_VM);
    /* Take care of the robot id */
    vm->robot = robot;
+   /* Send compact messages by default */
+   vm->msgenc = BUZZMSG_ENC_COMPACT;
    /* Initialize empty random number generator (buzzvm_math takes care of creating it) */
    vm->rngstate = NULL;
    vm->rngidx = 0;
@@ -589,10 +635,13 @@ void buzzvm_destroy(buzzvm_t* vm) {
    buzzstrman_destroy(&(*vm)->strings);
    /* Get rid of the global variable table */
    buzzdict_destroy(&(*vm)->gsyms);
-   /* Get rid of the local variable tables */
-   buzzdarray_destroy(&(*vm)->lsymts);
+   buzzdarray_destroy(&(*vm)->gslots);
+   /* Get rid of the call frames and the local symbols */
+   buzzdarray_destroy(&(*vm)->upvals);
+   buzzdarray_destroy(&(*vm)->frames);
+   buzzdarray_destroy(&(*vm)->lsyms);
    /* Get rid of the stack */
-   buzzdarray_destroy(&(*vm)->stacks);
+   buzzdarray_destroy(&(*vm)->stack);
    /* Get rid of the heap */
    buzzheap_destroy(&(*vm)->heap);
    /* Get rid of the function list */
@@ -608,6 +657,10 @@ void buzzvm_destroy(buzzvm_t* vm) {
    buzzdict_destroy(&(*vm)->vstigs);
    /* Get rid of neighbor value listeners */
    buzzdict_destroy(&(*vm)->listeners);
+   /* Get rid of the decoded code */
+   buzzvm_code_free(*vm);
+   /* Get rid of the memory accounting */
+   buzzmem_destroy(&(*vm)->mem);
    free(*vm);
    *vm = 0;
 }
@@ -650,9 +703,202 @@ void buzzvm_seterror(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
+/*
+ * Returns the size in bytes of an instruction in the bytecode.
+ */
+#define buzzvm_instr_size(op) ((op) >= BUZZVM_INSTR_PUSHF ? 1 + sizeof(uint32_t) : 1)
+
+buzzvm_error buzzvm_bcode_verify(const uint8_t* bcode,
+                                 uint32_t bcode_size,
+                                 uint32_t* off) {
+   /* Check that the string table is terminated */
+   *off = 0;
+   if(bcode_size < sizeof(uint16_t)) return BUZZVM_ERROR_STRING;
+   uint16_t count;
+   memcpy(&count, bcode, sizeof(uint16_t));
+   uint32_t i = sizeof(uint16_t);
+   uint32_t c;
+   for(c = 0; c < count; ++c) {
+      *off = i;
+      while(i < bcode_size && bcode[i] != 0) ++i;
+      if(i >= bcode_size) return BUZZVM_ERROR_STRING;
+      ++i;
+   }
+   /* There must be some code after the strings */
+   uint32_t start = i;
+   *off = start;
+   if(start >= bcode_size) return BUZZVM_ERROR_PC;
+   /*
+    * First pass: check the opcodes and mark the instruction
+    * boundaries. An argument must be followed by at least one byte.
+    */
+   uint8_t* isinstr = (uint8_t*)calloc(bcode_size, 1);
+   uint32_t last = start;
+   for(i = start; i < bcode_size; i += buzzvm_instr_size(bcode[i])) {
+      *off = i;
+      if(bcode[i] >= BUZZVM_INSTR_COUNT) { free(isinstr); return BUZZVM_ERROR_INSTR; }
+      if(bcode[i] >= BUZZVM_INSTR_PUSHF && i + sizeof(uint32_t) >= bcode_size) { free(isinstr); return BUZZVM_ERROR_PC; }
+      isinstr[i] = 1;
+      last = i;
+   }
+   /* Execution must not run past the end of the code */
+   *off = last;
+   if(bcode[last] != BUZZVM_INSTR_DONE &&
+      bcode[last] != BUZZVM_INSTR_RET0 &&
+      bcode[last] != BUZZVM_INSTR_RET1) {
+      free(isinstr);
+      return BUZZVM_ERROR_PC;
+   }
+   /*
+    * Second pass: check the arguments
+    */
+   buzzvm_error err = BUZZVM_ERROR_NONE;
+   for(i = start; i < bcode_size && err == BUZZVM_ERROR_NONE; i += buzzvm_instr_size(bcode[i])) {
+      *off = i;
+      uint32_t arg;
+      switch(bcode[i]) {
+         case BUZZVM_INSTR_PUSHS:
+         case BUZZVM_INSTR_GSTORES:
+         case BUZZVM_INSTR_GLOADS:
+         case BUZZVM_INSTR_TGETS:
+            /* String ids refer to the string table */
+            memcpy(&arg, bcode + i + 1, sizeof(uint32_t));
+            if(arg >= count) err = BUZZVM_ERROR_STRING;
+            break;
+         case BUZZVM_INSTR_PUSHCN:
+         case BUZZVM_INSTR_PUSHL:
+         case BUZZVM_INSTR_JUMP:
+         case BUZZVM_INSTR_JUMPZ:
+         case BUZZVM_INSTR_JUMPNZ:
+            /* Code addresses must land on an instruction */
+            memcpy(&arg, bcode + i + 1, sizeof(uint32_t));
+            if(arg >= bcode_size || !isinstr[arg]) err = BUZZVM_ERROR_PC;
+            break;
+      }
+   }
+   free(isinstr);
+   return err;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the slot of the global variable with the given string id,
+ * creating the variable if necessary.
+ */
+static uint32_t buzzvm_gslot_sid(buzzvm_t vm,
+                                 uint32_t sid) {
+   const uint32_t* slot = buzzdict_get(vm->gsyms, &sid, uint32_t);
+   if(slot) return *slot;
+   uint32_t s = buzzdarray_size(vm->gslots);
+   buzzobj_t nil = buzzheap_newnil(vm);
+   buzzdarray_push(vm->gslots, &nil);
+   buzzdict_set(vm->gsyms, &sid, &s);
+   return s;
+}
+
+/*
+ * Decodes verified bytecode, starting from the given offset.
+ */
+static void buzzvm_bcode_decode(buzzvm_t vm,
+                                uint32_t start) {
+   /* Count the instructions and the inline caches */
+   uint32_t i, n = 0, nc = 0;
+   for(i = start; i < vm->bcode_size; i += buzzvm_instr_size(vm->bcode[i])) {
+      ++n;
+      if(vm->bcode[i] == BUZZVM_INSTR_TGETS) ++nc;
+   }
+   vm->code_size = n;
+   vm->tcache_size = nc;
+   vm->code = (buzzvm_code_t*)malloc(n * sizeof(buzzvm_code_t));
+   vm->code_off = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+   vm->tcache = (buzzvm_tcache_t*)calloc(nc ? nc : 1, sizeof(buzzvm_tcache_t));
+   buzzmem_charge(vm->mem, BUZZMEM_VM, buzzvm_code_bytes(vm));
+   /* Decode opcodes and arguments */
+   for(i = start, n = 0; i < vm->bcode_size; i += buzzvm_instr_size(vm->bcode[i]), ++n) {
+      vm->code[n].op = vm->bcode[i];
+      vm->code[n].arg.u = 0;
+      if(vm->code[n].op >= BUZZVM_INSTR_PUSHF)
+         memcpy(&vm->code[n].arg, vm->bcode + i + 1, sizeof(uint32_t));
+      vm->code_off[n] = i;
+   }
+   /* The end of the code maps to the end of the bytecode */
+   vm->code_off[n] = vm->bcode_size;
+   /*
+    * Turn code addresses into positions, global names into slots, and
+    * table keys into inline caches
+    */
+   for(i = 0, nc = 0; i < n; ++i) {
+      switch(vm->code[i].op) {
+         case BUZZVM_INSTR_PUSHCN:
+         case BUZZVM_INSTR_PUSHL:
+         case BUZZVM_INSTR_JUMP:
+         case BUZZVM_INSTR_JUMPZ:
+         case BUZZVM_INSTR_JUMPNZ:
+            vm->code[i].arg.u = buzzvm_offset2pc(vm, vm->code[i].arg.u);
+            break;
+         case BUZZVM_INSTR_GLOADS:
+         case BUZZVM_INSTR_GSTORES:
+            vm->code[i].arg.u = buzzvm_gslot_sid(vm, vm->code[i].arg.u);
+            break;
+         case BUZZVM_INSTR_TGETS:
+            vm->tcache[nc].sid = vm->code[i].arg.u;
+            vm->code[i].arg.u = nc++;
+            break;
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+int32_t buzzvm_pc2offset(buzzvm_t vm,
+                         int32_t pc) {
+   if(!vm->code) return pc;
+   if(pc < 0 || pc > vm->code_size) return -1;
+   return vm->code_off[pc];
+}
+
+/****************************************/
+/****************************************/
+
+int32_t buzzvm_offset2pc(buzzvm_t vm,
+                         int32_t off) {
+   if(!vm->code) return off;
+   if(off < 0) return -1;
+   /* Look for the instruction that starts at the offset */
+   uint32_t lo = 0, hi = vm->code_size;
+   while(lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if(vm->code_off[mid] < (uint32_t)off) lo = mid + 1;
+      else hi = mid;
+   }
+   if(lo == vm->code_size || vm->code_off[lo] != (uint32_t)off) return -1;
+   return lo;
+}
+
+/****************************************/
+/****************************************/
+
 int buzzvm_set_bcode(buzzvm_t vm,
                      const uint8_t* bcode,
                      uint32_t bcode_size) {
+   /* Initialize bytecode data */
+   vm->bcode_size = bcode_size;
+   vm->bcode = bcode;
+   vm->bcode_verified = 0;
+   buzzvm_code_free(vm);
+   /* Reject invalid bytecode before running any of it */
+   uint32_t off;
+   buzzvm_error err = buzzvm_bcode_verify(bcode, bcode_size, &off);
+   if(err != BUZZVM_ERROR_NONE) {
+      vm->pc = off;
+      vm->oldpc = off;
+      buzzvm_seterror(vm, err, "invalid bytecode at offset %" PRIu32, off);
+      return vm->state;
+   }
+   vm->bcode_verified = 1;
    /* Fetch the string count */
    uint16_t count;
    memcpy(&count, bcode, sizeof(uint16_t));
@@ -666,20 +912,21 @@ int buzzvm_set_bcode(buzzvm_t vm,
       while(*(bcode + i) != 0) ++i;
       ++i;
    }
+   /* The strings registered so far can be referred to by id in messages */
+   vm->sharedstrs = buzzdarray_size(vm->strings->entries);
+   /* Decode the instructions */
+   buzzvm_bcode_decode(vm, i);
    /* Initialize VM state */
    vm->state = BUZZVM_STATE_READY;
    vm->error = BUZZVM_ERROR_NONE;
-   /* Initialize bytecode data */
-   vm->bcode_size = bcode_size;
-   vm->bcode = bcode;
    /* Set program counter */
-   vm->pc = i;
+   vm->pc = 0;
    vm->oldpc = vm->pc;
    /*
     * Register function definitions
     * Stop when you find a 'nop'
     */
-   while(vm->bcode[vm->pc] != BUZZVM_INSTR_NOP)
+   while(vm->code[vm->pc].op != BUZZVM_INSTR_NOP)
       if(buzzvm_step(vm) != BUZZVM_STATE_READY) return vm->state;
    buzzvm_step(vm);
    /* Initialize empty neighbors */
@@ -707,297 +954,551 @@ int buzzvm_set_bcode(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
-#define assert_pc(IDX) if((IDX) < 0 || (IDX) >= vm->bcode_size) { buzzvm_seterror(vm, BUZZVM_ERROR_PC, NULL); return vm->state; }
+int buzzvm_gc_idle(buzzvm_t vm,
+                   uint32_t budget) {
+   return buzzheap_gc_idle(vm, budget);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_mem_limit_set(buzzvm_t vm,
+                          int64_t limit) {
+   vm->mem->limit = limit > 0 ? limit : 0;
+   /* Collect at the next instruction if already over the limit */
+   if(buzzmem_over(vm->mem))
+      vm->heap->gcpending = BUZZHEAP_GC_FULL;
+}
 
-#define inc_pc() vm->oldpc = vm->pc; ++vm->pc; assert_pc(vm->pc);
+/****************************************/
+/****************************************/
 
-#define get_arg(TYPE) assert_pc(vm->pc + sizeof(TYPE)); TYPE arg; memcpy((void*) (&arg), vm->bcode + vm->pc, sizeof(TYPE)); vm->pc += sizeof(TYPE);
+void buzzvm_msgenc_set(buzzvm_t vm,
+                       uint32_t enc) {
+   /* The flags on top of COMPACT are meaningless without it */
+   vm->msgenc = (enc & BUZZMSG_ENC_COMPACT) ? enc : BUZZMSG_ENC_LEGACY;
+}
 
-buzzvm_state buzzvm_step(buzzvm_t vm) {
-   /* buzzvm_dump(vm); */
-   /* Can't execute if not ready */
-   if(vm->state != BUZZVM_STATE_READY) return vm->state;
-   /* Execute GC */
-   buzzheap_gc(vm);
-   /* Fetch instruction and (potential) argument */
-   uint8_t instr = vm->bcode[vm->pc];
-   /* Execute instruction */
-   switch(instr) {
-      case BUZZVM_INSTR_NOP: {
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_DONE: {
-         buzzvm_done(vm);
-         break;
-      }
-      case BUZZVM_INSTR_PUSHNIL: {
-         inc_pc();
-         buzzvm_pushnil(vm);
-         break;
-      }
-      case BUZZVM_INSTR_DUP: {
-         inc_pc();
-         buzzvm_dup(vm);
-         break;
-      }
-      case BUZZVM_INSTR_POP: {
-         if(buzzvm_pop(vm) != BUZZVM_STATE_READY) return vm->state;
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_RET0: {
-         if(buzzvm_ret0(vm) != BUZZVM_STATE_READY) return vm->state;
-         assert_pc(vm->pc);
-         break;
-      }
-      case BUZZVM_INSTR_RET1: {
-         if(buzzvm_ret1(vm) != BUZZVM_STATE_READY) return vm->state;
-         assert_pc(vm->pc);
-         break;
-      }
-      case BUZZVM_INSTR_ADD: {
-         buzzvm_add(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_SUB: {
-         buzzvm_sub(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_MUL: {
-         buzzvm_mul(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_DIV: {
-         buzzvm_div(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_MOD: {
-         buzzvm_mod(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_POW: {
-         buzzvm_pow(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_UNM: {
-         buzzvm_unm(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_LAND: {
-         buzzvm_land(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_LOR: {
-         buzzvm_lor(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_LNOT: {
-         buzzvm_lnot(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_BAND: {
-         buzzvm_band(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_BOR: {
-         buzzvm_bor(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_BNOT: {
-         buzzvm_bnot(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_LSHIFT: {
-         buzzvm_lshift(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_RSHIFT: {
-         buzzvm_rshift(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_EQ: {
-         buzzvm_eq(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_NEQ: {
-         buzzvm_neq(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_GT: {
-         buzzvm_gt(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_GTE: {
-         buzzvm_gte(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_LT: {
-         buzzvm_lt(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_LTE: {
-         buzzvm_lte(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_GLOAD: {
-         inc_pc();
-         buzzvm_gload(vm);
-         break;
-      }
-      case BUZZVM_INSTR_GSTORE: {
-         inc_pc();
-         if(buzzvm_gstore(vm) != BUZZVM_STATE_READY) return vm->state;
-         break;
-      }
-      case BUZZVM_INSTR_PUSHT: {
-         buzzvm_pusht(vm);
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_TPUT: {
-         if(buzzvm_tput(vm) != BUZZVM_STATE_READY) return vm->state;
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_TGET: {
-         if(buzzvm_tget(vm) != BUZZVM_STATE_READY) return vm->state;
-         inc_pc();
-         break;
-      }
-      case BUZZVM_INSTR_CALLC: {
-         inc_pc();
-         if(buzzvm_callc(vm) != BUZZVM_STATE_READY) return vm->state;
-         assert_pc(vm->pc);
-         break;
-      }
-      case BUZZVM_INSTR_CALLS: {
-         inc_pc();
-         if(buzzvm_calls(vm) != BUZZVM_STATE_READY) return vm->state;
-         assert_pc(vm->pc);
-         break;
-      }
-      case BUZZVM_INSTR_PUSHF: {
-         inc_pc();
-         get_arg(float);
-         if(buzzvm_pushf(vm, arg) != BUZZVM_STATE_READY) return vm->state;
-         break;
-      }
-      case BUZZVM_INSTR_PUSHI: {
-         inc_pc();
-         get_arg(int32_t);
-         if(buzzvm_pushi(vm, arg) != BUZZVM_STATE_READY) return vm->state;
-         break;
-      }
-      case BUZZVM_INSTR_PUSHS: {
-         inc_pc();
-         get_arg(int32_t);
-         if(buzzvm_pushs(vm, arg) != BUZZVM_STATE_READY) return vm->state;
-         break;
-      }
-      case BUZZVM_INSTR_PUSHCN: {
-         inc_pc();
-         get_arg(uint32_t);
-         if(buzzvm_pushcn(vm, arg) != BUZZVM_STATE_READY) return vm->state;
-         break;
-      }
-      case BUZZVM_INSTR_PUSHCC: {
-         inc_pc();
-         get_arg(uint32_t);
-         if(buzzvm_pushcc(vm, arg) != BUZZVM_STATE_READY) return vm->state;
-         break;
-      }
-      case BUZZVM_INSTR_PUSHL: {
-         inc_pc();
-         get_arg(uint32_t);
-         if(buzzvm_pushl(vm, arg) != BUZZVM_STATE_READY) return vm->state;
-         break;
-      }
-      case BUZZVM_INSTR_LLOAD: {
-         inc_pc();
-         get_arg(uint32_t);
-         buzzvm_lload(vm, arg);
-         break;
-      }
-      case BUZZVM_INSTR_LSTORE: {
-         inc_pc();
-         get_arg(uint32_t);
-         buzzvm_lstore(vm, arg);
-         break;
-      }
-      case BUZZVM_INSTR_LREMOVE: {
-         inc_pc();
-         get_arg(uint32_t);
-         buzzvm_lremove(vm, arg);
-         break;
-      }
-      case BUZZVM_INSTR_JUMP: {
-         inc_pc();
-         get_arg(uint32_t);
-         vm->pc = arg;
-         assert_pc(vm->pc);
-         break;
-      }
-      case BUZZVM_INSTR_JUMPZ: {
-         inc_pc();
-         get_arg(uint32_t);
-         buzzvm_stack_assert(vm, 1);
-         if(buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_NIL ||
-            (buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_INT &&
-             buzzvm_stack_at(vm, 1)->i.value == 0)) {
-            vm->pc = arg;
+/****************************************/
+/****************************************/
+
+/*
+ * The decoded code comes from verified bytecode: it can't run past its
+ * end, and its jump targets are valid. Only returns and closure calls,
+ * which take their target from the stack, need to check the pc.
+ */
+#define assert_pc(IDX) if((IDX) < 0 || (IDX) >= vm->code_size) { buzzvm_seterror(vm, BUZZVM_ERROR_PC, NULL); return vm->state; }
+
+#define inc_pc() vm->oldpc = vm->pc; ++vm->pc;
+
+#define get_arg(FIELD) ins->arg.FIELD
+
+/*
+ * Dispatch is direct-threaded through computed gotos when the compiler
+ * supports them, and goes through a switch otherwise. Define
+ * BUZZVM_NO_THREADED_DISPATCH to force the switch.
+ */
+#if defined(__GNUC__) && !defined(BUZZVM_NO_THREADED_DISPATCH)
+#define BUZZVM_THREADED_DISPATCH
+#endif
+
+/*
+ * Instruction boundary: stops if the VM is not ready or the instruction
+ * budget is exhausted, collects garbage if an allocation exhausted the
+ * heap budget, and fetches the next instruction. An emergency collection
+ * that fails to free enough memory stops the VM.
+ */
+#define vm_fetch()                                                      \
+   if(vm->state != BUZZVM_STATE_READY || !left--) return vm->state;     \
+   if(vm->heap->gcpending) {                                            \
+      buzzheap_gc(vm);                                                  \
+      if(vm->state != BUZZVM_STATE_READY) return vm->state;             \
+   }                                                                    \
+   ins = vm->code + vm->pc;                                             \
+   instr = ins->op;
+
+#ifdef BUZZVM_THREADED_DISPATCH
+#define vm_dispatch() goto *vm_instrs[instr];
+#define vm_case(INSTR) vm_instr_##INSTR
+#define vm_next() { vm_fetch(); vm_dispatch(); }
+#else
+#define vm_dispatch() switch(instr)
+#define vm_case(INSTR) case BUZZVM_INSTR_##INSTR
+#define vm_next() continue
+#endif
+
+/*
+ * Executes instructions until the VM is no longer ready, max
+ * instructions have been executed, or a return brings the stack
+ * depth down to depth.
+ * @param vm The VM data.
+ * @param max The maximum number of instructions, or 0 for no limit.
+ * @param depth The stack depth at which to stop, or 0 to ignore it.
+ * @return The updated VM state.
+ */
+static buzzvm_state buzzvm_interpret(buzzvm_t vm,
+                                     uint32_t max,
+                                     uint32_t depth) {
+#ifdef BUZZVM_THREADED_DISPATCH
+   static const void* vm_instrs[BUZZVM_INSTR_COUNT] = {
+      [BUZZVM_INSTR_NOP] = &&vm_instr_NOP,
+      [BUZZVM_INSTR_DONE] = &&vm_instr_DONE,
+      [BUZZVM_INSTR_PUSHNIL] = &&vm_instr_PUSHNIL,
+      [BUZZVM_INSTR_DUP] = &&vm_instr_DUP,
+      [BUZZVM_INSTR_POP] = &&vm_instr_POP,
+      [BUZZVM_INSTR_RET0] = &&vm_instr_RET0,
+      [BUZZVM_INSTR_RET1] = &&vm_instr_RET1,
+      [BUZZVM_INSTR_ADD] = &&vm_instr_ADD,
+      [BUZZVM_INSTR_SUB] = &&vm_instr_SUB,
+      [BUZZVM_INSTR_MUL] = &&vm_instr_MUL,
+      [BUZZVM_INSTR_DIV] = &&vm_instr_DIV,
+      [BUZZVM_INSTR_MOD] = &&vm_instr_MOD,
+      [BUZZVM_INSTR_POW] = &&vm_instr_POW,
+      [BUZZVM_INSTR_UNM] = &&vm_instr_UNM,
+      [BUZZVM_INSTR_LAND] = &&vm_instr_LAND,
+      [BUZZVM_INSTR_LOR] = &&vm_instr_LOR,
+      [BUZZVM_INSTR_LNOT] = &&vm_instr_LNOT,
+      [BUZZVM_INSTR_BAND] = &&vm_instr_BAND,
+      [BUZZVM_INSTR_BOR] = &&vm_instr_BOR,
+      [BUZZVM_INSTR_BNOT] = &&vm_instr_BNOT,
+      [BUZZVM_INSTR_LSHIFT] = &&vm_instr_LSHIFT,
+      [BUZZVM_INSTR_RSHIFT] = &&vm_instr_RSHIFT,
+      [BUZZVM_INSTR_EQ] = &&vm_instr_EQ,
+      [BUZZVM_INSTR_NEQ] = &&vm_instr_NEQ,
+      [BUZZVM_INSTR_GT] = &&vm_instr_GT,
+      [BUZZVM_INSTR_GTE] = &&vm_instr_GTE,
+      [BUZZVM_INSTR_LT] = &&vm_instr_LT,
+      [BUZZVM_INSTR_LTE] = &&vm_instr_LTE,
+      [BUZZVM_INSTR_GLOAD] = &&vm_instr_GLOAD,
+      [BUZZVM_INSTR_GSTORE] = &&vm_instr_GSTORE,
+      [BUZZVM_INSTR_PUSHT] = &&vm_instr_PUSHT,
+      [BUZZVM_INSTR_TPUT] = &&vm_instr_TPUT,
+      [BUZZVM_INSTR_TGET] = &&vm_instr_TGET,
+      [BUZZVM_INSTR_CALLC] = &&vm_instr_CALLC,
+      [BUZZVM_INSTR_CALLS] = &&vm_instr_CALLS,
+      [BUZZVM_INSTR_PUSHF] = &&vm_instr_PUSHF,
+      [BUZZVM_INSTR_PUSHI] = &&vm_instr_PUSHI,
+      [BUZZVM_INSTR_PUSHS] = &&vm_instr_PUSHS,
+      [BUZZVM_INSTR_PUSHCN] = &&vm_instr_PUSHCN,
+      [BUZZVM_INSTR_PUSHCC] = &&vm_instr_PUSHCC,
+      [BUZZVM_INSTR_PUSHL] = &&vm_instr_PUSHL,
+      [BUZZVM_INSTR_LLOAD] = &&vm_instr_LLOAD,
+      [BUZZVM_INSTR_LSTORE] = &&vm_instr_LSTORE,
+      [BUZZVM_INSTR_LREMOVE] = &&vm_instr_LREMOVE,
+      [BUZZVM_INSTR_ULOAD] = &&vm_instr_ULOAD,
+      [BUZZVM_INSTR_USTORE] = &&vm_instr_USTORE,
+      [BUZZVM_INSTR_UCAPL] = &&vm_instr_UCAPL,
+      [BUZZVM_INSTR_UCAPU] = &&vm_instr_UCAPU,
+      [BUZZVM_INSTR_GSTORES] = &&vm_instr_GSTORES,
+      [BUZZVM_INSTR_JUMP] = &&vm_instr_JUMP,
+      [BUZZVM_INSTR_JUMPZ] = &&vm_instr_JUMPZ,
+      [BUZZVM_INSTR_JUMPNZ] = &&vm_instr_JUMPNZ,
+      [BUZZVM_INSTR_GLOADS] = &&vm_instr_GLOADS,
+      [BUZZVM_INSTR_TGETS] = &&vm_instr_TGETS,
+      [BUZZVM_INSTR_ADDI] = &&vm_instr_ADDI,
+      [BUZZVM_INSTR_CALLCI] = &&vm_instr_CALLCI
+   };
+#endif
+   uint64_t left = max ? max : UINT64_MAX;
+   const buzzvm_code_t* ins;
+   uint32_t instr;
+   while(1) {
+      vm_fetch();
+      vm_dispatch() {
+         vm_case(NOP): {
+            inc_pc();
+            vm_next();
+         }
+         vm_case(DONE): {
+            buzzvm_done(vm);
+            vm_next();
+         }
+         vm_case(PUSHNIL): {
+            inc_pc();
+            buzzvm_pushnil(vm);
+            vm_next();
+         }
+         vm_case(DUP): {
+            inc_pc();
+            buzzvm_dup(vm);
+            vm_next();
+         }
+         vm_case(POP): {
+            if(buzzvm_pop(vm) != BUZZVM_STATE_READY) return vm->state;
+            inc_pc();
+            vm_next();
+         }
+         vm_case(RET0): {
+            if(buzzvm_ret0(vm) != BUZZVM_STATE_READY) return vm->state;
             assert_pc(vm->pc);
+            if(buzzvm_stack_depth(vm) <= depth) return vm->state;
+            vm_next();
          }
-         buzzvm_pop(vm);
-         break;
-      }
-      case BUZZVM_INSTR_JUMPNZ: {
-         inc_pc();
-         get_arg(uint32_t);
-         buzzvm_stack_assert(vm, 1);
-         if(buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_NIL &&
-            (buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_INT ||
-             buzzvm_stack_at(vm, 1)->i.value != 0)) {
+         vm_case(RET1): {
+            if(buzzvm_ret1(vm) != BUZZVM_STATE_READY) return vm->state;
+            assert_pc(vm->pc);
+            if(buzzvm_stack_depth(vm) <= depth) return vm->state;
+            vm_next();
+         }
+         vm_case(ADD): {
+            buzzvm_add(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(SUB): {
+            buzzvm_sub(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(MUL): {
+            buzzvm_mul(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(DIV): {
+            buzzvm_div(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(MOD): {
+            buzzvm_mod(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(POW): {
+            buzzvm_pow(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(UNM): {
+            buzzvm_unm(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(LAND): {
+            buzzvm_land(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(LOR): {
+            buzzvm_lor(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(LNOT): {
+            buzzvm_lnot(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(BAND): {
+            buzzvm_band(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(BOR): {
+            buzzvm_bor(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(BNOT): {
+            buzzvm_bnot(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(LSHIFT): {
+            buzzvm_lshift(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(RSHIFT): {
+            buzzvm_rshift(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(EQ): {
+            buzzvm_eq(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(NEQ): {
+            buzzvm_neq(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(GT): {
+            buzzvm_gt(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(GTE): {
+            buzzvm_gte(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(LT): {
+            buzzvm_lt(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(LTE): {
+            buzzvm_lte(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(GLOAD): {
+            inc_pc();
+            buzzvm_gload(vm);
+            vm_next();
+         }
+         vm_case(GSTORE): {
+            inc_pc();
+            if(buzzvm_gstore(vm) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(PUSHT): {
+            buzzvm_pusht(vm);
+            inc_pc();
+            vm_next();
+         }
+         vm_case(TPUT): {
+            if(buzzvm_tput(vm) != BUZZVM_STATE_READY) return vm->state;
+            inc_pc();
+            vm_next();
+         }
+         vm_case(TGET): {
+            if(buzzvm_tget(vm) != BUZZVM_STATE_READY) return vm->state;
+            inc_pc();
+            vm_next();
+         }
+         vm_case(CALLC): {
+            inc_pc();
+            if(buzzvm_callc(vm) != BUZZVM_STATE_READY) return vm->state;
+            assert_pc(vm->pc);
+            vm_next();
+         }
+         vm_case(CALLS): {
+            inc_pc();
+            if(buzzvm_calls(vm) != BUZZVM_STATE_READY) return vm->state;
+            assert_pc(vm->pc);
+            vm_next();
+         }
+         vm_case(PUSHF): {
+            inc_pc();
+            float arg = get_arg(f);
+            if(buzzvm_pushf(vm, arg) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(PUSHI): {
+            inc_pc();
+            int32_t arg = get_arg(i);
+            if(buzzvm_pushi(vm, arg) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(PUSHS): {
+            inc_pc();
+            int32_t arg = get_arg(i);
+            if(buzzvm_pushs(vm, arg) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(PUSHCN): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            if(buzzvm_pushcn(vm, arg) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(PUSHCC): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            if(buzzvm_pushcc(vm, arg) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(PUSHL): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            if(buzzvm_pushl(vm, arg) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(LLOAD): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_lload(vm, arg);
+            vm_next();
+         }
+         vm_case(LSTORE): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_lstore(vm, arg);
+            vm_next();
+         }
+         vm_case(LREMOVE): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_lremove(vm, arg);
+            vm_next();
+         }
+         vm_case(ULOAD): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_uload(vm, arg);
+            vm_next();
+         }
+         vm_case(USTORE): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_ustore(vm, arg);
+            vm_next();
+         }
+         vm_case(UCAPL): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_capture(vm, arg, 1);
+            vm_next();
+         }
+         vm_case(UCAPU): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_capture(vm, arg, 0);
+            vm_next();
+         }
+         vm_case(GSTORES): {
+            inc_pc();
+            /* The argument was turned into a slot at load time */
+            if(buzzvm_gstore_slot(vm, get_arg(u)) != BUZZVM_STATE_READY) return vm->state;
+            vm_next();
+         }
+         vm_case(JUMP): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
             vm->pc = arg;
+            vm_next();
+         }
+         vm_case(JUMPZ): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_stack_assert(vm, 1);
+            if(buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_NIL ||
+               (buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_INT &&
+                buzzvm_stack_at(vm, 1)->i.value == 0)) {
+               vm->pc = arg;
+            }
+            buzzvm_pop(vm);
+            vm_next();
+         }
+         vm_case(JUMPNZ): {
+            inc_pc();
+            uint32_t arg = get_arg(u);
+            buzzvm_stack_assert(vm, 1);
+            if(buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_NIL &&
+               (buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_INT ||
+                buzzvm_stack_at(vm, 1)->i.value != 0)) {
+               vm->pc = arg;
+            }
+            buzzvm_pop(vm);
+            vm_next();
+         }
+         vm_case(GLOADS): {
+            inc_pc();
+            /* The argument was turned into a slot at load time */
+            buzzvm_push(vm, buzzdarray_get(vm->gslots, get_arg(u), buzzobj_t));
+            vm_next();
+         }
+         vm_case(TGETS): {
+            inc_pc();
+            buzzvm_stack_assert(vm, 1);
+            buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+            /* The argument was turned into an inline cache at load time */
+            buzzvm_tcache_t* c = vm->tcache + get_arg(u);
+            buzzobj_t t = buzzvm_stack_at(vm, 1);
+            const buzzobj_t* v;
+            if(c->table == t && c->shape && c->shape == t->t.shape) {
+               /* Cache hit, the key is where it was */
+               v = c->value;
+            }
+            else {
+               /*
+                * Look the key up without making a string object. String
+                * keys are always in the hash part of the table, and are
+                * compared by id only, so the characters are not needed.
+                */
+               union buzzobj_u key;
+               key.s.type = BUZZTYPE_STRING;
+               key.s.marker = 0;
+               key.s.value.sid = c->sid;
+               key.s.value.str = NULL;
+               buzzobj_t k = &key;
+               v = buzzdict_get(t->t.value, &k, buzzobj_t);
+               /* Give the table a shape, if needed, and fill the cache */
+               if(!t->t.shape) {
+                  if(!++vm->shapes) ++vm->shapes;
+                  t->t.shape = vm->shapes;
+               }
+               c->table = t;
+               c->shape = t->t.shape;
+               c->value = v;
+            }
+            buzzvm_pop(vm);
+            if(v) buzzvm_push(vm, *v);
+            else buzzvm_pushnil(vm);
+            vm_next();
+         }
+         vm_case(ADDI): {
+            inc_pc();
+            if(buzzvm_stack_top(vm) > 0 &&
+               buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_INT) {
+               int32_t x = buzzvm_stack_at(vm, 1)->i.value + get_arg(i);
+               buzzvm_pop(vm);
+               buzzvm_push(vm, buzzheap_newint(vm, x));
+            }
+            else {
+               if(buzzvm_pushi(vm, get_arg(i)) != BUZZVM_STATE_READY) return vm->state;
+               buzzvm_add(vm);
+            }
+            vm_next();
+         }
+         vm_case(CALLCI): {
+            inc_pc();
+            if(buzzvm_pushi(vm, get_arg(i)) != BUZZVM_STATE_READY) return vm->state;
+            if(buzzvm_callc(vm) != BUZZVM_STATE_READY) return vm->state;
             assert_pc(vm->pc);
+            vm_next();
          }
-         buzzvm_pop(vm);
-         break;
+#ifndef BUZZVM_THREADED_DISPATCH
+         default:
+            buzzvm_seterror(vm, BUZZVM_ERROR_INSTR, NULL);
+            vm_next();
+#endif
       }
-      default:
-         buzzvm_seterror(vm, BUZZVM_ERROR_INSTR, NULL);
-         break;
    }
-   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_step(buzzvm_t vm) {
+   return buzzvm_interpret(vm, 1, 0);
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_run(buzzvm_t vm,
+                        uint32_t max_instructions) {
+   return buzzvm_interpret(vm, max_instructions, 0);
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_run_to_depth(buzzvm_t vm,
+                                 uint32_t depth) {
+   return buzzvm_interpret(vm, 0, depth);
 }
 
 /****************************************/
 /****************************************/
 
 buzzvm_state buzzvm_execute_script(buzzvm_t vm) {
-   while(buzzvm_step(vm) == BUZZVM_STATE_READY);
-   return vm->state;
+   return buzzvm_run(vm, 0);
 }
 
 /****************************************/
@@ -1006,19 +1507,19 @@ buzzvm_state buzzvm_execute_script(buzzvm_t vm) {
 buzzvm_state buzzvm_closure_call(buzzvm_t vm,
                                  uint32_t argc) {
    /* Insert the self table right before the closure */
-   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_NIL);
+   buzzobj_t o = buzzheap_newnil(vm);
    buzzdarray_insert(vm->stack,
                      buzzdarray_size(vm->stack) - argc - 1,
                      &o);
    /* Push the argument count */
    buzzvm_pushi(vm, argc);
    /* Save the current stack depth */
-   uint32_t stacks = buzzdarray_size(vm->stacks);
-   /* Call the closure and keep stepping until
-    * the stack count is back to the saved value */
-   buzzvm_callc(vm);
-   do if(buzzvm_step(vm) != BUZZVM_STATE_READY) return vm->state;
-   while(stacks < buzzdarray_size(vm->stacks));
+   uint32_t depth = buzzvm_stack_depth(vm);
+   /* Call the closure and keep running until
+    * the stack depth is back to the saved value */
+   if(buzzvm_callc(vm) != BUZZVM_STATE_READY) return vm->state;
+   if(depth < buzzvm_stack_depth(vm))
+      buzzvm_run_to_depth(vm, depth);
    return vm->state;
 }
 
@@ -1096,38 +1597,47 @@ buzzvm_state buzzvm_call(buzzvm_t vm, int isswrm) {
    int32_t argn = buzzvm_stack_at(vm, 1)->i.value;
    buzzvm_pop(vm);
    /* Make sure the stack has enough elements */
-   buzzvm_stack_assert(vm, argn+1);
+   buzzvm_stack_assert(vm, argn+2);
    /* Make sure the closure is where expected */
    buzzvm_type_assert(vm, argn+1, BUZZTYPE_CLOSURE);
    buzzobj_t c = buzzvm_stack_at(vm, argn+1);
+   /*
+    * Self is bound at call time: it is the table the closure was
+    * fetched from, if any, or the self the closure was created with
+    */
+   buzzobj_t self = buzzvm_stack_at(vm, argn+2);
+   if(self->o.type != BUZZTYPE_TABLE)
+      self = buzzdarray_get(c->c.value.actrec, 0, buzzobj_t);
    /* Make sure that that data about C closures is correct */
    if((!c->c.value.isnative) &&
       ((c->c.value.ref) >= buzzdarray_size(vm->flist))) {
       buzzvm_seterror(vm, BUZZVM_ERROR_FLIST, NULL);
       return vm->state;
    }
-   /* Create a new local symbol list copying the parent's */
-   vm->lsyms =
-      buzzvm_lsyms_new(isswrm,
-                       buzzdarray_clone(c->c.value.actrec));
-   buzzdarray_push(vm->lsymts, &(vm->lsyms));
+   /* Push a new call frame; no allocation happens unless the
+    * shared arrays must grow */
+   buzzvm_frame_t* f =
+      (buzzvm_frame_t*)buzzdarray_makeslot(vm->frames,
+                                           buzzdarray_size(vm->frames));
+   f->lsymbase = buzzdarray_size(vm->lsyms);
+   f->retpc = vm->pc;
+   f->closure = c;
+   f->isswarm = isswrm;
+   /* The first local symbol is self; captured variables stay in the closure */
+   buzzdarray_push(vm->lsyms, &self);
    /* Add function arguments to the local symbols */
    int32_t i;
    for(i = argn; i > 0; --i)
-      buzzdarray_push(vm->lsyms->syms,
+      buzzdarray_push(vm->lsyms,
                       &buzzdarray_get(vm->stack,
                                       buzzdarray_size(vm->stack) - i,
                                       buzzobj_t));
-   /* Get rid of the function arguments */
-   for(i = argn+1; i > 0; --i)
-      buzzdarray_pop(vm->stack);
-   /* Pop unused self table */
-   buzzdarray_pop(vm->stack);
-   /* Push return address */
-   buzzvm_pushi((vm), vm->pc);
-   /* Make a new stack for the function */
-   vm->stack = buzzdarray_new(1, sizeof(buzzobj_t), NULL);
-   buzzdarray_push(vm->stacks, &(vm->stack));
+   /* Get rid of the function arguments, the closure, and the self table */
+   buzzdarray_truncate(vm->stack, buzzdarray_size(vm->stack) - argn - 2);
+   /* The stack of the function starts here */
+   f->stackbase = buzzdarray_size(vm->stack);
+   vm->stackbase = f->stackbase;
+   vm->lsymbase = f->lsymbase;
    /* Jump to/execute the function */
    if(c->c.value.isnative) {
       vm->oldpc = vm->pc;
@@ -1143,7 +1653,7 @@ buzzvm_state buzzvm_call(buzzvm_t vm, int isswrm) {
 /****************************************/
 
 buzzvm_state buzzvm_pop(buzzvm_t vm) {
-   if(buzzdarray_isempty(vm->stack)) {
+   if(buzzvm_stack_top(vm) == 0) {
       buzzvm_seterror(vm, BUZZVM_ERROR_STACK, "empty stack");
       return vm->state;
    }
@@ -1157,7 +1667,7 @@ buzzvm_state buzzvm_pop(buzzvm_t vm) {
 /****************************************/
 
 buzzvm_state buzzvm_dup(buzzvm_t vm) {
-   if(buzzdarray_isempty(vm->stack)) {
+   if(buzzvm_stack_top(vm) == 0) {
       buzzvm_seterror(vm, BUZZVM_ERROR_STACK, "empty stack");
       return vm->state;
    }
@@ -1190,9 +1700,7 @@ buzzvm_state buzzvm_pushu(buzzvm_t vm, void* v) {
 /****************************************/
 
 buzzvm_state buzzvm_pushnil(buzzvm_t vm) {
-   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_NIL);
-   buzzvm_push(vm, o);
-   return vm->state;
+   return buzzvm_push(vm, buzzheap_newnil(vm));
 }
 
 /****************************************/
@@ -1202,7 +1710,7 @@ buzzvm_state buzzvm_pushc(buzzvm_t vm, int32_t rfrnc, int32_t nat) {
    buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_CLOSURE);
    o->c.value.isnative = nat;
    o->c.value.ref = rfrnc;
-   buzzobj_t nil = buzzheap_newobj(vm, BUZZTYPE_NIL);
+   buzzobj_t nil = buzzheap_newnil(vm);
    buzzdarray_push(o->c.value.actrec, &nil);
    buzzvm_push(vm, o);
    return vm->state;
@@ -1212,30 +1720,24 @@ buzzvm_state buzzvm_pushc(buzzvm_t vm, int32_t rfrnc, int32_t nat) {
 /****************************************/
 
 buzzvm_state buzzvm_pushi(buzzvm_t vm, int32_t v) {
-   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
-   o->i.value = v;
-   buzzvm_push(vm, o);
-   return vm->state;
+   return buzzvm_push(vm, buzzheap_newint(vm, v));
 }
 
 /****************************************/
 /****************************************/
 
 buzzvm_state buzzvm_pushf(buzzvm_t vm, float v) {
-   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_FLOAT);
-   o->f.value = v;
-   buzzvm_push(vm, o);
-   return vm->state;
+   return buzzvm_push(vm, buzzheap_newfloat(vm, v));
 }
 
 /****************************************/
 /****************************************/
 
-buzzvm_state buzzvm_pushs(buzzvm_t vm, uint16_t strid) {
+buzzvm_state buzzvm_pushs(buzzvm_t vm, uint32_t strid) {
    if(!buzzstrman_get(vm->strings, strid)) {
       buzzvm_seterror(vm,
                       BUZZVM_ERROR_STRING,
-                      "id read = %" PRIu16,
+                      "id read = %" PRIu32,
                       strid);
       return vm->state;
    }
@@ -1253,15 +1755,15 @@ buzzvm_state buzzvm_pushl(buzzvm_t vm, int32_t addr) {
    buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_CLOSURE);
    o->c.value.isnative = 1;
    o->c.value.ref = addr;
-   if(vm->lsyms) {
-      int i;
-      for(i = 0; i < buzzdarray_size(vm->lsyms->syms); ++i)
-         buzzdarray_push(o->c.value.actrec,
-                         &buzzdarray_get(vm->lsyms->syms,
-                                         i, buzzobj_t));
+   /* A lambda shares self with the function that creates it; the
+    * captured variables are added by the ucapl/ucapu instructions
+    * that follow */
+   if(!buzzdarray_isempty(vm->frames)) {
+      buzzobj_t self = buzzvm_lsym_at(vm, 0);
+      buzzdarray_push(o->c.value.actrec, &self);
    }
    else {
-      buzzobj_t nil = buzzheap_newobj(vm, BUZZTYPE_NIL);
+      buzzobj_t nil = buzzheap_newnil(vm);
       buzzdarray_push(o->c.value.actrec,
                       &nil);
    }
@@ -1286,26 +1788,12 @@ buzzvm_state buzzvm_tput(buzzvm_t vm) {
       buzzvm_seterror(vm, BUZZVM_ERROR_TYPE, "a %s value can't be used as table key", buzztype_desc[k->o.type]);
       return vm->state;
    }
-   if(v->o.type == BUZZTYPE_NIL) {
-      /* Nil, erase entry */
-      buzzdict_remove(t->t.value, &k);
-   }
-   else if(v->o.type == BUZZTYPE_CLOSURE) {
-      /* Method call */
-      int i;
-      buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_CLOSURE);
-      o->c.value.isnative = v->c.value.isnative;
-      o->c.value.ref = v->c.value.ref;
-      buzzdarray_push(o->c.value.actrec, &t);
-      for(i = 1; i < buzzdarray_size(v->c.value.actrec); ++i)
-         buzzdarray_push(o->c.value.actrec,
-                         &buzzdarray_get(v->c.value.actrec,
-                                         i, buzzobj_t));
-      buzzdict_set(t->t.value, &k, &o);
-   }
-   else {
-      buzzdict_set(t->t.value, &k, &v);
-   }
+   /*
+    * Closures are stored as they are; self is bound when they are
+    * called through the table (see buzzvm_call()). Setting nil erases
+    * the entry.
+    */
+   buzztable_put(vm, t, k, v);
    return BUZZVM_STATE_READY;
 }
 
@@ -1325,7 +1813,7 @@ buzzvm_state buzzvm_tget(buzzvm_t vm) {
       buzzvm_seterror(vm, BUZZVM_ERROR_TYPE, "a %s value can't be used as table key", k->o.type);
       return vm->state;
    }
-   const buzzobj_t* v = buzzdict_get(t->t.value, &k, buzzobj_t);
+   const buzzobj_t* v = buzztable_get(t, k);
    if(v) buzzvm_push(vm, *v);
    else buzzvm_pushnil(vm);
    return BUZZVM_STATE_READY;
@@ -1339,9 +1827,9 @@ buzzvm_state buzzvm_gload(buzzvm_t vm) {
    buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
    buzzobj_t str = buzzvm_stack_at(vm, 1);
    buzzvm_pop(vm);
-   const buzzobj_t* o = buzzdict_get(vm->gsyms, &(str->s.value.sid), buzzobj_t);
-   if(!o) { buzzvm_pushnil(vm); }
-   else { buzzvm_push(vm, (*o)); }
+   const uint32_t* slot = buzzdict_get(vm->gsyms, &(str->s.value.sid), uint32_t);
+   if(!slot) { buzzvm_pushnil(vm); }
+   else { buzzvm_push(vm, buzzdarray_get(vm->gslots, *slot, buzzobj_t)); }
    return BUZZVM_STATE_READY;
 }
 
@@ -1351,40 +1839,131 @@ buzzvm_state buzzvm_gload(buzzvm_t vm) {
 buzzvm_state buzzvm_gstore(buzzvm_t vm) {
    buzzvm_stack_assert((vm), 2);
    buzzvm_type_assert((vm), 2, BUZZTYPE_STRING);
-   buzzobj_t str = buzzvm_stack_at((vm), 2);
+   uint32_t slot = buzzvm_gslot_sid(vm, buzzvm_stack_at((vm), 2)->s.value.sid);
    buzzobj_t o = buzzvm_stack_at((vm), 1);
    buzzvm_pop(vm);
    buzzvm_pop(vm);
-   buzzdict_set((vm)->gsyms, &(str->s.value.sid), &o);
+   buzzheap_wb_root(vm, BUZZHEAP_ROOT_GSYMS, o);
+   buzzdarray_set(vm->gslots, slot, &o);
    return BUZZVM_STATE_READY;
 }
 
 /****************************************/
 /****************************************/
 
-buzzvm_state buzzvm_ret0(buzzvm_t vm) {
+uint32_t buzzvm_global_slot(buzzvm_t vm,
+                            const char* name) {
+   return buzzvm_gslot_sid(vm, buzzvm_string_register(vm, name, 1));
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_gload_slot(buzzvm_t vm,
+                               uint32_t slot) {
+   buzzvm_push(vm, buzzdarray_get(vm->gslots, slot, buzzobj_t));
+   return BUZZVM_STATE_READY;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_gstore_slot(buzzvm_t vm,
+                                uint32_t slot) {
+   buzzvm_stack_assert(vm, 1);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   buzzheap_wb_root(vm, BUZZHEAP_ROOT_GSYMS, o);
+   buzzdarray_set(vm->gslots, slot, &o);
+   return BUZZVM_STATE_READY;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the open upvalue for the local symbol at the given
+ * position, creating it if necessary.
+ * @param vm The VM data.
+ * @param slot The position in the local symbols.
+ */
+static buzzobj_t buzzvm_upval_open(buzzvm_t vm, int64_t slot) {
+   /* The open upvalues are sorted by slot, the most recent ones are last */
+   int64_t i = buzzdarray_size(vm->upvals) - 1;
+   while(i >= 0 && buzzdarray_get(vm->upvals, i, buzzobj_t)->v.value.slot > slot) --i;
+   if(i >= 0 && buzzdarray_get(vm->upvals, i, buzzobj_t)->v.value.slot == slot)
+      return buzzdarray_get(vm->upvals, i, buzzobj_t);
+   /* Make a new upvalue */
+   buzzobj_t u = buzzheap_newobj(vm, BUZZTYPE_UPVALUE);
+   u->v.value.slot = slot;
+   u->v.value.data = NULL;
+   buzzdarray_insert(vm->upvals, i + 1, &u);
+   return u;
+}
+
+/*
+ * Closes the open upvalues for the local symbols at the given
+ * position and beyond. Must be called before those local symbols
+ * are removed.
+ * @param vm The VM data.
+ * @param from The position in the local symbols.
+ */
+static void buzzvm_upvals_close(buzzvm_t vm, int64_t from) {
+   while(!buzzdarray_isempty(vm->upvals)) {
+      buzzobj_t u = buzzdarray_last(vm->upvals, buzzobj_t);
+      if(u->v.value.slot < from) return;
+      u->v.value.data = buzzdarray_get(vm->lsyms, u->v.value.slot, buzzobj_t);
+      u->v.value.slot = -1;
+      buzzheap_wb(vm, u, u->v.value.data);
+      buzzdarray_truncate(vm->upvals, buzzdarray_size(vm->upvals) - 1);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Pops the current call frame, discarding its stack elements and
+ * local symbols, and jumps to its return address.
+ * @param vm The VM data.
+ * @return The updated VM state.
+ */
+static buzzvm_state buzzvm_frame_pop(buzzvm_t vm) {
+   /* Make sure there's a frame to return from */
+   if(buzzdarray_isempty(vm->frames)) {
+      buzzvm_seterror(vm, BUZZVM_ERROR_STACK, "return outside of a closure");
+      return vm->state;
+   }
+   buzzvm_frame_t f = buzzdarray_last(vm->frames, buzzvm_frame_t);
    /* Pop swarm stack */
-   if(vm->lsyms->isswarm)
+   if(f.isswarm)
       buzzdarray_pop(vm->swarmstack);
-   /* Pop local symbol table */
-   buzzdarray_pop(vm->lsymts);
-   /* Set local symbol table pointer */
-   vm->lsyms = !buzzdarray_isempty(vm->lsymts) ?
-      buzzdarray_last(vm->lsymts, buzzvm_lsyms_t) :
-      NULL;
-   /* Pop stack */
-   buzzdarray_pop(vm->stacks);
-   /* Set stack pointer */
-   vm->stack = buzzdarray_last(vm->stacks, buzzdarray_t);
-   /* Make sure the stack contains at least one element */
-   buzzvm_stack_assert(vm, 1);
-   /* Make sure that element is an integer */
-   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
-   /* Use that element as program counter */
+   /* Discard the frame data */
+   buzzvm_upvals_close(vm, f.lsymbase);
+   buzzdarray_truncate(vm->lsyms, f.lsymbase);
+   buzzdarray_truncate(vm->stack, f.stackbase);
+   buzzdarray_truncate(vm->frames, buzzdarray_size(vm->frames) - 1);
+   /* Go back to the frame beneath */
+   if(!buzzdarray_isempty(vm->frames)) {
+      vm->stackbase = buzzdarray_last(vm->frames, buzzvm_frame_t).stackbase;
+      vm->lsymbase = buzzdarray_last(vm->frames, buzzvm_frame_t).lsymbase;
+   }
+   else {
+      vm->stackbase = 0;
+      vm->lsymbase = 0;
+   }
+   /* Use the return address as program counter */
    vm->oldpc = vm->pc;
-   vm->pc = buzzvm_stack_at(vm, 1)->i.value;
-   /* Pop the return address */
-   buzzvm_pop(vm);
+   vm->pc = f.retpc;
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_ret0(buzzvm_t vm) {
+   /* Pop the call frame */
+   if(buzzvm_frame_pop(vm) != BUZZVM_STATE_READY) return vm->state;
    /* Push nil as the return value */
    return buzzvm_pushnil(vm);
 }
@@ -1393,32 +1972,12 @@ buzzvm_state buzzvm_ret0(buzzvm_t vm) {
 /****************************************/
 
 buzzvm_state buzzvm_ret1(buzzvm_t vm) {
-   /* Pop swarm stack */
-   if(vm->lsyms->isswarm)
-      buzzdarray_pop(vm->swarmstack);
-   /* Pop local symbol table */
-   buzzdarray_pop(vm->lsymts);
-   /* Set local symbol table pointer */
-   vm->lsyms = !buzzdarray_isempty(vm->lsymts) ?
-      buzzdarray_last(vm->lsymts, buzzvm_lsyms_t) :
-      NULL;
    /* Make sure there's an element on the stack */
    buzzvm_stack_assert(vm, 1);
-   /* Save it, it's the return value to pass to the lower stack */
+   /* Save it, it's the return value to pass to the frame beneath */
    buzzobj_t ret = buzzvm_stack_at(vm, 1);
-   /* Pop stack */
-   buzzdarray_pop(vm->stacks);
-   /* Set stack pointer */
-   vm->stack = buzzdarray_last(vm->stacks, buzzdarray_t);
-   /* Make sure the stack contains at least one element */
-   buzzvm_stack_assert(vm, 1);
-   /* Make sure that element is an integer */
-   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
-   /* Use that element as program counter */
-   vm->oldpc = vm->pc;
-   vm->pc = buzzvm_stack_at(vm, 1)->i.value;
-   /* Pop the return address */
-   buzzvm_pop(vm);
+   /* Pop the call frame */
+   if(buzzvm_frame_pop(vm) != BUZZVM_STATE_READY) return vm->state;
    /* Push the return value */
    return buzzvm_push(vm, ret);
 }
@@ -1462,31 +2021,27 @@ buzzvm_state buzzvm_mod(buzzvm_t vm) {
    buzzdarray_pop(vm->stack);
    if(op1->o.type == BUZZTYPE_INT &&
       op2->o.type == BUZZTYPE_INT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);
-      res->i.value = op2->i.value % op1->i.value;
-      if(res->i.value < 0) res->i.value += op1->i.value;
-      return buzzvm_push(vm, res);
+      int32_t res = op2->i.value % op1->i.value;
+      if(res < 0) res += op1->i.value;
+      return buzzvm_push(vm, buzzheap_newint(vm, res));
    }
    else if(op1->o.type == BUZZTYPE_FLOAT &&
            op2->o.type == BUZZTYPE_FLOAT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = fmodf(op2->f.value, op1->f.value);
-      if(res->f.value < 0.) res->f.value += op1->f.value;
-      return buzzvm_push(vm, res);
+      float res = fmodf(op2->f.value, op1->f.value);
+      if(res < 0.) res += op1->f.value;
+      return buzzvm_push(vm, buzzheap_newfloat(vm, res));
    }
    else if(op1->o.type == BUZZTYPE_INT &&
            op2->o.type == BUZZTYPE_FLOAT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = fmodf(op2->f.value, op1->i.value);
-      if(res->f.value < 0.) res->f.value += op1->f.value;
-      return buzzvm_push(vm, res);
+      float res = fmodf(op2->f.value, op1->i.value);
+      if(res < 0.) res += op1->f.value;
+      return buzzvm_push(vm, buzzheap_newfloat(vm, res));
    }
    else if(op1->o.type == BUZZTYPE_FLOAT &&
            op2->o.type == BUZZTYPE_INT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = fmodf(op2->i.value, op1->f.value);
-      if(res->f.value < 0.) res->f.value += op1->i.value;
-      return buzzvm_push(vm, res);
+      float res = fmodf(op2->i.value, op1->f.value);
+      if(res < 0.) res += op1->i.value;
+      return buzzvm_push(vm, buzzheap_newfloat(vm, res));
    }
    else {
       (vm)->state = BUZZVM_STATE_ERROR;
@@ -1506,27 +2061,19 @@ buzzvm_state buzzvm_pow(buzzvm_t vm) {
    buzzdarray_pop(vm->stack);
    if(op1->o.type == BUZZTYPE_INT &&
       op2->o.type == BUZZTYPE_INT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = powf(op2->i.value, op1->i.value);
-      return buzzvm_push(vm, res);
+      return buzzvm_push(vm, buzzheap_newfloat(vm, powf(op2->i.value, op1->i.value)));
    }
    else if(op1->o.type == BUZZTYPE_FLOAT &&
            op2->o.type == BUZZTYPE_FLOAT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = powf(op2->f.value, op1->f.value);
-      return buzzvm_push(vm, res);
+      return buzzvm_push(vm, buzzheap_newfloat(vm, powf(op2->f.value, op1->f.value)));
    }
    else if(op1->o.type == BUZZTYPE_INT &&
            op2->o.type == BUZZTYPE_FLOAT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = powf(op2->f.value, op1->i.value);
-      return buzzvm_push(vm, res);
+      return buzzvm_push(vm, buzzheap_newfloat(vm, powf(op2->f.value, op1->i.value)));
    }
    else if(op1->o.type == BUZZTYPE_FLOAT &&
            op2->o.type == BUZZTYPE_INT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = powf(op2->i.value, op1->f.value);
-      return buzzvm_push(vm, res);
+      return buzzvm_push(vm, buzzheap_newfloat(vm, powf(op2->i.value, op1->f.value)));
    }
    else {
       (vm)->state = BUZZVM_STATE_ERROR;
@@ -1543,14 +2090,10 @@ buzzvm_state buzzvm_unm(buzzvm_t vm) {
    buzzobj_t op = buzzvm_stack_at(vm, 1);
    buzzdarray_pop(vm->stack);
    if(op->o.type == BUZZTYPE_INT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);
-      res->i.value = -op->i.value;
-      return buzzvm_push(vm, res);
+      return buzzvm_push(vm, buzzheap_newint(vm, -op->i.value));
    }
    else if(op->o.type == BUZZTYPE_FLOAT) {
-      buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_FLOAT);
-      res->f.value = -op->f.value;
-      return buzzvm_push(vm, res);
+      return buzzvm_push(vm, buzzheap_newfloat(vm, -op->f.value));
    }
    else {
       (vm)->state = BUZZVM_STATE_ERROR;
@@ -1580,11 +2123,10 @@ buzzvm_state buzzvm_lnot(buzzvm_t vm) {
    buzzvm_stack_assert((vm), 1);
    buzzobj_t op = buzzvm_stack_at(vm, 1);
    buzzdarray_pop(vm->stack);
-   buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);
-   res->i.value =
-      (op->o.type == BUZZTYPE_NIL ||
-       (op->i.type == BUZZTYPE_INT && op->i.value == 0));
-   return buzzvm_push(vm, res);
+   return buzzvm_push(vm,
+                      buzzheap_newint(vm,
+                                      (op->o.type == BUZZTYPE_NIL ||
+                                       (op->i.type == BUZZTYPE_INT && op->i.value == 0))));
 }
 
 /****************************************/
@@ -1609,9 +2151,7 @@ buzzvm_state buzzvm_bnot(buzzvm_t vm) {
    buzzvm_type_assert((vm), 1, BUZZTYPE_INT);
    buzzobj_t op = buzzvm_stack_at(vm, 1);
    buzzdarray_pop(vm->stack);
-   buzzobj_t res = buzzheap_newobj((vm), BUZZTYPE_INT);
-   res->i.value = ~op->i.value;
-   return buzzvm_push(vm, res);
+   return buzzvm_push(vm, buzzheap_newint(vm, ~op->i.value));
 }
 
 /****************************************/
@@ -1683,7 +2223,7 @@ buzzvm_state buzzvm_lload(buzzvm_t vm, uint32_t idx) {
       return vm->state;
    }
    /* Return the local symbol */
-   buzzvm_push(vm, buzzdarray_get(vm->lsyms->syms, idx, buzzobj_t));
+   buzzvm_push(vm, buzzvm_lsym_at(vm, idx));
    return vm->state;
 }
 
@@ -1694,18 +2234,105 @@ buzzvm_state buzzvm_lstore(buzzvm_t vm, uint32_t idx) {
    buzzvm_stack_assert((vm), 1);
    buzzobj_t o = buzzvm_stack_at(vm, 1);
    buzzvm_pop(vm);
-   buzzdarray_set((vm)->lsyms->syms, idx, &o);
+   buzzdarray_set(vm->lsyms, vm->lsymbase + idx, &o);
    return vm->state;
 }
 
 buzzvm_state buzzvm_lremove(buzzvm_t vm, uint32_t num) {
-   if(buzzvm_lnum(vm) < num)
+   /* Block variables are removed from the current frame only; at the
+      top level, there's no self symbol to skip */
+   if(buzzdarray_size(vm->lsyms) - vm->lsymbase < num) {
       buzzvm_seterror(vm,
                       BUZZVM_ERROR_LNUM,
                       "not enough local symbols in stack"
          );
-  for( uint32_t i =0 ; i < num ; i++ )
-    buzzdarray_pop((vm)->lsyms->syms);
+      return vm->state;
+   }
+   buzzvm_upvals_close(vm, buzzdarray_size(vm->lsyms) - num);
+   buzzdarray_truncate(vm->lsyms, buzzdarray_size(vm->lsyms) - num);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the upvalue at the given index in the running closure, or
+ * NULL if there's no such upvalue.
+ * @param vm The VM data.
+ * @param idx The upvalue index.
+ */
+static buzzobj_t buzzvm_upval_get(buzzvm_t vm, uint32_t idx) {
+   if(buzzdarray_isempty(vm->frames)) return NULL;
+   buzzdarray_t actrec = buzzdarray_last(vm->frames, buzzvm_frame_t).closure->c.value.actrec;
+   /* Upvalues come right after self */
+   if(idx + 1 >= buzzdarray_size(actrec)) return NULL;
+   return buzzdarray_get(actrec, idx + 1, buzzobj_t);
+}
+
+buzzvm_state buzzvm_uload(buzzvm_t vm, uint32_t idx) {
+   buzzobj_t u = buzzvm_upval_get(vm, idx);
+   if(!u) {
+      buzzvm_seterror(vm, BUZZVM_ERROR_LNUM, "upvalue %u out of range", idx);
+      return vm->state;
+   }
+   if(u->v.value.slot >= 0)
+      buzzvm_push(vm, buzzdarray_get(vm->lsyms, u->v.value.slot, buzzobj_t));
+   else
+      buzzvm_push(vm, u->v.value.data);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_ustore(buzzvm_t vm, uint32_t idx) {
+   buzzvm_stack_assert(vm, 1);
+   buzzobj_t u = buzzvm_upval_get(vm, idx);
+   if(!u) {
+      buzzvm_seterror(vm, BUZZVM_ERROR_LNUM, "upvalue %u out of range", idx);
+      return vm->state;
+   }
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   if(u->v.value.slot >= 0) {
+      /* Open upvalue, the variable is still in the local symbols */
+      buzzdarray_set(vm->lsyms, u->v.value.slot, &o);
+   }
+   else {
+      buzzheap_wb(vm, u, o);
+      u->v.value.data = o;
+   }
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_capture(buzzvm_t vm, uint32_t idx, int islocal) {
+   buzzvm_stack_assert(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+   buzzobj_t c = buzzvm_stack_at(vm, 1);
+   buzzobj_t u;
+   if(islocal) {
+      if(buzzvm_lnum(vm) < idx) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_LNUM,
+                         "not enough local symbols in stack"
+            );
+         return vm->state;
+      }
+      u = buzzvm_upval_open(vm, vm->lsymbase + idx);
+   }
+   else {
+      u = buzzvm_upval_get(vm, idx);
+      if(!u) {
+         buzzvm_seterror(vm, BUZZVM_ERROR_LNUM, "upvalue %u out of range", idx);
+         return vm->state;
+      }
+   }
+   buzzheap_wb(vm, c, u);
+   buzzdarray_push(c->c.value.actrec, &u);
    return vm->state;
 }
 
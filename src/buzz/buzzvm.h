@@ -2,6 +2,7 @@
 #define BUZZVM_H
 
 #include <buzz/buzzheap.h>
+#include <buzz/buzztable.h>
 #include <buzz/buzzstrman.h>
 #include <buzz/buzzinmsg.h>
 #include <buzz/buzzoutmsg.h>
@@ -44,7 +45,8 @@ extern "C" {
       BUZZVM_ERROR_FLIST,    // Function call id out of range
       BUZZVM_ERROR_TYPE,     // Type mismatch
       BUZZVM_ERROR_STRING,   // Unknown string id
-      BUZZVM_ERROR_SWARM     // Unknown swarm id
+      BUZZVM_ERROR_SWARM,    // Unknown swarm id
+      BUZZVM_ERROR_MEMORY    // Memory limit exceeded
    } buzzvm_error;
    extern const char *buzzvm_error_desc[];
 
@@ -107,10 +109,57 @@ extern "C" {
       BUZZVM_INSTR_JUMP,     // Set PC to argument
       BUZZVM_INSTR_JUMPZ,    // Set PC to argument if stack top is zero, pop operand
       BUZZVM_INSTR_JUMPNZ,   // Set PC to argument if stack top is not zero, pop operand
+      /* Superinstructions, emitted by the assembler for common sequences */
+      BUZZVM_INSTR_GLOADS,   // Push global variable corresponding to string constant (pushs + gload)
+      BUZZVM_INSTR_TGETS,    // Push value for string constant key in table (stack #1), pop table (pushs + tget)
+      BUZZVM_INSTR_ADDI,     // Push stack(#1) + integer constant, pop operand (pushi + add)
+      BUZZVM_INSTR_CALLCI,   // Calls the closure with the given number of arguments (pushi + callc)
+      /* New opcodes go last so that older bytecode keeps its meaning */
+      BUZZVM_INSTR_ULOAD,    // Push upvalue at given position
+      BUZZVM_INSTR_USTORE,   // Store stack-top value into upvalue at given position, pop operand
+      BUZZVM_INSTR_UCAPL,    // Capture local variable at given position into the closure at stack top
+      BUZZVM_INSTR_UCAPU,    // Capture upvalue at given position into the closure at stack top
+      BUZZVM_INSTR_GSTORES,  // Store stack-top value into global variable corresponding to string constant, pop operand
       BUZZVM_INSTR_COUNT     // Used to count how many instructions have been defined
    } buzzvm_instr;
    extern const char *buzzvm_instr_desc[];
 
+   /*
+    * A decoded instruction.
+    * The VM executes a copy of the bytecode in which every instruction
+    * has the same size and its argument is aligned. Jump targets and
+    * closure addresses are positions in the decoded code.
+    */
+   struct buzzvm_code_s {
+      /* The opcode */
+      uint32_t op;
+      /* The argument, if any */
+      union {
+         int32_t i;
+         uint32_t u;
+         float f;
+      } arg;
+   };
+   typedef struct buzzvm_code_s buzzvm_code_t;
+
+   /*
+    * An inline cache for a BUZZVM_INSTR_TGETS instruction.
+    * The cache remembers where the key was found in the last table
+    * looked up, as long as the shape of that table does not change.
+    * See buzztable.h.
+    */
+   struct buzzvm_tcache_s {
+      /* The string id of the key */
+      uint32_t sid;
+      /* The shape of the cached table, 0 if the cache is empty */
+      uint32_t shape;
+      /* The cached table */
+      union buzzobj_u* table;
+      /* Where the value is in the table, or NULL if the key is missing */
+      union buzzobj_u* const* value;
+   };
+   typedef struct buzzvm_tcache_s buzzvm_tcache_t;
+
    /*
     * Function pointer for BUZZVM_INSTR_CALL.
     * @param vm The VM data.
@@ -120,24 +169,21 @@ extern "C" {
    typedef int (*buzzvm_funp)(struct buzzvm_s* vm);
 
    /*
-    * Data for local symbols
+    * A call frame
     */
-   struct buzzvm_lsyms_s {
-      /* The symbol list */
-      buzzdarray_t syms;
-      /* 1 if this is a swarm closure, 0 if not */
+   struct buzzvm_frame_s {
+      /* Position of the first element of the frame in the value stack */
+      uint32_t stackbase;
+      /* Position of the first local symbol of the frame */
+      uint32_t lsymbase;
+      /* Return address */
+      int32_t retpc;
+      /* The closure being executed */
+      union buzzobj_u* closure;
+      /* 1 if this is a swarm closure call, 0 if not */
       uint8_t isswarm;
    };
-   typedef struct buzzvm_lsyms_s* buzzvm_lsyms_t;
-
-   /*
-    * Creates a new local symbol table.
-    * @param isswarm 0 if this is a normal symbol table, 1 if it's for a swarm closure call.
-    * @param syms A list fo symbols.
-    * @return A new local symbol table.
-    */
-   extern buzzvm_lsyms_t buzzvm_lsyms_new(uint8_t isswarm,
-                                          buzzdarray_t syms);
+   typedef struct buzzvm_frame_s buzzvm_frame_t;
 
    /*
     * VM data
@@ -147,20 +193,40 @@ extern "C" {
       const uint8_t* bcode;
       /* Size of the loaded bytecode */
       uint32_t bcode_size;
-      /* Program counter */
+      /* Whether the loaded bytecode passed verification */
+      int bcode_verified;
+      /* Decoded code */
+      buzzvm_code_t* code;
+      /* Number of decoded instructions */
+      uint32_t code_size;
+      /* Bytecode offset of each decoded instruction */
+      uint32_t* code_off;
+      /* Inline caches of the TGETS instructions */
+      buzzvm_tcache_t* tcache;
+      /* Number of inline caches */
+      uint32_t tcache_size;
+      /* The last table shape assigned */
+      uint32_t shapes;
+      /* Program counter (position in the decoded code) */
       int32_t pc;
       /* Old program counter (for error reporting) */
       int32_t oldpc;
-      /* Current stack content */
+      /* Value stack, shared by all the call frames */
       buzzdarray_t stack;
-      /* Stack list */
-      buzzdarray_t stacks;
-      /* Current local variable table */
-      buzzvm_lsyms_t lsyms;
-      /* Local variable table list */
-      buzzdarray_t lsymts;
-      /* Global symbols */
+      /* Local symbols, shared by all the call frames */
+      buzzdarray_t lsyms;
+      /* Active call frames (buzzvm_frame_t) */
+      buzzdarray_t frames;
+      /* Open upvalues, sorted by position in the local symbols */
+      buzzdarray_t upvals;
+      /* Base of the current frame in the value stack */
+      uint32_t stackbase;
+      /* Base of the current frame in the local symbols */
+      uint32_t lsymbase;
+      /* Global symbols: string id -> slot in gslots */
       buzzdict_t gsyms;
+      /* Global variable values, indexed by slot */
+      buzzdarray_t gslots;
       /* Strings */
       buzzstrman_t strings;
       /* Heap content */
@@ -179,6 +245,10 @@ extern "C" {
       buzzinmsg_queue_t inmsgs;
       /* Output message FIFO */
       buzzoutmsg_queue_t outmsgs;
+      /* Encoding of the outgoing objects (buzzmsg_enc_e flags) */
+      uint32_t msgenc;
+      /* Strings with a lower id come from the script and have the same id on every robot */
+      uint32_t sharedstrs;
       /* Virtual stigmergy maps */
       buzzdict_t vstigs;
       /* Neighbor value listeners */
@@ -195,6 +265,8 @@ extern "C" {
       int32_t* rngstate;
       /* Random number generator index */
       uint32_t rngidx;
+      /* Memory accounting */
+      buzzmem_t mem;
    };
    typedef struct buzzvm_s* buzzvm_t;
 
@@ -242,8 +314,26 @@ extern "C" {
                                const char* errmsg,
                                ...);
 
+   /*
+    * Verifies bytecode.
+    * Checks that the string table is well formed, that the opcodes are
+    * valid, that the arguments fit in the buffer, that string ids refer
+    * to the string table, that jump targets and closure addresses land
+    * on an instruction, and that execution can't run past the end of
+    * the code.
+    * @param bcode The bytecode buffer.
+    * @param bcode_size The size (in bytes) of the bytecode.
+    * @param off Set to the offset of the first invalid item.
+    * @return BUZZVM_ERROR_NONE if the bytecode is valid, the error code otherwise.
+    */
+   extern buzzvm_error buzzvm_bcode_verify(const uint8_t* bcode,
+                                           uint32_t bcode_size,
+                                           uint32_t* off);
+
    /*
     * Sets the bytecode in the VM.
+    * The bytecode is verified first; invalid bytecode is rejected with
+    * an error whose message reports the offending offset.
     * The passed buffer cannot be deleted until the VM is done with it.
     * @param vm The VM data.
     * @param bcode_size The size (in bytes) of the bytecode.
@@ -254,18 +344,85 @@ extern "C" {
                                const uint8_t* bcode,
                                uint32_t bcode_size);
 
+   /*
+    * Returns the bytecode offset of a decoded instruction.
+    * The program counter and the addresses of native closures are
+    * positions in the decoded code. Use this function to turn them
+    * into bytecode offsets, e.g., to look up debugging information.
+    * If the bytecode was rejected, the program counter already is the
+    * offset of the error and is returned as is.
+    * @param vm The VM data.
+    * @param pc The position of the instruction in the decoded code.
+    * @return The bytecode offset of the instruction, or -1 if the position is invalid.
+    */
+   extern int32_t buzzvm_pc2offset(buzzvm_t vm,
+                                   int32_t pc);
+
+   /*
+    * Turns a bytecode offset into the position of the instruction in
+    * the decoded code. This is the inverse of buzzvm_pc2offset().
+    * @param vm The VM data.
+    * @param off The bytecode offset.
+    * @return The position of the instruction, or -1 if no instruction starts at the offset.
+    */
+   extern int32_t buzzvm_offset2pc(buzzvm_t vm,
+                                   int32_t off);
+
    /*
     * Processes the input message queue.
+    * At most buzzinmsg_queue_limit_set() messages are processed, if set.
+    * The messages left, if the limit is reached or the VM stops, are
+    * detached from the buffers they were appended from.
     * @param vm The VM data.
+    * @see buzzinmsg_queue_detach
     */
    extern void buzzvm_process_inmsgs(buzzvm_t vm);
 
    /*
     * Processes the output message queue.
+    * Call it once per step, before sending the messages.
     * @param vm The VM data.
+    * @see buzzoutmsg_queue_step
     */
    extern void buzzvm_process_outmsgs(buzzvm_t vm);
 
+   /*
+    * Performs garbage collection work within the given time budget.
+    * Meant to be called when the VM is idle, e.g., at the end of a
+    * control step, to advance the collection in progress and collect
+    * the garbage made during the step before the next one.
+    * @param vm The VM data.
+    * @param budget The time budget in microseconds.
+    * @return 1 if a collection is still in progress, 0 otherwise.
+    */
+   extern int buzzvm_gc_idle(buzzvm_t vm,
+                             uint32_t budget);
+
+   /*
+    * Sets the limit on the memory used by the VM.
+    * When an allocation brings the memory in use over the limit, the
+    * VM performs an emergency garbage collection at the next
+    * instruction. If the memory is still over the limit afterwards,
+    * the VM enters the error state with BUZZVM_ERROR_MEMORY.
+    * @param vm The VM data.
+    * @param limit The limit in bytes, or 0 for no limit.
+    * @see buzzvm_mem_used
+    */
+   extern void buzzvm_mem_limit_set(buzzvm_t vm,
+                                    int64_t limit);
+
+   /*
+    * Sets the encoding of the objects in the outgoing messages.
+    * Incoming messages are decoded whatever their encoding. Use
+    * BUZZMSG_ENC_LEGACY while some robots run a Buzz version that only
+    * understands the legacy encoding. String references are valid only
+    * when all the robots run the same script.
+    * @param vm The VM data.
+    * @param enc The encoding, a combination of buzzmsg_enc_e flags.
+    */
+   extern void buzzvm_msgenc_set(buzzvm_t vm,
+                                 uint32_t enc);
+
    /*
     * Executes the next step in the bytecode, if possible.
     * @param vm The VM data.
@@ -273,6 +430,29 @@ extern "C" {
     */
    extern buzzvm_state buzzvm_step(buzzvm_t vm);
 
+   /*
+    * Executes a batch of instructions.
+    * Execution stops when the script is done, an error occurs, or the
+    * given number of instructions has been executed.
+    * @param vm The VM data.
+    * @param max_instructions The maximum number of instructions to execute, or 0 for no limit.
+    * @return The updated VM state.
+    */
+   extern buzzvm_state buzzvm_run(buzzvm_t vm,
+                                  uint32_t max_instructions);
+
+   /*
+    * Executes instructions until a closure call returns.
+    * Execution stops when the script is done, an error occurs, or a
+    * return brings the stack depth of the VM down to the given
+    * depth.
+    * @param vm The VM data.
+    * @param depth The stack depth before the closure was called (see buzzvm_stack_depth()).
+    * @return The updated VM state.
+    */
+   extern buzzvm_state buzzvm_run_to_depth(buzzvm_t vm,
+                                           uint32_t depth);
+
    /*
     * Executes the script up to completion.
     * @param vm The VM data.
@@ -331,10 +511,11 @@ extern "C" {
     * ...
     * #1+N Closure argN
     * #2+N The closure
-    * This function pushes a new stack and a new local variable table filled with the
-    * activation record entries and the closure arguments. In addition, it leaves the stack
-    * beneath as follows:
-    * #1 An integer for the return address
+    * #3+N The table the closure was fetched from, or nil
+    * This function pops the arguments, the closure and the table, and pushes a new
+    * call frame whose local symbols are self and the closure arguments. Self is the
+    * table at #3+N or, if that is not a table, the self the closure was created with.
+    * The return address is stored in the frame.
     * @param vm The VM data.
     * @param isswrm 0 for a normal closure, 1 for a swarm closure
     * @return The VM state.
@@ -401,7 +582,7 @@ extern "C" {
     * This function is designed to be used within int-returning functions such as
     * BuzzVM hook functions or buzzvm_step().
     * @param vm The VM data.
-    * @param rfrnc The closure reference.
+    * @param rfrnc The closure reference: the position in the decoded code for native closures, the function id otherwise.
     * @param nat 1 if the closure in native, 0 if not
     * @param v The value.
     * @return The VM state.
@@ -414,7 +595,7 @@ extern "C" {
     * @param strid The string id.
     * @return The VM state.
     */
-   extern buzzvm_state buzzvm_pushs(buzzvm_t vm, uint16_t strid);
+   extern buzzvm_state buzzvm_pushs(buzzvm_t vm, uint32_t strid);
 
    /*
     * Pushes a lambda native closure on the stack.
@@ -474,14 +655,44 @@ extern "C" {
     */
    extern buzzvm_state buzzvm_gstore(buzzvm_t vm);
 
+   /*
+    * Returns the slot of the global variable with the given name.
+    * If the variable does not exist, it is created with value nil.
+    * A slot is valid for the lifetime of the VM, so hosts can look
+    * it up once and then use buzzvm_gload_slot() and
+    * buzzvm_gstore_slot() to access the variable without lookups.
+    * @param vm The VM data.
+    * @param name The variable name.
+    * @return The slot of the variable.
+    */
+   extern uint32_t buzzvm_global_slot(buzzvm_t vm,
+                                      const char* name);
+
+   /*
+    * Pushes the global variable at the given slot.
+    * @param vm The VM data.
+    * @param slot The slot, as returned by buzzvm_global_slot().
+    */
+   extern buzzvm_state buzzvm_gload_slot(buzzvm_t vm,
+                                         uint32_t slot);
+
+   /*
+    * Stores the object located at the stack top into the global
+    * variable at the given slot, pops operand.
+    * Internally checks whether the operation is valid.
+    * @param vm The VM data.
+    * @param slot The slot, as returned by buzzvm_global_slot().
+    */
+   extern buzzvm_state buzzvm_gstore_slot(buzzvm_t vm,
+                                          uint32_t slot);
+
    /*
     * Returns from a closure without setting a return value.
     * Internally checks whether the operation is valid.
-    * This function expects at least two stacks to be present. The
-    * first stack is popped. The stack beneath, now the top stack, is
-    * expected to have at least one element: the return address at
-    * #1. The return address is popped and used to update the program
-    * counter.
+    * This function expects a call frame to be active. The frame is
+    * popped along with its stack elements and local symbols, and the
+    * program counter is set to the return address stored in the
+    * frame. Then, nil is pushed on the stack.
     * @param vm The VM data.
     * @return The VM state.
     */
@@ -490,13 +701,12 @@ extern "C" {
    /*
     * Returns from a closure setting a return value.
     * Internally checks whether the operation is valid.
-    * This function expects at least two stacks to be present. The
-    * first stack must have at least one element, which is saved as
-    * the return value of the call. The stack is then popped. The
-    * stack beneath, now the top stack, is expected to have at least
-    * one element: the return address at #1. The return address is
-    * popped and used to update the program counter. Then, the saved
-    * return value is pushed on the stack.
+    * This function expects a call frame to be active, with at least
+    * one element on its stack, which is saved as the return value of
+    * the call. The frame is then popped along with its stack elements
+    * and local symbols, and the program counter is set to the return
+    * address stored in the frame. Then, the saved return value is
+    * pushed on the stack.
     * @param vm The VM data.
     * @return The VM state.
     */
@@ -721,6 +931,41 @@ extern "C" {
     */
    extern buzzvm_state buzzvm_lremove(buzzvm_t vm, uint32_t num);
 
+   /*
+    * Pushes the value of the upvalue at the given index in the
+    * running closure.
+    * Internally checks whether the operation is valid.
+    * This function is designed to be used within int-returning functions such as
+    * BuzzVM hook functions or buzzvm_step().
+    * @param vm The VM data.
+    * @param idx The upvalue index.
+    */
+   extern buzzvm_state buzzvm_uload(buzzvm_t vm, uint32_t idx);
+
+   /*
+    * Stores the object located at the stack top into the upvalue at
+    * the given index in the running closure, pops operand.
+    * Internally checks whether the operation is valid.
+    * This function is designed to be used within int-returning functions such as
+    * BuzzVM hook functions or buzzvm_step().
+    * @param vm The VM data.
+    * @param idx The upvalue index.
+    */
+   extern buzzvm_state buzzvm_ustore(buzzvm_t vm, uint32_t idx);
+
+   /*
+    * Adds an upvalue to the closure at the stack top.
+    * The upvalue is either shared with a local variable of the current
+    * call frame, or taken from the upvalues of the running closure.
+    * Internally checks whether the operation is valid.
+    * This function is designed to be used within int-returning functions such as
+    * BuzzVM hook functions or buzzvm_step().
+    * @param vm The VM data.
+    * @param idx The local variable or upvalue index.
+    * @param islocal 1 to capture a local variable, 0 to capture an upvalue.
+    */
+   extern buzzvm_state buzzvm_capture(buzzvm_t vm, uint32_t idx, int islocal);
+
 
 #ifdef __cplusplus
 }
@@ -783,11 +1028,18 @@ extern "C" {
    }
 
 /*
- * Returns the size of the stack.
+ * Returns the size of the stack of the current call frame.
  * The most recently pushed element in the stack is at top - 1.
  * @param vm The VM data.
  */
-#define buzzvm_stack_top(vm) buzzdarray_size((vm)->stack)
+#define buzzvm_stack_top(vm) (buzzdarray_size((vm)->stack) - (vm)->stackbase)
+
+/*
+ * Returns the stack depth, that is, the number of active call frames
+ * plus one for the top-level script.
+ * @param vm The VM data.
+ */
+#define buzzvm_stack_depth(vm) (buzzdarray_size((vm)->frames) + 1)
 
 /*
  * Returns the stack element at the passed index.
@@ -795,7 +1047,7 @@ extern "C" {
  * @param vm The VM data.
  * @param idx The stack index, where 0 is the stack top and >0 goes down the stack.
  */
-#define buzzvm_stack_at(vm, idx) buzzdarray_get((vm)->stack, (buzzvm_stack_top(vm) - (idx)), buzzobj_t)
+#define buzzvm_stack_at(vm, idx) buzzdarray_get((vm)->stack, (buzzdarray_size((vm)->stack) - (idx)), buzzobj_t)
 
 /*
  * Converts a number at the given position in the stack to int.
@@ -852,10 +1104,19 @@ extern "C" {
 #define buzzvm_pushcc(vm, cid) buzzvm_pushc(vm, cid, 0)
 
 /*
- * Returns the number of local variables in the current local symbol stack.
+ * Returns the number of local variables in the current call frame.
+ * The local symbol at index 0 (self) is not counted.
  * @param vm The VM data.
  */
-#define buzzvm_lnum(vm) (buzzdarray_size((vm)->lsyms->syms)-1)
+#define buzzvm_lnum(vm) (buzzdarray_size((vm)->lsyms) - (int64_t)(vm)->lsymbase - 1)
+
+/*
+ * Returns the local symbol at the passed index in the current call frame.
+ * Does not perform any check on the validity of the index.
+ * @param vm The VM data.
+ * @param idx The local symbol index.
+ */
+#define buzzvm_lsym_at(vm, idx) buzzdarray_get((vm)->lsyms, (vm)->lsymbase + (idx), buzzobj_t)
 
 /*
  * Checks whether the current function was passed a certain number of parameters.
@@ -878,10 +1139,11 @@ extern "C" {
  * ...
  * #1+N Closure argN
  * #2+N The closure
- * This function pushes a new stack and a new local variable table filled with the
- * activation record entries and the closure arguments. In addition, it leaves the stack
- * beneath as follows:
- * #1 An integer for the return address
+ * #3+N The table the closure was fetched from, or nil
+ * This function pops the arguments, the closure and the table, and pushes a new
+ * call frame whose local symbols are self and the closure arguments. Self is the
+ * table at #3+N or, if that is not a table, the self the closure was created with.
+ * The return address is stored in the frame.
  */
 #define buzzvm_callc(vm) buzzvm_call(vm, 0)
 
@@ -896,10 +1158,11 @@ extern "C" {
  * ...
  * #1+N Closure argN
  * #2+N The closure
- * This function pushes a new stack and a new local variable table filled with the
- * activation record entries and the closure arguments. In addition, it leaves the stack
- * beneath as follows:
- * #1 An integer for the return address
+ * #3+N The table the closure was fetched from, or nil
+ * This function pops the arguments, the closure and the table, and pushes a new
+ * call frame whose local symbols are self and the closure arguments. Self is the
+ * table at #3+N or, if that is not a table, the self the closure was created with.
+ * The return address is stored in the frame.
  */
 #define buzzvm_calls(vm) buzzvm_call(vm, 1)
 
@@ -924,4 +1187,29 @@ extern "C" {
  */
 #define buzzvm_string_get(vm, sid) buzzstrman_get((vm)->strings, sid)
 
+/*
+ * Returns the number of bytes used by a subsystem of the VM.
+ * @param vm The VM data.
+ * @param sys The subsystem (a buzzmem_sys value).
+ */
+#define buzzvm_mem_used(vm, sys) ((vm)->mem->used[(sys)])
+
+/*
+ * Returns the number of bytes used by the VM.
+ * @param vm The VM data.
+ */
+#define buzzvm_mem_total(vm) ((vm)->mem->total)
+
+/*
+ * Returns the highest number of bytes used by the VM so far.
+ * @param vm The VM data.
+ */
+#define buzzvm_mem_peak(vm) ((vm)->mem->peak)
+
+/*
+ * Returns the limit on the memory used by the VM, or 0 if there is none.
+ * @param vm The VM data.
+ */
+#define buzzvm_mem_limit(vm) ((vm)->mem->limit)
+
 #endif
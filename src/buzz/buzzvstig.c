@@ -81,9 +81,9 @@ buzzvstig_elem_t buzzvstig_elem_clone(buzzvm_t vm, const buzzvstig_elem_t e) {
 /****************************************/
 
 void buzzvstig_elem_destroy(const void* key, void* data, void* params) {
-   free((void*)key);
+   buzzdict_t dt = (buzzdict_t)params;
+   buzzmem_charge(dt->mem, dt->memsys, -(int64_t)sizeof(struct buzzvstig_elem_s));
    free(*(buzzvstig_elem_t*)data);
-   free(data);
 }
 
 /****************************************/
@@ -107,6 +107,7 @@ buzzvstig_t buzzvstig_new() {
 /****************************************/
 
 void buzzvstig_destroy(buzzvstig_t* vs) {
+   buzzmem_charge((*vs)->data->mem, (*vs)->data->memsys, -(int64_t)sizeof(struct buzzvstig_s));
    buzzdict_destroy(&((*vs)->data));
    free(*vs);
 }
@@ -116,9 +117,10 @@ void buzzvstig_destroy(buzzvstig_t* vs) {
 
 void buzzvstig_elem_serialize(buzzmsg_payload_t buf,
                               const buzzobj_t key,
-                              const buzzvstig_elem_t data) {
-   buzzobj_serialize    (buf, key);
-   buzzobj_serialize    (buf, data->data);
+                              const buzzvstig_elem_t data,
+                              struct buzzvm_s* vm) {
+   buzzobj_serialize    (buf, key, vm);
+   buzzobj_serialize    (buf, data->data, vm);
    buzzmsg_serialize_u16(buf, data->timestamp);
    buzzmsg_serialize_u16(buf, data->robot);
 }
@@ -128,7 +130,7 @@ void buzzvstig_elem_serialize(buzzmsg_payload_t buf,
 
 int64_t buzzvstig_elem_deserialize(buzzobj_t* key,
                                    buzzvstig_elem_t* data,
-                                   buzzmsg_payload_t buf,
+                                   buzzmsg_view_t buf,
                                    uint32_t pos,
                                    struct buzzvm_s* vm) {
    /* Initialize the position */
@@ -167,6 +169,8 @@ int buzzvstig_create(buzzvm_t vm) {
    }
    /* Create a new virtual stigmergy */
    buzzvstig_t nvs = buzzvstig_new();
+   buzzdict_account(nvs->data, vm->mem, BUZZMEM_VSTIGS);
+   buzzmem_charge(vm->mem, BUZZMEM_VSTIGS, sizeof(struct buzzvstig_s));
    buzzdict_set(vm->vstigs, &id, &nvs);
    /* Create a table */
    buzzvm_pusht(vm);
@@ -207,6 +211,7 @@ int buzzvstig_put(buzzvm_t vm) {
          /* Element found */
          if(v->o.type != BUZZTYPE_NIL) {
             /* New value is not nil, update the existing element */
+            buzzheap_wb_root(vm, BUZZHEAP_ROOT_VSTIGS, v);
             (*x)->data = v;
             ++((*x)->timestamp);
             (*x)->robot = vm->robot;
@@ -217,7 +222,7 @@ int buzzvstig_put(buzzvm_t vm) {
             /* New value is nil, must delete the existing element */
             /* Make a new element with nil as value to update neighbors */
             buzzvstig_elem_t y = buzzvstig_elem_new(
-               buzzobj_new(BUZZTYPE_NIL), // nil value
+               buzzheap_newnil(vm),       // nil value
                (*x)->timestamp + 1,       // new timestamp
                vm->robot);                // robot id
             /* Append a PUT message to the out message queue with nil in it */
@@ -229,7 +234,7 @@ int buzzvstig_put(buzzvm_t vm) {
       else if(v->o.type != BUZZTYPE_NIL) {
          /* Element not found and new value is not nil, store it */
          buzzvstig_elem_t y = buzzvstig_elem_new(v, 1, vm->robot);
-         buzzvstig_store(*vs, &k, &y);
+         buzzvstig_store(vm, *vs, &k, &y);
          /* Append a PUT message to the out message queue */
          buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, y);
       }
@@ -259,6 +264,13 @@ void buzzvstig_foreach_entry(const void* key, void* data, void* params) {
    p->vm->state = buzzvm_closure_call(p->vm, 3);
 }
 
+/*
+ * Pushes a key of a virtual stigmergy on the stack.
+ */
+static void buzzvstig_foreach_key(const void* key, void* data, void* params) {
+   buzzdarray_push((buzzdarray_t)params, key);
+}
+
 int buzzvstig_foreach(struct buzzvm_s* vm) {
    /* Make sure you got one argument */
    buzzvm_lnum_assert(vm, 1);
@@ -272,9 +284,26 @@ int buzzvstig_foreach(struct buzzvm_s* vm) {
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
       buzzobj_t c = buzzvm_stack_at(vm, 1);
-      /* Go through the elements and apply the closure */
+      /*
+       * Go through the elements and apply the closure. The closure
+       * might put elements or create the virtual stigmergy anew, so go
+       * through a snapshot of the keys and look each one up again. The
+       * snapshot is on the stack, so the garbage collector keeps the keys.
+       */
       struct buzzvstig_foreach_params p = { .vm = vm, .fun = c };
-      buzzdict_foreach((*vs)->data, buzzvstig_foreach_entry, &p);
+      uint32_t i, base = buzzdarray_size(vm->stack);
+      buzzdict_scan((*vs)->data, buzzvstig_foreach_key, vm->stack);
+      uint32_t end = buzzdarray_size(vm->stack);
+      for(i = base; i < end && i < buzzdarray_size(vm->stack); ++i) {
+         buzzobj_t k = buzzdarray_get(vm->stack, i, buzzobj_t);
+         vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+         if(!vs) break;
+         const buzzvstig_elem_t* e = buzzvstig_fetch(*vs, &k);
+         if(e) buzzvstig_foreach_entry(&k, (void*)e, &p);
+      }
+      /* Get rid of the snapshot */
+      while(buzzdarray_size(vm->stack) > base)
+         buzzdarray_pop(vm->stack);
    }
    /* Return */
    return buzzvm_ret0(vm);
@@ -358,9 +387,9 @@ int buzzvstig_onconflict(struct buzzvm_s* vm) {
       /* Get closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      /* Clone the closure */
-      if((*vs)->onconflict) free((*vs)->onconflict);
+      /* Clone the closure; the previous one is left to the garbage collector */
       (*vs)->onconflict = buzzheap_clone(vm, buzzvm_stack_at(vm, 1));
+      buzzheap_wb_root(vm, BUZZHEAP_ROOT_VSTIGS, (*vs)->onconflict);
    }
    else {
       /* No virtual stigmergy found, just push false */
@@ -386,9 +415,9 @@ int buzzvstig_onconflictlost(struct buzzvm_s* vm) {
       /* Get closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      /* Clone the closure */
-      if((*vs)->onconflictlost) free((*vs)->onconflictlost);
+      /* Clone the closure; the previous one is left to the garbage collector */
       (*vs)->onconflictlost = buzzheap_clone(vm, buzzvm_stack_at(vm, 1));
+      buzzheap_wb_root(vm, BUZZHEAP_ROOT_VSTIGS, (*vs)->onconflictlost);
    }
    else {
       /* No virtual stigmergy found, just push false */
@@ -424,6 +453,8 @@ buzzvstig_elem_t buzzvstig_onconflict_call(buzzvm_t vm,
       add_field(robot, rv, pushi);
       add_field(data, rv, push);
       add_field(timestamp, rv, pushi);
+      /* The closure might overwrite the local element, keep its timestamp */
+      uint16_t timestamp = lv->timestamp;
       /* Call closure (key, lv, rv on the stack) */
       buzzvm_closure_call(vm, 3);
       /* Make new entry with return value */
@@ -447,7 +478,7 @@ buzzvstig_elem_t buzzvstig_onconflict_call(buzzvm_t vm,
       buzzobj_t data = buzzvm_stack_at(vm, 1);
       buzzvm_pop(vm);
       /* Make new entry */
-      return buzzvstig_elem_new(data, lv->timestamp, robot);
+      return buzzvstig_elem_new(data, timestamp, robot);
    }
    else {
       /* No conflict manager, use default behavior */
@@ -83,25 +83,26 @@ extern "C" {
     * @param buf The output buffer where the serialized data is appended.
     * @param key The key of the element to serialize.
     * @param data The data of the element to serialize.
+    * @param vm The Buzz VM data.
     */
    extern void buzzvstig_elem_serialize(buzzmsg_payload_t buf,
                                         const buzzobj_t key,
-                                        const buzzvstig_elem_t data);
+                                        const buzzvstig_elem_t data,
+                                        struct buzzvm_s* vm);
 
    /*
     * Deserializes a virtual stigmergy element.
-    * The data is read from the given buffer starting at the given position.
-    * The buffer is treated as a dynamic array of uint8_t.
+    * The data is read from the given view starting at the given position.
     * @param key The deserialized key of the element.
     * @param data The deserialized data of the element.
-    * @param buf The input buffer where the serialized data is stored.
+    * @param buf The view of the serialized data.
     * @param pos The position at which the data starts.
     * @param vm The Buzz VM data.
     * @return The new position in the buffer, of -1 in case of error.
     */
    extern int64_t buzzvstig_elem_deserialize(buzzobj_t* key,
                                              buzzvstig_elem_t* data,
-                                             buzzmsg_payload_t buf,
+                                             buzzmsg_view_t buf,
                                              uint32_t pos,
                                              struct buzzvm_s* vm);
 
@@ -188,11 +189,19 @@ extern "C" {
 
 /*
  * Puts data into a virtual stigmergy structure.
+ * The structure takes ownership of the element.
+ * @param vm The Buzz VM state.
  * @param vs The virtual stigmergy structure.
  * @param key The key.
  * @param el The element.
  */
-#define buzzvstig_store(vs, key, el) buzzdict_set((vs)->data, (key), (el));
+#define buzzvstig_store(vm, vs, key, el) {                              \
+      buzzheap_wb_root((vm), BUZZHEAP_ROOT_VSTIGS, *(key));             \
+      buzzheap_wb_root((vm), BUZZHEAP_ROOT_VSTIGS, (*(el))->data);      \
+      buzzmem_charge((vs)->data->mem, (vs)->data->memsys,               \
+                     sizeof(struct buzzvstig_elem_s));                  \
+      buzzdict_set((vs)->data, (key), (el));                            \
+   }
 
 /*
  * Deletes data from a virtual stigmergy structure.
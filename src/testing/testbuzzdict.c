@@ -1,5 +1,204 @@
 #include <buzz/buzzdict.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * The chained dictionary buzzdict used to be: an array of buckets, each
+ * a buzzdarray of separately allocated (key, data) pairs. It is kept
+ * here as a baseline for the benchmark.
+ */
+
+struct chained_entry_s {
+   void* key;
+   void* data;
+};
+
+struct chained_s {
+   buzzdarray_t* buckets;
+   uint32_t size;
+   uint32_t num_buckets;
+   buzzdict_hashfunp hashf;
+   buzzdict_key_cmpp keycmpf;
+   uint32_t key_size;
+   uint32_t data_size;
+};
+typedef struct chained_s* chained_t;
+
+chained_t chained_new(uint32_t buckets,
+                      uint32_t key_size,
+                      uint32_t data_size,
+                      buzzdict_hashfunp hashf,
+                      buzzdict_key_cmpp keycmpf) {
+   chained_t dt = (chained_t)calloc(1, sizeof(struct chained_s));
+   dt->num_buckets = buckets;
+   dt->hashf = hashf;
+   dt->keycmpf = keycmpf;
+   dt->key_size = key_size;
+   dt->data_size = data_size;
+   dt->buckets = (buzzdarray_t*)calloc(dt->num_buckets, sizeof(buzzdarray_t));
+   return dt;
+}
+
+void chained_destroy(chained_t* dt) {
+   uint32_t i, j;
+   for(i = 0; i < (*dt)->num_buckets; ++i) {
+      if((*dt)->buckets[i]) {
+         for(j = 0; j < buzzdarray_size((*dt)->buckets[i]); ++j) {
+            const struct chained_entry_s* e = &buzzdarray_get((*dt)->buckets[i], j, struct chained_entry_s);
+            free(e->key);
+            free(e->data);
+         }
+         buzzdarray_destroy(&((*dt)->buckets[i]));
+      }
+   }
+   free((*dt)->buckets);
+   free(*dt);
+   *dt = NULL;
+}
+
+void* chained_get(chained_t dt,
+                  const void* key) {
+   uint32_t h = dt->hashf(key) % dt->num_buckets, i;
+   if(!dt->buckets[h]) return NULL;
+   for(i = 0; i < buzzdarray_size(dt->buckets[h]); ++i) {
+      const struct chained_entry_s* e = &buzzdarray_get(dt->buckets[h], i, struct chained_entry_s);
+      if(dt->keycmpf(key, e->key) == 0)
+         return e->data;
+   }
+   return NULL;
+}
+
+void chained_set(chained_t dt,
+                 const void* key,
+                 const void* data) {
+   uint32_t h = dt->hashf(key) % dt->num_buckets, i;
+   if(!dt->buckets[h])
+      dt->buckets[h] = buzzdarray_new(1, sizeof(struct chained_entry_s), NULL);
+   for(i = 0; i < buzzdarray_size(dt->buckets[h]); ++i) {
+      const struct chained_entry_s* e = &buzzdarray_get(dt->buckets[h], i, struct chained_entry_s);
+      if(dt->keycmpf(key, e->key) == 0) {
+         free(e->key);
+         free(e->data);
+         buzzdarray_remove(dt->buckets[h], i);
+         --(dt->size);
+         break;
+      }
+   }
+   struct chained_entry_s e;
+   e.key = malloc(dt->key_size);
+   memcpy(e.key, key, dt->key_size);
+   e.data = malloc(dt->data_size);
+   memcpy(e.data, data, dt->data_size);
+   buzzdarray_push(dt->buckets[h], &e);
+   ++(dt->size);
+}
+
+int chained_remove(chained_t dt,
+                   const void* key) {
+   uint32_t h = dt->hashf(key) % dt->num_buckets, i;
+   if(!dt->buckets[h]) return 0;
+   for(i = 0; i < buzzdarray_size(dt->buckets[h]); ++i) {
+      const struct chained_entry_s* e = &buzzdarray_get(dt->buckets[h], i, struct chained_entry_s);
+      if(dt->keycmpf(key, e->key) == 0) {
+         free(e->key);
+         free(e->data);
+         buzzdarray_remove(dt->buckets[h], i);
+         if(buzzdarray_isempty(dt->buckets[h]))
+            buzzdarray_destroy(&(dt->buckets[h]));
+         --(dt->size);
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+double now_ms() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+/*
+ * Timings of a benchmark run, in ms.
+ */
+struct bench_s {
+   double set;
+   double get;
+   double miss;
+   double remove;
+};
+
+/*
+ * Sets n int32 keys, gets them all, looks up n missing keys, and
+ * removes them all, on a chained dictionary with 10 buckets as used
+ * for Buzz tables.
+ */
+struct bench_s bench_chained(uint32_t n) {
+   struct bench_s b;
+   chained_t dt = chained_new(10,
+                              sizeof(int32_t),
+                              sizeof(float),
+                              buzzdict_int32keyhash,
+                              buzzdict_int32keycmp);
+   int32_t k;
+   float d = 0.0f, sum = 0.0f;
+   double t = now_ms();
+   for(k = 0; k < n; ++k) chained_set(dt, &k, &d);
+   b.set = now_ms() - t; t = now_ms();
+   for(k = 0; k < n; ++k) sum += *(float*)chained_get(dt, &k);
+   b.get = now_ms() - t; t = now_ms();
+   for(k = n; k < 2 * n; ++k) sum += (chained_get(dt, &k) != NULL);
+   b.miss = now_ms() - t; t = now_ms();
+   for(k = 0; k < n; ++k) chained_remove(dt, &k);
+   b.remove = now_ms() - t;
+   chained_destroy(&dt);
+   if(sum != 0.0f) fprintf(stderr, "unexpected sum %f\n", sum);
+   return b;
+}
+
+/*
+ * The same as bench_chained(), with buzzdict.
+ */
+struct bench_s bench_buzzdict(uint32_t n) {
+   struct bench_s b;
+   buzzdict_t dt = buzzdict_new(10,
+                                sizeof(int32_t),
+                                sizeof(float),
+                                buzzdict_int32keyhash,
+                                buzzdict_int32keycmp,
+                                NULL);
+   int32_t k;
+   float d = 0.0f, sum = 0.0f;
+   double t = now_ms();
+   for(k = 0; k < n; ++k) buzzdict_set(dt, &k, &d);
+   b.set = now_ms() - t; t = now_ms();
+   for(k = 0; k < n; ++k) sum += *buzzdict_get(dt, &k, float);
+   b.get = now_ms() - t; t = now_ms();
+   for(k = n; k < 2 * n; ++k) sum += buzzdict_exists(dt, &k);
+   b.miss = now_ms() - t; t = now_ms();
+   for(k = 0; k < n; ++k) buzzdict_remove(dt, &k);
+   b.remove = now_ms() - t;
+   buzzdict_destroy(&dt);
+   if(sum != 0.0f) fprintf(stderr, "unexpected sum %f\n", sum);
+   return b;
+}
+
+void bench_print(const char* name, uint32_t n, struct bench_s b) {
+   fprintf(stdout, "%10s %10" PRIu32 " %12.3f %12.3f %12.3f %12.3f\n",
+           name, n, b.set, b.get, b.miss, b.remove);
+}
+
+/****************************************/
+/****************************************/
 
 void di_print_elem(const void* key, void* data, void* params) {
    int16_t k = *(const int16_t*)key;
@@ -67,5 +266,12 @@ int main() {
    di_print(di);
 
    buzzdict_destroy(&di);
+
+   uint32_t sizes[] = { 100, 1000, 10000, 50000 };
+   fprintf(stdout, "%10s %10s %12s %12s %12s %12s\n", "dict", "elements", "set (ms)", "get (ms)", "miss (ms)", "remove (ms)");
+   for(i = 0; i < sizeof(sizes) / sizeof(uint32_t); ++i) {
+      bench_print("chained", sizes[i], bench_chained(sizes[i]));
+      bench_print("buzzdict", sizes[i], bench_buzzdict(sizes[i]));
+   }
    return 0;
 }
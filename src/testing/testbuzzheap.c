@@ -0,0 +1,173 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+#include <time.h>
+#include <inttypes.h>
+
+/****************************************/
+/****************************************/
+
+double now_ms() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+void obj_destroy(uint32_t pos, void* data, void* params) {
+   buzzobj_destroy((buzzobj_t*)data);
+}
+
+int obj_ismarked(uint32_t pos, void* data, void* params) {
+   return (*(buzzobj_t*)data)->o.marker == 1;
+}
+
+/*
+ * Makes a list of n objects in which every other object is dead.
+ */
+buzzdarray_t objs_new(uint32_t n) {
+   buzzdarray_t objs = buzzdarray_new(10, sizeof(buzzobj_t), obj_destroy);
+   uint32_t i;
+   for(i = 0; i < n; ++i) {
+      buzzobj_t o = buzzobj_new(BUZZTYPE_FLOAT);
+      o->o.marker = i % 2;
+      buzzdarray_push(objs, &o);
+   }
+   return objs;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * The sweep as it used to be: one buzzdarray_remove() per dead object.
+ */
+double bench_remove(uint32_t n) {
+   buzzdarray_t objs = objs_new(n);
+   double t = now_ms();
+   int64_t i = buzzdarray_size(objs) - 1;
+   while(i >= 0) {
+      if(buzzdarray_get(objs, i, buzzobj_t)->o.marker != 1)
+         buzzdarray_remove(objs, i);
+      --i;
+   }
+   t = now_ms() - t;
+   buzzdarray_destroy(&objs);
+   return t;
+}
+
+/*
+ * The compacting sweep.
+ */
+double bench_filter(uint32_t n) {
+   buzzdarray_t objs = objs_new(n);
+   double t = now_ms();
+   buzzdarray_filter(objs, obj_ismarked, NULL);
+   t = now_ms() - t;
+   buzzdarray_destroy(&objs);
+   return t;
+}
+
+/*
+ * A full collection on a VM heap of n objects, half of which are on
+ * the stack.
+ */
+double bench_gc(uint32_t n) {
+   buzzvm_t vm = buzzvm_new(1);
+   uint32_t i;
+   for(i = 0; i < n; ++i) {
+      if(i % 2) buzzvm_pushf(vm, i);
+      else buzzheap_newfloat(vm, i);
+   }
+   vm->heap->gcpending = BUZZHEAP_GC_MAJOR;
+   buzzheap_gc(vm);
+   double t = vm->heap->stats.last_pause / 1000.0;
+   buzzvm_destroy(&vm);
+   return t;
+}
+
+/*
+ * A minor collection of 1000 young objects on a VM heap with n old
+ * objects stored in a global table.
+ */
+double bench_minor(uint32_t n) {
+   buzzvm_t vm = buzzvm_new(1);
+   uint32_t i;
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "live", 1));
+   buzzvm_pusht(vm);
+   for(i = 0; i < n; ++i) {
+      buzzvm_dup(vm);
+      buzzvm_pushi(vm, i);
+      buzzvm_pushf(vm, i);
+      buzzvm_tput(vm);
+   }
+   buzzvm_gstore(vm);
+   /* Make the table and its content old */
+   vm->heap->gcpending = BUZZHEAP_GC_MAJOR;
+   buzzheap_gc(vm);
+   /* Make some garbage and collect it */
+   for(i = 0; i < 1000; ++i)
+      buzzheap_newfloat(vm, i);
+   vm->heap->gcpending = BUZZHEAP_GC_MINOR;
+   buzzheap_gc(vm);
+   double t = vm->heap->stats.last_pause / 1000.0;
+   buzzvm_destroy(&vm);
+   return t;
+}
+
+/*
+ * The longest slice of an incremental major collection with a 500us
+ * deadline, on a VM heap with n objects spread over 256 tables stored
+ * in a global table.
+ */
+double bench_incremental(uint32_t n) {
+   buzzvm_t vm = buzzvm_new(1);
+   uint32_t i, j;
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "live", 1));
+   buzzvm_pusht(vm);
+   for(i = 0; i < 256; ++i) {
+      buzzvm_dup(vm);
+      buzzvm_pushi(vm, i);
+      buzzvm_pusht(vm);
+      for(j = 0; j < n / 256; ++j) {
+         buzzvm_dup(vm);
+         buzzvm_pushi(vm, j);
+         buzzvm_pushf(vm, j);
+         buzzvm_tput(vm);
+      }
+      buzzvm_tput(vm);
+   }
+   buzzvm_gstore(vm);
+   /* Make the tables and their content old */
+   vm->heap->gcpending = BUZZHEAP_GC_MAJOR;
+   buzzheap_gc(vm);
+   /* Collect incrementally, one slice per batch of allocations */
+   buzzheap_incremental_set(vm, 500);
+   buzzheap_stats_reset(vm);
+   vm->heap->gcpending = BUZZHEAP_GC_MAJOR;
+   do {
+      for(i = 0; i < 256; ++i)
+         buzzheap_newfloat(vm, i);
+      buzzheap_gc(vm);
+   } while(vm->heap->gcphase != BUZZHEAP_PHASE_IDLE);
+   double t = vm->heap->stats.longest_pause / 1000.0;
+   buzzvm_destroy(&vm);
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+int main() {
+   uint32_t sizes[] = { 1000, 10000, 50000, 100000, 200000 };
+   uint32_t i;
+   fprintf(stdout, "%10s %14s %14s %14s %14s %14s\n", "objects", "remove (ms)", "filter (ms)", "major (ms)", "minor (ms)", "slice (ms)");
+   for(i = 0; i < sizeof(sizes) / sizeof(uint32_t); ++i) {
+      fprintf(stdout, "%10" PRIu32 " %14.3f %14.3f %14.3f %14.3f %14.3f\n",
+              sizes[i],
+              bench_remove(sizes[i]),
+              bench_filter(sizes[i]),
+              bench_gc(sizes[i]),
+              bench_minor(sizes[i]),
+              bench_incremental(sizes[i]));
+   }
+   return 0;
+}
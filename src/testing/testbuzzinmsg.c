@@ -0,0 +1,59 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+/* The message bytes are their own number */
+uint8_t BYTES[256];
+
+void append(buzzvm_t vm, uint16_t rid, uint8_t n) {
+   buzzmsg_view_t v = { .data = BYTES + n, .size = 1 };
+   buzzinmsg_queue_append(vm, rid, v);
+}
+
+void extract_all(buzzvm_t vm) {
+   buzzinmsg_t m;
+   printf("size %" PRIu32 ", dropped %" PRIu32 ":",
+          buzzinmsg_queue_size(vm->inmsgs),
+          buzzinmsg_queue_dropped(vm->inmsgs));
+   while(buzzinmsg_queue_extract(vm, &m)) {
+      printf(" %" PRIu16 ":%" PRIu8, m.robot, m.payload.data[0]);
+      buzzinmsg_release(vm, &m);
+   }
+   printf("\n");
+}
+
+void test(int fair) {
+   buzzvm_t vm = buzzvm_new(1);
+   buzzinmsg_queue_fair_set(vm->inmsgs, fair);
+   int i;
+
+   printf("A flooding sender loses its own messages\n");
+   buzzinmsg_queue_max_set(vm->inmsgs, 4);
+   append(vm, 1, 0);
+   for(i = 1; i <= 10; ++i) append(vm, 2, i);
+   extract_all(vm);
+
+   printf("A new sender at a full queue drops the oldest message\n");
+   buzzinmsg_queue_max_set(vm->inmsgs, 3);
+   for(i = 1; i <= 4; ++i) append(vm, i, 20 + i);
+   extract_all(vm);
+
+   printf("The ring buffer does not grow past the max\n");
+   buzzinmsg_queue_max_set(vm->inmsgs, 8);
+   append(vm, 1, 0);
+   for(i = 1; i <= 1000; ++i) append(vm, 2, i % 256);
+   printf("capacity %" PRIu32 "\n", vm->inmsgs->cap);
+   extract_all(vm);
+
+   buzzvm_destroy(&vm);
+}
+
+int main() {
+   int i;
+   for(i = 0; i < 256; ++i) BYTES[i] = i;
+   printf("=== ARRIVAL ORDER ===\n\n");
+   test(0);
+   printf("\n=== FAIR ===\n\n");
+   test(1);
+   return 0;
+}
@@ -0,0 +1,87 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+void print_obj(buzzobj_t o) {
+   switch(o->o.type) {
+      case BUZZTYPE_NIL:    printf("nil"); break;
+      case BUZZTYPE_INT:    printf("%" PRId32, o->i.value); break;
+      case BUZZTYPE_FLOAT:  printf("%.9g", o->f.value); break;
+      case BUZZTYPE_STRING: printf("'%s'", o->s.value.str); break;
+      case BUZZTYPE_TABLE:  printf("table with %" PRIu32 " elements", buzztable_size(o)); break;
+      default:              printf("%s", buzztype_desc[o->o.type]);
+   }
+}
+
+void roundtrip(buzzvm_t vm, buzzobj_t o, uint32_t enc) {
+   buzzvm_msgenc_set(vm, enc);
+   buzzmsg_payload_t m = buzzmsg_payload_new(10);
+   buzzobj_serialize(m, o, vm);
+   buzzobj_t d;
+   int64_t pos = buzzobj_deserialize(&d, buzzmsg_payload_view(m), 0, vm);
+   printf("enc=%" PRIu32 " size=%3" PRIu32 " -> ", enc, (uint32_t)buzzmsg_payload_size(m));
+   if(pos != (int64_t)buzzmsg_payload_size(m)) printf("ERROR at %" PRId64 "\n", pos);
+   else { print_obj(d); printf("\n"); }
+   buzzmsg_payload_destroy(&m);
+}
+
+void test(buzzvm_t vm, buzzobj_t o) {
+   print_obj(o);
+   printf("\n");
+   roundtrip(vm, o, BUZZMSG_ENC_LEGACY);
+   roundtrip(vm, o, BUZZMSG_ENC_COMPACT);
+   roundtrip(vm, o, BUZZMSG_ENC_COMPACT | BUZZMSG_ENC_HALF | BUZZMSG_ENC_STRREF);
+   printf("\n");
+}
+
+int main() {
+   buzzvm_t vm = buzzvm_new(1);
+   /* Pretend these strings come from the script */
+   buzzvm_string_register(vm, "position", 1);
+   vm->sharedstrs = buzzdarray_size(vm->strings->entries);
+
+   printf("=== INTEGERS ===\n\n");
+   test(vm, buzzheap_newint(vm, 0));
+   test(vm, buzzheap_newint(vm, -1));
+   test(vm, buzzheap_newint(vm, 300));
+   test(vm, buzzheap_newint(vm, INT32_MIN));
+
+   printf("=== FLOATS ===\n\n");
+   test(vm, buzzheap_newfloat(vm, 0.5f));
+   test(vm, buzzheap_newfloat(vm, 3.14159265f));
+   test(vm, buzzheap_newfloat(vm, -1e-6f));
+   test(vm, buzzheap_newfloat(vm, 1e10f));
+
+   printf("=== STRINGS ===\n\n");
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "position", 0));
+   test(vm, buzzvm_stack_at(vm, 1));
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "not from the script", 0));
+   test(vm, buzzvm_stack_at(vm, 1));
+
+   printf("=== TABLES ===\n\n");
+   int32_t i;
+   buzzvm_pusht(vm);
+   buzzobj_t t = buzzvm_stack_at(vm, 1);
+   for(i = 0; i < 3; ++i) {
+      buzzvm_push(vm, t);
+      buzzvm_pushi(vm, i);
+      buzzvm_pushf(vm, i * 0.25f);
+      buzzvm_tput(vm);
+   }
+   test(vm, t);
+   for(i = 3; i < 300; ++i) {
+      buzzvm_push(vm, t);
+      buzzvm_pushi(vm, i * 7);
+      buzzvm_pushi(vm, -i);
+      buzzvm_tput(vm);
+   }
+   test(vm, t);
+
+   printf("=== HALF FLOATS ===\n\n");
+   float f[] = { 1.0f, -2.5f, 65504.0f, 65520.0f, 6.0e-8f, 1.0e-8f, 0.1f };
+   for(i = 0; i < (int32_t)(sizeof(f) / sizeof(float)); ++i)
+      printf("%.9g -> %.9g\n", f[i], buzzmsg_float_fromhalf(buzzmsg_float_tohalf(f[i])));
+
+   buzzvm_destroy(&vm);
+   return 0;
+}
@@ -0,0 +1,78 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+/*
+ * Sends the queued messages with the legacy loop, and stops after
+ * too many messages in case the loop does not end.
+ */
+void send_legacy(buzzvm_t vm) {
+   uint32_t n = 0, bytes = 0;
+   while(!buzzoutmsg_queue_isempty(vm) && n < 1000) {
+      buzzmsg_payload_t m = buzzoutmsg_queue_first(vm);
+      if(m) {
+         bytes += buzzmsg_payload_size(m);
+         buzzmsg_payload_destroy(&m);
+      }
+      buzzoutmsg_queue_next(vm);
+      ++n;
+   }
+   printf("step %2" PRIu32 ": sent %2" PRIu32 " (%3" PRIu32 " bytes), left %2" PRIu32 ", ready %d%s\n",
+          vm->outmsgs->step,
+          n, bytes,
+          buzzoutmsg_queue_size(vm),
+          buzzoutmsg_queue_isready(vm),
+          n >= 1000 ? " LOOP DID NOT END" : "");
+}
+
+void append_broadcast(buzzvm_t vm, int32_t value) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "topic", 1));
+   buzzoutmsg_queue_append_broadcast(vm,
+                                     buzzvm_stack_at(vm, 1),
+                                     buzzheap_newint(vm, value));
+   buzzvm_pop(vm);
+}
+
+int main() {
+   buzzvm_t vm = buzzvm_new(1);
+   int32_t i;
+
+   printf("=== NO LIMIT ===\n\n");
+   for(i = 0; i < 5; ++i) append_broadcast(vm, i);
+   buzzvm_process_outmsgs(vm);
+   send_legacy(vm);
+
+   printf("\n=== RATE-LIMITED BROADCASTS ===\n\n");
+   buzzoutmsg_class_set(vm, BUZZMSG_BROADCAST, 0, 30, 0);
+   for(i = 0; i < 10; ++i) append_broadcast(vm, i);
+   while(buzzoutmsg_queue_size(vm) > 0) {
+      buzzvm_process_outmsgs(vm);
+      send_legacy(vm);
+   }
+
+   printf("\n=== RATE-LIMITED BROADCASTS, UNLIMITED SWARM MESSAGES ===\n\n");
+   for(i = 0; i < 4; ++i) append_broadcast(vm, i);
+   buzzoutmsg_queue_append_swarm_joinleave(vm, BUZZMSG_SWARM_JOIN, 1);
+   buzzoutmsg_queue_append_swarm_joinleave(vm, BUZZMSG_SWARM_JOIN, 2);
+   while(buzzoutmsg_queue_size(vm) > 0) {
+      buzzvm_process_outmsgs(vm);
+      send_legacy(vm);
+   }
+
+   printf("\n=== PACKETS TOO SMALL FOR ANY MESSAGE ===\n\n");
+   uint8_t buf[2];
+   for(i = 0; i < 3; ++i) append_broadcast(vm, i);
+   buzzvm_process_outmsgs(vm);
+   for(i = 0; i <= 1; ++i) {
+      uint32_t packed = buzzoutmsg_pack(vm, buf, i);
+      printf("cap %" PRId32 ": packed %" PRIu32 ", left %" PRIu32 ", discarded %" PRIu32 "\n",
+             i,
+             packed,
+             buzzoutmsg_queue_size(vm),
+             buzzoutmsg_queue_discarded(vm));
+   }
+   send_legacy(vm);
+
+   buzzvm_destroy(&vm);
+   return 0;
+}
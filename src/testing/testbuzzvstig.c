@@ -0,0 +1,135 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/*
+ * Runs two robots that exchange virtual stigmergy messages.
+ * Usage: testbuzzvstig [file.bo]
+ * Without arguments, the scripts of the test suite are run.
+ */
+
+#define ROBOTS 2
+#define PACKET 1024
+
+int print(buzzvm_t vm) {
+   int i;
+   for(i = 1; i <= buzzvm_lnum(vm); ++i) {
+      buzzvm_lload(vm, i);
+      buzzobj_t o = buzzvm_stack_at(vm, 1);
+      buzzvm_pop(vm);
+      switch(o->o.type) {
+         case BUZZTYPE_NIL:    printf("[nil]"); break;
+         case BUZZTYPE_INT:    printf("%" PRId32, o->i.value); break;
+         case BUZZTYPE_STRING: printf("%s", o->s.value.str); break;
+         default:              printf("[%s]", buzztype_desc[o->o.type]);
+      }
+   }
+   printf("\n");
+   return buzzvm_ret0(vm);
+}
+
+/*
+ * Sends the "step" closure of the first robot to the second one, then
+ * again with a bytecode offset that does not start an instruction.
+ */
+void closure_check(buzzvm_t src, buzzvm_t dst) {
+   int i;
+   buzzvm_pushs(src, buzzvm_string_register(src, "step", 1));
+   buzzvm_gload(src);
+   buzzobj_t c = buzzvm_stack_at(src, 1);
+   buzzvm_pop(src);
+   buzzvm_msgenc_set(src, BUZZMSG_ENC_LEGACY);
+   buzzmsg_payload_t m = buzzmsg_payload_new(10);
+   buzzobj_serialize(m, c, src);
+   buzzobj_t d;
+   int64_t pos = buzzobj_deserialize(&d, buzzmsg_payload_view(m), 0, dst);
+   printf("closure: %s\n",
+          pos == (int64_t)buzzmsg_payload_size(m) &&
+          d->c.value.ref == c->c.value.ref ? "same code" : "ERROR");
+   /* Replace the offset, the last field, with one inside an instruction */
+   uint32_t pc = c->c.value.ref;
+   while(dst->code_off[pc + 1] - dst->code_off[pc] < 2) ++pc;
+   for(i = 0; i < 4; ++i) buzzdarray_pop(m);
+   buzzmsg_serialize_u32(m, dst->code_off[pc] + 1);
+   pos = buzzobj_deserialize(&d, buzzmsg_payload_view(m), 0, dst);
+   printf("closure at a wrong offset: %s\n\n", pos < 0 ? "rejected" : "ERROR");
+   buzzmsg_payload_destroy(&m);
+}
+
+int run(const char* fname) {
+   printf("##### %s #####\n\n", fname);
+   /* Read the bytecode */
+   FILE* fd = fopen(fname, "rb");
+   if(!fd) {
+      perror(fname);
+      return 1;
+   }
+   fseek(fd, 0, SEEK_END);
+   size_t size = ftell(fd);
+   rewind(fd);
+   uint8_t* bcode = (uint8_t*)malloc(size);
+   if(fread(bcode, 1, size, fd) < size) {
+      perror(fname);
+      return 1;
+   }
+   fclose(fd);
+   /* Set up the robots */
+   buzzvm_t vm[ROBOTS];
+   uint8_t packet[ROBOTS][PACKET];
+   uint32_t packetsize[ROBOTS];
+   int i, j, t;
+   for(i = 0; i < ROBOTS; ++i) {
+      vm[i] = buzzvm_new(i + 1);
+      buzzvm_set_bcode(vm[i], bcode, size);
+      buzzvm_pushs(vm[i], buzzvm_string_register(vm[i], "log", 1));
+      buzzvm_pushcc(vm[i], buzzvm_function_register(vm[i], print));
+      buzzvm_gstore(vm[i]);
+      buzzvm_execute_script(vm[i]);
+      buzzvm_function_call(vm[i], "init", 0);
+      buzzvm_pop(vm[i]);
+      buzzvm_process_outmsgs(vm[i]);
+      packetsize[i] = buzzoutmsg_pack(vm[i], packet[i], PACKET);
+   }
+   closure_check(vm[0], vm[1]);
+   /* Exchange messages */
+   for(t = 0; t < 3; ++t) {
+      printf("=== STEP %d ===\n\n", t);
+      for(i = 0; i < ROBOTS; ++i) {
+         /* Receive the packets of the others */
+         for(j = 0; j < ROBOTS; ++j) {
+            uint32_t pos = 0;
+            if(j == i) continue;
+            while(pos + 2 <= packetsize[j]) {
+               buzzmsg_view_t m;
+               m.size = (packet[j][pos] << 8) | packet[j][pos + 1];
+               m.data = packet[j] + pos + 2;
+               buzzinmsg_queue_append(vm[i], j + 1, m);
+               pos += 2 + m.size;
+            }
+         }
+         buzzvm_process_inmsgs(vm[i]);
+         if(buzzvm_function_call(vm[i], "step", 0) != BUZZVM_STATE_READY) {
+            printf("robot %d: %s\n", i + 1, vm[i]->errormsg);
+            return 1;
+         }
+         buzzvm_pop(vm[i]);
+      }
+      /* Send the packets, once all the robots have read the others */
+      for(i = 0; i < ROBOTS; ++i) {
+         buzzvm_process_outmsgs(vm[i]);
+         packetsize[i] = buzzoutmsg_pack(vm[i], packet[i], PACKET);
+      }
+      printf("\n");
+   }
+   /* Clean up */
+   for(i = 0; i < ROBOTS; ++i)
+      buzzvm_destroy(&vm[i]);
+   free(bcode);
+   return 0;
+}
+
+int main(int argc, char** argv) {
+   if(argc > 1) return run(argv[1]);
+   return run("testvstigconflict.bo") || run("testvstigclosure.bo");
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <buzz/buzztype.h>
+#include <buzz/buzzstrman.h>
 #include "../../../src/buzz/buzztype.c"
 
 
@@ -22,10 +23,19 @@ buzzobj_t buzzobj_new_float(const int value) {
     return object;
 }
 
+// Returns the string manager that interns the test strings.
+buzzstrman_t test_strman() {
+    static buzzstrman_t strman = buzzstrman_new();
+
+    return strman;
+}
+
 // Creates a Buzz string and initializes it to the given value.
+// The string is interned, so equal strings share the same id.
 buzzobj_t buzzobj_new_string(const char* value) {
     buzzobj_t object = buzzobj_new(BUZZTYPE_STRING);
-    object->s.value.str = value;
+    object->s.value.sid = buzzstrman_register(test_strman(), value, 1);
+    object->s.value.str = buzzstrman_get(test_strman(), object->s.value.sid);
 
     return object;
 }
@@ -173,13 +183,16 @@ TEST(BuzzObjHash, Float) {
 
 // Tests for `buzzobj_hash` defined in <buzz/buzztype.h>
 // Hashes for strings should be consistent and unique.
+// Strings are interned, so the hash depends on the string id.
 TEST(BuzzObjHash, String) {
     buzzobj_t objects[3];
     for (auto &&object : objects) {
         object = buzzobj_new(BUZZTYPE_STRING);
         object->s.value.str = "A string";
+        object->s.value.sid = 1;
     }
     objects[2]->s.value.str = "Another string";
+    objects[2]->s.value.sid = 2;
 
     // Test hash consistency
     EXPECT_EQ(buzzobj_hash(objects[0]), buzzobj_hash(objects[1]));